@@ -8,12 +8,21 @@
 
 #include "common.h"
 
+#if !defined(__KERNEL__) && defined(__x86_64__) && defined(__GNUC__)
+#define WALB_CHECKSUM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef __KERNEL__
+#include <linux/crc32c.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /**
- * Calculate checksum incrementally.
+ * Calculate checksum incrementally (portable implementation).
  *
  * @sum previous checksum. specify 0 for first call.
  * @data pointer to u8 array to calculate
@@ -21,7 +30,7 @@ extern "C" {
  *
  * @return current checksum.
  */
-static inline u32 checksum_partial(u32 sum, const void *data, u32 size)
+static inline u32 checksum_partial_generic(u32 sum, const void *data, u32 size)
 {
 	u32 n = size / sizeof(u32);
 	u32 i;
@@ -39,6 +48,87 @@ static inline u32 checksum_partial(u32 sum, const void *data, u32 size)
 	return sum;
 }
 
+#ifdef WALB_CHECKSUM_X86_SIMD
+/*
+ * The checksum is a sum of u32 values modulo 2^32,
+ * so it can be calculated with independent u32 lanes
+ * and their sum is bit-identical with checksum_partial_generic().
+ */
+
+/**
+ * SSE2 version of checksum_partial_generic().
+ */
+__attribute__((target("sse2")))
+static inline u32 checksum_partial_sse2(u32 sum, const void *data, u32 size)
+{
+	const u8 *p = (const u8 *)data;
+	const u32 n = size & ~(u32)31;
+	__m128i acc0 = _mm_setzero_si128();
+	__m128i acc1 = _mm_setzero_si128();
+	u32 lanes[4];
+	u32 i;
+
+	for (i = 0; i < n; i += 32) {
+		acc0 = _mm_add_epi32(acc0, _mm_loadu_si128((const __m128i *)(p + i)));
+		acc1 = _mm_add_epi32(acc1, _mm_loadu_si128((const __m128i *)(p + i + 16)));
+	}
+	acc0 = _mm_add_epi32(acc0, acc1);
+	_mm_storeu_si128((__m128i *)lanes, acc0);
+	sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	return checksum_partial_generic(sum, p + n, size - n);
+}
+
+/**
+ * AVX2 version of checksum_partial_generic().
+ */
+__attribute__((target("avx2")))
+static inline u32 checksum_partial_avx2(u32 sum, const void *data, u32 size)
+{
+	const u8 *p = (const u8 *)data;
+	const u32 n = size & ~(u32)63;
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	u32 lanes[8];
+	u32 i;
+
+	for (i = 0; i < n; i += 64) {
+		acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i *)(p + i)));
+		acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i *)(p + i + 32)));
+	}
+	acc0 = _mm256_add_epi32(acc0, acc1);
+	_mm256_storeu_si256((__m256i *)lanes, acc0);
+	for (i = 0; i < 8; i++)
+		sum += lanes[i];
+	return checksum_partial_generic(sum, p + n, size - n);
+}
+#endif /* WALB_CHECKSUM_X86_SIMD */
+
+/**
+ * Calculate checksum incrementally.
+ *
+ * In userland on x86_64, the fastest implementation
+ * supported by the CPU is selected at runtime.
+ * Kernel code uses checksum_partial_simd() in the module separately,
+ * so this is always the portable implementation there.
+ *
+ * @sum previous checksum. specify 0 for first call.
+ * @data pointer to u8 array to calculate
+ * @size data size in bytes. This must be dividable by sizeof(u32).
+ *
+ * @return current checksum.
+ */
+static inline u32 checksum_partial(u32 sum, const void *data, u32 size)
+{
+#ifdef WALB_CHECKSUM_X86_SIMD
+	if (size >= 64) {
+		if (__builtin_cpu_supports("avx2"))
+			return checksum_partial_avx2(sum, data, size);
+		return checksum_partial_sse2(sum, data, size);
+	}
+#endif
+	return checksum_partial_generic(sum, data, size);
+}
+
 /**
  * Finish checksum.
  *
@@ -66,6 +156,147 @@ static inline u32 checksum(const void *data, u32 size, u32 salt)
 	return checksum_finish(checksum_partial(salt, data, size));
 }
 
+/*******************************************************************************
+ * CRC32C.
+ *
+ * This is the raw CRC32C (Castagnoli) update without pre/post inversion,
+ * the same as crc32c() in the kernel.
+ *******************************************************************************/
+
+#ifndef __KERNEL__
+/**
+ * Calculate CRC32C incrementally (portable implementation).
+ * This is defined in tool/crc32c.c with its table.
+ *
+ * @crc previous value.
+ * @data pointer to u8 array to calculate
+ * @size data size in bytes.
+ *
+ * @return current value.
+ */
+u32 crc32c_partial_generic(u32 crc, const void *data, u32 size);
+
+#ifdef WALB_CHECKSUM_X86_SIMD
+/**
+ * SSE4.2 version of crc32c_partial_generic().
+ */
+__attribute__((target("sse4.2")))
+static inline u32 crc32c_partial_sse42(u32 crc, const void *data, u32 size)
+{
+	const u8 *p = (const u8 *)data;
+	u64 crc64 = crc;
+
+	while (size >= sizeof(u64)) {
+		u64 v;
+		memcpy(&v, p, sizeof(u64));
+		crc64 = _mm_crc32_u64(crc64, v);
+		p += sizeof(u64);
+		size -= sizeof(u64);
+	}
+	crc = (u32)crc64;
+	while (size > 0) {
+		crc = _mm_crc32_u8(crc, *p);
+		p++;
+		size--;
+	}
+	return crc;
+}
+#endif /* WALB_CHECKSUM_X86_SIMD */
+#endif /* __KERNEL__ */
+
+/**
+ * Calculate CRC32C incrementally.
+ *
+ * The kernel uses crc32c() of libcrc32c,
+ * which is accelerated by the crc32c-intel driver if available.
+ */
+static inline u32 crc32c_partial(u32 crc, const void *data, u32 size)
+{
+#ifdef __KERNEL__
+	return crc32c(crc, data, size);
+#else
+#ifdef WALB_CHECKSUM_X86_SIMD
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_partial_sse42(crc, data, size);
+#endif
+	return crc32c_partial_generic(crc, data, size);
+#endif
+}
+
+/*******************************************************************************
+ * Log checksum.
+ *
+ * Log record data are checksummed with the algorithm
+ * specified in the super sector.
+ * Super sectors and logpack headers always use checksum()
+ * because their validation relies on that the sum of the whole sector
+ * including the checksum field is zero.
+ *******************************************************************************/
+
+/**
+ * Log checksum algorithms.
+ */
+enum {
+	WALB_LOG_CHECKSUM_SUM = 0, /* checksum(). */
+	WALB_LOG_CHECKSUM_CRC32C = 1,
+	WALB_LOG_CHECKSUM_MAX,
+};
+
+static inline bool is_valid_log_checksum_type(u32 type)
+{
+	return type < WALB_LOG_CHECKSUM_MAX;
+}
+
+static inline const char* get_log_checksum_type_str(u32 type)
+{
+	switch (type) {
+	case WALB_LOG_CHECKSUM_SUM:
+		return "sum";
+	case WALB_LOG_CHECKSUM_CRC32C:
+		return "crc32c";
+	default:
+		return "unknown";
+	}
+}
+
+/**
+ * Calculate log checksum incrementally.
+ *
+ * @type log checksum algorithm.
+ * @csum previous value. specify salt for first call.
+ * @data pointer to u8 array to calculate
+ * @size data size in bytes. This must be dividable by sizeof(u32).
+ *
+ * @return current value.
+ */
+static inline u32 log_checksum_partial(
+	u32 type, u32 csum, const void *data, u32 size)
+{
+	if (type == WALB_LOG_CHECKSUM_CRC32C)
+		return crc32c_partial(csum, data, size);
+	return checksum_partial(csum, data, size);
+}
+
+/**
+ * Finish log checksum.
+ */
+static inline u32 log_checksum_finish(u32 type, u32 csum)
+{
+	if (type == WALB_LOG_CHECKSUM_CRC32C)
+		return ~csum;
+	return checksum_finish(csum);
+}
+
+/**
+ * Calculate log checksum of byte array.
+ */
+static inline u32 log_checksum(
+	u32 type, const void *data, u32 size, u32 salt)
+{
+	return log_checksum_finish(
+		type, log_checksum_partial(type, salt, data, size));
+}
+
 #ifdef __cplusplus
 }
 #endif
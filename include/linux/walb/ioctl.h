@@ -15,6 +15,7 @@
 #include <linux/ioctl.h>
 #else /* __KERNEL__ */
 #include <stdio.h>
+#include <stddef.h>
 #include <sys/ioctl.h>
 #endif /* __KERNEL__ */
 
@@ -159,9 +160,11 @@ enum {
 	 *   ctl->u2k.wminor as walb device minor.
 	 *     Specify WALB_DYNAMIC_MINOR for automatic assign.
 	 *   ctl->u2k.buf as struct walb_start_param.
+	 *     ctl->u2k.buf_size must satisfy is_walb_start_param_size_valid().
 	 * OUTPUT:
 	 *   ctl->k2u.wmajor, ctl->k2u.wminor as walb device major/minor.
-	 *   ctl->k2u.buf as device name (ctl->k2u.buf_size >= DISK_NAME_LEN).
+	 *   ctl->k2u.buf as struct walb_start_param really used.
+	 *     ctl->k2u.buf_size must be the same as ctl->u2k.buf_size.
 	 *   ctl->error as error code.
 	 * RETURN:
 	 *   0 in success, or -EFAULT.
@@ -247,11 +250,18 @@ enum {
 	WALB_IOCTL_SET_OLDEST_LSID,
 
 	/*
-	 * NOT YET IMPLEMENTED (NYI).
-	 * ???
+	 * Get a status snapshot of the device.
 	 *
 	 * INPUT:
+	 *   ctl->k2u.buf_size as sizeof(struct walb_status) of the caller.
+	 *     It must be at least WALB_STATUS_MIN_SIZE.
 	 * OUTPUT:
+	 *   ctl->k2u.buf as struct walb_status.
+	 *     The first min(ctl->k2u.buf_size, sizeof(struct walb_status)) bytes
+	 *     are filled. Check version and size members.
+	 *   ctl->val_u32 as WALB_STATUS_VERSION of the driver.
+	 * RETURN:
+	 *   0 in success, or -EFAULT.
 	 */
 	WALB_IOCTL_STATUS,
 
@@ -449,6 +459,25 @@ enum {
 	 */
 	WALB_IOCTL_IS_FROZEN,
 
+	/*
+	 * Wait for permanent_lsid or completed_lsid to reach a target.
+	 *
+	 * INPUT:
+	 *   ctl->val_u64 as target lsid.
+	 *   ctl->val_int as kind of lsid.
+	 *     0 for permanent_lsid, or non-zero for completed_lsid.
+	 *   ctl->val_u32 as timeout [ms].
+	 *     0 means no timeout.
+	 * OUTPUT:
+	 *   ctl->val_u64 as the lsid of the kind at return.
+	 *   ctl->error as result.
+	 *     0 if the lsid has reached the target, or -ETIMEDOUT.
+	 * RETURN:
+	 *   0 if reached or timed out, -EINTR if interrupted by a signal,
+	 *   or -EFAULT if the device is read-only mode or stopping.
+	 */
+	WALB_IOCTL_WAIT_FOR_LSID,
+
 	/* NIY means [N]ot [I]mplemented [Y]et. */
 };
 
@@ -484,6 +513,121 @@ struct walb_start_param
 	/* Max number of data IOs to be processed at once. */
 	unsigned int n_io_bulk;
 
+	/* Number of pending data shards partitioned by LBA range.
+	   0 means the default value. */
+	unsigned int n_pending_shards;
+
+	/* Data IOs are applied to the data device after this period [ms]
+	   while pending data is less than min_pending_mb.
+	   0 means they are applied as soon as their logs are permanent. */
+	unsigned int apply_delay_ms;
+
+} __attribute__((packed));
+
+/**
+ * Sizes of struct walb_start_param in older versions.
+ * V0: before n_pending_shards was added.
+ * V1: before apply_delay_ms was added.
+ *
+ * Binaries built with older headers pass an older size.
+ * The kernel accepts it and zero-fills the missing members,
+ * which means their default values.
+ * Members must be appended to the end of the struct
+ * and their zero value must mean the default.
+ */
+#define WALB_START_PARAM_SIZE_V0 \
+	offsetof(struct walb_start_param, n_pending_shards)
+#define WALB_START_PARAM_SIZE_V1 \
+	offsetof(struct walb_start_param, apply_delay_ms)
+
+/**
+ * WALB_IOCTL_STATUS
+ *
+ * Members may be appended in later versions
+ * but existing members will not be changed.
+ */
+#define WALB_STATUS_VERSION 1
+
+/**
+ * Size of version and size members.
+ */
+#define WALB_STATUS_MIN_SIZE (sizeof(u32) * 2)
+
+/**
+ * Bits of struct walb_status.flags.
+ */
+#define WALB_STATUS_READ_ONLY     (1U << 0)
+#define WALB_STATUS_LOG_OVERFLOW  (1U << 1)
+#define WALB_STATUS_FROZEN        (1U << 2)
+#define WALB_STATUS_QUEUE_STOPPED (1U << 3)
+#define WALB_STATUS_LAZY_REDO     (1U << 4)
+
+/**
+ * Stages of struct walb_status.latency.
+ * See module/latency_hist.h for details.
+ */
+enum {
+	WALB_STATUS_LAT_QUEUE = 0,
+	WALB_STATUS_LAT_LOG_WRITE,
+	WALB_STATUS_LAT_LOG_FLUSH,
+	WALB_STATUS_LAT_DATA_WRITE,
+	WALB_STATUS_LAT_WRITE,
+	WALB_STATUS_LAT_READ,
+	WALB_STATUS_LAT_MAX,
+};
+
+/**
+ * Latency summary of a stage.
+ * Each percentile is the upper bound of the log2 histogram bucket
+ * containing it [usec].
+ */
+struct walb_status_latency
+{
+	u64 count;
+	u64 p50_us;
+	u64 p99_us;
+	u64 max_us;
+} __attribute__((packed));
+
+struct walb_status
+{
+	u32 version; /* WALB_STATUS_VERSION. */
+	u32 size; /* Filled size [byte]. */
+
+	u32 flags; /* WALB_STATUS_XXX bits. */
+	u32 pbs; /* Physical block size [byte]. */
+
+	/* See struct lsid_set in module/kern.h. */
+	u64 latest_lsid;
+	u64 flush_lsid;
+	u64 completed_lsid;
+	u64 permanent_lsid;
+	u64 written_lsid;
+	u64 prev_written_lsid;
+	u64 oldest_lsid;
+
+	/* [physical block]. */
+	u64 log_capacity;
+	u64 log_usage;
+
+	/* Pending data and its watermarks [logical block]. */
+	u64 pending_sectors;
+	u64 max_pending_sectors;
+	u64 min_pending_sectors;
+
+	/* Total time the queue has been stopped
+	   due to too much pending data [ms]. */
+	u64 queue_stopped_ms;
+
+	/* Counters since the device started. */
+	u64 n_logpack; /* Submitted logpacks except for zero-flush ones. */
+	u64 n_flush_requested; /* Log device flushes requested. */
+	u64 n_flush_issued; /* Log device flushes really issued. */
+	u64 n_fua; /* Logged REQ_FUA write IOs. */
+	u64 n_discard; /* Logged discard IOs. */
+	u64 logged_bytes; /* Logged write IO bytes except for discard. */
+
+	struct walb_status_latency latency[WALB_STATUS_LAT_MAX];
 } __attribute__((packed));
 
 /**
@@ -504,11 +648,23 @@ static inline bool is_walb_start_param_valid(
 	CHECKd(param->log_flush_interval_mb * 2 <= param->max_pending_mb);
 	CHECKd(0 < param->n_pack_bulk);
 	CHECKd(0 < param->n_io_bulk);
+	CHECKd(param->n_pending_shards <= MAX_PENDING_SHARDS);
+	CHECKd(param->apply_delay_ms <= MAX_APPLY_DELAY_MS);
 	return true;
 error:
 	return false;
 };
 
+/**
+ * Check the size of struct walb_start_param given by userland.
+ */
+static inline bool is_walb_start_param_size_valid(size_t size)
+{
+	return size == WALB_START_PARAM_SIZE_V0 ||
+		size == WALB_START_PARAM_SIZE_V1 ||
+		size == sizeof(struct walb_start_param);
+}
+
 #ifdef __cplusplus
 }
 #endif
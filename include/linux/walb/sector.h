@@ -571,6 +571,7 @@ static inline int sector_array_sprint(
  * @sect_ary sector data array.
  * @offset offset in bytes.
  * @size size in bytes.
+ * @type log checksum algorithm (WALB_LOG_CHECKSUM_XXX).
  * @salt checksum salt.
  *
  * RETURN:
@@ -578,7 +579,7 @@ static inline int sector_array_sprint(
  */
 static inline u32 sector_array_checksum(
 	struct sector_data_array *sect_ary,
-	unsigned int offset, unsigned int size, u32 salt)
+	unsigned int offset, unsigned int size, u32 type, u32 salt)
 {
 	unsigned int remaining = size;
 	unsigned int sect_size;
@@ -596,14 +597,14 @@ static inline u32 sector_array_checksum(
 	while (remaining > 0) {
 		ASSERT(idx < sect_ary->size);
 		tsize = get_min_value(sect_size - off, remaining);
-		sum = checksum_partial(
-			sum, &((u8 *)sect_ary->array[idx]->data)[off],
+		sum = log_checksum_partial(
+			type, sum, &((u8 *)sect_ary->array[idx]->data)[off],
 			tsize);
 		remaining -= tsize;
 		idx++;
 		off = 0;
 	}
-	return checksum_finish(sum);
+	return log_checksum_finish(type, sum);
 }
 
 /**
@@ -11,6 +11,7 @@
 #include "block_size.h"
 #include "check.h"
 #include "util.h"
+#include "checksum.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,7 +30,7 @@ extern "C" {
 struct walb_super_sector {
 
 	/* (2 * 2) + (4) +
-	   (4 * 4) + 16 + 64 + (8 * 4) = 136 bytes */
+	   (4 * 4) + 16 + 64 + (8 * 4) + 4 = 140 bytes */
 
 	/*
 	 * Constant value inside the kernel.
@@ -110,6 +111,11 @@ struct walb_super_sector {
 	/* Size of wrapper block device [logical block] */
 	u64 device_size;
 
+	/* Checksum algorithm of log data. See WALB_LOG_CHECKSUM_XXX.
+	   Version 2 super sectors do not have this field.
+	   Use get_super_sector_log_checksum_type() to read it. */
+	u32 log_checksum_type;
+
 } __attribute__((packed, aligned(8)));
 
 /**
@@ -131,7 +137,10 @@ static inline int is_valid_super_sector_raw(
 	/* sector type */
 	CHECKd(sect->sector_type == SECTOR_TYPE_SUPER);
 	/* version */
-	CHECKd(sect->version == WALB_LOG_VERSION);
+	CHECKd(is_supported_log_version(sect->version));
+	/* log checksum type */
+	CHECKd(sect->version < 3 ||
+		is_valid_log_checksum_type(sect->log_checksum_type));
 	/* block size */
 	CHECKd(sect->physical_bs == pbs);
 	CHECKd(sect->physical_bs >= sect->logical_bs);
@@ -184,6 +193,20 @@ static inline char* set_super_sector_name(
 	return super_sect->name;
 }
 
+/**
+ * Get log checksum algorithm of a super sector.
+ *
+ * RETURN:
+ *   WALB_LOG_CHECKSUM_XXX.
+ */
+static inline u32 get_super_sector_log_checksum_type(
+	const struct walb_super_sector *super_sect)
+{
+	if (super_sect->version < 3)
+		return WALB_LOG_CHECKSUM_SUM;
+	return super_sect->log_checksum_type;
+}
+
 /**
  * Get super sector pointer.
  *
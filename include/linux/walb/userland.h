@@ -31,6 +31,7 @@ typedef int64_t s64;
    and macros MAJOR, MINOR, MKDEV to share code between kernel and userland.
 */
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #define MAJOR(dev) major(dev)
 #define MINOR(dev) minor(dev)
 #define MKDEV(dev) makedev(dev)
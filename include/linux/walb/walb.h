@@ -20,8 +20,19 @@ extern "C" {
  * ver2
  *   enlarge max IO size to 32bit from 16bit unsigned int.
  *   Still max IO size with data is limited to 16bit due to other reasons.
+ * ver3
+ *   add log_checksum_type to the super sector and the walblog header.
+ *   ver2 log devices and walblog files are still supported
+ *   and they always use WALB_LOG_CHECKSUM_SUM.
  */
-#define WALB_LOG_VERSION 2
+#define WALB_LOG_VERSION 3
+#define WALB_LOG_VERSION_MIN 2
+
+/**
+ * Check a log device format version is supported.
+ */
+#define is_supported_log_version(ver)					\
+	(WALB_LOG_VERSION_MIN <= (ver) && (ver) <= WALB_LOG_VERSION)
 
 /**
  * Maximum IO size [logical block or sector].
@@ -81,6 +92,16 @@ static inline bool is_lsid_range_valid(u64 lsid0, u64 lsid1)
  */
 #define MAX_PENDING_MB 16384 /* 16GB */
 
+/**
+ * Maximum number of pending data shards.
+ */
+#define MAX_PENDING_SHARDS 64
+
+/**
+ * Maximum apply delay of data IOs [ms].
+ */
+#define MAX_APPLY_DELAY_MS 10000
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,12 +55,18 @@ static atomic_t n_allocated_pages_ = ATOMIC_INIT(0);
 
 /**
  * Page allocator with counter.
+ *
+ * @pp page pool. If NULL, the page allocator is used directly.
  */
-static inline struct page* alloc_page_inc(gfp_t gfp_mask)
+static inline struct page* alloc_page_inc(
+	struct walb_page_pool *pp, gfp_t gfp_mask)
 {
 	struct page *p;
 
-	p = alloc_page(gfp_mask);
+	if (pp)
+		p = walb_page_pool_alloc(pp, gfp_mask);
+	else
+		p = alloc_page(gfp_mask);
 #ifdef WALB_DEBUG
 	if (p)
 		atomic_inc(&n_allocated_pages_);
@@ -70,11 +76,16 @@ static inline struct page* alloc_page_inc(gfp_t gfp_mask)
 
 /**
  * Page deallocator with counter.
+ *
+ * @pp page pool. If NULL, the page allocator is used directly.
  */
-static inline void free_page_dec(struct page *page)
+static inline void free_page_dec(struct walb_page_pool *pp, struct page *page)
 {
 	ASSERT(page);
-	__free_page(page);
+	if (pp)
+		walb_page_pool_free(pp, page);
+	else
+		__free_page(page);
 #ifdef WALB_DEBUG
 	atomic_dec(&n_allocated_pages_);
 #endif
@@ -209,11 +220,14 @@ retry:
  * Allocate a bio with pages.
  *
  * @size size in bytes.
+ * @pp page pool to allocate pages from (can be NULL).
  *
  * You must set bi_bdev, bi_opf, bi_iter by yourself.
  * bi_iter.bi_size will be set to the specified size if size is not 0.
  */
-struct bio* bio_alloc_with_pages(uint size, struct block_device *bdev, gfp_t gfp_mask)
+struct bio* bio_alloc_with_pages(
+	uint size, struct block_device *bdev,
+	struct walb_page_pool *pp, gfp_t gfp_mask)
 {
 	struct bio *bio;
 	uint i, nr_pages, remaining;
@@ -229,7 +243,7 @@ struct bio* bio_alloc_with_pages(uint size, struct block_device *bdev, gfp_t gfp
 	remaining = size;
 	for (i = 0; i < nr_pages; i++) {
 		uint len0, len1;
-		struct page *page = alloc_page_inc(gfp_mask);
+		struct page *page = alloc_page_inc(pp, gfp_mask);
 		if (!page)
 			goto err;
 		len0 = min_t(uint, PAGE_SIZE, remaining);
@@ -241,14 +255,16 @@ struct bio* bio_alloc_with_pages(uint size, struct block_device *bdev, gfp_t gfp
 	ASSERT(bio->bi_iter.bi_size == size);
 	return bio;
 err:
-	bio_put_with_pages(bio);
+	bio_put_with_pages(bio, pp);
 	return NULL;
 }
 
 /**
  * Free its all pages and call bio_put().
+ *
+ * @pp page pool which the pages were allocated from (can be NULL).
  */
-void bio_put_with_pages(struct bio *bio)
+void bio_put_with_pages(struct bio *bio, struct walb_page_pool *pp)
 {
 	struct bio_vec *bv;
 	int i;
@@ -256,7 +272,7 @@ void bio_put_with_pages(struct bio *bio)
 
 	bio_for_each_segment_all(bv, bio, i) {
 		if (bv->bv_page) {
-			free_page_dec(bv->bv_page);
+			free_page_dec(pp, bv->bv_page);
 			bv->bv_page = NULL;
 		}
 	}
@@ -266,8 +282,11 @@ void bio_put_with_pages(struct bio *bio)
 
 /**
  * Create a copy of a write bio.
+ *
+ * @pp page pool to allocate pages from (can be NULL).
  */
-struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask)
+struct bio* bio_deep_clone(
+	struct bio *bio, struct walb_page_pool *pp, gfp_t gfp_mask)
 {
 	uint size;
 	struct bio *clone;
@@ -281,7 +300,7 @@ struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask)
 	else
 		size = 0;
 
-	clone = bio_alloc_with_pages(size, bio->bi_bdev, gfp_mask);
+	clone = bio_alloc_with_pages(size, bio->bi_bdev, pp, gfp_mask);
 	if (!clone)
 		return NULL;
 
@@ -11,6 +11,7 @@
 #include <linux/blkdev.h>
 #include <linux/list.h>
 #include <linux/completion.h>
+#include "page_pool.h"
 
 #include "linux/walb/common.h"
 
@@ -57,9 +58,11 @@ void wait_for_bio_entry(struct bio_entry *bioe, ulong timeoutMs, uint dev_minor)
  * with own pages.
  */
 struct bio* bio_alloc_with_pages(
-	uint sectors, struct block_device *bdev, gfp_t gfp_mask);
-void bio_put_with_pages(struct bio *bio);
-struct bio* bio_deep_clone(struct bio *bio, gfp_t gfp_mask);
+	uint sectors, struct block_device *bdev,
+	struct walb_page_pool *pp, gfp_t gfp_mask);
+void bio_put_with_pages(struct bio *bio, struct walb_page_pool *pp);
+struct bio* bio_deep_clone(
+	struct bio *bio, struct walb_page_pool *pp, gfp_t gfp_mask);
 
 /********************************************************************************
  * Init/exit.
@@ -15,6 +15,7 @@
 #include "linux/walb/common.h"
 #include "linux/walb/logger.h"
 #include "linux/walb/checksum.h"
+#include "checksum_simd.h"
 
 #define bio_begin_sector(bio) ((bio)->bi_iter.bi_sector)
 
@@ -58,15 +59,17 @@ static inline void bio_get_overlapped(
 }
 
 /**
- * Calculate checksum.
+ * Calculate log checksum.
  *
  * @bio target bio
+ * @type log checksum algorithm (WALB_LOG_CHECKSUM_XXX).
  * @salt checksum salt.
  *
  * RETURN:
  *   checksum if bio->bi_size > 0, else 0.
  */
-static inline u32 bio_calc_checksum_iter(const struct bio *bio, struct bvec_iter iter, u32 salt)
+static inline u32 bio_calc_checksum_iter(
+	const struct bio *bio, struct bvec_iter iter, u32 type, u32 salt)
 {
 	struct bio *biox = (struct bio *)bio;
 	struct bio_vec bvec;
@@ -83,16 +86,16 @@ static inline u32 bio_calc_checksum_iter(const struct bio *bio, struct bvec_iter
 		const uint off = bio_iter_offset(bio, iterx);
 
 		u8 *buf = (u8 *)kmap_atomic(bio_iter_page(bio, iterx));
-		sum = checksum_partial(sum, buf + off, len);
+		sum = log_checksum_partial_simd(type, sum, buf + off, len);
 		kunmap_atomic(buf);
 	}
 
-	return checksum_finish(sum);
+	return log_checksum_finish(type, sum);
 }
 
-static inline u32 bio_calc_checksum(const struct bio *bio, u32 salt)
+static inline u32 bio_calc_checksum(const struct bio *bio, u32 type, u32 salt)
 {
-	return bio_calc_checksum_iter(bio, bio->bi_iter, salt);
+	return bio_calc_checksum_iter(bio, bio->bi_iter, type, salt);
 }
 
 #define SNPRINT_BIO_PROCEED(buf, size, w, s) do {			\
@@ -178,7 +178,12 @@ void init_bio_wrapper(struct bio_wrapper *biow, struct bio *bio)
 	init_completion(&biow->done);
 	biow->flags = 0;
 	biow->lsid = 0;
+	biow->overwritten_lsid = 0;
 	biow->copied_bio = NULL;
+	RB_CLEAR_NODE(&biow->pending_node);
+#ifdef WALB_OVERLAPPED_SERIALIZE
+	RB_CLEAR_NODE(&biow->overlapped_node);
+#endif
 
 	if (bio) {
 		biow->bio = bio;
@@ -220,8 +225,11 @@ struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask)
 
 /**
  * Do not touch biow->bio if not null.
+ *
+ * @pp page pool where pages of the copied bio are returned.
+ *   If NULL, they are freed to the page allocator.
  */
-void destroy_bio_wrapper(struct bio_wrapper *biow)
+void destroy_bio_wrapper(struct bio_wrapper *biow, struct walb_page_pool *pp)
 {
 	if (!biow)
 		return;
@@ -229,8 +237,12 @@ void destroy_bio_wrapper(struct bio_wrapper *biow)
 	if (bio_entry_exists(&biow->cloned_bioe))
 		fin_bio_entry(&biow->cloned_bioe);
 
-	if (biow->copied_bio)
-		bio_put_with_pages(biow->copied_bio);
+	if (biow->copied_bio) {
+		if (bio_wrapper_state_is_zero_copy(biow))
+			bio_put(biow->copied_bio);
+		else
+			bio_put_with_pages(biow->copied_bio, pp);
+	}
 
 	kmem_cache_free(bio_wrapper_cache_, biow);
 }
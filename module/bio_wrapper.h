@@ -10,6 +10,8 @@
 #include <linux/types.h>
 #include <linux/blkdev.h>
 #include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/rbtree.h>
 #include <linux/completion.h>
 #include <linux/time.h>
 
@@ -25,6 +27,17 @@ struct bio_wrapper
 	struct list_head list2; /* another list entry. */
 	struct list_head list3; /* another list entry. */
 	struct list_head list4; /* another list entry. */
+	struct llist_node llnode; /* lock-less list entry. */
+	u64 staging_ns; /* time of staging in the iocore [ns]. */
+
+	/* Interval tree nodes of pending data and overlapped data.
+	   The interval is [pos, pos + len - 1]. */
+	struct rb_node pending_node;
+	u64 pending_subtree_last;
+#ifdef WALB_OVERLAPPED_SERIALIZE
+	struct rb_node overlapped_node;
+	u64 overlapped_subtree_last;
+#endif
 
 	struct work_struct work; /* for workqueue tasks. */
 
@@ -43,9 +56,15 @@ struct bio_wrapper
 	   (2) comparison with permanent_lsid. */
 	u64 lsid;
 
+	/* lsid of the bio wrapper which has fully overwritten this one.
+	   Valid only if BIO_WRAPPER_OVERWRITTEN is set. */
+	u64 overwritten_lsid;
+
 	/* Original bio's buffer will be updated during IO.
 	   Walb requires a fixed snapshot of data during IO.
 	   So submitted bio will be copied to here at first.
+	   If BIO_WRAPPER_ZERO_COPY is set, this is a clone
+	   sharing pages with the original bio.
 	   For discard IOs, this is NULL. */
 	struct bio *copied_bio;
 
@@ -57,6 +76,12 @@ struct bio_wrapper
 
 	unsigned long start_time; /* for diskstats. */
 
+	/* For latency histograms [nsec].
+	   begin_ns is the arrival time and
+	   stage_ns is the end time of the previous stage. */
+	u64 begin_ns;
+	u64 stage_ns;
+
 	void *private_data;
 
 #ifdef WALB_OVERLAPPED_SERIALIZE
@@ -112,6 +137,12 @@ enum
 	BIO_WRAPPER_DISCARD,
 	/* Set if the biow data will be fully overwritten by newer IO(s). */
 	BIO_WRAPPER_OVERWRITTEN,
+	/* Set if the data IO is skipped because the biow data
+	   will be written by the newer IO which overwrote it. */
+	BIO_WRAPPER_ABSORBED,
+	/* Set if biow->copied_bio references the pages of the original bio
+	   instead of its own copy. */
+	BIO_WRAPPER_ZERO_COPY,
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	/* Set if the biow submission for data device is delayed
 	   due to overlapped. */
@@ -137,6 +168,10 @@ enum
 	test_bit(BIO_WRAPPER_DISCARD, &(biow)->flags)
 #define bio_wrapper_state_is_overwritten(biow) \
 	test_bit(BIO_WRAPPER_OVERWRITTEN, &(biow)->flags)
+#define bio_wrapper_state_is_absorbed(biow) \
+	test_bit(BIO_WRAPPER_ABSORBED, &(biow)->flags)
+#define bio_wrapper_state_is_zero_copy(biow) \
+	test_bit(BIO_WRAPPER_ZERO_COPY, &(biow)->flags)
 #ifdef WALB_OVERLAPPED_SERIALIZE
 #define bio_wrapper_state_is_delayed(biow) \
 	test_bit(BIO_WRAPPER_DELAYED, &(biow)->flags)
@@ -182,7 +217,7 @@ UNUSED void print_bio_wrapper_short(
 
 void init_bio_wrapper(struct bio_wrapper *biow, struct bio *bio);
 struct bio_wrapper* alloc_bio_wrapper(gfp_t gfp_mask);
-void destroy_bio_wrapper(struct bio_wrapper *biow);
+void destroy_bio_wrapper(struct bio_wrapper *biow, struct walb_page_pool *pp);
 
 bool bio_wrapper_copy_overlapped(
 	struct bio_wrapper *dst, struct bio_wrapper *src, gfp_t gfp_mask);
@@ -198,7 +233,8 @@ void bio_wrapper_exit(void);
 #define BIO_WRAPPER_PRINT_CSUM(prefix, biow) do {			\
 		const struct walb_dev *wdev = biow->private_data;	\
 		biow->csum = bio_calc_checksum(				\
-			biow->bio, wdev->log_checksum_salt);		\
+			biow->bio, wdev->log_checksum_type,		\
+			wdev->log_checksum_salt);			\
 		print_bio_wrapper_short(KERN_INFO, biow, prefix);	\
 	} while (0)
 #define BIO_WRAPPER_PRINT_LS(prefix, biow, list_size) do {	\
@@ -222,6 +258,22 @@ void bio_wrapper_exit(void);
 /**
  * Check overlapped.
  */
+/**
+ * First and last positions [logical block] of a biow
+ * as an interval tree key.
+ * biow->len must be positive.
+ */
+static inline u64 bio_wrapper_first_pos(const struct bio_wrapper *biow)
+{
+	return biow->pos;
+}
+
+static inline u64 bio_wrapper_last_pos(const struct bio_wrapper *biow)
+{
+	ASSERT(biow->len > 0);
+	return biow->pos + biow->len - 1;
+}
+
 static inline bool bio_wrapper_is_overlap(
 	const struct bio_wrapper *biow0, const struct bio_wrapper *biow1)
 {
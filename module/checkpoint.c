@@ -10,6 +10,7 @@
 #include "super.h"
 #include "checkpoint.h"
 #include "kern.h"
+#include "walb_trace.h"
 
 /**
  * Initialize checkpointing.
@@ -34,6 +35,7 @@ void init_checkpointing(struct checkpoint_data *cpd)
 bool take_checkpoint(struct checkpoint_data *cpd)
 {
 	bool skip;
+	u64 written_lsid;
 	struct walb_dev *wdev;
 
 	ASSERT(cpd);
@@ -42,8 +44,10 @@ bool take_checkpoint(struct checkpoint_data *cpd)
 
 	/* Check the need of writing superblock. */
 	spin_lock(&wdev->lsid_lock);
-	skip = wdev->lsids.written == wdev->lsids.prev_written;
+	written_lsid = wdev->lsids.written;
+	skip = written_lsid == wdev->lsids.prev_written;
 	spin_unlock(&wdev->lsid_lock);
+	trace_walb_checkpoint(wdev, written_lsid, skip);
 	if (skip) {
 		WLOG_(wdev, "skip superblock sync.\n");
 		return true;
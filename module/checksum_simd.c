@@ -0,0 +1,187 @@
+/**
+ * checksum_simd.c - SIMD checksum calculation in the kernel.
+ *
+ * The checksum is a sum of u32 values modulo 2^32,
+ * so it can be calculated with independent u32 lanes.
+ * Compiler intrinsics are not available in kernel builds,
+ * so the loops are written in inline assembler
+ * like the raid6 and xor SIMD code in the kernel.
+ */
+#include "check_kernel.h"
+#include <linux/module.h>
+#include "checksum_simd.h"
+#include "linux/walb/logger.h"
+
+#ifdef CONFIG_X86_64
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#include <asm/fpu/xstate.h>
+#endif
+
+/*******************************************************************************
+ * Static data.
+ *******************************************************************************/
+
+/**
+ * Calculate checksum of size bytes where size is a multiple of the block size.
+ */
+typedef u32 (checksum_blocks_t)(u32 sum, const u8 *data, u32 size);
+
+struct checksum_simd_impl
+{
+	const char *name;
+	u32 block_size; /* [byte] */
+	checksum_blocks_t *blocks;
+};
+
+/* Selected implementation. NULL means the portable one. */
+static const struct checksum_simd_impl *impl_ = NULL;
+
+/* Shorter data are calculated without SIMD. */
+#define CHECKSUM_SIMD_MIN_SIZE 64
+
+/* Max size calculated in a kernel_fpu_begin()/kernel_fpu_end() section. */
+#define CHECKSUM_SIMD_CHUNK_SIZE 4096
+
+/*******************************************************************************
+ * Static functions definition.
+ *******************************************************************************/
+
+#ifdef CONFIG_X86_64
+
+static u32 checksum_blocks_sse2(u32 sum, const u8 *data, u32 size)
+{
+	u32 lanes[4];
+	u32 i;
+
+	ASSERT(size % 32 == 0);
+
+	asm volatile("pxor %xmm0,%xmm0\n\t"
+		"pxor %xmm1,%xmm1");
+	for (i = 0; i < size; i += 32) {
+		asm volatile("movdqu %0,%%xmm2\n\t"
+			"movdqu %1,%%xmm3\n\t"
+			"paddd %%xmm2,%%xmm0\n\t"
+			"paddd %%xmm3,%%xmm1"
+			: : "m" (data[i]), "m" (data[i + 16]));
+	}
+	asm volatile("paddd %%xmm1,%%xmm0\n\t"
+		"movdqu %%xmm0,%0"
+		: "=m" (lanes));
+
+	for (i = 0; i < 4; i++)
+		sum += lanes[i];
+	return sum;
+}
+
+static const struct checksum_simd_impl impl_sse2_ = {
+	.name = "sse2",
+	.block_size = 32,
+	.blocks = checksum_blocks_sse2,
+};
+
+#ifdef CONFIG_AS_AVX2
+static u32 checksum_blocks_avx2(u32 sum, const u8 *data, u32 size)
+{
+	u32 lanes[8];
+	u32 i;
+
+	ASSERT(size % 64 == 0);
+
+	asm volatile("vpxor %ymm0,%ymm0,%ymm0\n\t"
+		"vpxor %ymm1,%ymm1,%ymm1");
+	for (i = 0; i < size; i += 64) {
+		asm volatile("vpaddd %0,%%ymm0,%%ymm0\n\t"
+			"vpaddd %1,%%ymm1,%%ymm1"
+			: : "m" (data[i]), "m" (data[i + 32]));
+	}
+	asm volatile("vpaddd %%ymm1,%%ymm0,%%ymm0\n\t"
+		"vmovdqu %%ymm0,%0\n\t"
+		"vzeroupper"
+		: "=m" (lanes));
+
+	for (i = 0; i < 8; i++)
+		sum += lanes[i];
+	return sum;
+}
+
+static const struct checksum_simd_impl impl_avx2_ = {
+	.name = "avx2",
+	.block_size = 64,
+	.blocks = checksum_blocks_avx2,
+};
+#endif /* CONFIG_AS_AVX2 */
+
+#endif /* CONFIG_X86_64 */
+
+/*******************************************************************************
+ * Global functions definition.
+ *******************************************************************************/
+
+/**
+ * Select the fastest implementation supported by the CPU.
+ * Call this once at module init.
+ *
+ * @enable false to use the portable implementation always.
+ */
+void checksum_simd_init(bool enable)
+{
+	impl_ = NULL;
+	if (!enable)
+		return;
+#ifdef CONFIG_X86_64
+#ifdef CONFIG_AS_AVX2
+	/* The OS must save YMM registers also. */
+	if (boot_cpu_has(X86_FEATURE_AVX2) && boot_cpu_has(X86_FEATURE_OSXSAVE) &&
+		cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL)) {
+		impl_ = &impl_avx2_;
+		return;
+	}
+#endif
+	if (boot_cpu_has(X86_FEATURE_XMM2))
+		impl_ = &impl_sse2_;
+#endif
+}
+
+/**
+ * Name of the selected implementation.
+ */
+const char* checksum_simd_name(void)
+{
+	return impl_ ? impl_->name : "generic";
+}
+
+/**
+ * Calculate checksum incrementally.
+ *
+ * @sum previous checksum.
+ * @data pointer to u8 array to calculate.
+ * @size data size in bytes. This must be dividable by sizeof(u32).
+ *
+ * RETURN:
+ *   current checksum.
+ */
+u32 checksum_partial_simd(u32 sum, const void *data, u32 size)
+{
+	const u8 *p = data;
+
+	if (!impl_ || size < CHECKSUM_SIMD_MIN_SIZE)
+		return checksum_partial(sum, data, size);
+#ifdef CONFIG_X86_64
+	if (!irq_fpu_usable())
+		return checksum_partial(sum, data, size);
+
+	while (size >= impl_->block_size) {
+		u32 n = min_t(u32, size, CHECKSUM_SIMD_CHUNK_SIZE);
+		n -= n % impl_->block_size;
+		kernel_fpu_begin();
+		sum = impl_->blocks(sum, p, n);
+		kernel_fpu_end();
+		p += n;
+		size -= n;
+	}
+#endif
+	return checksum_partial(sum, p, size);
+}
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,42 @@
+/**
+ * checksum_simd.h - SIMD checksum calculation in the kernel.
+ */
+#ifndef WALB_CHECKSUM_SIMD_H_KERNEL
+#define WALB_CHECKSUM_SIMD_H_KERNEL
+
+#include "check_kernel.h"
+#include <linux/types.h>
+#include "linux/walb/checksum.h"
+
+/**
+ * Usage:
+ *
+ *   sum = checksum_partial_simd(sum, data0, size0);
+ *   sum = checksum_partial_simd(sum, data1, size1);
+ *   ...
+ *
+ * SIMD registers are used in sections of at most
+ * CHECKSUM_SIMD_CHUNK_SIZE bytes where preemption is disabled,
+ * so long data does not keep preemption disabled.
+ * The portable implementation is used where SIMD is not usable.
+ * Results are bit-identical with checksum_partial().
+ */
+
+void checksum_simd_init(bool enable);
+const char* checksum_simd_name(void);
+u32 checksum_partial_simd(u32 sum, const void *data, u32 size);
+
+/**
+ * Log checksum version.
+ * SIMD is used for WALB_LOG_CHECKSUM_SUM only
+ * because crc32c() selects an accelerated implementation by itself.
+ */
+static inline u32 log_checksum_partial_simd(
+	u32 type, u32 csum, const void *data, u32 size)
+{
+	if (type == WALB_LOG_CHECKSUM_SUM)
+		return checksum_partial_simd(csum, data, size);
+	return log_checksum_partial(type, csum, data, size);
+}
+
+#endif /* WALB_CHECKSUM_SIMD_H_KERNEL */
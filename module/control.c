@@ -55,14 +55,15 @@ static long walb_ctl_compat_ioctl(
  *		   WALB_DYNAMIC_MINOR means automatic assignment),
  *	    lmajor, lminor,
  *	    dmajor, dminor,
- *	    buf_size (sizeof(struct walb_start_param)),
+ *	    buf_size (see is_walb_start_param_size_valid()),
  *	    (struct walb_start_param *)kbuf
  *            Parameters to start a walb device.
+ *            Members out of buf_size are zero, that means default.
  *	Output:
  *	  error: 0 in success.
  *	  k2u
  *	    wmajor, wminor
- *	    buf_size (sizeof(struct walb_start_param)),
+ *	    buf_size (the same as u2k.buf_size),
  *	    (struct walb_start_param *)kbuf
  *            Parameters set really.
  *
@@ -73,7 +74,8 @@ static int ioctl_start_dev(struct walb_ctl *ctl)
 	dev_t ldevt, ddevt;
 	unsigned int wminor;
 	struct walb_dev *wdev;
-	struct walb_start_param *param0, *param1;
+	struct walb_start_param param;
+	size_t size;
 
 	ASSERT(ctl->command == WALB_IOCTL_START_DEV);
 
@@ -87,21 +89,23 @@ static int ioctl_start_dev(struct walb_ctl *ctl)
 		MAJOR(ldevt), MINOR(ldevt),
 		MAJOR(ddevt), MINOR(ddevt));
 
-	if (ctl->u2k.buf_size != sizeof(struct walb_start_param)) {
+	size = ctl->u2k.buf_size;
+	if (!is_walb_start_param_size_valid(size)) {
 		LOGe("ctl->u2k.buf_size is invalid.\n");
 		ctl->error = -1;
 		return -EFAULT;
 	}
-	if (ctl->k2u.buf_size != sizeof(struct walb_start_param)) {
+	if (ctl->k2u.buf_size != size) {
 		LOGe("ctl->k2u.buf_size is invalid.\n");
 		ctl->error = -2;
 		return -EFAULT;
 	}
-	param0 = (struct walb_start_param *)ctl->u2k.kbuf;
-	param1 = (struct walb_start_param *)ctl->k2u.kbuf;
-	ASSERT(param0);
-	ASSERT(param1);
-	if (!is_walb_start_param_valid(param0)) {
+	ASSERT(ctl->u2k.kbuf);
+	ASSERT(ctl->k2u.kbuf);
+	/* Older userland may not know the last members. */
+	memset(&param, 0, sizeof(param));
+	memcpy(&param, ctl->u2k.kbuf, size);
+	if (!is_walb_start_param_valid(&param)) {
 		LOGe("walb start param is invalid.\n");
 		ctl->error = -3;
 		return -EFAULT;
@@ -133,7 +137,7 @@ static int ioctl_start_dev(struct walb_ctl *ctl)
 		goto error0;
 	}
 
-	wdev = prepare_wdev(wminor, ldevt, ddevt, param0);
+	wdev = prepare_wdev(wminor, ldevt, ddevt, &param);
 	if (!wdev) {
 		free_minor(wminor);
 		LOGe("prepare wdev failed.\n");
@@ -160,7 +164,7 @@ static int ioctl_start_dev(struct walb_ctl *ctl)
 	/* Return values to userland. */
 	ctl->k2u.wmajor = walb_major_;
 	ctl->k2u.wminor = wminor;
-	*param1 = *param0;
+	memcpy(ctl->k2u.kbuf, &param, size);
 	ctl->error = 0;
 
 #if 0
@@ -10,12 +10,13 @@
 #include <linux/printk.h>
 #include <linux/time.h>
 #include <linux/kmod.h>
+#include <linux/backing-dev.h>
+#include <linux/list_sort.h>
 #include "linux/walb/logger.h"
 #include "kern.h"
 #include "io.h"
 #include "bio_wrapper.h"
 #include "bio_entry.h"
-#include "treemap.h"
 #include "worker.h"
 #include "bio_util.h"
 #include "pack_work.h"
@@ -26,6 +27,9 @@
 #include "overlapped_io.h"
 #include "queue_util.h"
 #include "bio_set.h"
+#include "redo.h"
+#define CREATE_TRACE_POINTS
+#include "walb_trace.h"
 
 /*******************************************************************************
  * Static data definition.
@@ -63,17 +67,108 @@ struct pack
 	bool is_logpack_failed;
 };
 
+/**
+ * An original bio of a REQ_FUA write IO waiting for a fua_flush
+ * and data to account it when it completes.
+ * The bio wrapper may have been destroyed by then.
+ */
+struct fua_flush_bio
+{
+	struct bio *bio;
+	unsigned long start_time;
+	u64 begin_ns;
+};
+
+/**
+ * REQ_FUA write IOs of a logpack waiting for a log device flush.
+ *
+ * The flush is requested after all the logs of the pack have completed
+ * and the original bios complete when the flush completes,
+ * so the log wait task does not wait for it.
+ * The flush is coalesced with the others. See request_ldev_flush().
+ * Zero-copy bio wrappers keep their original bios
+ * until their data IOs complete, so they just wait for permanent_lsid.
+ */
+struct fua_flush
+{
+	struct walb_dev *wdev;
+
+	/* list entry of ldev_flush->fua_list. */
+	struct list_head list;
+
+	/* Original bios of REQ_FUA write IOs. */
+	unsigned int n_bio;
+	unsigned int max_n_bio;
+	struct fua_flush_bio bios[0];
+};
+
+/**
+ * A log device flush shared by coalesced flush requests.
+ *
+ * Zero-flush bio wrappers are attached to it
+ * and they complete when the flush completes,
+ * so the log wait task does not wait for it.
+ */
+struct ldev_flush
+{
+	struct walb_dev *wdev;
+	struct work_struct work;
+
+	/* Generation number. See iocored->ldev_flush_started. */
+	u64 gen;
+
+	/* Zero-flush bio wrappers linked with biow->list. */
+	struct list_head biow_list;
+
+	/* fua_flush list linked with ff->list.
+	   end_fua_flush() is called for them when the flush completes. */
+	struct list_head fua_list;
+
+	/* permanent_lsid will be this after the flush. 0 means nothing. */
+	u64 new_permanent_lsid;
+	blk_status_t status;
+};
+
 static atomic_t n_users_of_pack_cache_ = ATOMIC_INIT(0);
 #define KMEM_CACHE_PACK_NAME "pack_cache"
 struct kmem_cache *pack_cache_ = NULL;
 
-/* All treemap(s) in this module will share a treemap memory manager. */
-static atomic_t n_users_of_memory_manager_ = ATOMIC_INIT(0);
-static struct treemap_memory_manager mmgr_;
-#define TREE_NODE_CACHE_NAME "walb_iocore_bio_node_cache"
-#define TREE_CELL_HEAD_CACHE_NAME "walb_iocore_bio_cell_head_cache"
-#define TREE_CELL_CACHE_NAME "walb_iocore_bio_cell_cache"
-#define N_ITEMS_IN_MEMPOOL (128 * 2) /* for pending data and overlapped data. */
+/**
+ * A range of pending data shards.
+ * Shard indexes are (begin + i) % n_pending_shards for 0 <= i < n.
+ */
+struct pending_shard_range
+{
+	unsigned int begin;
+	unsigned int n;
+};
+
+/**
+ * Bio wrappers whose data IOs will be merged into one bio.
+ */
+struct write_merge
+{
+	struct list_head biow_list; /* linked with biow->list4. */
+	unsigned int n_biow;
+	sector_t pos; /* [logical block] */
+	unsigned int len; /* [logical block] */
+	unsigned int n_vecs;
+};
+
+/**
+ * bi_private of a merged bio.
+ */
+struct merged_bio_private
+{
+	unsigned int n_bioe;
+	struct bio_entry *bioe[0];
+};
+
+/**
+ * Each shard lock has its own lock class
+ * because several shard locks are held at once in ascending order.
+ */
+static struct lock_class_key pending_shard_lock_keys_[MAX_PENDING_SHARDS];
 
 /*******************************************************************************
  * Macros definition.
@@ -81,6 +176,10 @@ static struct treemap_memory_manager mmgr_;
 
 #define WORKER_NAME_GC "walb_gc"
 
+/* Max waiting period for wdev->lsids to be updated [jiffies].
+   Updates without notify_lsids_updated() are noticed after this. */
+#define LSIDS_WAIT_TIMEO msecs_to_jiffies(100)
+
 /*******************************************************************************
  * Static functions definition.
  *******************************************************************************/
@@ -109,6 +208,7 @@ static void task_wait_for_logpack_list(struct work_struct *work);
 static void task_wait_and_gc_read_bio_wrapper(struct work_struct *work);
 static void task_submit_bio_wrapper_list(struct work_struct *work);
 static void task_wait_for_bio_wrapper_list(struct work_struct *work);
+static void task_expire_apply_delay(struct work_struct *work);
 
 /* Logpack GC */
 static void run_gc_logpack_list(void *data);
@@ -145,7 +245,6 @@ static void logpack_init_bio_entry(
 	struct bio_entry *bioe, struct bio *bio,
 	unsigned int pbs, struct block_device *ldev,
 	u64 ldev_off_pb, unsigned int bio_off_lb);
-static void logpack_submit_flush(struct block_device *bdev, struct pack *pack);
 static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list);
 static void dequeue_and_gc_logpack_list(struct walb_dev *wdev);
 
@@ -154,19 +253,28 @@ static bool is_prepared_pack_valid(struct pack *pack);
 UNUSED static bool is_pack_list_valid(struct list_head *pack_list);
 
 /* IOcore data related. */
-static struct iocore_data* create_iocore_data(gfp_t gfp_mask);
+static struct iocore_data* create_iocore_data(
+	unsigned int n_pending_shards, gfp_t gfp_mask);
 static void destroy_iocore_data(struct iocore_data *iocored);
 
 /* Other helper functions. */
 static bool push_into_lpack_submit_queue(struct bio_wrapper *biow);
+static int cmp_bio_wrapper_by_staging_ns(
+	void *priv, struct list_head *a, struct list_head *b);
+static u64 sort_staging_queues(struct iocore_data *iocored);
+static void splice_staging_list(struct iocore_data *iocored, u64 end_ns);
+static bool is_staging_queues_empty(struct iocore_data *iocored);
 static bool writepack_add_bio_wrapper(
 	struct list_head *wpack_list, struct pack **wpackp,
 	struct bio_wrapper *biow,
 	u64 ring_buffer_size, unsigned int max_logpack_pb,
 	u64 *latest_lsidp, struct walb_dev *wdev, gfp_t gfp_mask, bool *is_flushp);
-static void insert_to_sorted_bio_wrapper_list_by_pos(
-	struct bio_wrapper *biow, struct list_head *biow_list);
+static void add_to_bio_wrapper_list_to_sort(
+	struct bio_wrapper *biow, struct list_head *biow_list, bool *is_sortedp);
+static int cmp_bio_wrapper_by_pos(
+	void *priv, struct list_head *a, struct list_head *b);
 static void writepack_check_and_set_zeroflush(struct pack *wpack, bool *is_flushp);
+static bool is_zero_flush_deferred(struct pack *wpack);
 static bool wait_for_logpack_header(struct pack *wpack);
 static void wait_for_logpack_and_submit_datapack(
 	struct walb_dev *wdev, struct pack *wpack);
@@ -176,11 +284,40 @@ static void wait_for_bio_wrapper_io(
 	struct bio_wrapper *biow, bool is_endio, bool is_delete, struct timespec *end_ts);
 static void submit_write_bio_wrapper(
 	struct bio_wrapper *biow, bool is_plugging);
+static bool can_absorb_write_bio_wrapper(
+	struct walb_dev *wdev, struct bio_wrapper *biow);
+static void submit_write_bio_wrapper_list(
+	struct walb_dev *wdev, struct list_head *biow_list);
+static bool is_mergeable_write_bio_wrapper(
+	struct walb_dev *wdev, struct bio_wrapper *biow);
+static bool can_add_to_write_merge(
+	struct walb_dev *wdev, const struct write_merge *wm,
+	struct bio_wrapper *biow, unsigned int max_sectors);
+static void add_to_write_merge(
+	struct write_merge *wm, struct bio_wrapper *biow);
+static void submit_write_merge(struct walb_dev *wdev, struct write_merge *wm);
+static void merged_bio_end_io(struct bio *bio);
+static void absorb_write_bio_wrapper(
+	struct walb_dev *wdev, struct bio_wrapper *biow);
 static void cancel_write_bio_wrapper(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
+static void end_zero_copy_bio_wrapper(struct bio_wrapper *biow);
+static void wait_for_fua_flush(struct walb_dev *wdev, struct bio_wrapper *biow);
+static bool is_stable_page(struct page *page);
+static bool can_reference_bio_pages(struct walb_dev *wdev, struct bio *bio);
+static bool prepare_write_data(struct walb_dev *wdev, struct bio_wrapper *biow);
 static void submit_read_bio_wrapper(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
-static bool submit_flush(struct bio_entry *bioe, struct block_device *bdev);
+static struct ldev_flush* create_ldev_flush_never_giveup(struct walb_dev *wdev);
+static u64 request_ldev_flush(
+	struct walb_dev *wdev, u64 gen, u64 new_permanent_lsid,
+	struct list_head *biow_list, struct fua_flush *ff);
+static void submit_ldev_flush(struct ldev_flush *lf);
+static void bio_end_io_for_ldev_flush(struct bio *bio);
+static void task_end_ldev_flush(struct work_struct *work);
+static int flush_ldev_coalesced(struct walb_dev *wdev, u64 gen);
+static bool is_ldev_flush_done(
+	struct iocore_data *iocored, u64 gen, int *err_p);
 static void dispatch_submit_log_task(struct walb_dev *wdev);
 static void dispatch_wait_log_task(struct walb_dev *wdev);
 static void dispatch_submit_data_task(struct walb_dev *wdev);
@@ -191,25 +328,53 @@ static void wait_for_logpack_submit_queue_empty(struct walb_dev *wdev);
 static void wait_for_all_started_write_io_done(struct walb_dev *wdev);
 static void wait_for_all_pending_gc_done(struct walb_dev *wdev);
 static void force_flush_ldev(struct walb_dev *wdev);
+static struct fua_flush* create_fua_flush_never_giveup(
+	struct walb_dev *wdev, unsigned int max_n_bio);
+static void add_bio_wrapper_to_fua_flush(
+	struct fua_flush *ff, struct bio_wrapper *biow);
+static void submit_fua_flush(struct fua_flush *ff);
+static void end_fua_flush(struct fua_flush *ff, blk_status_t status);
 static bool wait_for_log_permanent(struct walb_dev *wdev, u64 lsid);
+static void notify_lsids_updated(struct walb_dev *wdev);
+static u64 get_lsid_to_wait(struct walb_dev *wdev, bool is_permanent);
+static bool is_lsids_updated(
+	struct walb_dev *wdev, const struct lsid_set *lsids);
 static void flush_all_wq(void);
 static void clear_working_flag(int working_bit, unsigned long *flag_p);
 static void invoke_userland_exec(struct walb_dev *wdev, const char *event);
 static void fail_and_destroy_bio_wrapper_list(
 	struct walb_dev *wdev, struct list_head *biow_list);
 static void update_flush_lsid_if_necessary(struct walb_dev *wdev, u64 lsid);
+static bool insert_bio_wrapper_to_pending_data(
+	struct walb_dev *wdev, struct bio_wrapper *biow);
 static bool delete_bio_wrapper_from_pending_data(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
 
+/* Pending data shards. */
+static struct pending_shard* get_pending_shard(
+	struct iocore_data *iocored, u64 pos);
+static struct pending_shard* get_pending_shard_in_range(
+	struct iocore_data *iocored,
+	const struct pending_shard_range *range, unsigned int i);
+static void get_pending_shard_range(
+	struct iocore_data *iocored, const struct bio_wrapper *biow,
+	struct pending_shard_range *range);
+static void lock_pending_shards(
+	struct iocore_data *iocored, const struct pending_shard_range *range);
+static void unlock_pending_shards(
+	struct iocore_data *iocored, const struct pending_shard_range *range);
+static unsigned int get_pending_sectors(struct iocore_data *iocored);
+
+/* Apply delay of data IOs. */
+static bool is_apply_window_full(struct walb_dev *wdev);
+static bool is_apply_due(struct walb_dev *wdev, struct bio_wrapper *biow);
+
 /* Stop/start queue for fast algorithm. */
 static bool should_stop_queue(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
 static bool should_start_queue(
 	struct walb_dev *wdev, struct bio_wrapper *biow);
 
-/* For treemap memory manager. */
-static bool treemap_memory_manager_get(void);
-static void treemap_memory_manager_put(void);
 
 /* For pack_cache. */
 static bool pack_cache_get(void);
@@ -218,6 +383,9 @@ static void pack_cache_put(void);
 /* For diskstats. */
 static void io_acct_start(struct bio_wrapper *biow);
 static void io_acct_end(struct bio_wrapper *biow);
+static unsigned long io_acct_end_detail(
+	struct walb_dev *wdev, int rw, unsigned long start_time, u64 begin_ns);
+static void record_stage_latency(struct bio_wrapper *biow, unsigned int stage);
 
 /* For freeze/melt. */
 static bool is_frozen(struct iocore_data *iocored);
@@ -507,16 +675,25 @@ static void task_submit_logpack_list(struct work_struct *work)
 		bool is_empty;
 		unsigned int n_io = 0;
 
+		u64 end_ns;
+
 		ASSERT(list_empty(&biow_list));
 		ASSERT(list_empty(&wpack_list));
 
+		/* Sort staged bio wrappers without the lock. */
+		end_ns = sort_staging_queues(iocored);
+
 		/* Dequeue all bio wrappers from the submit queue. */
 		spin_lock(&iocored->logpack_submit_queue_lock);
+		splice_staging_list(iocored, end_ns);
 		is_empty = list_empty(&iocored->logpack_submit_queue);
 		if (is_empty) {
 			clear_working_flag(
 				IOCORE_STATE_SUBMIT_LOG_TASK_WORKING,
 				&iocored->flags);
+			/* Clear the flag before checking the staging queues
+			   at the end. See push_into_lpack_submit_queue(). */
+			smp_mb__after_atomic();
 		}
 		list_for_each_entry_safe(biow, biow_next,
 					&iocored->logpack_submit_queue, list) {
@@ -551,6 +728,14 @@ static void task_submit_logpack_list(struct work_struct *work)
 		dispatch_wait_log_task(wdev);
 	}
 
+	/* Bio wrappers may have been staged after the last splice
+	   and before the working flag was cleared.
+	   Bio wrappers staged during the last splice are kept
+	   in staging_list. */
+	if (!is_staging_queues_empty(iocored) ||
+		!list_empty(&iocored->staging_list))
+		dispatch_submit_log_task(wdev);
+
 	LOG_("end\n");
 }
 
@@ -643,6 +828,8 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 	struct walb_dev *wdev;
 	struct iocore_data *iocored;
 	struct list_head biow_list, biow_list_sorted;
+	bool is_sorted, is_full, is_waiting;
+	unsigned long due_jiffies = 0;
 
 	get_wdev_and_iocored_from_work(&wdev, &iocored, work);
 	LOG_("begin\n");
@@ -656,23 +843,39 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 		u32 pb = 0;
 		unsigned int n_io = 0;
 		struct blk_plug plug;
-#ifdef WALB_OVERLAPPED_SERIALIZE
-		bool ret;
-#endif
 
 		ASSERT(list_empty(&biow_list));
 		ASSERT(list_empty(&biow_list_sorted));
 
+		/* Keep bio wrappers in pending data
+		   to absorb rewrites and sort more IOs at once. */
+		is_full = wdev->apply_delay_jiffies == 0 ||
+			is_apply_window_full(wdev);
+
 		/* Dequeue all bio wrappers from the submit queue. */
 		spin_lock(&iocored->datapack_submit_queue_lock);
 		is_empty = list_empty(&iocored->datapack_submit_queue);
-		if (is_empty) {
+		is_waiting = false;
+		if (!is_empty && !is_full) {
+			/* The queue is in the order of lsid
+			   so the first one is the oldest. */
+			biow = list_first_entry(&iocored->datapack_submit_queue,
+						struct bio_wrapper, list2);
+			if (!is_apply_due(wdev, biow)) {
+				due_jiffies = biow->start_time +
+					wdev->apply_delay_jiffies;
+				is_waiting = true;
+			}
+		}
+		if (is_empty || is_waiting) {
 			clear_working_flag(
 				IOCORE_STATE_SUBMIT_DATA_TASK_WORKING,
 				&iocored->flags);
 		}
 		list_for_each_entry_safe(biow, biow_next,
 					&iocored->datapack_submit_queue, list2) {
+			if (!is_full && !is_apply_due(wdev, biow))
+				break;
 			list_move_tail(&biow->list2, &biow_list);
 			n_io++;
 			lsid = biow->lsid;
@@ -685,7 +888,19 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 			if (n_io >= wdev->n_io_bulk) { break; }
 		}
 		spin_unlock(&iocored->datapack_submit_queue_lock);
+		if (is_waiting) {
+			/* Do not sleep here holding the working flag.
+			   The task will be dispatched again when the delay expires
+			   or a logpack makes the window full. */
+			ASSERT(n_io == 0);
+			queue_delayed_work(
+				wq_unbound_, &iocored->apply_delay_work,
+				time_after(due_jiffies, jiffies)
+				? due_jiffies - jiffies : 0);
+			break;
+		}
 		if (is_empty) { break; }
+		if (n_io == 0) { continue; }
 
 		/* Wait for all previous log must be permanent
 		   before submitting data IO. */
@@ -705,62 +920,42 @@ static void task_submit_bio_wrapper_list(struct work_struct *work)
 #ifdef WALB_OVERLAPPED_SERIALIZE
 		/* Check and insert to overlapped detection data. */
 		list_for_each_entry(biow, &biow_list, list2) {
-		retry_insert_ol:
 			spin_lock(&iocored->overlapped_data_lock);
-			ret = overlapped_check_and_insert(
-				iocored->overlapped_data,
-				&iocored->max_sectors_in_overlapped,
-				biow, GFP_ATOMIC
+			overlapped_check_and_insert(
+				&iocored->overlapped_data, biow
 #ifdef WALB_DEBUG
 				, &iocored->overlapped_in_id
 #endif
 				);
 			spin_unlock(&iocored->overlapped_data_lock);
-			if (!ret) {
-				schedule();
-				goto retry_insert_ol;
-			}
 		}
 #endif /* WALB_OVERLAPPED_SERIALIZE */
 
 		/* Sort IOs. */
+		is_sorted = true;
 		list_for_each_entry_safe(biow, biow_next, &biow_list, list2) {
 			bio_clear_flush_flags_list(&biow->cloned_bio_list);
 
 #ifdef WALB_OVERLAPPED_SERIALIZE
 			if (!bio_wrapper_state_is_delayed(biow)) {
 				ASSERT(biow->n_overlapped == 0);
-				if (sort_data_io_) {
-					/* Sort. */
-					insert_to_sorted_bio_wrapper_list_by_pos(
-						biow, &biow_list_sorted);
-				} else {
-					list_add_tail(&biow->list4, &biow_list_sorted);
-				}
+				add_to_bio_wrapper_list_to_sort(
+					biow, &biow_list_sorted, &is_sorted);
 			} else {
 				/* Delayed. */
 			}
 #else /* WALB_OVERLAPPED_SERIALIZE */
-			if (sort_data_io_) {
-				/* Sort. */
-				insert_to_sorted_bio_wrapper_list_by_pos(
-					biow, &biow_list_sorted);
-			} else {
-				list_add_tail(&biow->list4, &biow_list_sorted);
-			}
+			add_to_bio_wrapper_list_to_sort(
+				biow, &biow_list_sorted, &is_sorted);
 #endif /* WALB_OVERLAPPED_SERIALIZE */
 		}
+		if (sort_data_io_ && !is_sorted)
+			list_sort(NULL, &biow_list_sorted, cmp_bio_wrapper_by_pos);
 
 		/* Submit. */
+		trace_walb_data_submit(wdev, lsid, n_io, is_sorted);
 		blk_start_plug(&plug);
-		list_for_each_entry_safe(biow, biow_next, &biow_list_sorted, list4) {
-			const bool is_plugging = false;
-			/* Submit bio wrapper. */
-			list_del(&biow->list4);
-			BIO_WRAPPER_CHANGE_STATE(biow);
-			BIO_WRAPPER_PRINT("data0", biow);
-			submit_write_bio_wrapper(biow, is_plugging);
-		}
+		submit_write_bio_wrapper_list(wdev, &biow_list_sorted);
 		blk_finish_plug(&plug);
 
 		/* Enqueue wait task. */
@@ -829,6 +1024,19 @@ static void task_wait_for_bio_wrapper_list(struct work_struct *work)
 	LOG_("end.\n");
 }
 
+/**
+ * Dispatch the data submit task when the apply delay expires.
+ */
+static void task_expire_apply_delay(struct work_struct *work)
+{
+	struct delayed_work *dwork =
+		container_of(work, struct delayed_work, work);
+	struct iocore_data *iocored =
+		container_of(dwork, struct iocore_data, apply_delay_work);
+
+	dispatch_submit_data_task(iocored->wdev);
+}
+
 /**
  * Run gc logpack list.
  */
@@ -964,14 +1172,24 @@ static bool create_logpack_list(
 		if (latest_lsid - written_lsid > wdev->ring_buffer_size) {
 			if (test_bit(WALB_STATE_READ_ONLY, &wdev->flags))
 				goto error;
-			WLOGw(wdev, "Ring buffer size is too small: sleep 100ms: "
-				"latest %" PRIu64 " written %" PRIu64 " prev_written %" PRIu64 "\n"
-				, latest_lsid, written_lsid, prev_written_lsid);
+			if (test_bit(WALB_STATE_LAZY_REDO, &wdev->flags)) {
+				/* written_lsid is kept during lazy redo
+				   so write IOs are throttled until it finishes. */
+				WLOGw(wdev, "Ring buffer is full during lazy redo: "
+					"wait for it to finish: "
+					"latest %" PRIu64 " written %" PRIu64 "\n"
+					, latest_lsid, written_lsid);
+				wait_for_lazy_redo(wdev);
+			} else {
+				WLOGw(wdev, "Ring buffer size is too small: sleep 100ms: "
+					"latest %" PRIu64 " written %" PRIu64 " prev_written %" PRIu64 "\n"
+					, latest_lsid, written_lsid, prev_written_lsid);
 
-			/* In order to avoid live lock of IOs waiting their logs to be permanent */
-			force_flush_ldev(wdev);
+				/* In order to avoid live lock of IOs waiting their logs to be permanent */
+				force_flush_ldev(wdev);
 
-			msleep(100);
+				msleep(100);
+			}
 		} else {
 			WLOGw(wdev, "Ring buffer size is too small: try to take checkpoint: "
 				"latest %" PRIu64 " written %" PRIu64 " prev_written %" PRIu64 "\n"
@@ -987,6 +1205,12 @@ static bool create_logpack_list(
 		spin_unlock(&wdev->lsid_lock);
 	}
 
+	if (trace_walb_logpack_create_enabled()) {
+		list_for_each_entry(wpack, wpack_list, list)
+			trace_walb_logpack_create(
+				wdev, get_logpack_header(wpack->logpack_header_sector));
+	}
+
 	/* Now the logpack can be submitted. */
 	return true;
 
@@ -1018,6 +1242,7 @@ static void submit_logpack_list(
 	struct iocore_data *iocored;
 	struct pack *wpack;
 	struct blk_plug plug;
+	unsigned int n_pack = 0;
 	ASSERT(wpack_list);
 	ASSERT(wdev);
 	iocored = get_iocored_from_wdev(wdev);
@@ -1030,15 +1255,15 @@ static void submit_logpack_list(
 
 		ASSERT_SECTOR_DATA(wpack->logpack_header_sector);
 		logh = get_logpack_header(wpack->logpack_header_sector);
+		trace_walb_logpack_submit(wdev, logh);
 
 		if (wpack->is_zero_flush_only) {
 			ASSERT(logh->n_records == 0);
 			WLOG_(wdev, "is_zero_flush_only\n");
-			if (!is_flush) {
-				/* do nothing because only the first wpack should submit flush request. */
-				continue;
-			}
-			logpack_submit_flush(wdev->ldev, wpack);
+			/* Only the first wpack should flush and the flush
+			   will be executed in wait_for_logpack_header()
+			   to coalesce it with others. */
+			continue;
 		} else {
 			ASSERT(logh->n_records > 0);
 			logpack_calc_checksum(logh, wdev->physical_bs,
@@ -1048,9 +1273,11 @@ static void submit_logpack_list(
 				wdev->physical_bs, is_flush,
 				wdev->ldev, wdev->ring_buffer_off,
 				wdev->ring_buffer_size, wdev->ldev_chunk_sectors);
+			n_pack++;
 		}
 	}
 	blk_finish_plug(&plug);
+	atomic64_add(n_pack, &iocored->n_logpack);
 }
 
 /**
@@ -1059,7 +1286,8 @@ static void submit_logpack_list(
  * @logh log pack header.
  * @pbs physical sector size (allocated size as logh).
  * @biow_list list of biow.
- *   checksum of each bio has already been calculated as biow->csum.
+ *   checksum of each bio has already been calculated as biow->csum
+ *   in prepare_write_data() so this just folds them into the header.
  */
 static void logpack_calc_checksum(
 	struct walb_logpack_header *logh,
@@ -1092,9 +1320,10 @@ static void logpack_calc_checksum(
 			continue;
 		}
 
-		biow->csum = bio_calc_checksum(
-			biow->copied_bio,
-			((struct walb_dev *)biow->private_data)->log_checksum_salt);
+		ASSERT(biow->csum == bio_calc_checksum(
+				biow->copied_bio,
+				((struct walb_dev *)biow->private_data)->log_checksum_type,
+				((struct walb_dev *)biow->private_data)->log_checksum_salt));
 		logh->record[i].checksum = biow->csum;
 		i++;
 	}
@@ -1158,6 +1387,7 @@ static void submit_logpack(
 #ifdef WALB_PERFORMANCE_ANALYSIS
 		getnstimeofday(&biow->ts[WALB_TIME_W_LOG_SUBMITTED]);
 #endif
+		record_stage_latency(biow, WALB_LAT_QUEUE);
 		if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
 			/* No need to execute IO to the log device. */
 			ASSERT(bio_wrapper_state_is_discard(biow));
@@ -1332,23 +1562,6 @@ retry:
 }
 
 
-/**
- * Submit flush for logpack.
- */
-static void logpack_submit_flush(struct block_device *bdev, struct pack *pack)
-{
-	ASSERT(bdev);
-	ASSERT(pack);
-
-	if (!supports_flush_request_bdev(bdev))
-		return;
-
-	while (!submit_flush(&pack->header_bioe, bdev))
-		schedule();
-
-	ASSERT(bio_entry_exists(&pack->header_bioe));
-}
-
 /**
  * Gc logpack list.
  */
@@ -1398,7 +1611,8 @@ static void gc_logpack_list(struct walb_dev *wdev, struct list_head *wpack_list)
 	/* Update written_lsid. */
 	ASSERT(written_lsid != INVALID_LSID);
 	spin_lock(&wdev->lsid_lock);
-	wdev->lsids.written = written_lsid;
+	if (!hold_written_lsid_for_lazy_redo(wdev, written_lsid))
+		wdev->lsids.written = written_lsid;
 	spin_unlock(&wdev->lsid_lock);
 }
 
@@ -1558,9 +1772,17 @@ error:
  * Create iocore data.
  * GC worker will not be started inside this function.
  */
-static struct iocore_data* create_iocore_data(gfp_t gfp_mask)
+static struct iocore_data* create_iocore_data(
+	unsigned int n_pending_shards, gfp_t gfp_mask)
 {
 	struct iocore_data *iocored;
+	int cpu;
+	unsigned int i;
+
+	BUILD_BUG_ON(WALB_MAX_NORMAL_IO_SECTORS
+		>= (1U << PENDING_SHARD_STRIPE_SHIFT));
+	ASSERT(0 < n_pending_shards);
+	ASSERT(n_pending_shards <= MAX_PENDING_SHARDS);
 
 	iocored = kmalloc(sizeof(struct iocore_data), gfp_mask);
 	if (!iocored) {
@@ -1593,30 +1815,68 @@ static struct iocore_data* create_iocore_data(gfp_t gfp_mask)
 
 	/* Log flush time. */
 	iocored->log_flush_jiffies = jiffies;
+	init_waitqueue_head(&iocored->lsids_wait_q);
 
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	spin_lock_init(&iocored->overlapped_data_lock);
-	iocored->overlapped_data = multimap_create(gfp_mask, &mmgr_);
-	if (!iocored->overlapped_data) {
-		LOGe("overlapped_data allocation failure.\n");
-		goto error1;
-	}
-	iocored->max_sectors_in_overlapped = 0;
+	iocored->overlapped_data = RB_ROOT;
 #ifdef WALB_DEBUG
 	iocored->overlapped_in_id = 0;
 	iocored->overlapped_out_id = 0;
 #endif
 #endif
 
-	spin_lock_init(&iocored->pending_data_lock);
-	iocored->pending_data = multimap_create(gfp_mask, &mmgr_);
-	if (!iocored->pending_data) {
-		LOGe("pending_data allocation failure.\n");
-		goto error2;
+	/* Pending data shards. */
+	iocored->n_pending_shards = n_pending_shards;
+	iocored->pending_shards = kcalloc(
+		n_pending_shards, sizeof(struct pending_shard), gfp_mask);
+	if (!iocored->pending_shards) {
+		LOGe("pending_shards allocation failure.\n");
+		goto error1;
+	}
+	for (i = 0; i < n_pending_shards; i++) {
+		struct pending_shard *shard = &iocored->pending_shards[i];
+		spin_lock_init(&shard->lock);
+		lockdep_set_class(&shard->lock, &pending_shard_lock_keys_[i]);
+		shard->data = RB_ROOT;
+		shard->sectors = 0;
 	}
-	iocored->pending_sectors = 0;
 	iocored->queue_restart_jiffies = jiffies;
-	iocored->max_sectors_in_pending = 0;
+	atomic64_set(&iocored->copied_bytes, 0);
+	atomic64_set(&iocored->referenced_bytes, 0);
+	atomic64_set(&iocored->absorbed_bytes, 0);
+	atomic64_set(&iocored->n_merged_bios, 0);
+	atomic64_set(&iocored->n_merged_biows, 0);
+	spin_lock_init(&iocored->ldev_flush_lock);
+	atomic64_set(&iocored->ldev_flush_started, 0);
+	iocored->ldev_flush_done = 0;
+	iocored->ldev_flush_err = 0;
+	iocored->ldev_flush_running = NULL;
+	iocored->ldev_flush_next = NULL;
+	init_waitqueue_head(&iocored->ldev_flush_wait_q);
+	atomic64_set(&iocored->n_flush_requested, 0);
+	atomic64_set(&iocored->n_flush_issued, 0);
+	iocored->queue_stop_jiffies = jiffies;
+	atomic64_set(&iocored->queue_stopped_jiffies, 0);
+	atomic64_set(&iocored->n_logpack, 0);
+	atomic64_set(&iocored->n_fua, 0);
+	atomic64_set(&iocored->n_discard, 0);
+	atomic64_set(&iocored->logged_bytes, 0);
+
+	/* Per-CPU staging queues. */
+	iocored->staging_queue = alloc_percpu_gfp(struct llist_head, gfp_mask);
+	if (!iocored->staging_queue) {
+		LOGe("staging_queue allocation failure.\n");
+		goto error2;
+	}
+	for_each_possible_cpu(cpu)
+		init_llist_head(per_cpu_ptr(iocored->staging_queue, cpu));
+	INIT_LIST_HEAD(&iocored->staging_list);
+
+	if (!walb_latency_hist_init(&iocored->lat_hist, gfp_mask)) {
+		LOGe("lat_hist allocation failure.\n");
+		goto error3;
+	}
 
 #ifdef WALB_DEBUG
 	atomic_set(&iocored->n_flush_io, 0);
@@ -1627,13 +1887,11 @@ static struct iocore_data* create_iocore_data(gfp_t gfp_mask)
 #endif
 	return iocored;
 
+error3:
+	free_percpu(iocored->staging_queue);
 error2:
-	multimap_destroy(iocored->pending_data);
-
-#ifdef WALB_OVERLAPPED_SERIALIZE
+	kfree(iocored->pending_shards);
 error1:
-	multimap_destroy(iocored->overlapped_data);
-#endif
 	kfree(iocored);
 error0:
 	return NULL;
@@ -1646,10 +1904,25 @@ static void destroy_iocore_data(struct iocore_data *iocored)
 {
 	ASSERT(iocored);
 
-	multimap_destroy(iocored->pending_data);
+#ifdef WALB_DEBUG
+	{
+		unsigned int i;
+		for (i = 0; i < iocored->n_pending_shards; i++) {
+			ASSERT(RB_EMPTY_ROOT(&iocored->pending_shards[i].data));
+			ASSERT(iocored->pending_shards[i].sectors == 0);
+		}
+	}
+#endif
 #ifdef WALB_OVERLAPPED_SERIALIZE
-	multimap_destroy(iocored->overlapped_data);
+	ASSERT(RB_EMPTY_ROOT(&iocored->overlapped_data));
 #endif
+	ASSERT(is_staging_queues_empty(iocored));
+	ASSERT(list_empty(&iocored->staging_list));
+	ASSERT(!iocored->ldev_flush_running);
+	ASSERT(!iocored->ldev_flush_next);
+	free_percpu(iocored->staging_queue);
+	walb_latency_hist_exit(&iocored->lat_hist);
+	kfree(iocored->pending_shards);
 	kfree(iocored);
 }
 
@@ -1672,30 +1945,124 @@ static void make_frozen_queue_empty(struct iocore_data *iocored)
 }
 
 /**
- * Push a bio wrapper into the logpack submit queue if not stopped,
- * else use frozen queue.
+ * Push a bio wrapper into the staging queue of the current CPU.
+ * This does not take any lock nor write any shared data
+ * except the staging queue.
+ * task_submit_logpack_list() will move it to the logpack submit queue
+ * if not stopped, else the frozen queue.
  *
  * RETURN:
- *   true if the logpack submit queue is not empty.
+ *   true if the submit task should be dispatched.
  */
 static bool push_into_lpack_submit_queue(struct bio_wrapper *biow)
 {
-       struct walb_dev *wdev = biow->private_data;
-       struct iocore_data *iocored = get_iocored_from_wdev(wdev);
-       bool ret;
+	struct walb_dev *wdev = biow->private_data;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct llist_head *head;
+
+	/* Preemption is disabled to keep the staging_ns order
+	   in each staging queue. */
+	head = get_cpu_ptr(iocored->staging_queue);
+	biow->staging_ns = ktime_get_ns();
+	llist_add(&biow->llnode, head);
+	put_cpu_ptr(iocored->staging_queue);
+	return true;
+}
 
-       spin_lock(&iocored->logpack_submit_queue_lock);
-       if (is_frozen(iocored)) {
-               list_add_tail(&biow->list, &iocored->frozen_queue);
-               ret = !list_empty(&iocored->logpack_submit_queue);
-       } else {
-               make_frozen_queue_empty(iocored);
-               list_add_tail(&biow->list, &iocored->logpack_submit_queue);
-               ret = true;
-       }
-       spin_unlock(&iocored->logpack_submit_queue_lock);
+/**
+ * Comparator for list_sort() of bio wrappers by staging_ns.
+ */
+static int cmp_bio_wrapper_by_staging_ns(
+	void *priv, struct list_head *a, struct list_head *b)
+{
+	const struct bio_wrapper *biow_a = list_entry(a, struct bio_wrapper, list);
+	const struct bio_wrapper *biow_b = list_entry(b, struct bio_wrapper, list);
+
+	if (biow_a->staging_ns < biow_b->staging_ns)
+		return -1;
+	if (biow_a->staging_ns > biow_b->staging_ns)
+		return 1;
+	return 0;
+}
+
+/**
+ * Move bio wrappers in the per-CPU staging queues to iocored->staging_list
+ * and sort it by staging_ns.
+ *
+ * A submitter stages its bio wrappers one by one,
+ * so a bio wrapper of it with staging_ns before the returned time
+ * is preceded by all its previous bio wrappers in staging_list.
+ * The lock is not required because only the submit task calls this.
+ *
+ * RETURN:
+ *   time before which bio wrappers can be moved by splice_staging_list().
+ */
+static u64 sort_staging_queues(struct iocore_data *iocored)
+{
+	struct bio_wrapper *biow, *next;
+	bool is_added = false;
+	u64 end_ns;
+	int cpu;
+
+	end_ns = ktime_get_ns();
+	/* Read the staging queues after the clock. */
+	smp_mb();
+
+	for_each_possible_cpu(cpu) {
+		struct llist_node *node;
+
+		node = llist_del_all(per_cpu_ptr(iocored->staging_queue, cpu));
+		node = llist_reverse_order(node);
+		llist_for_each_entry_safe(biow, next, node, llnode) {
+			list_add_tail(&biow->list, &iocored->staging_list);
+			is_added = true;
+		}
+	}
+	if (is_added) {
+		/* Stable, so bio wrappers of each CPU keep their order. */
+		list_sort(NULL, &iocored->staging_list,
+			cmp_bio_wrapper_by_staging_ns);
+	}
+	return end_ns;
+}
+
+/**
+ * Move bio wrappers staged before end_ns in iocored->staging_list
+ * to the logpack submit queue if not stopped, else the frozen queue.
+ *
+ * iocored->logpack_submit_queue_lock must be held.
+ */
+static void splice_staging_list(struct iocore_data *iocored, u64 end_ns)
+{
+	struct list_head *dst;
+	struct bio_wrapper *biow, *next;
+
+	if (is_frozen(iocored)) {
+		dst = &iocored->frozen_queue;
+	} else {
+		make_frozen_queue_empty(iocored);
+		dst = &iocored->logpack_submit_queue;
+	}
+	list_for_each_entry_safe(biow, next, &iocored->staging_list, list) {
+		if (biow->staging_ns >= end_ns)
+			break;
+		list_move_tail(&biow->list, dst);
+	}
+}
 
-       return ret;
+/**
+ * RETURN:
+ *   true if all the per-CPU staging queues are empty.
+ */
+static bool is_staging_queues_empty(struct iocore_data *iocored)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (!llist_empty(per_cpu_ptr(iocored->staging_queue, cpu)))
+			return false;
+	}
+	return true;
 }
 
 static void update_biow_lsid(struct walb_logpack_header *logh, struct bio_wrapper *biow)
@@ -1817,59 +2184,52 @@ error0:
 }
 
 /**
- * Insert a bio wrapper to a sorted bio wrapper list.
- * using insertion sort.
+ * Add a bio wrapper to the tail of a list to be sorted by position.
  *
- * They are sorted by biow->pos.
  * Use biow->list4 for list operations.
- *
- * Sort cost is O(n^2) in a worst case,
- * while the cost is O(1) in sequential write.
+ * *is_sortedp will be false if the list is no longer sorted by biow->pos,
+ * so sequential writes need not to be sorted.
  *
  * @biow (struct bio_wrapper *)
  * @biow_list (struct list_head *)
+ * @is_sortedp (bool *)
  */
-static void insert_to_sorted_bio_wrapper_list_by_pos(
-	struct bio_wrapper *biow, struct list_head *biow_list)
+static void add_to_bio_wrapper_list_to_sort(
+	struct bio_wrapper *biow, struct list_head *biow_list, bool *is_sortedp)
 {
-	struct bio_wrapper *biow_tmp, *biow_next;
-	bool moved;
-#ifdef WALB_DEBUG
-	sector_t pos;
-#endif
-
 	ASSERT(biow);
 	ASSERT(biow_list);
+	ASSERT(is_sortedp);
 
-	if (!list_empty(biow_list)) {
-		/* last entry. */
-		biow_tmp = list_last_entry(biow_list, struct bio_wrapper, list4);
-		ASSERT(biow_tmp);
-		if (biow->pos > biow_tmp->pos) {
-			list_add_tail(&biow->list4, biow_list);
-			return;
-		}
-	}
-	moved = false;
-	list_for_each_entry_safe_reverse(biow_tmp, biow_next, biow_list, list4) {
-		if (biow->pos > biow_tmp->pos) {
-			list_add(&biow->list4, &biow_tmp->list4);
-			moved = true;
-			break;
-		}
-	}
-	if (!moved) {
-		list_add(&biow->list4, biow_list);
+	if (*is_sortedp && !list_empty(biow_list)) {
+		struct bio_wrapper *biow_last =
+			list_last_entry(biow_list, struct bio_wrapper, list4);
+		if (biow->pos < biow_last->pos)
+			*is_sortedp = false;
 	}
+	list_add_tail(&biow->list4, biow_list);
+}
 
-#ifdef WALB_DEBUG
-	pos = 0;
-	list_for_each_entry_safe(biow_tmp, biow_next, biow_list, list4) {
-		LOG_("%" PRIu64 "\n", (u64)biow_tmp->pos);
-		ASSERT(pos <= biow_tmp->pos);
-		pos = biow_tmp->pos;
-	}
-#endif
+/**
+ * Comparator for list_sort() of bio wrappers linked with biow->list4.
+ *
+ * list_sort() is a stable merge sort,
+ * so sort cost is O(n log n) even in a worst case
+ * and bio wrappers of the same position keep their lsid order.
+ */
+static int cmp_bio_wrapper_by_pos(
+	void *priv, struct list_head *a, struct list_head *b)
+{
+	const struct bio_wrapper *biow_a =
+		list_entry(a, struct bio_wrapper, list4);
+	const struct bio_wrapper *biow_b =
+		list_entry(b, struct bio_wrapper, list4);
+
+	if (biow_a->pos < biow_b->pos)
+		return -1;
+	if (biow_a->pos > biow_b->pos)
+		return 1;
+	return 0;
 }
 
 /**
@@ -1888,10 +2248,44 @@ static void writepack_check_and_set_zeroflush(struct pack *wpack, bool *is_flush
 	}
 }
 
+/**
+ * Check whether the zero-flush bio wrappers of a pack
+ * complete with a coalesced log device flush.
+ */
+static bool is_zero_flush_deferred(struct pack *wpack)
+{
+	return wpack->is_zero_flush_only && pack_header_should_flush(wpack);
+}
+
 static bool wait_for_logpack_header(struct pack *wpack)
 {
 	bool success;
 	struct bio_entry *bioe = &wpack->header_bioe;
+	struct walb_dev *wdev = wpack->wdev;
+	u64 gen;
+
+	/* The flush of a zero-flush-only pack is coalesced with others.
+	   Its bio wrappers are passed to the flush
+	   and they complete when the flush completes. */
+	if (wpack->is_zero_flush_only) {
+		ASSERT(!bio_entry_exists(bioe));
+		if (!is_zero_flush_deferred(wpack))
+			return true;
+		if (test_bit(WALB_STATE_READ_ONLY, &wdev->flags))
+			return false;
+		/* All the log IOs of the previous packs have completed here.
+		   Only a flush started after now makes them permanent. */
+		spin_lock(&wdev->lsid_lock);
+		wpack->new_permanent_lsid = wdev->lsids.completed;
+		update_flush_lsid_if_necessary(wdev, wpack->new_permanent_lsid);
+		spin_unlock(&wdev->lsid_lock);
+		gen = atomic64_read(
+			&get_iocored_from_wdev(wdev)->ldev_flush_started);
+		request_ldev_flush(wdev, gen,
+				wpack->new_permanent_lsid, &wpack->biow_list, NULL);
+		ASSERT(list_empty(&wpack->biow_list));
+		return true;
+	}
 
 	/* bioe->bio may be null when the flush request is not really required. */
 	if (!bio_entry_exists(bioe)) return true;
@@ -1917,8 +2311,13 @@ static void wait_for_logpack_and_submit_datapack(
 	struct bio_wrapper *biow, *biow_next;
 	bool is_failed = false;
 	struct iocore_data *iocored;
-	bool is_pending_insert_succeeded;
 	bool is_stop_queue = false;
+	struct fua_flush *ff = NULL;
+	const struct walb_logpack_header *logh =
+		get_logpack_header(wpack->logpack_header_sector);
+	unsigned int n_fua = 0, n_discard = 0;
+	u64 logged_bytes = 0;
+	bool is_cached = false;
 
 	ASSERT(wpack);
 	ASSERT(wdev);
@@ -1931,8 +2330,10 @@ static void wait_for_logpack_and_submit_datapack(
 	if (!wait_for_logpack_header(wpack))
 		is_failed = true;
 
-	/* Update permanent_lsid if necessary. */
-	if (!is_failed && pack_header_should_flush(wpack)) {
+	/* Update permanent_lsid if necessary.
+	   The flush of a zero-flush-only pack will do it. */
+	if (!is_failed && pack_header_should_flush(wpack) &&
+		!is_zero_flush_deferred(wpack)) {
 		bool should_notice = false;
 		ASSERT(wpack->new_permanent_lsid != INVALID_LSID);
 		spin_lock(&wdev->lsid_lock);
@@ -1942,11 +2343,19 @@ static void wait_for_logpack_and_submit_datapack(
 			LOG_("log_flush_completed_header\n");
 		}
 		spin_unlock(&wdev->lsid_lock);
+		notify_lsids_updated(wdev);
 		if (should_notice)
 			walb_sysfs_notify(wdev, "lsids");
 	}
 
 	iocored = get_iocored_from_wdev(wdev);
+
+	/* Cache the logpack for walblog device reads. */
+	if (!is_failed)
+		is_cached = walb_log_cache_begin_pack(
+			&iocored->log_cache,
+			get_logpack_header(wpack->logpack_header_sector));
+
 	/*
 	 * For each biow,
 	 *   (1) Wait for each log IOs corresponding to the biow.
@@ -1964,6 +2373,8 @@ static void wait_for_logpack_and_submit_datapack(
 		biow->ts[WALB_TIME_W_LOG_COMPLETED] = end_ts;
 		getnstimeofday(&biow->ts[WALB_TIME_W_LOG_END]);
 #endif
+		if (biow->len > 0)
+			record_stage_latency(biow, WALB_LAT_LOG_WRITE);
 		if (biow->len == 0) {
 			/* Zero-flush. */
 			ASSERT(wpack->is_zero_flush_only);
@@ -1977,6 +2388,12 @@ static void wait_for_logpack_and_submit_datapack(
 				bio_wrapper_state_is_discard(biow);
 			const bool support_discard =
 				blk_queue_discard(bdev_get_queue(wdev->ddev));
+			if (is_discard)
+				n_discard++;
+			else
+				logged_bytes += (u64)biow->len << 9;
+			if (biow->copied_bio->bi_opf & REQ_FUA)
+				n_fua++;
 			if (!is_discard || support_discard) {
 				/* Create all related bio(s) by copying IO data. */
 				init_bio_entry_by_clone_never_giveup(
@@ -1996,63 +2413,55 @@ static void wait_for_logpack_and_submit_datapack(
 						GFP_NOIO);
 			}
 
-			/* Try to insert pending data. */
-		retry_insert_pending:
-			spin_lock(&iocored->pending_data_lock);
-			LOG_("pending_sectors %u\n", iocored->pending_sectors);
-			is_stop_queue = should_stop_queue(wdev, biow);
-			if (is_discard) {
-				/* Discard IO does not have buffer of biow->len bytes.
-				   We consider its metadata only. */
-				iocored->pending_sectors++;
-				is_pending_insert_succeeded = true;
-			} else {
-				iocored->pending_sectors += biow->len;
-				is_pending_insert_succeeded =
-					pending_insert_and_delete_fully_overwritten(
-						iocored->pending_data,
-						&iocored->max_sectors_in_pending,
-						biow, GFP_ATOMIC);
-			}
-			spin_unlock(&iocored->pending_data_lock);
-			if (!is_pending_insert_succeeded) {
-				spin_lock(&iocored->pending_data_lock);
-				if (bio_wrapper_state_is_discard(biow)) {
-					iocored->pending_sectors--;
-				} else {
-					iocored->pending_sectors -= biow->len;
-				}
-				spin_unlock(&iocored->pending_data_lock);
-				schedule();
-				goto retry_insert_pending;
-			}
+			/* Insert pending data. */
+			is_stop_queue = insert_bio_wrapper_to_pending_data(
+				wdev, biow);
+
+			/* Data of lazy redo must not overwrite it.
+			   Reads of the range see the pending data from now on. */
+			if (test_bit(WALB_STATE_LAZY_REDO, &wdev->flags))
+				overwrite_lazy_redo(wdev, biow->pos, biow->len);
 
 			/* Check pending data size and stop the queue if needed. */
-			if (is_stop_queue && !test_and_set_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
+			if (is_stop_queue && !test_and_set_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags)) {
+				iocored->queue_stop_jiffies = jiffies;
 				freeze_detail(iocored, false);
+			}
 
-			/* We must flush here for REQ_FUA request before calling bio_endio().
+			/* We must flush for REQ_FUA request before calling bio_endio()
 			   because WalB must flush all the previous logpacks and
 			   the logpack header and all the previous IOs and itself in the same logpack
-			   in order to make the IO be permanent in the log device. */
+			   in order to make the IO be permanent in the log device.
+			   The original bio is passed to a fua_flush which is
+			   submitted after all the logs of the pack have completed.
+			   Zero-copy biow will call bio_endio() after its data IO,
+			   which waits for the flush through permanent_lsid. */
 			if (biow->copied_bio->bi_opf & REQ_FUA) {
-				u32 pb;
-				if (bio_wrapper_state_is_discard(biow))
-					pb = 0;
-				else
-					pb = capacity_pb(wdev->physical_bs, biow->len);
-				spin_lock(&wdev->lsid_lock);
-				wdev->lsids.completed = biow->lsid + pb;
-				spin_unlock(&wdev->lsid_lock);
-				force_flush_ldev(wdev);
+				if (!ff)
+					ff = create_fua_flush_never_giveup(
+						wdev, logh->n_records);
+				if (!bio_wrapper_state_is_zero_copy(biow)) {
+					BIO_WRAPPER_PRINT("log1", biow);
+					add_bio_wrapper_to_fua_flush(ff, biow);
+				}
 			}
 
 			/* call endio here in fast algorithm,
-			   while easy algorithm call it after data device IO. */
-			io_acct_end(biow);
-			BIO_WRAPPER_PRINT("log1", biow);
-			bio_endio(biow->bio);
-			biow->bio = NULL;
+			   while easy algorithm call it after data device IO.
+			   Zero-copy biow must keep the original bio
+			   until its data IO has completed. */
+			if (biow->bio && !bio_wrapper_state_is_zero_copy(biow)) {
+				io_acct_end(biow);
+				BIO_WRAPPER_PRINT("log1", biow);
+				bio_endio(biow->bio);
+				biow->bio = NULL;
+			}
+
+			/* Copy after bio_endio() not to delay it.
+			   copied_bio is valid until the biow is enqueued. */
+			if (is_cached && !is_discard)
+				walb_log_cache_add_bio(
+					&iocored->log_cache, biow->lsid, biow->copied_bio);
 
 			bio_wrapper_state_set_prepared(biow);
 			BIO_WRAPPER_CHANGE_STATE(biow);
@@ -2081,7 +2490,22 @@ static void wait_for_logpack_and_submit_datapack(
 		spin_lock(&wdev->lsid_lock);
 		wdev->lsids.completed = get_next_lsid(logh);
 		spin_unlock(&wdev->lsid_lock);
+		if (is_cached)
+			walb_log_cache_end_pack(&iocored->log_cache);
 	}
+	trace_walb_logpack_complete(
+		wdev, get_logpack_header(wpack->logpack_header_sector), is_failed);
+	if (n_fua > 0)
+		atomic64_add(n_fua, &iocored->n_fua);
+	if (n_discard > 0)
+		atomic64_add(n_discard, &iocored->n_discard);
+	if (logged_bytes > 0)
+		atomic64_add(logged_bytes, &iocored->logged_bytes);
+	/* Flush for REQ_FUA write IOs of the pack. */
+	if (ff)
+		submit_fua_flush(ff);
+	/* Waiters must also wake up when the device became read-only. */
+	notify_lsids_updated(wdev);
 }
 
 /**
@@ -2113,6 +2537,8 @@ static void wait_for_write_bio_wrapper(
 #ifdef WALB_PERFORMANCE_ANALYSIS
 	biow->ts[WALB_TIME_W_DATA_COMPLETED] = end_ts;
 #endif
+	if (!bio_wrapper_state_is_absorbed(biow))
+		record_stage_latency(biow, WALB_LAT_DATA_WRITE);
 
 #ifdef WALB_DEBUG
 	ASSERT(bio_wrapper_state_is_submitted(biow));
@@ -2125,8 +2551,7 @@ static void wait_for_write_bio_wrapper(
 	INIT_LIST_HEAD(&should_submit_list);
 	spin_lock(&iocored->overlapped_data_lock);
 	n_should_submit = overlapped_delete_and_notify(
-		iocored->overlapped_data,
-		&iocored->max_sectors_in_overlapped,
+		&iocored->overlapped_data,
 		&should_submit_list, biow
 #ifdef WALB_DEBUG
 		, &iocored->overlapped_out_id
@@ -2148,6 +2573,9 @@ static void wait_for_write_bio_wrapper(
 				biow_tmp, (u64)biow_tmp->pos, biow_tmp->len);
 			c++;
 			BIO_WRAPPER_PRINT("data1", biow);
+			if (test_bit(WALB_STATE_LAZY_REDO, &wdev->flags))
+				wait_for_lazy_redo_applying(
+					wdev, biow_tmp->pos, biow_tmp->len);
 			submit_write_bio_wrapper(biow_tmp, is_plug);
 		}
 		blk_finish_plug(&plug);
@@ -2161,64 +2589,208 @@ static void wait_for_write_bio_wrapper(
 	if (starts_queue && test_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags)) {
 		if (melt_detail(iocored, false))
 			dispatch_submit_log_task(wdev);
-		clear_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags);
+		if (test_and_clear_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
+			atomic64_add(jiffies - iocored->queue_stop_jiffies,
+				&iocored->queue_stopped_jiffies);
 	}
 
 	/* Put related bio(s) and free resources. */
 	if (bio_entry_exists(&biow->cloned_bioe)) {
 		fin_bio_entry(&biow->cloned_bioe);
-	} else {
+	} else if (!bio_wrapper_state_is_absorbed(biow)) {
 		ASSERT(bio_wrapper_state_is_discard(biow));
 		ASSERT(!blk_queue_discard(bdev_get_queue(wdev->ddev)));
 	}
+
+	if (bio_wrapper_state_is_zero_copy(biow))
+		end_zero_copy_bio_wrapper(biow);
 }
 
 /**
- * Wait for completion of cloned_bioe related to a bio_wrapper.
- * and call bio_endio()/io_acct_end(), delete cloned_bioe if required.
- *
- * @biow target bio_wrapper.
- *   Do not assume biow->bio is available when is_endio is false.
- * @is_endio
- *   if true, call bio_endio() and io_acct_end() for biow->bio.
- * @is_delete
- *   destroy biow->cloned_bioe.
- * @end_ts
- *   end timestamp.
+ * Complete the original bio of a zero-copy bio wrapper.
+ * The clone referencing its pages is put before that
+ * because the pages belong to the upper layer.
  *
- * CONTEXT:
- *   non-irq. non-atomic.
+ * The biow must not be in pending data.
  */
-static void wait_for_bio_wrapper_io(struct bio_wrapper *biow, bool is_endio, bool is_delete, struct timespec *end_ts)
+static void end_zero_copy_bio_wrapper(struct bio_wrapper *biow)
 {
-	struct bio_entry *bioe;
-	struct walb_dev *wdev;
-	ASSERT(biow);
-	ASSERT(biow->status == BLK_STS_OK);
-	ASSERT(end_ts);
-	bioe = &biow->cloned_bioe;
-	wdev = biow->private_data;
-	ASSERT(wdev);
+	ASSERT(bio_wrapper_state_is_zero_copy(biow));
+	ASSERT(biow->bio);
+	ASSERT(biow->copied_bio);
 
-	if (bio_entry_exists(bioe)) {
-		wait_for_bio_entry(bioe, completion_timeo_ms_, wdev_minor(wdev));
-		biow->status = bioe->status;
-	} else
-		ASSERT(biow->len == 0 || bio_wrapper_state_is_discard(biow));
+	if (biow->copied_bio->bi_opf & REQ_FUA)
+		wait_for_fua_flush(biow->private_data, biow);
+	bio_put(biow->copied_bio);
+	biow->copied_bio = NULL;
 
-#ifdef WALB_PERFORMANCE_ANALYSIS
-	*end_ts = bioe->end_ts;
-#endif
-	if (is_endio) {
-		ASSERT(biow->bio);
-		BIO_WRAPPER_PRINT_CSUM("read2", biow);
-#ifdef WALB_PERFORMANCE_ANALYSIS
-		if (!bio_wrapper_state_is_write(biow)) {
-			biow->ts[WALB_TIME_R_COMPLETED] = *end_ts;
-			getnstimeofday(&biow->ts[WALB_TIME_R_END]);
-		}
-#endif
-		io_acct_end(biow);
+	io_acct_end(biow);
+	BIO_WRAPPER_PRINT("log1", biow);
+	if (biow->status)
+		bio_io_error(biow->bio);
+	else
+		bio_endio(biow->bio);
+	biow->bio = NULL;
+}
+
+/**
+ * Wait for the fua_flush of the logpack of a REQ_FUA zero-copy bio wrapper.
+ * The flush has been submitted before its data IO,
+ * so it usually has completed already.
+ */
+static void wait_for_fua_flush(struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	const u64 lsid = biow->lsid + capacity_pb(wdev->physical_bs, biow->len);
+
+	wait_event(get_iocored_from_wdev(wdev)->lsids_wait_q,
+		lsid <= get_lsid_to_wait(wdev, true) ||
+		test_bit(WALB_STATE_READ_ONLY, &wdev->flags));
+	if (lsid > get_lsid_to_wait(wdev, true))
+		biow->status = BLK_STS_IOERR;
+}
+
+/**
+ * Check whether a page of a write bio will not be modified
+ * until the bio completes.
+ *
+ * Page cache pages under writeback are stable if the backing device
+ * of their mapping requires stable pages,
+ * because writers to them wait for the end of the writeback.
+ * Anonymous pages such as O_DIRECT buffers are not stable.
+ * The flag of the walb device itself does not matter here.
+ */
+static bool is_stable_page(struct page *page)
+{
+	struct address_space *mapping;
+
+	if (!PageWriteback(page) || PageAnon(page) || PageSwapCache(page))
+		return false;
+	mapping = page_mapping(page);
+	if (!mapping || !mapping->host)
+		return false;
+	return bdi_cap_stable_pages_required(inode_to_bdi(mapping->host));
+}
+
+/**
+ * Check whether a write bio can be logged without copying its data.
+ *
+ * All the pages must be stable until the bio completes.
+ * Otherwise the logpack, the data device, and the checksum
+ * may not be the same.
+ *
+ * Zero-copy is not used with the apply delay
+ * because the original bio completes after its data IO
+ * and stable pages are not rewritten in the delay to be absorbed.
+ */
+static bool can_reference_bio_pages(struct walb_dev *wdev, struct bio *bio)
+{
+	struct bio_vec bv;
+	struct bvec_iter iter;
+
+	if (!zero_copy_write_ || wdev->apply_delay_jiffies > 0)
+		return false;
+	if (bio_op(bio) != REQ_OP_WRITE || !bio_has_data(bio))
+		return false;
+	bio_for_each_segment(bv, bio, iter) {
+		if (!is_stable_page(bv.bv_page))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Prepare the data and the checksum of a write bio wrapper.
+ *
+ * The checksum is calculated here in the submitter context
+ * so that the cost is spread over CPUs
+ * instead of serialized in task_submit_logpack_list().
+ * So the data must not change after that until the log IO is done.
+ * The original pages are referenced only if they are stable
+ * (see can_reference_bio_pages()).
+ * Otherwise the data are copied first and the checksum is
+ * calculated over the copy.
+ *
+ * RETURN:
+ *   true in success, or false in memory allocation failure.
+ */
+static bool prepare_write_data(struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct bio *bio = biow->bio;
+
+	if (can_reference_bio_pages(wdev, bio)) {
+		/* Reference the original pages.
+		   The original bio will be completed
+		   after its data IO. */
+		biow->copied_bio = bio_clone_fast(bio, GFP_NOIO, walb_bio_set_);
+		if (!biow->copied_bio)
+			return false;
+		set_bit(BIO_WRAPPER_ZERO_COPY, &biow->flags);
+		atomic64_add(bio->bi_iter.bi_size, &iocored->referenced_bytes);
+	} else {
+		/* Allocate another buffer and copy bio data.
+		   Do not use original bio's data from now. */
+		biow->copied_bio = bio_deep_clone(
+			bio, &iocored->page_pool, GFP_NOIO);
+		if (!biow->copied_bio)
+			return false;
+		if (bio_has_data(bio))
+			atomic64_add(bio->bi_iter.bi_size, &iocored->copied_bytes);
+	}
+
+	biow->csum = bio_calc_checksum(
+		biow->copied_bio, wdev->log_checksum_type,
+		wdev->log_checksum_salt);
+	return true;
+}
+
+/**
+ * Wait for completion of cloned_bioe related to a bio_wrapper.
+ * and call bio_endio()/io_acct_end(), delete cloned_bioe if required.
+ *
+ * @biow target bio_wrapper.
+ *   Do not assume biow->bio is available when is_endio is false.
+ * @is_endio
+ *   if true, call bio_endio() and io_acct_end() for biow->bio.
+ * @is_delete
+ *   destroy biow->cloned_bioe.
+ * @end_ts
+ *   end timestamp.
+ *
+ * CONTEXT:
+ *   non-irq. non-atomic.
+ */
+static void wait_for_bio_wrapper_io(struct bio_wrapper *biow, bool is_endio, bool is_delete, struct timespec *end_ts)
+{
+	struct bio_entry *bioe;
+	struct walb_dev *wdev;
+	ASSERT(biow);
+	ASSERT(biow->status == BLK_STS_OK);
+	ASSERT(end_ts);
+	bioe = &biow->cloned_bioe;
+	wdev = biow->private_data;
+	ASSERT(wdev);
+
+	if (bio_entry_exists(bioe)) {
+		wait_for_bio_entry(bioe, completion_timeo_ms_, wdev_minor(wdev));
+		biow->status = bioe->status;
+	} else
+		ASSERT(biow->len == 0 || bio_wrapper_state_is_discard(biow) ||
+			bio_wrapper_state_is_absorbed(biow));
+
+#ifdef WALB_PERFORMANCE_ANALYSIS
+	*end_ts = bioe->end_ts;
+#endif
+	if (is_endio) {
+		ASSERT(biow->bio);
+		BIO_WRAPPER_PRINT_CSUM("read2", biow);
+#ifdef WALB_PERFORMANCE_ANALYSIS
+		if (!bio_wrapper_state_is_write(biow)) {
+			biow->ts[WALB_TIME_R_COMPLETED] = *end_ts;
+			getnstimeofday(&biow->ts[WALB_TIME_R_END]);
+		}
+#endif
+		io_acct_end(biow);
 		if (biow->status)
 			bio_io_error(biow->bio);
 		else
@@ -2234,8 +2806,8 @@ static void wait_for_bio_wrapper_io(struct bio_wrapper *biow, bool is_endio, boo
  */
 static void submit_write_bio_wrapper(struct bio_wrapper *biow, bool is_plugging)
 {
-#ifdef WALB_DEBUG
 	struct walb_dev *wdev = biow->private_data;
+#ifdef WALB_DEBUG
 	const bool bioe_exists = bio_entry_exists(&biow->cloned_bioe);
 #endif
 	struct blk_plug plug;
@@ -2263,6 +2835,12 @@ static void submit_write_bio_wrapper(struct bio_wrapper *biow, bool is_plugging)
 #ifdef WALB_PERFORMANCE_ANALYSIS
 	getnstimeofday(&biow->ts[WALB_TIME_W_DATA_SUBMITTED]);
 #endif
+	record_stage_latency(biow, WALB_LAT_LOG_FLUSH);
+	if (can_absorb_write_bio_wrapper(wdev, biow)) {
+		absorb_write_bio_wrapper(wdev, biow);
+		return;
+	}
+
 	/* Submit all related bio(s). */
 	if (is_plugging)
 		blk_start_plug(&plug);
@@ -2275,6 +2853,242 @@ static void submit_write_bio_wrapper(struct bio_wrapper *biow, bool is_plugging)
 		blk_finish_plug(&plug);
 }
 
+/**
+ * Check whether the data IO of a bio wrapper can be skipped.
+ *
+ * The data of an overwritten biow will be written by the newer biow.
+ * The data IO can be skipped only if the log of the newer biow is permanent.
+ * Otherwise the data will be lost by a crash after written_lsid
+ * has passed the biow, because redo will not find the newer log.
+ */
+static bool can_absorb_write_bio_wrapper(
+	struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	u64 permanent_lsid;
+
+	if (!bio_wrapper_state_is_overwritten(biow))
+		return false;
+	/* Pairs with smp_mb__before_atomic()
+	   in pending_delete_fully_overwritten(). */
+	smp_rmb();
+
+	spin_lock(&wdev->lsid_lock);
+	permanent_lsid = wdev->lsids.permanent;
+	spin_unlock(&wdev->lsid_lock);
+
+	/* permanent_lsid never points to the middle of a log,
+	   so the whole log of the newer biow is permanent. */
+	return biow->overwritten_lsid < permanent_lsid;
+}
+
+/**
+ * Skip the data IO of a bio wrapper.
+ * It will be completed by wait_for_write_bio_wrapper() as usual.
+ */
+static void absorb_write_bio_wrapper(
+	struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	ASSERT(!bio_wrapper_state_is_discard(biow));
+	ASSERT(bio_entry_exists(&biow->cloned_bioe));
+
+	put_all_bio_list(&biow->cloned_bio_list);
+	biow->cloned_bioe.bio = NULL; // cloned_bio_list contains cloned_bioe->bio.
+	set_bit(BIO_WRAPPER_ABSORBED, &biow->flags);
+	atomic64_add((u64)biow->len << 9, &iocored->absorbed_bytes);
+	BIO_WRAPPER_PRINT("absorbed", biow);
+}
+
+/**
+ * Submit data IOs of a sorted bio wrapper list.
+ *
+ * Adjacent bio wrappers are merged into one bio
+ * within the limits of the data device.
+ *
+ * @biow_list bio wrappers linked with biow->list4.
+ *   It will be empty.
+ */
+static void submit_write_bio_wrapper_list(
+	struct walb_dev *wdev, struct list_head *biow_list)
+{
+	struct bio_wrapper *biow, *biow_next;
+	struct write_merge wm;
+	const unsigned int max_sectors =
+		queue_max_sectors(bdev_get_queue(wdev->ddev));
+
+	INIT_LIST_HEAD(&wm.biow_list);
+	wm.n_biow = 0;
+	list_for_each_entry_safe(biow, biow_next, biow_list, list4) {
+		list_del(&biow->list4);
+		BIO_WRAPPER_CHANGE_STATE(biow);
+		BIO_WRAPPER_PRINT("data0", biow);
+		if (test_bit(WALB_STATE_LAZY_REDO, &wdev->flags))
+			wait_for_lazy_redo_applying(wdev, biow->pos, biow->len);
+		if (!is_mergeable_write_bio_wrapper(wdev, biow)) {
+			submit_write_bio_wrapper(biow, false);
+			continue;
+		}
+		if (!can_add_to_write_merge(wdev, &wm, biow, max_sectors))
+			submit_write_merge(wdev, &wm);
+		add_to_write_merge(&wm, biow);
+	}
+	submit_write_merge(wdev, &wm);
+}
+
+/**
+ * Check whether the data IO of a bio wrapper can be merged with others.
+ *
+ * Bio wrappers split for chunks are not merged
+ * because their clones are chained.
+ */
+static bool is_mergeable_write_bio_wrapper(
+	struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	struct bio *clone = biow->cloned_bioe.bio;
+
+	if (!merge_data_io_ || bio_wrapper_state_is_discard(biow))
+		return false;
+	if (!clone || bio_list_size(&biow->cloned_bio_list) != 1)
+		return false;
+	ASSERT(bio_list_peek(&biow->cloned_bio_list) == clone);
+	if (bio_op(clone) != REQ_OP_WRITE)
+		return false;
+	/* Absorbed bio wrappers do not issue IOs. */
+	return !can_absorb_write_bio_wrapper(wdev, biow);
+}
+
+static bool can_add_to_write_merge(
+	struct walb_dev *wdev, const struct write_merge *wm,
+	struct bio_wrapper *biow, unsigned int max_sectors)
+{
+	const unsigned int chunk_sectors = wdev->ddev_chunk_sectors;
+
+	if (wm->n_biow == 0)
+		return true;
+	if (wm->pos + wm->len != biow->pos)
+		return false;
+	if (wm->len + biow->len > max_sectors)
+		return false;
+	if (wm->n_vecs + bio_segments(biow->cloned_bioe.bio) > BIO_MAX_PAGES)
+		return false;
+	if (chunk_sectors > 0) {
+		sector_t bgn = wm->pos;
+		sector_t last = biow->pos + biow->len - 1;
+		do_div(bgn, chunk_sectors);
+		do_div(last, chunk_sectors);
+		if (bgn != last)
+			return false;
+	}
+	return true;
+}
+
+static void add_to_write_merge(
+	struct write_merge *wm, struct bio_wrapper *biow)
+{
+	if (wm->n_biow == 0) {
+		wm->pos = biow->pos;
+		wm->len = 0;
+		wm->n_vecs = 0;
+	}
+	list_add_tail(&biow->list4, &wm->biow_list);
+	wm->n_biow++;
+	wm->len += biow->len;
+	wm->n_vecs += bio_segments(biow->cloned_bioe.bio);
+}
+
+/**
+ * Submit the data IOs of bio wrappers in a write merge as one bio.
+ * The write merge will be empty.
+ *
+ * The cloned bios of the bio wrappers are not submitted
+ * and their cloned_bioe will be completed by merged_bio_end_io().
+ * If allocation fails, they are submitted separately.
+ */
+static void submit_write_merge(struct walb_dev *wdev, struct write_merge *wm)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct bio_wrapper *biow, *biow_next;
+	struct merged_bio_private *mpriv = NULL;
+	struct bio *bio = NULL;
+
+	if (wm->n_biow == 0)
+		return;
+	if (wm->n_biow > 1) {
+		mpriv = kmalloc(sizeof(*mpriv) +
+				sizeof(struct bio_entry *) * wm->n_biow, GFP_NOIO);
+		if (mpriv)
+			bio = bio_alloc(GFP_NOIO, wm->n_vecs);
+	}
+	if (!bio) {
+		kfree(mpriv);
+		list_for_each_entry_safe(biow, biow_next, &wm->biow_list, list4) {
+			list_del(&biow->list4);
+			submit_write_bio_wrapper(biow, false);
+		}
+		goto fin;
+	}
+
+	bio->bi_bdev = wdev->ddev;
+	bio_set_op_attrs(bio, REQ_OP_WRITE, 0);
+	bio->bi_iter.bi_sector = wm->pos;
+	bio->bi_private = mpriv;
+	bio->bi_end_io = merged_bio_end_io;
+	mpriv->n_bioe = 0;
+	list_for_each_entry_safe(biow, biow_next, &wm->biow_list, list4) {
+		struct bio *clone = biow->cloned_bioe.bio;
+		struct bio_vec bv;
+		struct bvec_iter iter;
+		UNUSED unsigned int len;
+
+		list_del(&biow->list4);
+#ifdef WALB_DEBUG
+		ASSERT(bio_wrapper_state_is_prepared(biow));
+#endif
+		bio_wrapper_state_set_submitted(biow);
+#ifdef WALB_PERFORMANCE_ANALYSIS
+		getnstimeofday(&biow->ts[WALB_TIME_W_DATA_SUBMITTED]);
+#endif
+		record_stage_latency(biow, WALB_LAT_LOG_FLUSH);
+		bio_for_each_segment(bv, clone, iter) {
+			len = bio_add_page(bio, bv.bv_page, bv.bv_len, bv.bv_offset);
+			ASSERT(len == bv.bv_len);
+		}
+		/* The clone will be put by fin_bio_entry(). */
+		bio_list_init(&biow->cloned_bio_list);
+		mpriv->bioe[mpriv->n_bioe++] = &biow->cloned_bioe;
+	}
+	ASSERT(mpriv->n_bioe == wm->n_biow);
+	ASSERT(bio_sectors(bio) == wm->len);
+	atomic64_inc(&iocored->n_merged_bios);
+	atomic64_add(wm->n_biow, &iocored->n_merged_biows);
+	generic_make_request(bio);
+fin:
+	INIT_LIST_HEAD(&wm->biow_list);
+	wm->n_biow = 0;
+}
+
+/**
+ * Complete all the bio entries of a merged bio.
+ * Their bio wrappers must not be touched after completion.
+ */
+static void merged_bio_end_io(struct bio *bio)
+{
+	struct merged_bio_private *mpriv = bio->bi_private;
+	unsigned int i;
+
+	for (i = 0; i < mpriv->n_bioe; i++) {
+		struct bio_entry *bioe = mpriv->bioe[i];
+		bioe->status = bio->bi_status;
+#ifdef WALB_PERFORMANCE_ANALYSIS
+		getnstimeofday(&bioe->end_ts);
+#endif
+		complete(&bioe->done);
+	}
+	kfree(mpriv);
+	bio_put(bio);
+}
+
 static void cancel_write_bio_wrapper(struct walb_dev *wdev, struct bio_wrapper *biow)
 {
 	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
@@ -2298,6 +3112,8 @@ static void cancel_write_bio_wrapper(struct walb_dev *wdev, struct bio_wrapper *
 	}
 
 	biow->status = BLK_STS_IOERR;
+	if (bio_wrapper_state_is_zero_copy(biow))
+		end_zero_copy_bio_wrapper(biow);
 	complete(&biow->done);
 }
 
@@ -2314,6 +3130,9 @@ static void submit_read_bio_wrapper(
 	bool ret;
 	struct bio_entry *bioe = &biow->cloned_bioe;
 	struct bio_list *bio_list = &biow->cloned_bio_list;
+	struct pending_shard_range range;
+	struct list_head biow_list;
+	unsigned int i, n_overlapped_bios;
 
 	ASSERT(bio_list_empty(bio_list));
 
@@ -2329,11 +3148,25 @@ static void submit_read_bio_wrapper(
 
 	/* Check pending data and copy data from executing write requests. */
 	BIO_WRAPPER_PRINT_LS("read0", biow, bio_list_size(bio_list));
-	spin_lock(&iocored->pending_data_lock);
-	ret = pending_check_and_copy(
-		iocored->pending_data,
-		iocored->max_sectors_in_pending, biow, GFP_ATOMIC);
-	spin_unlock(&iocored->pending_data_lock);
+	INIT_LIST_HEAD(&biow_list);
+	n_overlapped_bios = 0;
+	get_pending_shard_range(iocored, biow, &range);
+	lock_pending_shards(iocored, &range);
+	for (i = 0; i < range.n; i++) {
+		struct pending_shard *shard =
+			get_pending_shard_in_range(iocored, &range, i);
+		n_overlapped_bios += pending_collect_overlapped(
+			&shard->data, biow, &biow_list);
+	}
+	ret = pending_copy_overlapped(
+		biow, &biow_list, n_overlapped_bios, GFP_ATOMIC);
+	/* Read data not redone yet from the log device.
+	   Write IOs remove extents of lazy redo
+	   after they are inserted to pending data,
+	   so the pending shards must be locked here. */
+	if (ret && test_bit(WALB_STATE_LAZY_REDO, &wdev->flags))
+		ret = redirect_read_for_lazy_redo(wdev, bio_list, GFP_ATOMIC);
+	unlock_pending_shards(iocored, &range);
 	if (!ret)
 		goto error1;
 
@@ -2365,38 +3198,241 @@ error0:
 }
 
 /**
- * Submit a flush request.
+ * Create a ldev_flush.
+ * It is counted as a pending bio until it completes.
+ */
+static struct ldev_flush* create_ldev_flush_never_giveup(struct walb_dev *wdev)
+{
+	struct ldev_flush *lf;
+
+	for (;;) {
+		lf = kmalloc(sizeof(*lf), GFP_NOIO);
+		if (lf)
+			break;
+		schedule();
+	}
+	lf->wdev = wdev;
+	INIT_WORK(&lf->work, task_end_ldev_flush);
+	lf->gen = 0;
+	INIT_LIST_HEAD(&lf->biow_list);
+	INIT_LIST_HEAD(&lf->fua_list);
+	lf->new_permanent_lsid = 0;
+	lf->status = BLK_STS_OK;
+	atomic_inc(&get_iocored_from_wdev(wdev)->n_pending_bio);
+	return lf;
+}
+
+/**
+ * Request a log device flush coalescing concurrent flush requests.
  *
- * @bioe bio entry to use.
- * @bdev block device.
+ * A request is satisfied by a flush started after the request arrived,
+ * so requests arriving while a flush is in flight share the next one.
+ * This does not wait for the flush.
+ *
+ * @gen iocored->ldev_flush_started read after the request arrived.
+ * @new_permanent_lsid permanent_lsid will be this after the flush.
+ *   0 means nothing.
+ * @biow_list zero-flush bio wrappers linked with biow->list.
+ *   They will complete when the flush completes. It will be empty.
+ * @ff REQ_FUA write IOs to complete when the flush completes.
+ *   It may be NULL.
  *
  * RETURN:
- *   true if a bio was allocated and submitted.
+ *   generation of the flush that satisfies the request.
  * CONTEXT:
  *   non-atomic.
  */
-static bool submit_flush(struct bio_entry *bioe, struct block_device *bdev)
+static u64 request_ldev_flush(
+	struct walb_dev *wdev, u64 gen, u64 new_permanent_lsid,
+	struct list_head *biow_list, struct fua_flush *ff)
 {
-	struct bio *bio;
-	ASSERT(!bio_entry_exists(bioe));
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct ldev_flush *lf, *lf_new, *lf_submit = NULL;
+	u64 ret;
+
+	atomic64_inc(&iocored->n_flush_requested);
+	lf_new = create_ldev_flush_never_giveup(wdev);
+
+	spin_lock(&iocored->ldev_flush_lock);
+	lf = iocored->ldev_flush_running;
+	if (!lf || lf->gen <= gen) {
+		/* The running flush may not cover the request. */
+		lf = iocored->ldev_flush_next;
+		if (!lf) {
+			lf = lf_new;
+			lf_new = NULL;
+			lf->gen = atomic64_read(&iocored->ldev_flush_started) + 1;
+			iocored->ldev_flush_next = lf;
+		}
+	}
+	list_splice_tail_init(biow_list, &lf->biow_list);
+	if (ff)
+		list_add_tail(&ff->list, &lf->fua_list);
+	lf->new_permanent_lsid = max(lf->new_permanent_lsid, new_permanent_lsid);
+	ret = lf->gen;
+	if (!iocored->ldev_flush_running) {
+		lf_submit = iocored->ldev_flush_next;
+		iocored->ldev_flush_next = NULL;
+		iocored->ldev_flush_running = lf_submit;
+		atomic64_set(&iocored->ldev_flush_started, lf_submit->gen);
+	}
+	spin_unlock(&iocored->ldev_flush_lock);
 
-	bio = bio_alloc(GFP_NOIO, 0);
-	if (!bio)
-		return false;
+	if (lf_new) {
+		atomic_dec(&iocored->n_pending_bio);
+		kfree(lf_new);
+	}
+	if (lf_submit)
+		submit_ldev_flush(lf_submit);
+	return ret;
+}
 
-	bio->bi_bdev = bdev;
+/**
+ * Submit a flush request to the log device without waiting for it.
+ */
+static void submit_ldev_flush(struct ldev_flush *lf)
+{
+	struct walb_dev *wdev = lf->wdev;
+	struct bio *bio;
+
+	atomic64_inc(&get_iocored_from_wdev(wdev)->n_flush_issued);
+	trace_walb_ldev_flush_submit(wdev, lf->gen, lf->new_permanent_lsid);
+	if (!supports_flush_request_bdev(wdev->ldev)) {
+		queue_work(wq_unbound_, &lf->work);
+		return;
+	}
+	for (;;) {
+		bio = bio_alloc(GFP_NOIO, 0);
+		if (bio)
+			break;
+		schedule();
+	}
+	bio->bi_bdev = wdev->ldev;
 	bio_set_op_attrs(bio, REQ_OP_WRITE, REQ_PREFLUSH);
+	bio->bi_end_io = bio_end_io_for_ldev_flush;
+	bio->bi_private = lf;
+	generic_make_request(bio);
+}
 
-	init_bio_entry(bioe, bio);
-	ASSERT(bio_entry_len(bioe) == 0);
+static void bio_end_io_for_ldev_flush(struct bio *bio)
+{
+	struct ldev_flush *lf = bio->bi_private;
 
-	generic_make_request(bio);
-	return true;
-#if 0
-error0:
-	fin_bio_entry(bioe);
-	return false;
-#endif
+	lf->status = bio->bi_status;
+	bio_put(bio);
+	queue_work(wq_unbound_, &lf->work);
+}
+
+/**
+ * Submit the next flush, update permanent_lsid,
+ * and complete the bio wrappers and the fua_flushes of a ldev_flush.
+ */
+static void task_end_ldev_flush(struct work_struct *work)
+{
+	struct ldev_flush *lf = container_of(work, struct ldev_flush, work);
+	struct walb_dev *wdev = lf->wdev;
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct ldev_flush *lf_next;
+	struct bio_wrapper *biow, *biow_next;
+	struct fua_flush *ff, *ff_next;
+	bool should_notice = false;
+
+	if (lf->status) {
+		WLOGe(wdev, "log device flush failed. try to be read-only mode\n");
+		set_bit(WALB_STATE_READ_ONLY, &wdev->flags);
+	} else if (lf->new_permanent_lsid > 0) {
+		spin_lock(&wdev->lsid_lock);
+		if (wdev->lsids.permanent < lf->new_permanent_lsid) {
+			should_notice = is_permanent_log_empty(&wdev->lsids);
+			ASSERT(lf->new_permanent_lsid <= wdev->lsids.flush);
+			wdev->lsids.permanent = lf->new_permanent_lsid;
+			LOG_("log_flush_completed_coalesced\n");
+		}
+		ASSERT(lsid_set_is_valid(&wdev->lsids));
+		spin_unlock(&wdev->lsid_lock);
+	}
+
+	spin_lock(&iocored->ldev_flush_lock);
+	ASSERT(iocored->ldev_flush_running == lf);
+	iocored->ldev_flush_done = lf->gen;
+	iocored->ldev_flush_err = blk_status_to_errno(lf->status);
+	lf_next = iocored->ldev_flush_next;
+	iocored->ldev_flush_next = NULL;
+	iocored->ldev_flush_running = lf_next;
+	if (lf_next)
+		atomic64_set(&iocored->ldev_flush_started, lf_next->gen);
+	spin_unlock(&iocored->ldev_flush_lock);
+	trace_walb_ldev_flush_complete(
+		wdev, lf->gen, blk_status_to_errno(lf->status));
+	wake_up_all(&iocored->ldev_flush_wait_q);
+	if (lf_next)
+		submit_ldev_flush(lf_next);
+
+	notify_lsids_updated(wdev);
+	if (should_notice)
+		walb_sysfs_notify(wdev, "lsids");
+
+	list_for_each_entry_safe(biow, biow_next, &lf->biow_list, list) {
+		ASSERT(biow->len == 0);
+		ASSERT(!bio_entry_exists(&biow->cloned_bioe));
+		list_del(&biow->list);
+		io_acct_end(biow);
+		if (lf->status)
+			bio_io_error(biow->bio);
+		else
+			bio_endio(biow->bio);
+		destroy_bio_wrapper_dec(wdev, biow);
+	}
+	list_for_each_entry_safe(ff, ff_next, &lf->fua_list, list) {
+		list_del(&ff->list);
+		end_fua_flush(ff, lf->status);
+	}
+	atomic_dec(&iocored->n_pending_bio);
+	kfree(lf);
+}
+
+/**
+ * Flush the log device coalescing concurrent flush requests
+ * and wait for it.
+ *
+ * Do not call this in the log wait task.
+ * Use request_ldev_flush() instead.
+ *
+ * @gen iocored->ldev_flush_started read after the request arrived.
+ *
+ * RETURN:
+ *   0 in success, or error of the latest completed flush.
+ * CONTEXT:
+ *   non-atomic.
+ */
+static int flush_ldev_coalesced(struct walb_dev *wdev, u64 gen)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct list_head empty;
+	int err;
+
+	INIT_LIST_HEAD(&empty);
+	gen = request_ldev_flush(wdev, gen, 0, &empty, NULL);
+	wait_event(iocored->ldev_flush_wait_q,
+		is_ldev_flush_done(iocored, gen, &err));
+	return err;
+}
+
+/**
+ * Check whether the flush of a generation has completed.
+ *
+ * @err_p error of the latest completed flush will be set.
+ */
+static bool is_ldev_flush_done(
+	struct iocore_data *iocored, u64 gen, int *err_p)
+{
+	bool ret;
+
+	spin_lock(&iocored->ldev_flush_lock);
+	ret = iocored->ldev_flush_done >= gen;
+	*err_p = iocored->ldev_flush_err;
+	spin_unlock(&iocored->ldev_flush_lock);
+	return ret;
 }
 
 /**
@@ -2491,6 +3527,12 @@ static void wait_for_logpack_submit_queue_empty(struct walb_dev *wdev)
                spin_lock(&iocored->logpack_submit_queue_lock);
                is_empty = list_empty(&iocored->logpack_submit_queue);
                spin_unlock(&iocored->logpack_submit_queue_lock);
+               /* Staged bio wrappers will be moved to the submit queue
+                  or the frozen queue by the submit task.
+                  It may be sorting them without the lock. */
+               is_empty = is_empty && is_staging_queues_empty(iocored) &&
+                       !test_bit(IOCORE_STATE_SUBMIT_LOG_TASK_WORKING,
+                               &iocored->flags);
 
                if (is_empty)
                        return;
@@ -2521,7 +3563,7 @@ static void wait_for_all_pending_gc_done(struct walb_dev *wdev)
 static void force_flush_ldev(struct walb_dev *wdev)
 {
 	int err;
-	u64 new_permanent_lsid;
+	u64 new_permanent_lsid, gen;
 	bool should_notice = false;
 
 	/* Get completed_lsid and update flush_lsid. */
@@ -2529,19 +3571,22 @@ static void force_flush_ldev(struct walb_dev *wdev)
 	new_permanent_lsid = wdev->lsids.completed;
 	update_flush_lsid_if_necessary(wdev, new_permanent_lsid);
 	spin_unlock(&wdev->lsid_lock);
+	gen = atomic64_read(&get_iocored_from_wdev(wdev)->ldev_flush_started);
 
 #if 0
 	WLOGi(wdev, "force_flush lsid %" PRIu64 "\n", new_permanent_lsid);
 #endif
 
 	/* Execute a flush request. */
+	err = 0;
 	if (supports_flush_request_bdev(wdev->ldev)) {
-		err = blkdev_issue_flush(wdev->ldev, GFP_NOIO, NULL);
+		err = flush_ldev_coalesced(wdev, gen);
 		if (err) {
 			WLOGe(wdev, "log device flush failed. try to be read-only mode\n");
 			set_bit(WALB_STATE_READ_ONLY, &wdev->flags);
 		}
 	}
+	trace_walb_force_flush(wdev, new_permanent_lsid, err);
 
 #ifdef WALB_DEBUG
 	atomic_inc(&get_iocored_from_wdev(wdev)->n_flush_force);
@@ -2557,10 +3602,116 @@ static void force_flush_ldev(struct walb_dev *wdev)
 	}
 	ASSERT(lsid_set_is_valid(&wdev->lsids));
 	spin_unlock(&wdev->lsid_lock);
+	notify_lsids_updated(wdev);
 	if (should_notice)
 		walb_sysfs_notify(wdev, "lsids");
 }
 
+/**
+ * Create a fua_flush.
+ * It is counted as a pending bio until the original bios complete.
+ *
+ * @max_n_bio max number of original bios to add.
+ */
+static struct fua_flush* create_fua_flush_never_giveup(
+	struct walb_dev *wdev, unsigned int max_n_bio)
+{
+	struct fua_flush *ff;
+
+	for (;;) {
+		ff = kmalloc(sizeof(*ff) + sizeof(struct fua_flush_bio) * max_n_bio,
+			GFP_NOIO);
+		if (ff)
+			break;
+		schedule();
+	}
+	ff->wdev = wdev;
+	INIT_LIST_HEAD(&ff->list);
+	ff->n_bio = 0;
+	ff->max_n_bio = max_n_bio;
+	atomic_inc(&get_iocored_from_wdev(wdev)->n_pending_bio);
+	return ff;
+}
+
+/**
+ * Pass the original bio of a REQ_FUA write bio wrapper to a fua_flush.
+ * It will be accounted and completed when the flush completes.
+ */
+static void add_bio_wrapper_to_fua_flush(
+	struct fua_flush *ff, struct bio_wrapper *biow)
+{
+	struct fua_flush_bio *fb;
+
+	ASSERT(ff->n_bio < ff->max_n_bio);
+	ASSERT(biow->bio);
+	fb = &ff->bios[ff->n_bio++];
+	fb->bio = biow->bio;
+	fb->start_time = biow->start_time;
+	fb->begin_ns = biow->begin_ns;
+	biow->bio = NULL;
+}
+
+/**
+ * Request a log device flush for a fua_flush without waiting for it.
+ * All the logs of REQ_FUA write IOs in the fua_flush must have completed.
+ *
+ * CONTEXT:
+ *   non-atomic.
+ */
+static void submit_fua_flush(struct fua_flush *ff)
+{
+	struct walb_dev *wdev = ff->wdev;
+	struct list_head empty;
+	u64 new_permanent_lsid, gen;
+
+	/* Get completed_lsid and update flush_lsid. */
+	spin_lock(&wdev->lsid_lock);
+	new_permanent_lsid = wdev->lsids.completed;
+	update_flush_lsid_if_necessary(wdev, new_permanent_lsid);
+	spin_unlock(&wdev->lsid_lock);
+	gen = atomic64_read(&get_iocored_from_wdev(wdev)->ldev_flush_started);
+
+#ifdef WALB_DEBUG
+	atomic_inc(&get_iocored_from_wdev(wdev)->n_flush_force);
+#endif
+
+	trace_walb_fua_flush(wdev, new_permanent_lsid, ff->n_bio);
+	INIT_LIST_HEAD(&empty);
+	request_ldev_flush(wdev, gen, new_permanent_lsid, &empty, ff);
+}
+
+/**
+ * Complete the original bios of a fua_flush.
+ * This is called by task_end_ldev_flush()
+ * after permanent_lsid has been updated.
+ * Their IO latency includes the flush.
+ */
+static void end_fua_flush(struct fua_flush *ff, blk_status_t status)
+{
+	struct walb_dev *wdev = ff->wdev;
+	unsigned int i;
+
+	for (i = 0; i < ff->n_bio; i++) {
+		struct fua_flush_bio *fb = &ff->bios[i];
+		const unsigned long duration_ms = io_acct_end_detail(
+			wdev, WRITE, fb->start_time, fb->begin_ns);
+
+		if (io_latency_threshold_ms_ > 0 &&
+			duration_ms > io_latency_threshold_ms_) {
+			WLOGw(wdev, "IO latency exceeds threshold: %lu W "
+				"FUA pos %" PRIu64 " len %u\n"
+				, duration_ms, (u64)fb->bio->bi_iter.bi_sector
+				, bio_sectors(fb->bio));
+		}
+		if (status)
+			bio_io_error(fb->bio);
+		else
+			bio_endio(fb->bio);
+	}
+	atomic_dec(&get_iocored_from_wdev(wdev)->n_pending_bio);
+	kfree(ff);
+}
+
 /**
  * Wait for all logs permanent which lsid <= specified 'lsid'.
  *
@@ -2579,8 +3730,10 @@ static void force_flush_ldev(struct walb_dev *wdev)
  */
 static bool wait_for_log_permanent(struct walb_dev *wdev, u64 lsid)
 {
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
 	struct lsid_set lsids;
 	unsigned long timeout_jiffies;
+	long timeo;
 
 	/* We will wait for log flush at most the given interval period. */
 	timeout_jiffies = jiffies + wdev->log_flush_interval_jiffies;
@@ -2594,26 +3747,75 @@ retry:
 		/* No need to wait. */
 		return true;
 	}
-	if (lsid > lsids.completed) {
-		/* The ldev IO is still not completed. */
-		msleep(1);
-		goto retry;
-	}
-	if (lsid <= lsids.flush) {
-		/* Flush request to make lsid permanent will be completed soon. */
-		msleep(1);
-		goto retry;
+	if (lsid > lsids.completed || lsid <= lsids.flush) {
+		/* The ldev IO is still not completed, or
+		   flush request to make lsid permanent will be completed soon. */
+		timeo = LSIDS_WAIT_TIMEO;
+		goto wait;
 	}
 	if (time_is_after_jiffies(timeout_jiffies) &&
 		lsid < lsids.flush + wdev->log_flush_interval_pb) {
 		/* Too early to force flush log device.
 		   Wait for a while. */
-		msleep(1);
-		goto retry;
+		timeo = min_t(long, LSIDS_WAIT_TIMEO, timeout_jiffies - jiffies);
+		if (timeo > 0)
+			goto wait;
 	}
 
-	force_flush_ldev(wdev);
-	return !test_bit(WALB_STATE_READ_ONLY, &wdev->flags);
+	force_flush_ldev(wdev);
+	return !test_bit(WALB_STATE_READ_ONLY, &wdev->flags);
+
+wait:
+	wait_event_timeout(iocored->lsids_wait_q,
+			is_lsids_updated(wdev, &lsids), timeo);
+	goto retry;
+}
+
+/**
+ * Wake up the tasks waiting for wdev->lsids to be updated.
+ *
+ * Call this after updating wdev->lsids and releasing wdev->lsid_lock.
+ */
+static void notify_lsids_updated(struct walb_dev *wdev)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	/* wq_has_sleeper() contains a memory barrier
+	   pairing with the one in prepare_to_wait(). */
+	if (wq_has_sleeper(&iocored->lsids_wait_q))
+		wake_up_all(&iocored->lsids_wait_q);
+}
+
+/**
+ * Get permanent_lsid or completed_lsid.
+ */
+static u64 get_lsid_to_wait(struct walb_dev *wdev, bool is_permanent)
+{
+	u64 lsid;
+
+	spin_lock(&wdev->lsid_lock);
+	lsid = is_permanent ? wdev->lsids.permanent : wdev->lsids.completed;
+	spin_unlock(&wdev->lsid_lock);
+	return lsid;
+}
+
+/**
+ * Check whether wdev->lsids has been changed from a snapshot,
+ * or the device has become read-only mode.
+ */
+static bool is_lsids_updated(
+	struct walb_dev *wdev, const struct lsid_set *lsids)
+{
+	bool ret;
+
+	if (test_bit(WALB_STATE_READ_ONLY, &wdev->flags))
+		return true;
+	spin_lock(&wdev->lsid_lock);
+	ret = wdev->lsids.completed != lsids->completed ||
+		wdev->lsids.flush != lsids->flush ||
+		wdev->lsids.permanent != lsids->permanent;
+	spin_unlock(&wdev->lsid_lock);
+	return ret;
 }
 
 /**
@@ -2702,6 +3904,49 @@ static void update_flush_lsid_if_necessary(struct walb_dev *wdev, u64 flush_lsid
        }
 }
 
+/**
+ * Insert a write bio wrapper to the pending data
+ * and delete the pending bio wrappers fully overwritten by it.
+ *
+ * RETURN:
+ *   should_stop_queue() return value.
+ */
+static bool insert_bio_wrapper_to_pending_data(
+	struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct pending_shard *shard = get_pending_shard(iocored, biow->pos);
+	struct pending_shard_range range;
+	bool stops_queue;
+	unsigned int i;
+
+	if (bio_wrapper_state_is_discard(biow)) {
+		/* Discard IO does not have buffer of biow->len bytes.
+		   We consider its metadata only. */
+		spin_lock(&shard->lock);
+		stops_queue = should_stop_queue(wdev, biow);
+		shard->sectors++;
+		spin_unlock(&shard->lock);
+		return stops_queue;
+	}
+
+	/* Overwritten bio wrappers may belong to the other shards. */
+	get_pending_shard_range(iocored, biow, &range);
+	lock_pending_shards(iocored, &range);
+	LOG_("pending_sectors %u\n", get_pending_sectors(iocored));
+	stops_queue = should_stop_queue(wdev, biow);
+	shard->sectors += biow->len;
+	pending_insert(&shard->data, biow);
+	for (i = 0; i < range.n; i++) {
+		pending_delete_fully_overwritten(
+			&get_pending_shard_in_range(iocored, &range, i)->data,
+			biow);
+	}
+	unlock_pending_shards(iocored, &range);
+
+	return stops_queue;
+}
+
 /**
  * RETURN:
  *   should_start_queue() return value.
@@ -2710,30 +3955,146 @@ static bool delete_bio_wrapper_from_pending_data(
 	struct walb_dev *wdev, struct bio_wrapper *biow)
 {
 	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct pending_shard *shard = get_pending_shard(iocored, biow->pos);
 	bool starts_queue;
 
-	spin_lock(&iocored->pending_data_lock);
+	spin_lock(&shard->lock);
 	starts_queue = should_start_queue(wdev, biow);
 	if (bio_wrapper_state_is_discard(biow)) {
-		iocored->pending_sectors--;
+		shard->sectors--;
 	} else {
-		iocored->pending_sectors -= biow->len;
+		shard->sectors -= biow->len;
 		if (!bio_wrapper_state_is_overwritten(biow)) {
-			pending_delete(iocored->pending_data,
-				&iocored->max_sectors_in_pending, biow);
+			pending_delete(&shard->data, biow);
 		}
 	}
-	spin_unlock(&iocored->pending_data_lock);
+	spin_unlock(&shard->lock);
 
 	return starts_queue;
 }
 
+/**
+ * Get the pending data shard containing a position.
+ */
+static struct pending_shard* get_pending_shard(
+	struct iocore_data *iocored, u64 pos)
+{
+	u64 stripe = pos >> PENDING_SHARD_STRIPE_SHIFT;
+
+	return &iocored->pending_shards[
+		do_div(stripe, iocored->n_pending_shards)];
+}
+
+/**
+ * Get the i-th shard in a pending data shard range.
+ */
+static struct pending_shard* get_pending_shard_in_range(
+	struct iocore_data *iocored,
+	const struct pending_shard_range *range, unsigned int i)
+{
+	ASSERT(i < range->n);
+	return &iocored->pending_shards[
+		(range->begin + i) % iocored->n_pending_shards];
+}
+
+/**
+ * Get the range of pending data shards which may contain
+ * write bio wrappers overlapped with a bio wrapper.
+ *
+ * Pending write IOs are not longer than a stripe,
+ * so they start at the previous stripe of biow->pos at least.
+ */
+static void get_pending_shard_range(
+	struct iocore_data *iocored, const struct bio_wrapper *biow,
+	struct pending_shard_range *range)
+{
+	const unsigned int n_shards = iocored->n_pending_shards;
+	u64 first = bio_wrapper_first_pos(biow) >> PENDING_SHARD_STRIPE_SHIFT;
+	const u64 last = bio_wrapper_last_pos(biow) >> PENDING_SHARD_STRIPE_SHIFT;
+
+	if (first > 0)
+		first--;
+	if (last - first + 1 >= n_shards) {
+		range->begin = 0;
+		range->n = n_shards;
+		return;
+	}
+	range->n = last - first + 1;
+	range->begin = do_div(first, n_shards);
+}
+
+/**
+ * Lock pending data shards in ascending order of their index
+ * to avoid deadlock.
+ */
+static void lock_pending_shards(
+	struct iocore_data *iocored, const struct pending_shard_range *range)
+{
+	const unsigned int n_shards = iocored->n_pending_shards;
+	const unsigned int end = range->begin + range->n;
+	unsigned int i;
+
+	ASSERT(range->n <= n_shards);
+
+	/* The wrapped part has smaller indexes. */
+	for (i = 0; i + n_shards < end; i++)
+		spin_lock(&iocored->pending_shards[i].lock);
+	for (i = range->begin; i < min(end, n_shards); i++)
+		spin_lock(&iocored->pending_shards[i].lock);
+}
+
+static void unlock_pending_shards(
+	struct iocore_data *iocored, const struct pending_shard_range *range)
+{
+	unsigned int i;
+
+	for (i = 0; i < range->n; i++)
+		spin_unlock(&get_pending_shard_in_range(iocored, range, i)->lock);
+}
+
+/**
+ * Get total number of pending sectors.
+ *
+ * The other shards may be being updated concurrently,
+ * so the result is approximate unless all the shard locks are held.
+ */
+static unsigned int get_pending_sectors(struct iocore_data *iocored)
+{
+	unsigned int i, sectors = 0;
+
+	for (i = 0; i < iocored->n_pending_shards; i++)
+		sectors += READ_ONCE(iocored->pending_shards[i].sectors);
+	return sectors;
+}
+
+/**
+ * Check whether the pending data is large enough
+ * to apply data IOs without waiting for the apply delay.
+ */
+static bool is_apply_window_full(struct walb_dev *wdev)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	return get_pending_sectors(iocored) >= wdev->min_pending_sectors ||
+		test_bit(WALB_STATE_READ_ONLY, &wdev->flags) ||
+		test_bit(WALB_STATE_FINALIZE, &wdev->flags);
+}
+
+/**
+ * Check whether the apply delay of a bio wrapper has passed.
+ */
+static bool is_apply_due(struct walb_dev *wdev, struct bio_wrapper *biow)
+{
+	return time_is_before_eq_jiffies(
+		biow->start_time + wdev->apply_delay_jiffies);
+}
+
 /**
  * Check whether walb should stop the queue
  * due to too much pending data.
  *
  * CONTEXT:
- *   pending_data_lock must be held.
+ *   The lock of the pending data shard of biow must be held.
  */
 static bool should_stop_queue(
 	struct walb_dev *wdev, struct bio_wrapper *biow)
@@ -2749,7 +4110,7 @@ static bool should_stop_queue(
 	if (test_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
 		return false;
 
-	should_stop = iocored->pending_sectors + biow->len
+	should_stop = get_pending_sectors(iocored) + biow->len
 		> wdev->max_pending_sectors;
 
 	if (should_stop) {
@@ -2766,7 +4127,7 @@ static bool should_stop_queue(
  * because pending data is not too much now.
  *
  * CONTEXT:
- *   pending_data_lock must be held.
+ *   The lock of the pending data shard of biow must be held.
  */
 static bool should_start_queue(
 	struct walb_dev *wdev, struct bio_wrapper *biow)
@@ -2774,6 +4135,7 @@ static bool should_start_queue(
 	bool is_size;
 	bool is_timeout;
 	struct iocore_data *iocored;
+	unsigned int pending_sectors;
 
 	ASSERT(wdev);
 	ASSERT(biow);
@@ -2783,8 +4145,9 @@ static bool should_start_queue(
 	if (!test_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags))
 		return false;
 
-	if (iocored->pending_sectors >= biow->len)
-		is_size = iocored->pending_sectors - biow->len
+	pending_sectors = get_pending_sectors(iocored);
+	if (pending_sectors >= biow->len)
+		is_size = pending_sectors - biow->len
 			< wdev->min_pending_sectors;
 	else
 		is_size = true;
@@ -2794,39 +4157,6 @@ static bool should_start_queue(
 	return is_size || is_timeout;
 }
 
-/**
- * Increment n_users of treemap memory manager and
- * iniitialize mmgr_ if necessary.
- */
-static bool treemap_memory_manager_get(void)
-{
-	bool ret;
-
-	if (atomic_inc_return(&n_users_of_memory_manager_) == 1) {
-		ret = initialize_treemap_memory_manager(
-			&mmgr_, N_ITEMS_IN_MEMPOOL,
-			TREE_NODE_CACHE_NAME,
-			TREE_CELL_HEAD_CACHE_NAME,
-			TREE_CELL_CACHE_NAME);
-		if (!ret) { goto error; }
-	}
-	return true;
-error:
-	atomic_dec(&n_users_of_memory_manager_);
-	return false;
-}
-
-/**
- * Decrement n_users of treemap memory manager and
- * finalize mmgr_ if necessary.
- */
-static void treemap_memory_manager_put(void)
-{
-	if (atomic_dec_return(&n_users_of_memory_manager_) == 0) {
-		finalize_treemap_memory_manager(&mmgr_);
-	}
-}
-
 static bool pack_cache_get(void)
 {
 	if (atomic_inc_return(&n_users_of_pack_cache_) == 1) {
@@ -2859,6 +4189,8 @@ static void io_acct_start(struct bio_wrapper *biow)
 	struct hd_struct *part0 = &wdev->gd->part0;
 
 	biow->start_time = jiffies;
+	biow->begin_ns = ktime_get_ns();
+	biow->stage_ns = biow->begin_ns;
 
 	cpu = part_stat_lock();
 	part_round_stats(cpu, part0);
@@ -2874,18 +4206,10 @@ static void io_acct_start(struct bio_wrapper *biow)
 
 static void io_acct_end(struct bio_wrapper *biow)
 {
-	int cpu;
-	int rw = bio_data_dir(biow->bio);
 	struct walb_dev *wdev = biow->private_data;
-	struct hd_struct *part0 = &wdev->gd->part0;
-	unsigned long duration = jiffies - biow->start_time;
-	unsigned long duration_ms = jiffies_to_msecs(duration);
-
-	cpu = part_stat_lock();
-	part_stat_add(cpu, part0, ticks[rw], duration);
-	part_round_stats(cpu, part0);
-	part_dec_in_flight(part0, rw);
-	part_stat_unlock();
+	const int rw = bio_data_dir(biow->bio);
+	const unsigned long duration_ms = io_acct_end_detail(
+		wdev, rw, biow->start_time, biow->begin_ns);
 
 	if (io_latency_threshold_ms_ > 0 && duration_ms > io_latency_threshold_ms_) {
 		char buf[64];
@@ -2896,10 +4220,50 @@ static void io_acct_end(struct bio_wrapper *biow)
 		print_bio_wrapper_performance(KERN_WARNING, biow);
 #endif
 	}
+}
+
+/**
+ * Account the end of an IO started by io_acct_start().
+ *
+ * RETURN:
+ *   IO latency [ms].
+ */
+static unsigned long io_acct_end_detail(
+	struct walb_dev *wdev, int rw, unsigned long start_time, u64 begin_ns)
+{
+	int cpu;
+	struct hd_struct *part0 = &wdev->gd->part0;
+	unsigned long duration = jiffies - start_time;
+
+	walb_latency_hist_add(
+		&get_iocored_from_wdev(wdev)->lat_hist,
+		rw == WRITE ? WALB_LAT_WRITE : WALB_LAT_READ,
+		ktime_get_ns() - begin_ns);
+
+	cpu = part_stat_lock();
+	part_stat_add(cpu, part0, ticks[rw], duration);
+	part_round_stats(cpu, part0);
+	part_dec_in_flight(part0, rw);
+	part_stat_unlock();
 
 #ifdef WALB_DEBUG
 	atomic_dec(&get_iocored_from_wdev(wdev)->n_io_acct);
 #endif
+	return jiffies_to_msecs(duration);
+}
+
+/**
+ * Add the latency of a stage of a write bio wrapper to the histogram
+ * and start the next stage.
+ */
+static void record_stage_latency(struct bio_wrapper *biow, unsigned int stage)
+{
+	struct walb_dev *wdev = biow->private_data;
+	const u64 now = ktime_get_ns();
+
+	walb_latency_hist_add(
+		&get_iocored_from_wdev(wdev)->lat_hist, stage, now - biow->stage_ns);
+	biow->stage_ns = now;
 }
 
 /**
@@ -2960,44 +4324,58 @@ bool iocore_initialize(struct walb_dev *wdev)
 	int ret;
 	struct iocore_data *iocored;
 
-	if (!treemap_memory_manager_get()) {
-		LOGe("Treemap memory manager inc failed.\n");
-		goto error0;
-	}
-
 	if (!pack_cache_get()) {
 		LOGe("Failed to create a kmem_cache for pack.\n");
-		goto error1;
+		goto error0;
 	}
 
 	if (!bio_entry_init()) {
 		LOGe("Failed to init bio_entry.\n");
-		goto error2;
+		goto error1;
 	}
 
 	if (!bio_wrapper_init()) {
 		LOGe("Failed to init bio_wrapper.\n");
-		goto error3;
+		goto error2;
 	}
 
 	if (!pack_work_init()) {
 		LOGe("Failed to init pack_work.\n");
-		goto error4;
+		goto error3;
 	}
 
-	iocored = create_iocore_data(GFP_KERNEL);
+	iocored = create_iocore_data(wdev->n_pending_shards, GFP_KERNEL);
 	if (!iocored) {
 		LOGe("Memory allocation failed.\n");
-		goto error5;
+		goto error4;
 	}
 	wdev->private_data = iocored;
+	iocored->wdev = wdev;
+	INIT_DELAYED_WORK(&iocored->apply_delay_work, task_expire_apply_delay);
+
+	/* Page pool for copied write IOs. */
+	if (!walb_page_pool_init(
+			&iocored->page_pool,
+			wdev->min_pending_sectors >> (PAGE_SHIFT - 9),
+			wdev->max_pending_sectors >> (PAGE_SHIFT - 9))) {
+		LOGe("Failed to init page pool.\n");
+		goto error5;
+	}
+
+	/* Cache of recently written logs. */
+	if (!walb_log_cache_init(
+			&iocored->log_cache, wdev->physical_bs,
+			READ_ONCE(log_cache_mb_), wdev->ring_buffer_size)) {
+		LOGe("Failed to init log cache.\n");
+		goto error6;
+	}
 
 	/* Decide gc worker name and start it. */
 	ret = snprintf(iocored->gc_worker_data.name, WORKER_NAME_MAX_LEN,
 		"%s/%u", WORKER_NAME_GC, MINOR(wdev->devt) / 2);
 	if (ret >= WORKER_NAME_MAX_LEN) {
 		LOGe("Thread name size too long.\n");
-		goto error6;
+		goto error7;
 	}
 	initialize_worker(&iocored->gc_worker_data,
 			run_gc_logpack_list, (void *)wdev);
@@ -3005,22 +4383,24 @@ bool iocore_initialize(struct walb_dev *wdev)
 	return true;
 
 #if 0
-error7:
+error8:
 	finalize_worker(&iocored->gc_worker_data);
 #endif
+error7:
+	walb_log_cache_exit(&iocored->log_cache);
 error6:
+	walb_page_pool_exit(&iocored->page_pool);
+error5:
 	destroy_iocore_data(iocored);
 	wdev->private_data = NULL;
-error5:
-	pack_work_exit();
 error4:
-	bio_wrapper_exit();
+	pack_work_exit();
 error3:
-	bio_entry_exit();
+	bio_wrapper_exit();
 error2:
-	pack_cache_put();
+	bio_entry_exit();
 error1:
-	treemap_memory_manager_put();
+	pack_cache_put();
 error0:
 	return false;
 }
@@ -3039,7 +4419,11 @@ void iocore_finalize(struct walb_dev *wdev)
 	n_flush_force = atomic_read(&iocored->n_flush_force);
 #endif
 
+	cancel_delayed_work_sync(&iocored->apply_delay_work);
+	flush_all_wq();
 	finalize_worker(&iocored->gc_worker_data);
+	walb_log_cache_exit(&iocored->log_cache);
+	walb_page_pool_exit(&iocored->page_pool);
 	destroy_iocore_data(iocored);
 	wdev->private_data = NULL;
 
@@ -3047,7 +4431,6 @@ void iocore_finalize(struct walb_dev *wdev)
 	bio_wrapper_exit();
 	bio_entry_exit();
 	pack_cache_put();
-	treemap_memory_manager_put();
 
 #ifdef WALB_DEBUG
 	LOGi("n_flush_io: %d\nn_flush_logpack: %d\nn_flush_force: %d\n"
@@ -3083,6 +4466,10 @@ void iocore_freeze(struct walb_dev *wdev)
 	   which update wdev->written_lsid. */
 	wait_for_all_pending_gc_done(wdev);
 
+	/* Lazy redo stops at a batch boundary.
+	   written_lsid is kept until lazy redo finishes. */
+	pause_lazy_redo(wdev);
+
 	spin_lock(&wdev->lsid_lock);
 	lsids = wdev->lsids;
 	spin_unlock(&wdev->lsid_lock);
@@ -3090,7 +4477,9 @@ void iocore_freeze(struct walb_dev *wdev)
 		" latest %" PRIu64 ""
 		" written %" PRIu64 "\n"
 		, lsids.latest, lsids.written);
-	ASSERT(lsids.latest == lsids.written);
+	/* It is not the case during lazy redo. */
+	ASSERT(lsids.latest == lsids.written ||
+		test_bit(WALB_STATE_LAZY_REDO, &wdev->flags));
 }
 
 /**
@@ -3102,6 +4491,7 @@ void iocore_melt(struct walb_dev *wdev)
 
 	might_sleep();
 
+	resume_lazy_redo(wdev);
 	if (melt_detail(iocored, true)) {
 		dispatch_submit_log_task(wdev);
 		WLOGi(wdev, "iocore melted.\n");
@@ -3114,7 +4504,6 @@ void iocore_melt(struct walb_dev *wdev)
 void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 {
 	struct bio_wrapper *biow;
-	struct iocore_data *iocored;
 	bool is_write;
 
 	switch(bio_op(bio)) {
@@ -3139,7 +4528,6 @@ void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 		bio_endio(bio);
 		return;
 	}
-	iocored = get_iocored_from_wdev(wdev);
 
 	/* Check whether read-only mode. */
 	if (is_write && test_bit(WALB_STATE_READ_ONLY, &wdev->flags)) {
@@ -3156,6 +4544,7 @@ void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 	}
 	init_bio_wrapper(biow, bio);
 	biow->private_data = wdev;
+	trace_walb_make_request(wdev, biow, is_write);
 
 	/* IO accounting for diskstats. */
 	io_acct_start(biow);
@@ -3165,10 +4554,7 @@ void iocore_make_request(struct walb_dev *wdev, struct bio *bio)
 		getnstimeofday(&biow->ts[WALB_TIME_W_BEGIN]);
 #endif
 
-		/* Allocate another buffer and copy bio data.
-		   Do not use original bio's data from now. */
-		biow->copied_bio = bio_deep_clone(bio, GFP_NOIO);
-		if (!biow->copied_bio)
+		if (!prepare_write_data(wdev, biow))
 			goto error0;
 
 		/* Push into queue and invoke submit task. */
@@ -3203,15 +4589,126 @@ void iocore_log_make_request(struct walb_dev *wdev, struct bio *bio)
 		bio_io_error(bio);
 		return;
 	}
+	if (bio_op(bio) == REQ_OP_READ &&
+		walb_log_cache_read(
+			&get_iocored_from_wdev(wdev)->log_cache, bio,
+			wdev->ring_buffer_off, wdev->ring_buffer_size)) {
+		bio_endio(bio);
+		return;
+	}
 	bio->bi_bdev = wdev->ldev;
 	generic_make_request(bio);
 }
 
+/**
+ * Fill iocore members of a status snapshot.
+ * Pending sectors, queue stopped time, counters, and latencies.
+ */
+void iocore_get_status(struct walb_dev *wdev, struct walb_status *st)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	u64 stopped_jiffies;
+	unsigned int i;
+
+	ASSERT(iocored);
+
+	stopped_jiffies = atomic64_read(&iocored->queue_stopped_jiffies);
+	if (test_bit(IOCORE_STATE_IS_QUEUE_STOPPED, &iocored->flags)) {
+		st->flags |= WALB_STATUS_QUEUE_STOPPED;
+		stopped_jiffies += jiffies - READ_ONCE(iocored->queue_stop_jiffies);
+	}
+	st->queue_stopped_ms = jiffies_to_msecs(stopped_jiffies);
+	st->pending_sectors = get_pending_sectors(iocored);
+	st->max_pending_sectors = wdev->max_pending_sectors;
+	st->min_pending_sectors = wdev->min_pending_sectors;
+
+	st->n_logpack = atomic64_read(&iocored->n_logpack);
+	st->n_flush_requested = atomic64_read(&iocored->n_flush_requested);
+	st->n_flush_issued = atomic64_read(&iocored->n_flush_issued);
+	st->n_fua = atomic64_read(&iocored->n_fua);
+	st->n_discard = atomic64_read(&iocored->n_discard);
+	st->logged_bytes = atomic64_read(&iocored->logged_bytes);
+
+	BUILD_BUG_ON(WALB_STATUS_LAT_MAX != WALB_LAT_MAX);
+	for (i = 0; i < WALB_LAT_MAX; i++) {
+		u64 count, p50_us, p99_us, max_us;
+		walb_latency_hist_summarize(
+			&iocored->lat_hist, i, &count, &p50_us, &p99_us, &max_us);
+		st->latency[i].count = count;
+		st->latency[i].p50_us = p50_us;
+		st->latency[i].p99_us = p99_us;
+		st->latency[i].max_us = max_us;
+	}
+}
+
+/**
+ * Wait for permanent_lsid or completed_lsid to reach a target lsid.
+ *
+ * Waiters are woken up by notify_lsids_updated()
+ * so this does not poll the lsids except for LSIDS_WAIT_TIMEO.
+ *
+ * @wdev walb device.
+ * @lsid target lsid.
+ * @is_permanent true for permanent_lsid, or false for completed_lsid.
+ * @timeout_ms timeout [ms]. 0 means no timeout.
+ * @cur_lsid_p the lsid at return will be set.
+ *
+ * RETURN:
+ *   0 if the lsid has reached the target,
+ *   -ETIMEDOUT, -EINTR if interrupted by a signal,
+ *   or -EIO if the device is read-only mode or dying.
+ */
+int iocore_wait_for_lsid(
+	struct walb_dev *wdev, u64 lsid, bool is_permanent,
+	unsigned int timeout_ms, u64 *cur_lsid_p)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	const unsigned long end_jiffies = jiffies + msecs_to_jiffies(timeout_ms);
+	u64 cur_lsid;
+	long timeo;
+	int err;
+
+	for (;;) {
+		cur_lsid = get_lsid_to_wait(wdev, is_permanent);
+		if (lsid <= cur_lsid) {
+			err = 0;
+			break;
+		}
+		if (test_bit(WALB_STATE_READ_ONLY, &wdev->flags) ||
+			is_wdev_dying(wdev)) {
+			err = -EIO;
+			break;
+		}
+		timeo = LSIDS_WAIT_TIMEO;
+		if (timeout_ms > 0) {
+			if (time_after_eq(jiffies, end_jiffies)) {
+				err = -ETIMEDOUT;
+				break;
+			}
+			timeo = min_t(long, timeo, end_jiffies - jiffies);
+		}
+		if (wait_event_interruptible_timeout(
+				iocored->lsids_wait_q,
+				lsid <= get_lsid_to_wait(wdev, is_permanent) ||
+				test_bit(WALB_STATE_READ_ONLY, &wdev->flags),
+				timeo) == -ERESTARTSYS) {
+			err = -EINTR;
+			break;
+		}
+	}
+	*cur_lsid_p = cur_lsid;
+	return err;
+}
+
 /**
  * Wait for all pending IO(s) for underlying data/log devices.
  */
 void iocore_flush(struct walb_dev *wdev)
 {
+	/* Do not wait for the apply delay to expire. */
+	if (wdev->apply_delay_jiffies > 0)
+		mod_delayed_work(wq_unbound_,
+				&get_iocored_from_wdev(wdev)->apply_delay_work, 0);
 	wait_for_all_pending_io_done(wdev);
 	flush_all_wq();
 }
@@ -3280,7 +4777,8 @@ void destroy_bio_wrapper_dec(
 	ASSERT(biow);
 
 	started = bio_wrapper_state_is_started(biow);
-	destroy_bio_wrapper(biow);
+	/* The copied pages are returned to the page pool. */
+	destroy_bio_wrapper(biow, &iocored->page_pool);
 
 	atomic_dec(&iocored->n_pending_bio);
 	if (started) {
@@ -3298,6 +4796,123 @@ blk_qc_t walb_make_request(struct request_queue *q, struct bio *bio)
 	return BLK_QC_T_NONE;
 }
 
+/**
+ * Completion of a bio clone created by walb_mq_queue_rq().
+ */
+static void walb_mq_bio_endio(struct bio *clone)
+{
+	struct request *rq = clone->bi_private;
+	struct walb_mq_cmd *cmd = blk_mq_rq_to_pdu(rq);
+
+	if (clone->bi_status)
+		cmd->status = clone->bi_status;
+	bio_put(clone);
+
+	if (atomic_dec_and_test(&cmd->nr_bio))
+		blk_mq_end_request(rq, cmd->status);
+}
+
+/**
+ * Create a bio clone for a request of the blk-mq frontend.
+ *
+ * The flush sequence of blk-mq has already handled REQ_PREFLUSH
+ * and REQ_FUA if the request does not have it, so they are cleared.
+ */
+static struct bio* walb_mq_clone_bio(
+	struct request *rq, struct bio *bio, gfp_t gfp_mask)
+{
+	struct bio *clone;
+
+	clone = bio_clone_fast(bio, gfp_mask, walb_bio_set_);
+	if (!clone)
+		return NULL;
+
+	clone->bi_opf &= ~REQ_PREFLUSH;
+	if (!(rq->cmd_flags & REQ_FUA))
+		clone->bi_opf &= ~REQ_FUA;
+	clone->bi_private = rq;
+	clone->bi_end_io = walb_mq_bio_endio;
+	return clone;
+}
+
+/**
+ * Create an empty flush bio for a flush request of the blk-mq frontend.
+ */
+static struct bio* walb_mq_alloc_flush_bio(
+	struct walb_dev *wdev, struct request *rq, gfp_t gfp_mask)
+{
+	struct bio *bio;
+
+	bio = bio_alloc_bioset(gfp_mask, 0, walb_bio_set_);
+	if (!bio)
+		return NULL;
+
+	/*
+	 * The bio is for the walb device itself like bios of the bio path.
+	 * The iocore completes it after flushing the log device.
+	 */
+	bio->bi_bdev = wdev->bdev;
+	bio_set_op_attrs(bio, REQ_OP_WRITE, REQ_PREFLUSH);
+	bio->bi_private = rq;
+	bio->bi_end_io = walb_mq_bio_endio;
+	return bio;
+}
+
+/**
+ * queue_rq callback of the blk-mq frontend.
+ *
+ * All the clones are prepared before submitting any of them,
+ * so the request can be requeued safely in allocation failure.
+ */
+static blk_status_t walb_mq_queue_rq(
+	struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd)
+{
+	struct walb_dev *wdev = get_wdev_from_queue(hctx->queue);
+	struct request *rq = bd->rq;
+	struct walb_mq_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	struct bio_list bio_list;
+	struct bio *bio, *clone;
+	int nr = 0;
+
+	blk_mq_start_request(rq);
+	cmd->status = BLK_STS_OK;
+	bio_list_init(&bio_list);
+
+	if (req_op(rq) == REQ_OP_FLUSH) {
+		clone = walb_mq_alloc_flush_bio(wdev, rq, GFP_NOIO);
+		if (!clone)
+			goto error0;
+		bio_list_add(&bio_list, clone);
+		nr++;
+	} else {
+		__rq_for_each_bio(bio, rq) {
+			clone = walb_mq_clone_bio(rq, bio, GFP_NOIO);
+			if (!clone)
+				goto error0;
+			bio_list_add(&bio_list, clone);
+			nr++;
+		}
+	}
+	if (nr == 0) {
+		blk_mq_end_request(rq, BLK_STS_OK);
+		return BLK_STS_OK;
+	}
+
+	atomic_set(&cmd->nr_bio, nr);
+	while ((clone = bio_list_pop(&bio_list)))
+		iocore_make_request(wdev, clone);
+
+	return BLK_STS_OK;
+
+error0:
+	put_all_bio_list(&bio_list);
+	return BLK_STS_RESOURCE;
+}
+
+const struct blk_mq_ops walb_mq_ops = {
+	.queue_rq = walb_mq_queue_rq,
+};
+
 /**
  * Walblog device make request.
  *
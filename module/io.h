@@ -10,12 +10,20 @@
 #include "check_kernel.h"
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
 #include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include "kern.h"
 #include "bio_wrapper.h"
 #include "worker.h"
-#include "treemap.h"
+#include "page_pool.h"
+#include "latency_hist.h"
+#include "log_cache.h"
 
 /**
  * iocored->flags bit.
@@ -31,6 +39,39 @@ enum {
 	IOCORE_STATE_IS_QUEUE_STOPPED,
 };
 
+/**
+ * Stripe size of pending data shards [logical block] is
+ * (1 << PENDING_SHARD_STRIPE_SHIFT).
+ * It must be larger than WALB_MAX_NORMAL_IO_SECTORS
+ * so that a write IO overlapping a range starts
+ * at the stripe containing the first position of the range,
+ * its previous stripe, or a later stripe within the range.
+ */
+#define PENDING_SHARD_STRIPE_SHIFT 17
+
+/**
+ * A shard of pending data.
+ *
+ * A bio wrapper belongs to the shard of
+ * (its position >> PENDING_SHARD_STRIPE_SHIFT) % n_pending_shards.
+ * When you lock several shards, lock them in ascending order of their index.
+ */
+struct pending_shard
+{
+	/* Use spin_lock()/spin_unlock(). */
+	spinlock_t lock;
+
+	/* Interval tree of bio_wrapper
+	   linked with biow->pending_node. */
+	struct rb_root data;
+
+	/* Number of sectors pending in the shard
+	   [logical block]. */
+	unsigned int sectors;
+} ____cacheline_aligned_in_smp;
+
+struct ldev_flush;
+
 /**
  * (struct walb_dev *)->private_data.
  */
@@ -39,6 +80,22 @@ struct iocore_data
 	/* See IOCORE_STATE_XXXXX */
 	unsigned long flags;
 
+	/*
+	 * Per-CPU staging queues of bio_wrapper.
+	 * Submitters push bio wrappers with llist_add() without any lock
+	 * and task_submit_logpack_list() moves them to
+	 * logpack_submit_queue (or frozen_queue).
+	 *
+	 * Each bio wrapper gets a staging_ns from ktime_get_ns()
+	 * when it is staged. The consumer sorts them by staging_ns
+	 * without the lock and moves the ones staged before it started
+	 * in that order, so the submission order of each submitter is kept.
+	 * The others wait in staging_list for the next round.
+	 * staging_list is accessed by the submit task only.
+	 */
+	struct llist_head __percpu *staging_queue;
+	struct list_head staging_list;
+
 	/*
 	 * There are four queues.
 	 * Each queue must be accessed with its own lock held.
@@ -89,11 +146,8 @@ struct iocore_data
 	 * You must keep address and size information in another way.
 	 */
 	spinlock_t overlapped_data_lock; /* Use spin_lock()/spin_unlock(). */
-	struct multimap *overlapped_data; /* key: blk_rq_pos(req),
-					     val: pointer to req_entry. */
-
-	/* Maximum request size [logical block]. */
-	unsigned int max_sectors_in_overlapped;
+	struct rb_root overlapped_data; /* interval tree of bio_wrapper
+					   linked with biow->overlapped_node. */
 
 #ifdef WALB_DEBUG
 	/* In order to check FIFO property. */
@@ -106,27 +160,92 @@ struct iocore_data
 	/**
 	 * All bio_wrapper data must keep
 	 * biow->bioe_list while they are stored in the pending_data.
+	 *
+	 * Pending data are partitioned into n_pending_shards shards
+	 * by LBA range. See struct pending_shard.
 	 */
-	/* Use spin_lock()/spin_unlock(). */
-	spinlock_t pending_data_lock;
+	unsigned int n_pending_shards;
+	struct pending_shard *pending_shards;
 
-	/* key: biow->pos,
-	   val: pointer to bio_wrapper. */
-	struct multimap *pending_data;
+	/* For queue stopped timeout check. */
+	unsigned long queue_restart_jiffies;
 
-	/* Number of sectors pending
-	   [logical block]. */
-	unsigned int pending_sectors;
+	/* When the queue has stopped, valid while
+	   IOCORE_STATE_IS_QUEUE_STOPPED is set,
+	   and total period the queue has been stopped. */
+	unsigned long queue_stop_jiffies;
+	atomic64_t queue_stopped_jiffies;
 
-	/* Maximum request size [logical block]. */
-	unsigned int max_sectors_in_pending;
+	/* Page pool for bio_deep_clone().
+	   Its watermarks are decided by min/max_pending_sectors. */
+	struct walb_page_pool page_pool;
 
-	/* For queue stopped timeout check. */
-	unsigned long queue_restart_jiffies;
+	/* Write IO bytes copied by bio_deep_clone()
+	   and referenced without copy. */
+	atomic64_t copied_bytes;
+	atomic64_t referenced_bytes;
+
+	/* Write IO bytes not written to the data device
+	   because newer IOs have overwritten them. */
+	atomic64_t absorbed_bytes;
+
+	/* Number of merged bios for the data device
+	   and bio wrappers merged into them. */
+	atomic64_t n_merged_bios;
+	atomic64_t n_merged_biows;
+
+	/*
+	 * Log device flushes are coalesced by generation numbers.
+	 * A flush request is satisfied by a flush
+	 * whose generation is larger than ldev_flush_started
+	 * read after the request arrived. See request_ldev_flush().
+	 *
+	 * At most one flush bio is in flight (ldev_flush_running).
+	 * Requests not satisfied by it are attached to ldev_flush_next
+	 * which is submitted when the running one completes.
+	 * Use spin_lock()/spin_unlock() of ldev_flush_lock
+	 * to access them and ldev_flush_done/err.
+	 */
+	spinlock_t ldev_flush_lock;
+	atomic64_t ldev_flush_started;
+	u64 ldev_flush_done;
+	int ldev_flush_err;
+	struct ldev_flush *ldev_flush_running;
+	struct ldev_flush *ldev_flush_next;
+	/* Waiters for ldev_flush_done to be updated. */
+	wait_queue_head_t ldev_flush_wait_q;
+
+	/* Number of log device flushes requested and really issued. */
+	atomic64_t n_flush_requested;
+	atomic64_t n_flush_issued;
+
+	/* Number of logged packs except for zero-flush ones,
+	   number of logged REQ_FUA and discard IOs,
+	   and logged write IO bytes except for discard. */
+	atomic64_t n_logpack;
+	atomic64_t n_fua;
+	atomic64_t n_discard;
+	atomic64_t logged_bytes;
+
+	/* Latency histograms of IO stages. */
+	struct walb_latency_hist lat_hist;
+
+	/* Cache of recently written logs for walblog device reads. */
+	struct walb_log_cache log_cache;
 
 	/* To check that we should flush log device. */
 	unsigned long log_flush_jiffies;
 
+	/* Waiters for wdev->lsids to be updated.
+	   See notify_lsids_updated(). */
+	wait_queue_head_t lsids_wait_q;
+
+	/* Dispatches the data submit task when the apply delay
+	   of the oldest bio wrapper in the datapack submit queue expires.
+	   See wdev->apply_delay_jiffies. */
+	struct delayed_work apply_delay_work;
+	struct walb_dev *wdev;
+
 #ifdef WALB_DEBUG
 	atomic_t n_flush_io;
 	atomic_t n_flush_logpack;
@@ -153,6 +272,26 @@ static inline struct iocore_data* get_iocored_from_wdev(
 blk_qc_t walb_make_request(struct request_queue *q, struct bio *bio);
 blk_qc_t walblog_make_request(struct request_queue *q, struct bio *bio);
 
+/**
+ * blk-mq frontend.
+ *
+ * Each request is split into bio clones which are passed to
+ * iocore_make_request() and the request completes
+ * when all of them have completed.
+ */
+#define WALB_MQ_QUEUE_DEPTH 128
+
+/**
+ * Per-request data (pdu) of the blk-mq frontend.
+ */
+struct walb_mq_cmd
+{
+	atomic_t nr_bio; /* Number of bio clones not completed yet. */
+	blk_status_t status;
+};
+
+extern const struct blk_mq_ops walb_mq_ops;
+
 /* For iocore interface. */
 bool iocore_initialize(struct walb_dev *wdev);
 void iocore_finalize(struct walb_dev *wdev);
@@ -161,6 +300,10 @@ void iocore_melt(struct walb_dev *wdev);
 void iocore_make_request(struct walb_dev *wdev, struct bio *bio);
 void iocore_log_make_request(struct walb_dev *wdev, struct bio *bio);
 void iocore_flush(struct walb_dev *wdev);
+void iocore_get_status(struct walb_dev *wdev, struct walb_status *st);
+int iocore_wait_for_lsid(
+	struct walb_dev *wdev, u64 lsid, bool is_permanent,
+	unsigned int timeout_ms, u64 *cur_lsid_p);
 
 /* Iocore utilities. */
 void wait_for_all_pending_io_done(struct walb_dev *wdev);
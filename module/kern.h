@@ -13,6 +13,7 @@
 #include <linux/spinlock.h>
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/mutex.h>
 
 #include "linux/walb/common.h"
@@ -42,6 +43,46 @@ extern struct workqueue_struct *wq_misc_;
  */
 extern unsigned int sort_data_io_;
 
+/**
+ * If non-zero, data IOs of adjacent write IOs will be merged.
+ */
+extern unsigned int merge_data_io_;
+
+/**
+ * If non-zero, write IOs from stable-pages callers are not copied.
+ */
+extern unsigned int zero_copy_write_;
+
+/**
+ * If non-zero, walb devices use the blk-mq frontend
+ * instead of the bio-based make_request_fn.
+ */
+extern unsigned int use_blk_mq_;
+
+/**
+ * If non-zero, checksums are calculated with SIMD instructions if possible.
+ */
+extern unsigned int simd_checksum_;
+
+/**
+ * If non-zero, redo writes only the latest data of each block
+ * in each window of this size [MiB].
+ * Larger values are clamped to MAX_REDO_WINDOW_MB.
+ */
+#define MAX_REDO_WINDOW_MB 1024
+extern unsigned int redo_window_mb_;
+
+/**
+ * If non-zero, walb devices start before redo finishes.
+ */
+extern unsigned int lazy_redo_;
+
+/**
+ * Size of the log cache of each walb device [MiB].
+ * 0 means disabled.
+ */
+extern unsigned int log_cache_mb_;
+
 /**
  * Executable binary path for error notification.
  */
@@ -120,8 +161,14 @@ enum {
 
 	/* Overflow state if set. */
 	WALB_STATE_OVERFLOW,
+
+	/* Redo is running in background if set.
+	   lsids.written is kept until it finishes. See redo.c. */
+	WALB_STATE_LAZY_REDO,
 };
 
+struct lazy_redo;
+
 /**
  * The internal representation of walb and walblog device.
  */
@@ -181,6 +228,10 @@ struct walb_dev
 	   This is used for logpack header and log data. */
 	u32 log_checksum_salt;
 
+	/* Log checksum algorithm for log data (WALB_LOG_CHECKSUM_XXX).
+	   Logpack headers always use checksum(). */
+	u32 log_checksum_type;
+
 	/* Lsids and its lock.
 	   Each variable must be accessed with lsid_lock held. */
 	spinlock_t lsid_lock;
@@ -193,6 +244,15 @@ struct walb_dev
 	struct gendisk *gd;
 	atomic_t n_users; /* number of users */
 
+	/* Block device of the whole wrapper device.
+	   Internal bios for the device such as blk-mq flushes use it.
+	   This is valid while the device is registered. */
+	struct block_device *bdev;
+
+	/* blk-mq tag set.
+	   This is used only when the queue is a blk-mq one. */
+	struct blk_mq_tag_set tag_set;
+
 	/*
 	 * For wrapper log device.
 	 */
@@ -237,9 +297,20 @@ struct walb_dev
 	/* If you use IO-scheduling-sensitive storage for the data device,
 	 * you should set larger n_io_bulk value.
 	 * For example, HDD with little cache.
-	 * This must not be so large because we use insertion sort. */
+	 * Sort cost is O(n log n) for the bulk size n. */
 	unsigned int n_io_bulk;
 
+	/* Number of pending data shards.
+	 * Pending data are partitioned by LBA range
+	 * to reduce lock contention among concurrent write IOs. */
+	unsigned int n_pending_shards;
+
+	/* Write IOs stay in pending data for this period [jiffies]
+	 * before submitted to the data device,
+	 * unless pending data reaches min_pending_sectors.
+	 * 0 means no delay. */
+	unsigned int apply_delay_jiffies;
+
 	/* for sysfs. */
 	bool support_flush;
 	bool support_fua;
@@ -262,6 +333,13 @@ struct walb_dev
 	 */
 	struct work_struct destroy_task;
 
+	/*
+	 * For lazy redo.
+	 * Valid after WALB_STATE_LAZY_REDO has been set
+	 * until finalize_lazy_redo() is called.
+	 */
+	struct lazy_redo *lazy_redo;
+
 	/*
 	 * For IOcore.
 	 */
@@ -0,0 +1,124 @@
+/**
+ * latency_hist.c - Per-CPU log2 latency histograms of IO stages.
+ */
+#include "check_kernel.h"
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include "latency_hist.h"
+#include "linux/walb/common.h"
+#include "linux/walb/check.h"
+
+static const char *stage_names_[WALB_LAT_MAX] = {
+	"queue",
+	"log_write",
+	"log_flush",
+	"data_write",
+	"write",
+	"read",
+};
+
+/*******************************************************************************
+ * Global functions definition.
+ *******************************************************************************/
+
+bool walb_latency_hist_init(struct walb_latency_hist *lh, gfp_t gfp_mask)
+{
+	lh->cpu = alloc_percpu_gfp(struct walb_latency_hist_cpu, gfp_mask);
+	return lh->cpu != NULL;
+}
+
+void walb_latency_hist_exit(struct walb_latency_hist *lh)
+{
+	free_percpu(lh->cpu);
+	lh->cpu = NULL;
+}
+
+/**
+ * Clear all the counters.
+ * Latencies added concurrently may be lost.
+ */
+void walb_latency_hist_reset(struct walb_latency_hist *lh)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(lh->cpu, cpu), 0,
+			sizeof(struct walb_latency_hist_cpu));
+}
+
+/**
+ * Print the histograms summed over CPUs.
+ *
+ * The first line shows the lower bound [usec] of each bucket
+ * and each following line shows a stage name and its counts.
+ *
+ * RETURN:
+ *   printed size [byte].
+ */
+ssize_t walb_latency_hist_print(
+	struct walb_latency_hist *lh, char *buf, size_t size)
+{
+	unsigned int stage, i;
+	size_t off = 0;
+	int cpu;
+
+	off += scnprintf(buf + off, size - off, "%-10s", "usec");
+	for (i = 0; i < WALB_LAT_N_BUCKET; i++)
+		off += scnprintf(buf + off, size - off, " %llu"
+				, i == 0 ? 0ULL : 1ULL << (i - 1));
+	off += scnprintf(buf + off, size - off, "\n");
+
+	for (stage = 0; stage < WALB_LAT_MAX; stage++) {
+		off += scnprintf(buf + off, size - off, "%-10s", stage_names_[stage]);
+		for (i = 0; i < WALB_LAT_N_BUCKET; i++) {
+			u64 sum = 0;
+			for_each_possible_cpu(cpu)
+				sum += per_cpu_ptr(lh->cpu, cpu)->count[stage][i];
+			off += scnprintf(buf + off, size - off, " %llu"
+					, (unsigned long long)sum);
+		}
+		off += scnprintf(buf + off, size - off, "\n");
+	}
+	return off;
+}
+
+/**
+ * Summarize the histogram of a stage summed over CPUs.
+ *
+ * Each percentile is the upper bound [usec] of the bucket containing it.
+ * They are all 0 if the stage has no latency.
+ */
+void walb_latency_hist_summarize(
+	struct walb_latency_hist *lh, unsigned int stage,
+	u64 *count, u64 *p50_us, u64 *p99_us, u64 *max_us)
+{
+	u64 sum[WALB_LAT_N_BUCKET];
+	u64 total = 0, acc = 0;
+	unsigned int i;
+	int cpu;
+
+	for (i = 0; i < WALB_LAT_N_BUCKET; i++) {
+		sum[i] = 0;
+		for_each_possible_cpu(cpu)
+			sum[i] += per_cpu_ptr(lh->cpu, cpu)->count[stage][i];
+		total += sum[i];
+	}
+	*count = total;
+	*p50_us = 0;
+	*p99_us = 0;
+	*max_us = 0;
+	for (i = 0; i < WALB_LAT_N_BUCKET; i++) {
+		const u64 upper = 1ULL << i;
+		if (sum[i] == 0)
+			continue;
+		acc += sum[i];
+		if (*p50_us == 0 && acc * 2 >= total)
+			*p50_us = upper;
+		if (*p99_us == 0 && acc * 100 >= total * 99)
+			*p99_us = upper;
+		*max_us = upper;
+	}
+}
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,78 @@
+/**
+ * latency_hist.h - Per-CPU log2 latency histograms of IO stages.
+ */
+#ifndef WALB_LATENCY_HIST_H_KERNEL
+#define WALB_LATENCY_HIST_H_KERNEL
+
+#include "check_kernel.h"
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/time.h>
+
+/**
+ * IO stages.
+ */
+enum
+{
+	/* Write: arrival to log submission. */
+	WALB_LAT_QUEUE = 0,
+	/* Write: log submission to log completion. */
+	WALB_LAT_LOG_WRITE,
+	/* Write: log completion to data submission.
+	   This contains the wait for the log being permanent. */
+	WALB_LAT_LOG_FLUSH,
+	/* Write: data submission to data completion. */
+	WALB_LAT_DATA_WRITE,
+	/* Write: arrival to completion of the original bio. */
+	WALB_LAT_WRITE,
+	/* Read: arrival to completion of the original bio. */
+	WALB_LAT_READ,
+	WALB_LAT_MAX,
+};
+
+/**
+ * Bucket i > 0 counts latencies in [2^(i-1), 2^i) usec,
+ * and bucket 0 counts latencies less than 1 usec.
+ * The last bucket also counts longer latencies.
+ */
+#define WALB_LAT_N_BUCKET 26
+
+struct walb_latency_hist_cpu
+{
+	u64 count[WALB_LAT_MAX][WALB_LAT_N_BUCKET];
+};
+
+struct walb_latency_hist
+{
+	struct walb_latency_hist_cpu __percpu *cpu;
+};
+
+bool walb_latency_hist_init(struct walb_latency_hist *lh, gfp_t gfp_mask);
+void walb_latency_hist_exit(struct walb_latency_hist *lh);
+void walb_latency_hist_reset(struct walb_latency_hist *lh);
+ssize_t walb_latency_hist_print(
+	struct walb_latency_hist *lh, char *buf, size_t size);
+void walb_latency_hist_summarize(
+	struct walb_latency_hist *lh, unsigned int stage,
+	u64 *count, u64 *p50_us, u64 *p99_us, u64 *max_us);
+
+/**
+ * Add a latency to the histogram of a stage.
+ * This can be called in any context.
+ *
+ * @stage WALB_LAT_XXX.
+ * @ns latency [nsec].
+ */
+static inline void walb_latency_hist_add(
+	struct walb_latency_hist *lh, unsigned int stage, u64 ns)
+{
+	unsigned int i = fls64(div_u64(ns, NSEC_PER_USEC));
+
+	if (i >= WALB_LAT_N_BUCKET)
+		i = WALB_LAT_N_BUCKET - 1;
+	this_cpu_inc(lh->cpu->count[stage][i]);
+}
+
+#endif /* WALB_LATENCY_HIST_H_KERNEL */
@@ -0,0 +1,320 @@
+/**
+ * log_cache.c - Cache of recently written logs for walblog device reads.
+ */
+#include "check_kernel.h"
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/math64.h>
+#include "log_cache.h"
+#include "linux/walb/common.h"
+#include "linux/walb/logger.h"
+#include "linux/walb/check.h"
+#include "linux/walb/block_size.h"
+
+/*******************************************************************************
+ * Static functions definition.
+ *******************************************************************************/
+
+static u64 mod_u64(u64 a, u64 b)
+{
+	u64 rem;
+
+	div64_u64_rem(a, b, &rem);
+	return rem;
+}
+
+/**
+ * Index of the block of an lsid in the cache.
+ */
+static unsigned long get_index(struct walb_log_cache *lc, u64 lsid)
+{
+	return (unsigned long)mod_u64(lsid, lc->n_pb);
+}
+
+/**
+ * Copy data between the cache and a buffer.
+ *
+ * @lc log cache.
+ * @lsid the first block.
+ * @off offset from the first block [byte]. It must be less than the cache size.
+ * @data buffer.
+ * @size size to copy [byte].
+ * @to_cache true to copy the buffer to the cache.
+ */
+static void copy_log_cache(
+	struct walb_log_cache *lc, u64 lsid, unsigned int off,
+	void *data, unsigned int size, bool to_cache)
+{
+	const u64 total = lc->n_pb * lc->pbs;
+	u64 pos = (u64)get_index(lc, lsid) * lc->pbs + off;
+
+	if (pos >= total)
+		pos -= total;
+	while (size > 0) {
+		const unsigned int n = min_t(u64, size, total - pos);
+		if (to_cache)
+			memcpy(lc->buf + pos, data, n);
+		else
+			memcpy(data, lc->buf + pos, n);
+		data += n;
+		size -= n;
+		pos = 0;
+	}
+}
+
+/**
+ * Copy data between the cache and pages of a bio.
+ */
+static void copy_log_cache_bio(
+	struct walb_log_cache *lc, u64 lsid, struct bio *bio, bool to_cache)
+{
+	struct bio_vec bv;
+	struct bvec_iter iter;
+	unsigned int off = 0;
+
+	bio_for_each_segment(bv, bio, iter) {
+		char *p = kmap_atomic(bv.bv_page);
+		copy_log_cache(lc, lsid, off, p + bv.bv_offset, bv.bv_len, to_cache);
+		kunmap_atomic(p);
+		off += bv.bv_len;
+	}
+}
+
+/*******************************************************************************
+ * Global functions definition.
+ *******************************************************************************/
+
+/**
+ * @size_mb cache size [MiB]. 0 means the cache is disabled.
+ * @max_n_pb max cache size [physical block].
+ *   A cache larger than the ring buffer is useless.
+ */
+bool walb_log_cache_init(
+	struct walb_log_cache *lc, unsigned int pbs, unsigned int size_mb,
+	u64 max_n_pb)
+{
+	u64 n_pb;
+
+	spin_lock_init(&lc->lock);
+	lc->begin_lsid = 0;
+	lc->end_lsid = 0;
+	lc->gen = 0;
+	lc->pbs = pbs;
+	lc->n_pb = 0;
+	lc->buf = NULL;
+	lc->valid = NULL;
+	lc->n_hit = 0;
+	lc->n_miss = 0;
+	if (size_mb == 0)
+		return true;
+
+	n_pb = (u64)min_t(unsigned int, size_mb, MAX_LOG_CACHE_MB)
+		* (1024 * 1024 / pbs);
+	n_pb = min(n_pb, max_n_pb);
+	lc->buf = vmalloc(n_pb * pbs);
+	if (!lc->buf)
+		return false;
+	lc->valid = vzalloc(BITS_TO_LONGS(n_pb) * sizeof(unsigned long));
+	if (!lc->valid) {
+		vfree(lc->buf);
+		lc->buf = NULL;
+		return false;
+	}
+	lc->n_pb = n_pb;
+	return true;
+}
+
+void walb_log_cache_exit(struct walb_log_cache *lc)
+{
+	vfree(lc->valid);
+	vfree(lc->buf);
+	lc->valid = NULL;
+	lc->buf = NULL;
+	lc->n_pb = 0;
+}
+
+/**
+ * Drop all the cached logs.
+ * Call this when lsids or the ring buffer of the log device have changed.
+ */
+void walb_log_cache_reset(struct walb_log_cache *lc)
+{
+	spin_lock(&lc->lock);
+	lc->begin_lsid = 0;
+	lc->end_lsid = 0;
+	lc->gen++;
+	spin_unlock(&lc->lock);
+}
+
+/**
+ * Start to add a logpack.
+ *
+ * Old blocks are evicted to make room for the logpack.
+ * If the logpack does not follow the cached logs, they are all dropped.
+ * Call walb_log_cache_add_bio() for its IOs and
+ * walb_log_cache_end_pack() after this.
+ * Logpacks must be added one by one.
+ *
+ * RETURN:
+ *   true if the logpack will be cached.
+ *   false if the cache is disabled or the logpack is not cached.
+ */
+bool walb_log_cache_begin_pack(
+	struct walb_log_cache *lc, const struct walb_logpack_header *logh)
+{
+	const u64 lsid = logh->logpack_lsid;
+	const u64 end_lsid = lsid + 1 + logh->total_io_size;
+	u64 i;
+
+	if (!lc->buf || logh->n_records == 0)
+		return false;
+
+	spin_lock(&lc->lock);
+	if (end_lsid - lsid > lc->n_pb) {
+		/* Too large. The next logpack will start from empty. */
+		lc->begin_lsid = end_lsid;
+		lc->end_lsid = end_lsid;
+		spin_unlock(&lc->lock);
+		return false;
+	}
+	if (lc->end_lsid != lsid) {
+		lc->begin_lsid = lsid;
+		lc->end_lsid = lsid;
+	} else if (end_lsid - lc->begin_lsid > lc->n_pb) {
+		lc->begin_lsid = end_lsid - lc->n_pb;
+	}
+	lc->pack_gen = lc->gen;
+	spin_unlock(&lc->lock);
+
+	/* The blocks are not visible to readers from now. */
+	lc->pack_lsid = lsid;
+	lc->pack_end_lsid = end_lsid;
+	for (i = lsid; i < end_lsid; i++)
+		clear_bit(get_index(lc, i), lc->valid);
+
+	copy_log_cache(lc, lsid, 0, (void *)logh, lc->pbs, true);
+	set_bit(get_index(lc, lsid), lc->valid);
+	return true;
+}
+
+/**
+ * Add IO data of a log record.
+ *
+ * @lsid lsid of the record.
+ * @bio bio having the IO data.
+ */
+void walb_log_cache_add_bio(
+	struct walb_log_cache *lc, u64 lsid, struct bio *bio)
+{
+	const unsigned int n_pb = bio->bi_iter.bi_size / lc->pbs;
+	unsigned int i;
+
+	ASSERT(lc->pack_lsid < lsid);
+	ASSERT(lsid + n_pb <= lc->pack_end_lsid);
+
+	copy_log_cache_bio(lc, lsid, bio, true);
+
+	/* A partially filled block is not valid. */
+	for (i = 0; i < n_pb; i++)
+		set_bit(get_index(lc, lsid + i), lc->valid);
+}
+
+/**
+ * Make the logpack added visible to readers.
+ */
+void walb_log_cache_end_pack(struct walb_log_cache *lc)
+{
+	spin_lock(&lc->lock);
+	if (lc->gen == lc->pack_gen && lc->end_lsid == lc->pack_lsid)
+		lc->end_lsid = lc->pack_end_lsid;
+	spin_unlock(&lc->lock);
+}
+
+/**
+ * Serve a read bio of the log device from the cache.
+ *
+ * The bio is not changed in a miss
+ * but its pages may be overwritten.
+ *
+ * @lc log cache.
+ * @bio read bio for the log device.
+ * @ring_buffer_off ring buffer offset [physical block].
+ * @ring_buffer_size ring buffer size [physical block].
+ *
+ * RETURN:
+ *   true in a hit where the bio data has been filled.
+ */
+bool walb_log_cache_read(
+	struct walb_log_cache *lc, struct bio *bio,
+	u64 ring_buffer_off, u64 ring_buffer_size)
+{
+	const unsigned int n_lb_in_pb = lc->pbs / LOGICAL_BLOCK_SIZE;
+	const unsigned int n_lb = bio_sectors(bio);
+	u64 off_pb, pos, lsid, last, gen;
+	unsigned int n_pb, i;
+	bool is_hit;
+
+	if (!lc->buf)
+		return false;
+	if (n_lb == 0 || n_lb % n_lb_in_pb != 0 ||
+		mod_u64(bio->bi_iter.bi_sector, n_lb_in_pb) != 0)
+		goto miss;
+	off_pb = div_u64(bio->bi_iter.bi_sector, n_lb_in_pb);
+	n_pb = n_lb / n_lb_in_pb;
+	if (off_pb < ring_buffer_off ||
+		off_pb + n_pb > ring_buffer_off + ring_buffer_size)
+		goto miss;
+	pos = off_pb - ring_buffer_off;
+
+	/* The block at pos has the latest lsid of the position. */
+	spin_lock(&lc->lock);
+	if (lc->begin_lsid == lc->end_lsid) {
+		spin_unlock(&lc->lock);
+		goto miss;
+	}
+	last = lc->end_lsid - 1;
+	lsid = last - mod_u64(mod_u64(last, ring_buffer_size)
+			+ ring_buffer_size - pos, ring_buffer_size);
+	is_hit = lc->begin_lsid <= lsid && lsid + n_pb <= lc->end_lsid;
+	gen = lc->gen;
+	spin_unlock(&lc->lock);
+	if (!is_hit)
+		goto miss;
+	for (i = 0; i < n_pb; i++) {
+		if (!test_bit(get_index(lc, lsid + i), lc->valid))
+			goto miss;
+	}
+
+	copy_log_cache_bio(lc, lsid, bio, false);
+
+	/* The blocks may have been evicted during the copy. */
+	spin_lock(&lc->lock);
+	is_hit = lc->gen == gen && lc->begin_lsid <= lsid;
+	if (is_hit)
+		lc->n_hit++;
+	else
+		lc->n_miss++;
+	spin_unlock(&lc->lock);
+	return is_hit;
+
+miss:
+	spin_lock(&lc->lock);
+	lc->n_miss++;
+	spin_unlock(&lc->lock);
+	return false;
+}
+
+void walb_log_cache_get_stat(
+	struct walb_log_cache *lc, struct walb_log_cache_stat *stat)
+{
+	spin_lock(&lc->lock);
+	stat->n_hit = lc->n_hit;
+	stat->n_miss = lc->n_miss;
+	stat->begin_lsid = lc->begin_lsid;
+	stat->end_lsid = lc->end_lsid;
+	spin_unlock(&lc->lock);
+	stat->n_pb = lc->n_pb;
+}
+
+MODULE_LICENSE("GPL");
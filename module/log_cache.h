@@ -0,0 +1,84 @@
+/**
+ * log_cache.h - Cache of recently written logs for walblog device reads.
+ */
+#ifndef WALB_LOG_CACHE_H_KERNEL
+#define WALB_LOG_CACHE_H_KERNEL
+
+#include "check_kernel.h"
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/bio.h>
+#include "linux/walb/log_record.h"
+
+/**
+ * Max log cache size [MiB].
+ */
+#define MAX_LOG_CACHE_MB 1024
+
+/**
+ * Log cache.
+ *
+ * This keeps copies of the physical blocks of the latest logs
+ * in [begin_lsid, end_lsid) in a ring buffer of n_pb blocks.
+ * The block of lsid is at (lsid % n_pb) * pbs in buf.
+ *
+ * Logpacks are added in lsid order after their log IOs have completed,
+ * so cached blocks are the same as those in the log device.
+ * Padding blocks are not cached. See the valid bitmap.
+ *
+ * The cache is disabled if n_pb is 0.
+ */
+struct walb_log_cache
+{
+	spinlock_t lock;
+
+	/* These must be accessed with the lock held. */
+	u64 begin_lsid;
+	u64 end_lsid;
+	u64 gen; /* incremented at reset. */
+
+	unsigned int pbs; /* physical block size [byte]. */
+	u64 n_pb; /* [physical block] */
+	u8 *buf; /* n_pb * pbs bytes. */
+	unsigned long *valid; /* n_pb bits. */
+
+	/* The logpack being added. Accessed by the adder only. */
+	u64 pack_lsid;
+	u64 pack_end_lsid;
+	u64 pack_gen;
+
+	/* Statistics of read bios.
+	   These must be accessed with the lock held. */
+	u64 n_hit;
+	u64 n_miss;
+};
+
+/**
+ * Statistics of a log cache.
+ */
+struct walb_log_cache_stat
+{
+	u64 n_hit;
+	u64 n_miss;
+	u64 begin_lsid;
+	u64 end_lsid;
+	u64 n_pb;
+};
+
+bool walb_log_cache_init(
+	struct walb_log_cache *lc, unsigned int pbs, unsigned int size_mb,
+	u64 max_n_pb);
+void walb_log_cache_exit(struct walb_log_cache *lc);
+void walb_log_cache_reset(struct walb_log_cache *lc);
+bool walb_log_cache_begin_pack(
+	struct walb_log_cache *lc, const struct walb_logpack_header *logh);
+void walb_log_cache_add_bio(
+	struct walb_log_cache *lc, u64 lsid, struct bio *bio);
+void walb_log_cache_end_pack(struct walb_log_cache *lc);
+bool walb_log_cache_read(
+	struct walb_log_cache *lc, struct bio *bio,
+	u64 ring_buffer_off, u64 ring_buffer_size);
+void walb_log_cache_get_stat(
+	struct walb_log_cache *lc, struct walb_log_cache_stat *stat);
+
+#endif /* WALB_LOG_CACHE_H_KERNEL */
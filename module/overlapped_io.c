@@ -5,70 +5,57 @@
  * @author HOSHINO Takashi <hoshino@labs.cybozu.co.jp>
  */
 #include <linux/module.h>
+#include <linux/interval_tree_generic.h>
 #include "linux/walb/logger.h"
 #include "overlapped_io.h"
-#include "treemap.h"
 #include "bio_wrapper.h"
 
+#ifdef WALB_OVERLAPPED_SERIALIZE
+/**
+ * Interval tree of bio wrappers.
+ * See also pending_io.c.
+ */
+INTERVAL_TREE_DEFINE(struct bio_wrapper, overlapped_node,
+		u64, overlapped_subtree_last,
+		bio_wrapper_first_pos, bio_wrapper_last_pos,
+		static, overlapped_tree)
+#endif
+
 /**
  * Overlapped check and insert.
  *
  * CONTEXT:
  *   overlapped_data lock must be held.
- * RETURN:
- *   true in success, or false (memory allocation failure).
  */
 #ifdef WALB_OVERLAPPED_SERIALIZE
-bool overlapped_check_and_insert(
-	struct multimap *overlapped_data,
-	unsigned int *max_sectors_p,
-	struct bio_wrapper *biow, gfp_t gfp_mask
+void overlapped_check_and_insert(
+	struct rb_root *overlapped_data, struct bio_wrapper *biow
 #ifdef WALB_DEBUG
 	, u64 *overlapped_in_id
 #endif
 	)
 {
-	struct multimap_cursor cur;
-	u64 max_io_size, start_pos;
+	u64 first, last;
 	int ret;
 	struct bio_wrapper *biow_tmp;
 
 	ASSERT(overlapped_data);
-	ASSERT(max_sectors_p);
 	ASSERT(biow);
 	ASSERT(biow->len > 0);
+	ASSERT(RB_EMPTY_NODE(&biow->overlapped_node));
 
-	/* Decide search start position. */
-	max_io_size = *max_sectors_p;
-	if (biow->pos > max_io_size) {
-		start_pos = biow->pos - max_io_size;
-	} else {
-		start_pos = 0;
-	}
-
-	multimap_cursor_init(overlapped_data, &cur);
+	first = bio_wrapper_first_pos(biow);
+	last = bio_wrapper_last_pos(biow);
 	biow->n_overlapped = 0;
 
-	/* Search the smallest candidate. */
-	if (!multimap_cursor_search(&cur, start_pos, MAP_SEARCH_GE, 0)) {
-		goto fin;
-	}
-
 	/* Count overlapped requests previously. */
 	BIO_WRAPPER_PRINT("cmpr0", biow);
-	while (multimap_cursor_key(&cur) < biow->pos + biow->len) {
-
-		ASSERT(multimap_cursor_is_valid(&cur));
-
-		biow_tmp = (struct bio_wrapper *)multimap_cursor_val(&cur);
-		ASSERT(biow_tmp);
+	biow_tmp = overlapped_tree_iter_first(overlapped_data, first, last);
+	while (biow_tmp) {
 		BIO_WRAPPER_PRINT("cmpr1", biow_tmp);
-		if (bio_wrapper_is_overlap(biow, biow_tmp)) {
-			biow->n_overlapped++;
-		}
-		if (!multimap_cursor_next(&cur)) {
-			break;
-		}
+		ASSERT(bio_wrapper_is_overlap(biow, biow_tmp));
+		biow->n_overlapped++;
+		biow_tmp = overlapped_tree_iter_next(biow_tmp, first, last);
 	}
 
 	if (biow->n_overlapped > 0) {
@@ -76,23 +63,13 @@ bool overlapped_check_and_insert(
 		ret = test_and_set_bit(BIO_WRAPPER_DELAYED, &biow->flags);
 		ASSERT(!ret);
 	}
-fin:
-	ret = multimap_add(overlapped_data, biow->pos, (unsigned long)biow, gfp_mask);
-	ASSERT(ret != -EEXIST);
-	ASSERT(ret != -EINVAL);
-	if (ret) {
-		ASSERT(ret == -ENOMEM);
-		LOGe("overlapped_check_and_insert failed.\n");
-		return false;
-	}
-	*max_sectors_p = max(*max_sectors_p, biow->len);
+	overlapped_tree_insert(biow, overlapped_data);
 #ifdef WALB_DEBUG
 	{
 		biow->ol_id = *overlapped_in_id;
 		(*overlapped_in_id)++;
 	}
 #endif
-	return true;
 }
 #endif
 
@@ -101,7 +78,6 @@ fin:
  * and waiting overlapped requests
  *
  * @overlapped_data overlapped data.
- * @max_sectors_p pointer to max_sectors value.
  * @should_submit_list bio wrapper(s) which n_overlapped became 0
  *     will be added.
  *     using biow->list4 for list operations.
@@ -112,8 +88,7 @@ fin:
  */
 #ifdef WALB_OVERLAPPED_SERIALIZE
 unsigned int overlapped_delete_and_notify(
-	struct multimap *overlapped_data,
-	unsigned int *max_sectors_p,
+	struct rb_root *overlapped_data,
 	struct list_head *should_submit_list,
 	struct bio_wrapper *biow
 #ifdef WALB_DEBUG
@@ -121,28 +96,21 @@ unsigned int overlapped_delete_and_notify(
 #endif
 	)
 {
-	struct multimap_cursor cur;
-	u64 max_io_size, start_pos;
+	u64 first, last;
 	struct bio_wrapper *biow_tmp;
 	unsigned int n_should_submit = 0;
 
 	ASSERT(overlapped_data);
-	ASSERT(max_sectors_p);
 	ASSERT(biow);
 	ASSERT(biow->n_overlapped == 0);
+	ASSERT(!RB_EMPTY_NODE(&biow->overlapped_node));
 
-	max_io_size = *max_sectors_p;
-	if (biow->pos > max_io_size) {
-		start_pos = biow->pos - max_io_size;
-	} else {
-		start_pos = 0;
-	}
+	first = bio_wrapper_first_pos(biow);
+	last = bio_wrapper_last_pos(biow);
 
 	/* Delete from the overlapped data. */
-	biow_tmp = (struct bio_wrapper *)multimap_del(
-		overlapped_data, biow->pos, (unsigned long)biow);
-	LOG_("biow_tmp %p biow %p\n", biow_tmp, biow); /* debug */
-	ASSERT(biow_tmp == biow);
+	overlapped_tree_remove(biow, overlapped_data);
+	RB_CLEAR_NODE(&biow->overlapped_node);
 
 #ifdef WALB_DEBUG
 	{
@@ -150,59 +118,34 @@ unsigned int overlapped_delete_and_notify(
 		(*overlapped_out_id)++;
 	}
 #endif
-	/* Initialize max_sectors. */
-	if (multimap_is_empty(overlapped_data)) {
-		*max_sectors_p = 0;
-	}
 
-	/* Search the smallest candidate. */
-	multimap_cursor_init(overlapped_data, &cur);
-	if (!multimap_cursor_search(&cur, start_pos, MAP_SEARCH_GE, 0)) {
-		return 0;
-	}
 	/* Decrement count of overlapped requests afterward and notify if need. */
-	while (multimap_cursor_key(&cur) < biow->pos + biow->len) {
-
-		ASSERT(multimap_cursor_is_valid(&cur));
-
-		biow_tmp = (struct bio_wrapper *)multimap_cursor_val(&cur);
-		ASSERT(biow_tmp);
-		if (bio_wrapper_is_overlap(biow, biow_tmp)) {
-			biow_tmp->n_overlapped--;
-			if (biow_tmp->n_overlapped == 0) {
-				/* There is no overlapped request before it. */
-				list_add_tail(
-					&biow_tmp->list4, should_submit_list);
-				n_should_submit++;
-			}
-		}
-		if (!multimap_cursor_next(&cur)) {
-			break;
+	biow_tmp = overlapped_tree_iter_first(overlapped_data, first, last);
+	while (biow_tmp) {
+		ASSERT(bio_wrapper_is_overlap(biow, biow_tmp));
+		biow_tmp->n_overlapped--;
+		if (biow_tmp->n_overlapped == 0) {
+			/* There is no overlapped request before it. */
+			list_add_tail(&biow_tmp->list4, should_submit_list);
+			n_should_submit++;
 		}
+		biow_tmp = overlapped_tree_iter_next(biow_tmp, first, last);
 	}
 	return n_should_submit;
 }
 #endif
 
 #ifdef WALB_OVERLAPPED_SERIALIZE
-void overlapped_data_print(struct multimap *overlapped_data)
+void overlapped_data_print(struct rb_root *overlapped_data)
 {
-	struct multimap_cursor cur;
+	struct rb_node *node;
 	ASSERT(overlapped_data);
-	multimap_cursor_init(overlapped_data, &cur);
-
-	if (!multimap_cursor_begin(&cur))
-		return;
 
 	printk(KERN_INFO "overlapped_data_print BEGIN\n");
-	while (multimap_cursor_next(&cur)) {
-		struct bio_wrapper *biow;
-		ASSERT(multimap_cursor_is_valid(&cur));
-		biow = (struct bio_wrapper *)multimap_cursor_val(&cur);
-		if (!biow)
-			printk(KERN_INFO "biow null\n");
-		else
-			print_bio_wrapper(KERN_INFO, biow);
+	for (node = rb_first(overlapped_data); node; node = rb_next(node)) {
+		struct bio_wrapper *biow =
+			rb_entry(node, struct bio_wrapper, overlapped_node);
+		print_bio_wrapper(KERN_INFO, biow);
 	}
 	printk(KERN_INFO "overlapped_data_print END\n");
 }
@@ -10,26 +10,25 @@
 #include "check_kernel.h"
 
 #include <linux/list.h>
-#include "treemap.h"
+#include <linux/rbtree.h>
 #include "bio_wrapper.h"
 
 /* Overlapped data functions. */
 #ifdef WALB_OVERLAPPED_SERIALIZE
-bool overlapped_check_and_insert(
-	struct multimap *overlapped_data, unsigned int *max_sectors_p,
-	struct bio_wrapper *biow, gfp_t gfp_mask
+void overlapped_check_and_insert(
+	struct rb_root *overlapped_data, struct bio_wrapper *biow
 #ifdef WALB_DEBUG
 	, u64 *overlapped_in_id
 #endif
 	);
 unsigned int overlapped_delete_and_notify(
-	struct multimap *overlapped_data, unsigned int *max_sectors_p,
+	struct rb_root *overlapped_data,
 	struct list_head *should_submit_list, struct bio_wrapper *biow
 #ifdef WALB_DEBUG
 	, u64 *overlapped_out_id
 #endif
 	);
-void overlapped_data_print(struct multimap *overlapped_data);
+void overlapped_data_print(struct rb_root *overlapped_data);
 #endif
 
 #endif /* WALB_OVERLAPPED_IO_H_KERNEL */
@@ -0,0 +1,304 @@
+/**
+ * page_pool.c - Recycled page pool for copied bio payloads.
+ */
+#include "check_kernel.h"
+#include <linux/module.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include "page_pool.h"
+#include "linux/walb/common.h"
+#include "linux/walb/logger.h"
+#include "linux/walb/check.h"
+
+/*******************************************************************************
+ * Static functions definition.
+ *******************************************************************************/
+
+/**
+ * Pop pooled pages down to the low watermark.
+ *
+ * @pp page pool.
+ * @nr_to_scan max number of pages to release.
+ * @list released pages will be added to this.
+ *
+ * RETURN:
+ *   number of pages moved to the list.
+ */
+static unsigned long walb_page_pool_pop_excess(
+	struct walb_page_pool *pp, unsigned long nr_to_scan,
+	struct list_head *list)
+{
+	unsigned long nr = 0;
+
+	spin_lock(&pp->lock);
+	while (nr < nr_to_scan && pp->nr_pages > pp->low_wm) {
+		struct page *page = list_first_entry(
+			&pp->pages, struct page, lru);
+		list_move(&page->lru, list);
+		pp->nr_pages--;
+		nr++;
+	}
+	spin_unlock(&pp->lock);
+	return nr;
+}
+
+static void free_page_list(struct list_head *list)
+{
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, list, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+}
+
+static unsigned long walb_page_pool_count(
+	struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct walb_page_pool *pp =
+		container_of(shrinker, struct walb_page_pool, shrinker);
+	unsigned int nr_pages = READ_ONCE(pp->nr_pages);
+
+	if (nr_pages <= pp->low_wm)
+		return 0;
+	return nr_pages - pp->low_wm;
+}
+
+static unsigned long walb_page_pool_scan(
+	struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct walb_page_pool *pp =
+		container_of(shrinker, struct walb_page_pool, shrinker);
+	struct list_head list;
+	unsigned long nr;
+
+	INIT_LIST_HEAD(&list);
+	nr = walb_page_pool_pop_excess(pp, sc->nr_to_scan, &list);
+	free_page_list(&list);
+	return nr > 0 ? nr : SHRINK_STOP;
+}
+
+/**
+ * Move pages from the shared pool to a per-CPU cache.
+ * Preemption must be disabled.
+ *
+ * RETURN:
+ *   true if at least one page has been moved.
+ */
+static bool walb_page_pool_refill_pcp(
+	struct walb_page_pool *pp, struct walb_page_pool_pcp *pcp)
+{
+	unsigned int nr = 0;
+
+	spin_lock(&pp->lock);
+	while (nr < WALB_PAGE_POOL_BATCH && pp->nr_pages > 0) {
+		struct page *page = list_first_entry(
+			&pp->pages, struct page, lru);
+		list_move(&page->lru, &pcp->pages);
+		pp->nr_pages--;
+		nr++;
+	}
+	spin_unlock(&pp->lock);
+	pcp->nr_pages += nr;
+	return nr > 0;
+}
+
+/**
+ * Move pages from a per-CPU cache to the shared pool.
+ * Preemption must be disabled.
+ *
+ * @nr number of pages to move.
+ * @list pages over high_wm will be added to this.
+ */
+static void walb_page_pool_drain_pcp(
+	struct walb_page_pool *pp, struct walb_page_pool_pcp *pcp,
+	unsigned int nr, struct list_head *list)
+{
+	ASSERT(nr <= pcp->nr_pages);
+
+	spin_lock(&pp->lock);
+	while (nr > 0) {
+		struct page *page = list_first_entry(
+			&pcp->pages, struct page, lru);
+		if (pp->nr_pages < pp->high_wm) {
+			list_move(&page->lru, &pp->pages);
+			pp->nr_pages++;
+		} else {
+			list_move(&page->lru, list);
+		}
+		pcp->nr_pages--;
+		nr--;
+	}
+	spin_unlock(&pp->lock);
+}
+
+/*******************************************************************************
+ * Global functions definition.
+ *******************************************************************************/
+
+/**
+ * Initialize a page pool.
+ * The pool is empty at first and grows with freed pages.
+ *
+ * @pp page pool.
+ * @low_wm pages kept under memory pressure.
+ * @high_wm max number of pages in the shared pool.
+ *
+ * RETURN:
+ *   true in success.
+ */
+bool walb_page_pool_init(
+	struct walb_page_pool *pp, unsigned int low_wm, unsigned int high_wm)
+{
+	int cpu;
+
+	ASSERT(pp);
+	ASSERT(low_wm <= high_wm);
+
+	pp->pcp = alloc_percpu(struct walb_page_pool_pcp);
+	if (!pp->pcp) {
+		LOGe("alloc_percpu failed.\n");
+		return false;
+	}
+	for_each_possible_cpu(cpu) {
+		struct walb_page_pool_pcp *pcp = per_cpu_ptr(pp->pcp, cpu);
+		INIT_LIST_HEAD(&pcp->pages);
+		pcp->nr_pages = 0;
+		pcp->n_hit = 0;
+		pcp->n_miss = 0;
+	}
+
+	spin_lock_init(&pp->lock);
+	INIT_LIST_HEAD(&pp->pages);
+	pp->nr_pages = 0;
+	pp->low_wm = low_wm;
+	pp->high_wm = high_wm;
+
+	pp->shrinker.count_objects = walb_page_pool_count;
+	pp->shrinker.scan_objects = walb_page_pool_scan;
+	pp->shrinker.seeks = DEFAULT_SEEKS;
+	pp->shrinker.batch = 0;
+	pp->shrinker.flags = 0;
+	if (register_shrinker(&pp->shrinker)) {
+		LOGe("register_shrinker failed.\n");
+		free_percpu(pp->pcp);
+		pp->pcp = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Finalize a page pool.
+ * All pages allocated from the pool must have been freed.
+ */
+void walb_page_pool_exit(struct walb_page_pool *pp)
+{
+	struct list_head list;
+	int cpu;
+
+	ASSERT(pp);
+	unregister_shrinker(&pp->shrinker);
+
+	INIT_LIST_HEAD(&list);
+	for_each_possible_cpu(cpu) {
+		struct walb_page_pool_pcp *pcp = per_cpu_ptr(pp->pcp, cpu);
+		list_splice_init(&pcp->pages, &list);
+		pcp->nr_pages = 0;
+	}
+	spin_lock(&pp->lock);
+	list_splice_init(&pp->pages, &list);
+	pp->nr_pages = 0;
+	spin_unlock(&pp->lock);
+	free_page_list(&list);
+	free_percpu(pp->pcp);
+	pp->pcp = NULL;
+}
+
+/**
+ * Allocate a page from the pool.
+ * If the pool is empty, the page allocator will be used.
+ *
+ * CONTEXT:
+ *   Non-IRQ.
+ */
+struct page* walb_page_pool_alloc(struct walb_page_pool *pp, gfp_t gfp_mask)
+{
+	struct walb_page_pool_pcp *pcp;
+	struct page *page = NULL;
+
+	ASSERT(pp);
+
+	pcp = get_cpu_ptr(pp->pcp);
+	if (pcp->nr_pages > 0 || walb_page_pool_refill_pcp(pp, pcp)) {
+		page = list_first_entry(&pcp->pages, struct page, lru);
+		list_del(&page->lru);
+		pcp->nr_pages--;
+		pcp->n_hit++;
+	} else {
+		pcp->n_miss++;
+	}
+	put_cpu_ptr(pp->pcp);
+
+	if (!page)
+		page = alloc_page(gfp_mask);
+	return page;
+}
+
+/**
+ * Free a page to the pool.
+ * If the pool is full, the page will be freed to the page allocator.
+ *
+ * CONTEXT:
+ *   Non-IRQ.
+ */
+void walb_page_pool_free(struct walb_page_pool *pp, struct page *page)
+{
+	struct walb_page_pool_pcp *pcp;
+	struct list_head list;
+
+	ASSERT(pp);
+	ASSERT(page);
+
+	INIT_LIST_HEAD(&list);
+	pcp = get_cpu_ptr(pp->pcp);
+	list_add(&page->lru, &pcp->pages);
+	pcp->nr_pages++;
+	if (pcp->nr_pages > WALB_PAGE_POOL_BATCH * 2)
+		walb_page_pool_drain_pcp(pp, pcp, WALB_PAGE_POOL_BATCH, &list);
+	put_cpu_ptr(pp->pcp);
+
+	free_page_list(&list);
+}
+
+/**
+ * Get statistics of a page pool.
+ * nr_pages includes pages in the per-CPU caches.
+ * The values are not exact because the per-CPU caches are read without lock.
+ */
+void walb_page_pool_get_stat(
+	struct walb_page_pool *pp, struct walb_page_pool_stat *stat)
+{
+	int cpu;
+
+	ASSERT(pp);
+	ASSERT(stat);
+
+	stat->n_hit = 0;
+	stat->n_miss = 0;
+	stat->nr_pages = 0;
+	for_each_possible_cpu(cpu) {
+		struct walb_page_pool_pcp *pcp = per_cpu_ptr(pp->pcp, cpu);
+		stat->n_hit += READ_ONCE(pcp->n_hit);
+		stat->n_miss += READ_ONCE(pcp->n_miss);
+		stat->nr_pages += READ_ONCE(pcp->nr_pages);
+	}
+	spin_lock(&pp->lock);
+	stat->nr_pages += pp->nr_pages;
+	stat->low_wm = pp->low_wm;
+	stat->high_wm = pp->high_wm;
+	spin_unlock(&pp->lock);
+}
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,78 @@
+/**
+ * page_pool.h - Recycled page pool for copied bio payloads.
+ */
+#ifndef WALB_PAGE_POOL_H_KERNEL
+#define WALB_PAGE_POOL_H_KERNEL
+
+#include "check_kernel.h"
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mm_types.h>
+#include <linux/shrinker.h>
+
+/**
+ * Per-CPU page cache of a page pool.
+ * This must be accessed with preemption disabled on its CPU.
+ */
+struct walb_page_pool_pcp
+{
+	struct list_head pages; /* linked with page->lru. */
+	unsigned int nr_pages;
+
+	/* Statistics. */
+	u64 n_hit;
+	u64 n_miss;
+};
+
+/**
+ * Number of pages moved between a per-CPU cache and the shared pool at once.
+ * A per-CPU cache keeps at most WALB_PAGE_POOL_BATCH * 2 pages.
+ */
+#define WALB_PAGE_POOL_BATCH 16
+
+/**
+ * Page pool.
+ *
+ * Pages are allocated from and freed to the per-CPU cache without any lock.
+ * The shared pool behind them is accessed in batches.
+ * Freed pages are kept in the shared pool up to high_wm pages
+ * and they are reused by the next allocations.
+ * Under memory pressure, the shrinker releases pages of the shared pool
+ * down to low_wm pages.
+ */
+struct walb_page_pool
+{
+	struct walb_page_pool_pcp __percpu *pcp;
+
+	spinlock_t lock;
+	struct list_head pages; /* linked with page->lru. */
+	unsigned int nr_pages; /* number of pages in the shared pool. */
+
+	unsigned int low_wm; /* [page] */
+	unsigned int high_wm; /* [page] */
+
+	struct shrinker shrinker;
+};
+
+/**
+ * Statistics of a page pool.
+ */
+struct walb_page_pool_stat
+{
+	u64 n_hit;
+	u64 n_miss;
+	unsigned int nr_pages;
+	unsigned int low_wm;
+	unsigned int high_wm;
+};
+
+bool walb_page_pool_init(
+	struct walb_page_pool *pp, unsigned int low_wm, unsigned int high_wm);
+void walb_page_pool_exit(struct walb_page_pool *pp);
+struct page* walb_page_pool_alloc(struct walb_page_pool *pp, gfp_t gfp_mask);
+void walb_page_pool_free(struct walb_page_pool *pp, struct page *page);
+void walb_page_pool_get_stat(
+	struct walb_page_pool *pp, struct walb_page_pool_stat *stat);
+
+#endif /* WALB_PAGE_POOL_H_KERNEL */
@@ -6,10 +6,23 @@
  */
 #include <linux/module.h>
 #include <linux/ratelimit.h>
+#include <linux/interval_tree_generic.h>
 #include "pending_io.h"
-#include "treemap.h"
 #include "bio_wrapper.h"
 
+/*******************************************************************************
+ * Interval tree of bio wrappers.
+ *
+ * Each node keeps the maximum last position in its subtree,
+ * so an overlap query costs O(log n + k) where k is the number of results,
+ * independent of the size of the largest pending IO.
+ *******************************************************************************/
+
+INTERVAL_TREE_DEFINE(struct bio_wrapper, pending_node,
+		u64, pending_subtree_last,
+		bio_wrapper_first_pos, bio_wrapper_last_pos,
+		static, pending_tree)
+
 /*******************************************************************************
  * Static functions prototype.
  *******************************************************************************/
@@ -78,130 +91,111 @@ static void insert_to_sorted_bio_wrapper_list_by_lsid(
  *******************************************************************************/
 
 /**
- * Insert a req_entry from a pending data.
+ * Insert a bio wrapper to a pending data.
  *
  * CONTEXT:
  *   pending_data lock must be held.
  */
-bool pending_insert(
-	struct multimap *pending_data,
-	unsigned int *max_sectors_p,
-	struct bio_wrapper *biow, gfp_t gfp_mask)
+void pending_insert(
+	struct rb_root *pending_data, struct bio_wrapper *biow)
 {
-	int ret;
-
 	ASSERT(pending_data);
-	ASSERT(max_sectors_p);
 	ASSERT(biow);
 	ASSERT(biow->copied_bio);
 	ASSERT(op_is_write(bio_op(biow->copied_bio)));
 	ASSERT(biow->len > 0);
+	ASSERT(RB_EMPTY_NODE(&biow->pending_node));
 
-	/* Insert the entry. */
-	ret = multimap_add(pending_data, biow->pos,
-			(unsigned long)biow, gfp_mask);
-	ASSERT(ret != EEXIST);
-	ASSERT(ret != EINVAL);
-	if (ret) {
-		ASSERT(ret == ENOMEM);
-		LOGe("pending_insert failed.\n");
-		return false;
-	}
-	*max_sectors_p = max(*max_sectors_p, biow->len);
-	return true;
+	pending_tree_insert(biow, pending_data);
 }
 
 /**
- * Delete a req_entry from a pending data.
+ * Delete a bio wrapper from a pending data.
  *
  * CONTEXT:
  *   pending_data lock must be held.
  */
 void pending_delete(
-	struct multimap *pending_data,
-	unsigned int *max_sectors_p,
-	struct bio_wrapper *biow)
+	struct rb_root *pending_data, struct bio_wrapper *biow)
 {
+	ASSERT(pending_data);
+	ASSERT(biow);
+	ASSERT(!RB_EMPTY_NODE(&biow->pending_node));
+
+	pending_tree_remove(biow, pending_data);
+	RB_CLEAR_NODE(&biow->pending_node);
+}
+
+/**
+ * Collect overlapped writes from a pending data.
+ *
+ * They are inserted to a bio wrapper list sorted by lsid
+ * using biow->list3, so you can collect them from several pending data
+ * by calling this function repeatedly with the same list.
+ *
+ * RETURN:
+ *   Number of collected bio wrappers.
+ *
+ * CONTEXT:
+ *   pending_data lock must be held.
+ */
+unsigned int pending_collect_overlapped(
+	struct rb_root *pending_data,
+	const struct bio_wrapper *biow, struct list_head *biow_list)
+{
+	const u64 first = bio_wrapper_first_pos(biow);
+	const u64 last = bio_wrapper_last_pos(biow);
 	struct bio_wrapper *biow_tmp;
+	unsigned int n_overlapped_bios = 0;
 
 	ASSERT(pending_data);
-	ASSERT(max_sectors_p);
 	ASSERT(biow);
+	ASSERT(biow_list);
 
-	/* Delete the entry. */
-	biow_tmp = (struct bio_wrapper *)multimap_del(
-		pending_data, biow->pos, (unsigned long)biow);
-	LOG_("biow_tmp %p biow %p\n", biow_tmp, biow);
-	ASSERT(biow_tmp == biow);
-	if (multimap_is_empty(pending_data)) {
-		*max_sectors_p = 0;
+	biow_tmp = pending_tree_iter_first(pending_data, first, last);
+	while (biow_tmp) {
+		ASSERT(bio_wrapper_is_overlap(biow, biow_tmp));
+		if (!bio_wrapper_state_is_discard(biow_tmp)) {
+			n_overlapped_bios++;
+			insert_to_sorted_bio_wrapper_list_by_lsid(
+				biow_tmp, biow_list);
+		}
+		biow_tmp = pending_tree_iter_next(biow_tmp, first, last);
 	}
+	return n_overlapped_bios;
 }
 
 /**
- * Check overlapped writes and copy from them.
+ * Copy from collected overlapped writes in the order of lsid.
+ *
+ * @biow read bio wrapper.
+ * @biow_list list made by pending_collect_overlapped().
+ * @n_overlapped_bios number of bio wrappers in the list.
  *
  * RETURN:
  *   true in success, or false due to data copy failed.
  *
  * CONTEXT:
- *   pending_data lock must be held.
+ *   All pending data locks used to collect the list must be held.
  */
-bool pending_check_and_copy(
-	struct multimap *pending_data, unsigned int max_sectors,
-	struct bio_wrapper *biow, gfp_t gfp_mask)
+bool pending_copy_overlapped(
+	struct bio_wrapper *biow, struct list_head *biow_list,
+	unsigned int n_overlapped_bios, gfp_t gfp_mask)
 {
-	struct multimap_cursor cur;
-	u64 max_io_size, start_pos;
 	struct bio_wrapper *biow_tmp;
-	struct list_head biow_list;
-	unsigned int n_overlapped_bios;
 #ifdef WALB_DEBUG
 	u64 lsid;
 #endif
 
-	ASSERT(pending_data);
 	ASSERT(biow);
+	ASSERT(biow_list);
 
-	/* Decide search start position. */
-	max_io_size = max_sectors;
-	if (biow->pos > max_io_size) {
-		start_pos = biow->pos - max_io_size;
-	} else {
-		start_pos = 0;
-	}
-
-	/* Search the smallest candidate. */
-	multimap_cursor_init(pending_data, &cur);
-	if (!multimap_cursor_search(&cur, start_pos, MAP_SEARCH_GE, 0)) {
-		/* No overlapped requests. */
-		return true;
-	}
-	/* Copy data from pending and overlapped write requests. */
-	INIT_LIST_HEAD(&biow_list);
-	n_overlapped_bios = 0;
-	while (multimap_cursor_key(&cur) < biow->pos + biow->len) {
-
-		ASSERT(multimap_cursor_is_valid(&cur));
-
-		biow_tmp = (struct bio_wrapper *)multimap_cursor_val(&cur);
-		ASSERT(biow_tmp);
-		if (!bio_wrapper_state_is_discard(biow_tmp) &&
-			bio_wrapper_is_overlap(biow, biow_tmp)) {
-			n_overlapped_bios++;
-			insert_to_sorted_bio_wrapper_list_by_lsid(
-				biow_tmp, &biow_list);
-		}
-		if (!multimap_cursor_next(&cur)) {
-			break;
-		}
-	}
 	if (n_overlapped_bios > 64) {
 		pr_warn_ratelimited("Too many overlapped bio(s): %u\n",
 				n_overlapped_bios);
 	}
 	/* Copy overlapped pending bio(s) in the order of lsid. */
-	list_for_each_entry(biow_tmp, &biow_list, list3) {
+	list_for_each_entry(biow_tmp, biow_list, list3) {
 		BIO_WRAPPER_PRINT("copy", biow_tmp);
 		if (!bio_wrapper_copy_overlapped(biow, biow_tmp, gfp_mask))
 			return false;
@@ -211,7 +205,7 @@ bool pending_check_and_copy(
 #ifdef WALB_DEBUG
 	LOG_("lsid begin\n");
 	lsid = 0;
-	list_for_each_entry(biow_tmp, &biow_list, list3) {
+	list_for_each_entry(biow_tmp, biow_list, list3) {
 		LOG_("lsid %"PRIu64"\n", biow_tmp->lsid);
 		ASSERT(lsid <= biow_tmp->lsid);
 		lsid = biow_tmp->lsid;
@@ -225,96 +219,53 @@ bool pending_check_and_copy(
  * Delete fully overwritten biow(s) by a specified biow
  * from a pending data.
  *
- * The is_overwritten field of all deleted biows will be true.
+ * The is_overwritten field of all deleted biows will be true
+ * and their overwritten_lsid will be biow->lsid.
  *
  * @pending_data pending data.
  * @biow bio wrapper as a target for comparison.
  */
 void pending_delete_fully_overwritten(
-	struct multimap *pending_data, const struct bio_wrapper *biow)
+	struct rb_root *pending_data, const struct bio_wrapper *biow)
 {
-	struct multimap_cursor cur;
-	u64 start_pos, end_pos;
+	const u64 first = bio_wrapper_first_pos(biow);
+	const u64 last = bio_wrapper_last_pos(biow);
+	struct bio_wrapper *biow_tmp, *biow_next;
 
 	ASSERT(pending_data);
 	ASSERT(biow);
 	ASSERT(biow->len > 0);
 
-	start_pos = biow->pos;
-	end_pos = start_pos + biow->len;
-
-	/* Search the smallest candidate. */
-	multimap_cursor_init(pending_data, &cur);
-	if (!multimap_cursor_search(&cur, start_pos, MAP_SEARCH_GE, 0)) {
-		/* No overlapped requests. */
-		return;
-	}
-
-	/* Search and delete overwritten biow(s). */
-	while (multimap_cursor_key(&cur) < end_pos) {
-		struct bio_wrapper *biow_tmp;
-		int ret;
-		ASSERT(multimap_cursor_is_valid(&cur));
-		biow_tmp = (struct bio_wrapper *)multimap_cursor_val(&cur);
-		ASSERT(biow_tmp);
-		ret = biow_tmp != biow &&
-			bio_wrapper_is_overwritten_by(biow_tmp, biow);
-		if (ret) {
+	/* Search and delete overwritten biow(s).
+	   The next node must be got before the current one is removed. */
+	biow_tmp = pending_tree_iter_first(pending_data, first, last);
+	while (biow_tmp) {
+		biow_next = pending_tree_iter_next(biow_tmp, first, last);
+		if (biow_tmp != biow &&
+			bio_wrapper_is_overwritten_by(biow_tmp, biow)) {
+			ASSERT(biow_tmp->lsid < biow->lsid);
+			biow_tmp->overwritten_lsid = biow->lsid;
+			/* Pairs with smp_rmb() in the data submit task
+			   reading overwritten_lsid after the flag. */
+			smp_mb__before_atomic();
 			set_bit(BIO_WRAPPER_OVERWRITTEN, &biow_tmp->flags);
-			ret = multimap_cursor_del(&cur);
-			ASSERT(ret);
-			ret = multimap_cursor_is_data(&cur);
-		} else {
-			ret = multimap_cursor_next(&cur);
+			pending_delete(pending_data, biow_tmp);
 		}
-		if (!ret) { break; }
+		biow_tmp = biow_next;
 	}
 }
 
-/**
- * Insert a biow to and
- * delete fully overwritten (not overlapped) biow(s) by the biow from
- * a pending data.
- *
- * RETURN:
- *   true in success, or false.
- */
-bool pending_insert_and_delete_fully_overwritten(
-	struct multimap *pending_data, unsigned int *max_sectors_p,
-	struct bio_wrapper *biow, gfp_t gfp_mask)
+void pending_data_print(struct rb_root *pending_data)
 {
-	ASSERT(pending_data);
-	ASSERT(max_sectors_p);
-	ASSERT(biow);
-
-	if (!pending_insert(pending_data, max_sectors_p, biow, gfp_mask))
-		return false;
-
-	pending_delete_fully_overwritten(pending_data, biow);
-	return true;
-}
-
-void pending_data_print(struct multimap *pending_data)
-{
-	struct multimap_cursor cur;
-	multimap_cursor_init(pending_data, &cur);
-
-	if (!multimap_cursor_begin(&cur))
-		return;
+	struct rb_node *node;
 
 	printk(KERN_INFO "pending_data_print BEGIN\n");
-	while (multimap_cursor_next(&cur)) {
-		struct bio_wrapper *biow;
-		ASSERT(multimap_cursor_is_valid(&cur));
-		biow = (struct bio_wrapper *)multimap_cursor_val(&cur);
-		if (!biow) {
-			printk(KERN_INFO "biow null\n");
-		} else {
-			print_bio_wrapper(KERN_INFO, biow);
-		}
+	for (node = rb_first(pending_data); node; node = rb_next(node)) {
+		struct bio_wrapper *biow =
+			rb_entry(node, struct bio_wrapper, pending_node);
+		print_bio_wrapper(KERN_INFO, biow);
 	}
 	printk(KERN_INFO "pending_data_print END\n");
-
 }
 
 MODULE_LICENSE("GPL");
@@ -8,25 +8,23 @@
 #define WALB_PENDING_IO_H_KERNEL
 
 #include "check_kernel.h"
+#include <linux/rbtree.h>
 #include "kern.h"
-#include "treemap.h"
 #include "bio_wrapper.h"
 
 /* Pending data functions. */
-bool pending_insert(
-	struct multimap *pending_data, unsigned int *max_sectors_p,
-	struct bio_wrapper *biow, gfp_t gfp_mask);
+void pending_insert(
+	struct rb_root *pending_data, struct bio_wrapper *biow);
 void pending_delete(
-	struct multimap *pending_data, unsigned int *max_sectors_p,
-	struct bio_wrapper *biow);
-bool pending_check_and_copy(
-	struct multimap *pending_data, unsigned int max_sectors,
-	struct bio_wrapper *biow, gfp_t gfp_mask);
+	struct rb_root *pending_data, struct bio_wrapper *biow);
+unsigned int pending_collect_overlapped(
+	struct rb_root *pending_data,
+	const struct bio_wrapper *biow, struct list_head *biow_list);
+bool pending_copy_overlapped(
+	struct bio_wrapper *biow, struct list_head *biow_list,
+	unsigned int n_overlapped_bios, gfp_t gfp_mask);
 void pending_delete_fully_overwritten(
-	struct multimap *pending_data, const struct bio_wrapper *biow);
-bool pending_insert_and_delete_fully_overwritten(
-	struct multimap *pending_data, unsigned int *max_sectors_p,
-	struct bio_wrapper *biow, gfp_t gfp_mask);
-void pending_data_print(struct multimap *pending_data);
+	struct rb_root *pending_data, const struct bio_wrapper *biow);
+void pending_data_print(struct rb_root *pending_data);
 
 #endif /* WALB_PENDING_IO_H_KERNEL */
@@ -6,6 +6,7 @@
  */
 #include <linux/module.h>
 #include <linux/delay.h>
+#include <linux/interval_tree_generic.h>
 #include "linux/walb/logger.h"
 #include "kern.h"
 #include "io.h"
@@ -17,6 +18,7 @@
 #include "super.h"
 #include "overlapped_io.h"
 #include "redo.h"
+#include "walb_trace.h"
 
 /*******************************************************************************
  * Static data definition.
@@ -31,6 +33,14 @@ struct redo_data
 	u64 lsid;
 	blk_status_t status;
 
+	/* Number of bios submitted by the worker. */
+	u64 n_bio;
+
+	/* Checksum verification statistics of the master. */
+	u64 n_csum_record;
+	u64 csum_cpu_ns; /* sum of time in calc_checksum_for_redo(). */
+	u64 csum_wait_ns; /* time to wait for verification. */
+
 	/* These are shared with worker and master.
 	   Use queue_lock to access them. */
 	spinlock_t queue_lock;
@@ -38,6 +48,172 @@ struct redo_data
 	unsigned int queue_len;
 };
 
+/**
+ * Sector data of a physical block in a redo chunk.
+ */
+struct redo_sector
+{
+	struct sector_data sectd; /* must be the first member. */
+	struct redo_chunk *chunk;
+	struct bio_wrapper *biow;
+};
+
+/**
+ * Contiguous log blocks read by one bio for redo.
+ *
+ * Each physical block is sliced to a bio wrapper
+ * whose private_data is &sect[i].sectd referring to the pages.
+ * The chunk will be freed when all the bio wrappers have been destroyed.
+ */
+struct redo_chunk
+{
+	atomic_t n_ref;
+	unsigned int n_pb;
+	unsigned int n_pages;
+	struct redo_sector *sect; /* n_pb items in lsid order. */
+	struct page *pages[0]; /* n_pages items. */
+};
+
+/**
+ * Data IOs of logpacks in a redo window.
+ *
+ * Extents in the tree do not overlap each other.
+ * A newer data IO drops, trims or is merged into older ones,
+ * so only the latest data of each block survive
+ * and they are submitted in address order when the window is flushed.
+ *
+ * This is crash-safe because written_lsid is not updated
+ * until all the data IOs of the redo have completed.
+ */
+struct redo_window
+{
+	/* Interval tree of data biows linked with biow->pending_node. */
+	struct rb_root tree;
+
+	/* Log size of the logpacks in the window [physical block]. */
+	u64 n_pb;
+
+	/* Statistics [logical block]. */
+	u64 n_lb_in; /* inserted. */
+	u64 n_lb_out; /* submitted. */
+};
+
+/**
+ * An extent of logged data not written to the data device yet
+ * in lazy redo.
+ */
+struct lazy_redo_extent
+{
+	struct rb_node node;
+	u64 subtree_last;
+
+	u64 pos; /* position in the data device [logical block]. */
+	unsigned int len; /* [logical block] */
+	/* Position of the data in the log device [logical block].
+	   Not used for discard. */
+	u64 log_pos;
+	bool is_discard;
+
+	struct list_head list; /* for temporary lists. */
+};
+
+/**
+ * Lazy redo data.
+ *
+ * Redo verifies logs and builds an extent index of the latest logged data
+ * without writing the data device, and the device starts.
+ * Then a worker writes the extents to the data device in address order.
+ *
+ * Reads of extents not written yet are redirected to the log device.
+ * Write IOs remove the overlapped part of extents
+ * after they are inserted to pending data,
+ * and their data IOs wait for the overlapped extents being written.
+ * Reads check pending data and extents with the pending shards locked.
+ *
+ * lsids.written is kept at the start of the redo
+ * until all the extents have been written,
+ * so the logs are redone again after a crash.
+ */
+struct lazy_redo
+{
+	struct walb_dev *wdev;
+	struct worker_data *wd;
+
+	/* Use spin_lock()/spin_unlock() to access the trees. */
+	spinlock_t lock;
+	/* Interval trees of struct lazy_redo_extent. They do not overlap. */
+	struct rb_root extents; /* not written yet. */
+	struct rb_root applying; /* being written. */
+
+	/* Ranges written by write IOs while the applying extents
+	   overlapped with them. They are removed from the extents
+	   put back to the index when a batch fails.
+	   Linked with ext->list. Use lock to access it. */
+	struct list_head overwritten;
+
+	/* Waiters for applying extents, is_applying, and is_done. */
+	wait_queue_head_t wait_q;
+	bool is_done;
+	bool is_failed;
+	/* Set to stop the worker before all the extents are written. */
+	bool should_stop;
+	/* Set to stop the worker at a batch boundary while frozen.
+	   is_applying is set while a batch is running.
+	   Use lock to access them. */
+	bool is_paused;
+	bool is_applying;
+
+	/* For bio_split() of redirected reads. */
+	struct bio_set *bio_set;
+
+	/* Lsid at the end of the redo. */
+	u64 end_lsid;
+	/* written_lsid notified by gc while lazy redo is running.
+	   Use wdev->lsid_lock. */
+	u64 written_lsid;
+
+	/* Statistics [logical block]. */
+	u64 n_lb;
+	u64 n_lb_applied;
+	struct timespec start_ts;
+};
+
+/**
+ * An IO to write an extent in lazy redo.
+ */
+struct lazy_redo_io
+{
+	struct lazy_redo_extent *ext;
+	struct bio *bio;
+	struct completion done;
+	blk_status_t status;
+	unsigned int n_pages;
+	struct page *pages[0];
+};
+
+/**
+ * Checksum calculation of a log record in redo.
+ * Records of a logpack are calculated in parallel
+ * by calc_checksums_for_redo().
+ */
+struct redo_csum_work
+{
+	struct work_struct work;
+	struct completion done;
+
+	/* The first biow of the record data.
+	   NULL if the record is not calculated. */
+	struct bio_wrapper *biow;
+	unsigned int n_lb;
+	unsigned int pbs;
+	u32 type;
+	u32 salt;
+
+	/* Results. */
+	u32 csum;
+	u64 cpu_ns;
+};
+
 /**
  * Logpack for redo.
  */
@@ -55,6 +231,42 @@ struct redo_pack
    Currently 8MB. */
 #define READ_AHEAD_LB (8 * 1024 * 1024 / LOGICAL_BLOCK_SIZE)
 
+/* Maximum size of an extent in lazy redo [logical block].
+   An extent must be read by a bio. */
+#define LAZY_REDO_EXTENT_MAX_LB (BIO_MAX_PAGES * (PAGE_SIZE / LOGICAL_BLOCK_SIZE))
+
+/* Number of extents written at once in lazy redo. */
+#define LAZY_REDO_BATCH 64
+
+/*******************************************************************************
+ * Interval tree of data IOs in a redo window.
+ *******************************************************************************/
+
+INTERVAL_TREE_DEFINE(struct bio_wrapper, pending_node,
+		u64, pending_subtree_last,
+		bio_wrapper_first_pos, bio_wrapper_last_pos,
+		static, redo_tree)
+
+/*******************************************************************************
+ * Interval tree of extents in lazy redo.
+ *******************************************************************************/
+
+static inline u64 lazy_redo_extent_first(const struct lazy_redo_extent *ext)
+{
+	return ext->pos;
+}
+
+static inline u64 lazy_redo_extent_last(const struct lazy_redo_extent *ext)
+{
+	ASSERT(ext->len > 0);
+	return ext->pos + ext->len - 1;
+}
+
+INTERVAL_TREE_DEFINE(struct lazy_redo_extent, node,
+		u64, subtree_last,
+		lazy_redo_extent_first, lazy_redo_extent_last,
+		static, lazy_tree)
+
 /*******************************************************************************
  * Static functions prototype.
  *******************************************************************************/
@@ -63,6 +275,13 @@ static struct redo_data* create_redo_data(struct walb_dev *wdev, u64 lsid);
 static void destroy_redo_data(struct redo_data* data);
 static void run_read_log_in_redo(void *data);
 static void run_gc_log_in_redo(void *data);
+static struct bio* create_redo_chunk(
+	struct walb_dev *wdev, u64 lsid, unsigned int n_pb,
+	struct list_head *biow_list);
+static void free_redo_chunk(struct redo_chunk *chunk);
+static void put_redo_sector(struct sector_data *sectd);
+static void bio_end_io_for_redo_chunk(struct bio *bio);
+static unsigned int get_max_redo_chunk_pb(struct walb_dev *wdev);
 static struct bio_wrapper* create_log_bio_wrapper_for_redo(
 	struct walb_dev *wdev, u64 lsid, struct sector_data *sectd);
 static bool prepare_data_bio_for_redo(
@@ -85,12 +304,17 @@ static struct bio_wrapper* get_logpack_header_for_redo(
 	u64 written_lsid);
 static bool redo_logpack(
 	struct worker_data *read_wd, struct redo_data *read_rd,
-	struct redo_data *gc_rd,
+	struct redo_data *gc_rd, struct redo_window *win,
+	struct lazy_redo *lazy,
 	struct bio_wrapper *logh_biow, u64 *written_lsid_p,
 	bool *should_terminate);
 static u32 calc_checksum_for_redo(
-	unsigned int n_lb, unsigned int pbs, u32 salt,
+	unsigned int n_lb, unsigned int pbs, u32 type, u32 salt,
+	struct bio_wrapper *biow);
+static struct redo_csum_work* calc_checksums_for_redo(
+	struct redo_data *read_rd, const struct walb_logpack_header *logh,
 	struct list_head *biow_list);
+static void task_calc_checksum_for_redo(struct work_struct *work);
 static void create_data_io_for_redo(
 	struct walb_dev *wdev,
 	struct walb_log_record *rec,
@@ -101,6 +325,49 @@ static void create_discard_data_io_for_redo(
 	struct list_head *biow_list);
 static void submit_data_bio_for_redo(
 	UNUSED struct walb_dev *wdev, struct bio_wrapper *biow);
+static void submit_data_bio_list_for_redo(
+	struct walb_dev *wdev, struct redo_data *gc_rd,
+	struct list_head *biow_list);
+static u64 get_redo_window_pb(struct walb_dev *wdev);
+static void init_redo_window(struct redo_window *win);
+static void insert_to_redo_window(
+	struct walb_dev *wdev, struct redo_window *win,
+	struct bio_wrapper *biow);
+static void trim_data_bio_for_redo(
+	struct bio_wrapper *biow, u64 pos, unsigned int len);
+static void copy_data_bio_for_redo(
+	struct bio_wrapper *dst, const struct bio_wrapper *src);
+static void flush_redo_window(
+	struct walb_dev *wdev, struct redo_window *win,
+	struct redo_data *gc_rd);
+static struct lazy_redo* create_lazy_redo(struct walb_dev *wdev);
+static void destroy_lazy_redo(struct lazy_redo *lazy);
+static struct lazy_redo_extent* alloc_lazy_redo_extent_never_giveup(void);
+static void overwrite_lazy_redo_extents(
+	struct lazy_redo *lazy, u64 pos, unsigned int len,
+	struct lazy_redo_extent **spare);
+static void insert_record_to_lazy_redo(
+	struct lazy_redo *lazy, const struct walb_log_record *rec);
+static void insert_extent_to_lazy_redo(
+	struct lazy_redo *lazy, u64 pos, unsigned int len,
+	u64 log_pos, bool is_discard);
+static struct lazy_redo_extent* get_first_readable_extent(
+	struct lazy_redo *lazy, u64 first, u64 last);
+static bool is_applying_overlapped(
+	struct lazy_redo *lazy, u64 pos, unsigned int len);
+static void run_lazy_redo(void *data);
+static bool begin_lazy_redo_batch(struct lazy_redo *lazy);
+static void end_lazy_redo_batch(struct lazy_redo *lazy);
+static bool is_lazy_redo_batch_running(struct lazy_redo *lazy);
+static bool apply_lazy_redo_batch(struct lazy_redo *lazy);
+static struct lazy_redo_io* create_lazy_redo_io(
+	struct walb_dev *wdev, struct lazy_redo_extent *ext);
+static void destroy_lazy_redo_io(struct lazy_redo_io *lio);
+static void prepare_lazy_redo_io(
+	struct lazy_redo_io *lio, struct block_device *bdev, sector_t sector,
+	unsigned int op);
+static void bio_end_io_for_lazy_redo(struct bio *bio);
+static void finish_lazy_redo(struct lazy_redo *lazy);
 
 /*******************************************************************************
  * Static functions definition.
@@ -124,6 +391,10 @@ static struct redo_data* create_redo_data(struct walb_dev *wdev, u64 lsid)
 	INIT_LIST_HEAD(&data->queue);
 	data->queue_len = 0;
 	data->status = BLK_STS_OK;
+	data->n_bio = 0;
+	data->n_csum_record = 0;
+	data->csum_cpu_ns = 0;
+	data->csum_wait_ns = 0;
 	return data;
 }
 
@@ -144,9 +415,10 @@ static void destroy_redo_data(struct redo_data* data)
  *
  * What this function will do:
  *   while queue is not occupied:
- *     create buf/bio/biow and submit it.
- *     enqueue the biow.
+ *     create a redo chunk of contiguous log blocks and submit its bio.
+ *     enqueue the biow of each physical block.
  *
+ * A chunk does not go across the end of the ring buffer.
  * You must call wakeup_worker() to read more data.
  *
  * @data struct redo_data pointer.
@@ -156,10 +428,12 @@ static void run_read_log_in_redo(void *data)
 	struct redo_data *redod;
 	struct walb_dev *wdev;
 	struct list_head biow_list;
+	struct bio_list bio_list;
 	unsigned int queue_len;
 	unsigned int pbs;
-	unsigned int max_len;
+	unsigned int max_len, max_chunk_pb;
 	struct bio_wrapper *biow, *biow_next;
+	struct bio *bio;
 	struct blk_plug plug;
 
 	redod = (struct redo_data *)data;
@@ -168,42 +442,52 @@ static void run_read_log_in_redo(void *data)
 	ASSERT(wdev);
 	pbs = wdev->physical_bs;
 	max_len = capacity_pb(pbs, READ_AHEAD_LB);
+	max_chunk_pb = get_max_redo_chunk_pb(wdev);
 
 	INIT_LIST_HEAD(&biow_list);
+	bio_list_init(&bio_list);
 
 	spin_lock(&redod->queue_lock);
 	queue_len = redod->queue_len;
 	spin_unlock(&redod->queue_lock);
 
 	while (queue_len < max_len) {
-		/* Create biow for redo. */
+		u64 off_in_ring;
+		unsigned int n_pb = min(max_len - queue_len, max_chunk_pb);
+
+		div64_u64_rem(redod->lsid, wdev->ring_buffer_size, &off_in_ring);
+		if (n_pb > wdev->ring_buffer_size - off_in_ring)
+			n_pb = wdev->ring_buffer_size - off_in_ring;
+
+		/* Create a chunk for redo. */
 	retry:
-		biow = create_log_bio_wrapper_for_redo(
-			wdev, redod->lsid, NULL);
-		if (!biow) {
+		bio = create_redo_chunk(wdev, redod->lsid, n_pb, &biow_list);
+		if (!bio) {
+			if (n_pb > 1)
+				n_pb /= 2;
 			schedule();
 			goto retry;
 		}
-
-		list_add_tail(&biow->list, &biow_list);
+		bio_list_add(&bio_list, bio);
 
 		/* Iterate. */
-		queue_len++;
-		redod->lsid++;
+		queue_len += n_pb;
+		redod->lsid += n_pb;
 	}
 
 	if (list_empty(&biow_list)) {
 		goto fin;
 	}
 
-	/* Submit biow(s). */
+	/* Submit bio(s). */
 	blk_start_plug(&plug);
-	list_for_each_entry_safe(biow, biow_next, &biow_list, list) {
-		generic_make_request(biow->bio);
+	while ((bio = bio_list_pop(&bio_list))) {
+		generic_make_request(bio);
+		redod->n_bio++;
 	}
 	blk_finish_plug(&plug);
 
-	/* Enqueue submitted biow(s). */
+	/* Enqueue biow(s) of the submitted chunk(s). */
 	spin_lock(&redod->queue_lock);
 	list_for_each_entry_safe(biow, biow_next, &biow_list, list) {
 		list_move_tail(&biow->list, &redod->queue);
@@ -276,8 +560,7 @@ static void run_gc_log_in_redo(void *data)
 			/* Delete from overlapped detection data. */
 			spin_lock(&iocored->overlapped_data_lock);
 			overlapped_delete_and_notify(
-				iocored->overlapped_data,
-				&iocored->max_sectors_in_overlapped,
+				&iocored->overlapped_data,
 				&should_submit_list, biow
 #ifdef WALB_DEBUG
 				, &iocored->overlapped_out_id
@@ -304,15 +587,178 @@ static void run_gc_log_in_redo(void *data)
 }
 
 /**
- * Create a bio wrapper for log read in redo.
- * You can submit the bio of returned bio wrapper.
+ * Create a redo chunk to read contiguous log blocks.
+ * You can submit the returned bio.
+ *
+ * @wdev walb device (log device will be used for target).
+ * @lsid the first lsid to read.
+ * @n_pb number of physical blocks to read.
+ *   They must not go across the end of the ring buffer.
+ * @biow_list bio wrappers of the physical blocks
+ *   will be added to the tail in lsid order.
+ *   They will be completed when the returned bio is completed.
+ *
+ * RETURN:
+ *   read bio in success, or NULL.
+ */
+static struct bio* create_redo_chunk(
+	struct walb_dev *wdev, u64 lsid, unsigned int n_pb,
+	struct list_head *biow_list)
+{
+	const unsigned int pbs = wdev->physical_bs;
+	const unsigned int n_pages = DIV_ROUND_UP(n_pb * pbs, PAGE_SIZE);
+	struct redo_chunk *chunk;
+	struct bio *bio;
+	struct bio_wrapper *biow, *biow_next;
+	struct list_head list;
+	unsigned int i;
+	u64 off_pb;
+	UNUSED int bytes;
+
+	ASSERT(pbs <= PAGE_SIZE);
+	ASSERT(n_pb > 0);
+	ASSERT(n_pages <= BIO_MAX_PAGES);
+	INIT_LIST_HEAD(&list);
+
+	chunk = kzalloc(sizeof(*chunk)
+			+ sizeof(struct page *) * n_pages
+			+ sizeof(struct redo_sector) * n_pb, GFP_NOIO);
+	if (!chunk) { goto error0; }
+	chunk->n_pb = n_pb;
+	chunk->n_pages = n_pages;
+	chunk->sect = (struct redo_sector *)&chunk->pages[n_pages];
+	atomic_set(&chunk->n_ref, n_pb);
+	for (i = 0; i < n_pages; i++) {
+		chunk->pages[i] = alloc_page(GFP_NOIO);
+		if (!chunk->pages[i]) { goto error1; }
+	}
+	bio = bio_alloc(GFP_NOIO, n_pages);
+	if (!bio) { goto error1; }
+
+	bio->bi_bdev = wdev->ldev;
+	off_pb = get_offset_of_lsid(lsid, wdev->ring_buffer_off, wdev->ring_buffer_size);
+	WLOG_(wdev, "lsid: %" PRIu64 " off_pb: %" PRIu64 " n_pb: %u\n"
+		, lsid, off_pb, n_pb);
+	bio->bi_iter.bi_sector = addr_lb(pbs, off_pb);
+	bio_set_op_attrs(bio, REQ_OP_READ, 0);
+	bio->bi_end_io = bio_end_io_for_redo_chunk;
+	bio->bi_private = chunk;
+	for (i = 0; i < n_pages; i++) {
+		const unsigned int len =
+			min_t(unsigned int, PAGE_SIZE, n_pb * pbs - i * PAGE_SIZE);
+		bytes = bio_add_page(bio, chunk->pages[i], len, 0);
+		ASSERT(bytes == len);
+	}
+	ASSERT((bio_sectors(bio) << 9) == n_pb * pbs);
+
+	for (i = 0; i < n_pb; i++) {
+		struct redo_sector *rsect = &chunk->sect[i];
+		const unsigned int off = i * pbs;
+
+		biow = alloc_bio_wrapper_inc(wdev, GFP_NOIO);
+		if (!biow) { goto error2; }
+		init_bio_wrapper(biow, NULL);
+		biow->pos = addr_lb(pbs, off_pb + i);
+		biow->len = n_lb_in_pb(pbs);
+
+		rsect->sectd.size = pbs;
+		rsect->sectd.data = page_address(chunk->pages[off / PAGE_SIZE])
+			+ off % PAGE_SIZE;
+		rsect->chunk = chunk;
+		rsect->biow = biow;
+		biow->private_data = &rsect->sectd;
+		list_add_tail(&biow->list, &list);
+	}
+	list_splice_tail(&list, biow_list);
+	return bio;
+
+error2:
+	list_for_each_entry_safe(biow, biow_next, &list, list) {
+		list_del(&biow->list);
+		destroy_bio_wrapper_dec(wdev, biow);
+	}
+	bio_put(bio);
+error1:
+	free_redo_chunk(chunk);
+error0:
+	return NULL;
+}
+
+/**
+ * Free a redo chunk and its pages.
+ */
+static void free_redo_chunk(struct redo_chunk *chunk)
+{
+	unsigned int i;
+
+	for (i = 0; i < chunk->n_pages; i++) {
+		if (chunk->pages[i])
+			__free_page(chunk->pages[i]);
+	}
+	kfree(chunk);
+}
+
+/**
+ * Release sector data of a physical block in a redo chunk.
+ * The chunk will be freed with the last one.
+ */
+static void put_redo_sector(struct sector_data *sectd)
+{
+	struct redo_sector *rsect = container_of(sectd, struct redo_sector, sectd);
+	struct redo_chunk *chunk = rsect->chunk;
+
+	ASSERT(chunk);
+	if (atomic_dec_and_test(&chunk->n_ref))
+		free_redo_chunk(chunk);
+}
+
+/**
+ * bio_end_io for the read bio of a redo chunk.
+ */
+static void bio_end_io_for_redo_chunk(struct bio *bio)
+{
+	struct redo_chunk *chunk = bio->bi_private;
+	struct redo_sector *sect = chunk->sect;
+	const unsigned int n_pb = chunk->n_pb;
+	const blk_status_t status = bio->bi_status;
+	unsigned int i;
+
+	bio_put(bio);
+	/* The chunk may be freed after the last biow is completed. */
+	for (i = 0; i < n_pb; i++) {
+		struct bio_wrapper *biow = sect[i].biow;
+		LOG_("pos %" PRIu64 "\n", (u64)biow->pos);
+		biow->status = status;
+		complete(&biow->done);
+	}
+}
+
+/**
+ * Get the maximum number of physical blocks in a redo chunk.
+ */
+static unsigned int get_max_redo_chunk_pb(struct walb_dev *wdev)
+{
+	const unsigned int pbs = wdev->physical_bs;
+	const unsigned int max_sectors =
+		queue_max_sectors(bdev_get_queue(wdev->ldev));
+	unsigned int n_pb = BIO_MAX_PAGES * (PAGE_SIZE / pbs);
+
+	ASSERT(pbs <= PAGE_SIZE);
+	n_pb = min(n_pb, max_sectors / n_lb_in_pb(pbs));
+	return max(n_pb, 1U);
+}
+
+/**
+ * Create a bio wrapper to write a log block in redo.
+ * You can submit the bio of returned bio wrapper
+ * after changing its operation.
  *
  * @wdev walb device (log device will be used for target).
- * @lsid target lsid to read.
- * @sectd sector data. if NULL then newly allocated.
+ * @lsid target lsid.
+ * @sectd sector data in a redo chunk.
  *
  * RETURN:
- *   bio wrapper in success, or false.
+ *   bio wrapper in success, or NULL.
  */
 static struct bio_wrapper* create_log_bio_wrapper_for_redo(
 	struct walb_dev *wdev, u64 lsid, struct sector_data *sectd)
@@ -322,19 +768,14 @@ static struct bio_wrapper* create_log_bio_wrapper_for_redo(
 	const unsigned int pbs = wdev->physical_bs;
 	u64 off_lb, off_pb;
 	int bytes;
-	bool is_sectd_alloc = false;
 
 	ASSERT(pbs <= PAGE_SIZE);
+	ASSERT_SECTOR_DATA(sectd);
 
-	if (!sectd) {
-		is_sectd_alloc = true;
-		sectd = sector_alloc(pbs, GFP_NOIO);
-		if (!sectd) { goto error0; }
-	}
 	bio = bio_alloc(GFP_NOIO, 1);
-	if (!bio) { goto error1; }
+	if (!bio) { goto error0; }
 	biow = alloc_bio_wrapper_inc(wdev, GFP_NOIO);
-	if (!biow) { goto error2; }
+	if (!biow) { goto error1; }
 
 	bio->bi_bdev = wdev->ldev;
 	off_pb = get_offset_of_lsid(lsid, wdev->ring_buffer_off, wdev->ring_buffer_size);
@@ -354,15 +795,11 @@ static struct bio_wrapper* create_log_bio_wrapper_for_redo(
 
 	return biow;
 #if 0
-error3:
+error2:
 	destroy_bio_wrapper_dec(wdev, biow);
 #endif
-error2:
-	bio_put(bio);
 error1:
-	if (is_sectd_alloc) {
-		sector_free(sectd);
-	}
+	bio_put(bio);
 error0:
 	return NULL;
 }
@@ -451,19 +888,16 @@ error0:
 }
 
 /**
- * Destroy bio wrapper created by create_bio_wrapper_for_redo().
+ * Destroy bio wrapper created for redo.
  */
 static void destroy_bio_wrapper_for_redo(
 	struct walb_dev *wdev, struct bio_wrapper* biow)
 {
-	struct sector_data *sectd;
-
 	if (!biow)
 		return;
 
 	if (biow->private_data) {
-		sectd = biow->private_data;
-		sector_free(sectd);
+		put_redo_sector(biow->private_data);
 		biow->private_data = NULL;
 	}
 	if (biow->bio) {
@@ -669,6 +1103,10 @@ retry:
  *
  * @read_rd redo data for read.
  * @gc_rd redo data for gc.
+ * @win redo window where data IOs are inserted.
+ *   If NULL, they are submitted immediately.
+ * @lazy lazy redo data where records are inserted instead of data IOs.
+ *   If NULL, data IOs are created.
  * @logh_biow !!!valid!!! logpack header biow.
  *   This logpack header will be updated
  *   if the logpack is partially invalid.
@@ -681,7 +1119,8 @@ retry:
  */
 static bool redo_logpack(
 	struct worker_data *read_wd, struct redo_data *read_rd,
-	struct redo_data *gc_rd,
+	struct redo_data *gc_rd, struct redo_window *win,
+	struct lazy_redo *lazy,
 	struct bio_wrapper *logh_biow, u64 *written_lsid_p,
 	bool *should_terminate)
 {
@@ -696,8 +1135,8 @@ static bool redo_logpack(
 	u32 csum;
 	bool is_valid = true;
 	blk_status_t status = BLK_STS_OK;
-	struct blk_plug plug;
 	bool retb = true;
+	struct redo_csum_work *csum_works = NULL;
 
 	ASSERT(read_rd);
 	wdev = read_rd->wdev;
@@ -713,6 +1152,7 @@ static bool redo_logpack(
 
 	logh = get_logpack_header(sectd);
 	ASSERT(logh);
+	trace_walb_redo_logpack(wdev, logh);
 
 	n_pb = 0;
 retry1:
@@ -732,6 +1172,10 @@ retry1:
 		wait_for_completion(&biow->done);
 	}
 
+	/* Calculate checksums of the records in parallel.
+	   If NULL, they will be calculated one by one. */
+	csum_works = calc_checksums_for_redo(read_rd, logh, &biow_list_pack);
+
 	for (i = 0; i < logh->n_records; i++) {
 		struct walb_log_record *rec = &logh->record[i];
 		const bool is_discard =
@@ -750,7 +1194,9 @@ retry1:
 		n_pb = capacity_pb(pbs, n_lb);
 
 		if (is_discard) {
-			if (blk_queue_discard(bdev_get_queue(wdev->ddev))) {
+			if (lazy) {
+				insert_record_to_lazy_redo(lazy, rec);
+			} else if (blk_queue_discard(bdev_get_queue(wdev->ddev))) {
 				create_discard_data_io_for_redo(
 					wdev, rec, &biow_list_ready);
 			} else {
@@ -790,15 +1236,33 @@ retry1:
 		}
 
 		/* Validate checksum. */
-		csum = calc_checksum_for_redo(
-			rec->io_size, pbs,
-			wdev->log_checksum_salt, &biow_list_io);
+		if (csum_works) {
+			ASSERT(csum_works[i].biow ==
+				list_first_entry(&biow_list_io, struct bio_wrapper, list));
+			csum = csum_works[i].csum;
+		} else {
+			csum = calc_checksum_for_redo(
+				rec->io_size, pbs, wdev->log_checksum_type,
+				wdev->log_checksum_salt,
+				list_first_entry(&biow_list_io, struct bio_wrapper, list));
+		}
 		if (csum != rec->checksum) {
 			is_valid = false;
 			invalid_idx = i;
 			break;
 		}
 
+		/* The data will be read from the log device again in lazy redo. */
+		if (lazy) {
+			insert_record_to_lazy_redo(lazy, rec);
+			list_for_each_entry_safe(biow, biow_next,
+						&biow_list_io, list) {
+				list_del(&biow->list);
+				destroy_bio_wrapper_for_redo(wdev, biow);
+			}
+			continue;
+		}
+
 		/* Create data bio. */
 		create_data_io_for_redo(wdev, rec, &biow_list_io);
 		list_for_each_entry_safe(biow, biow_next, &biow_list_io, list) {
@@ -806,22 +1270,15 @@ retry1:
 		}
 	}
 
-	/* Submit ready biow(s). */
-	blk_start_plug(&plug);
-	list_for_each_entry(biow, &biow_list_ready, list) {
-		LOG_("submit data bio pos %"PRIu64" len %u\n",
-			(u64)biow->pos, biow->len);
-		submit_data_bio_for_redo(wdev, biow);
-	}
-	blk_finish_plug(&plug);
-
-	/* Enqueue submitted biow(s) for gc. */
-	spin_lock(&gc_rd->queue_lock);
-	list_for_each_entry_safe(biow, biow_next, &biow_list_ready, list) {
-		list_move_tail(&biow->list, &gc_rd->queue);
-		gc_rd->queue_len++;
+	/* Submit ready biow(s) or insert them to the window. */
+	if (win) {
+		list_for_each_entry_safe(biow, biow_next, &biow_list_ready, list) {
+			list_del(&biow->list);
+			insert_to_redo_window(wdev, win, biow);
+		}
+	} else {
+		submit_data_bio_list_for_redo(wdev, gc_rd, &biow_list_ready);
 	}
-	spin_unlock(&gc_rd->queue_lock);
 	ASSERT(list_empty(&biow_list_ready));
 
 	/*
@@ -894,6 +1351,7 @@ retry2:
 	retb = true;
 
 fin:
+	kfree(csum_works);
 	/* Destroy remaining biow(s). */
 	list_for_each_entry_safe(biow, biow_next, &biow_list_io, list) {
 		list_del(&biow->list);
@@ -912,25 +1370,25 @@ fin:
  *
  * @n_lb io size [logical block].
  * @pbs physical block size [bytes].
+ * @type log checksum algorithm (WALB_LOG_CHECKSUM_XXX).
  * @salt checksum salt.
- * @biow_list biow list where each biow size is pbs.
+ * @biow the first biow of the IO data in a biow list
+ *   where each biow size is pbs.
  *
  * RETURN:
  *   checksum of the IO data.
  */
 static u32 calc_checksum_for_redo(
-	unsigned int n_lb, unsigned int pbs, u32 salt,
-	struct list_head *biow_list)
+	unsigned int n_lb, unsigned int pbs, u32 type, u32 salt,
+	struct bio_wrapper *biow)
 {
-	struct bio_wrapper *biow;
 	u32 csum = salt;
 
 	ASSERT(n_lb > 0);
 	ASSERT_PBS(pbs);
-	ASSERT(biow_list);
-	ASSERT(!list_empty(biow_list));
+	ASSERT(biow);
 
-	list_for_each_entry(biow, biow_list, list) {
+	while (true) {
 		struct sector_data *sectd = biow->private_data;
 		const unsigned int len = min(biow->len, n_lb);
 		ASSERT_SECTOR_DATA(sectd);
@@ -938,12 +1396,109 @@ static u32 calc_checksum_for_redo(
 		ASSERT(biow->len == n_lb_in_pb(pbs));
 		ASSERT(n_lb > 0);
 
-		csum = checksum_partial(
-			csum, sectd->data, len * LOGICAL_BLOCK_SIZE);
+		csum = log_checksum_partial_simd(
+			type, csum, sectd->data, len * LOGICAL_BLOCK_SIZE);
 		n_lb -= len;
+		if (n_lb == 0)
+			break;
+		biow = list_next_entry(biow, list);
 	}
-	ASSERT(n_lb == 0);
-	return checksum_finish(csum);
+	return log_checksum_finish(type, csum);
+}
+
+/**
+ * Calculate checksums of the normal records in a logpack in parallel.
+ *
+ * Each record is calculated by a work in wq_unbound_
+ * except the last one which is calculated by the caller.
+ * Statistics of read_rd will be updated.
+ *
+ * Logpacks are verified one by one, so the parallelism is
+ * limited by the number of normal records in a logpack.
+ * Logpacks of a few large IOs will not scale.
+ *
+ * @read_rd redo data for read.
+ * @logh logpack header.
+ * @biow_list biow list of the logpack data
+ *   whose read IOs have completed.
+ *
+ * RETURN:
+ *   Array of logh->n_records items where csum of record i is item[i].csum,
+ *   or NULL if memory allocation failed.
+ *   Free it with kfree().
+ */
+static struct redo_csum_work* calc_checksums_for_redo(
+	struct redo_data *read_rd, const struct walb_logpack_header *logh,
+	struct list_head *biow_list)
+{
+	struct walb_dev *wdev = read_rd->wdev;
+	const unsigned int pbs = wdev->physical_bs;
+	struct redo_csum_work *works, *last = NULL;
+	struct list_head *p = biow_list->next;
+	unsigned int i, j;
+	u64 t0;
+
+	if (logh->n_records == 0)
+		return NULL;
+	works = kcalloc(logh->n_records, sizeof(*works), GFP_NOIO);
+	if (!works)
+		return NULL;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < logh->n_records; i++) {
+		const struct walb_log_record *rec = &logh->record[i];
+		struct redo_csum_work *w = &works[i];
+		unsigned int n_pb;
+
+		if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)
+			|| rec->io_size == 0)
+			continue;
+		n_pb = capacity_pb(pbs, rec->io_size);
+		if (p == biow_list)
+			break;
+		if (!test_bit_u32(LOG_RECORD_PADDING, &rec->flags)) {
+			w->biow = list_entry(p, struct bio_wrapper, list);
+			w->n_lb = rec->io_size;
+			w->pbs = pbs;
+			w->type = wdev->log_checksum_type;
+			w->salt = wdev->log_checksum_salt;
+			init_completion(&w->done);
+			INIT_WORK(&w->work, task_calc_checksum_for_redo);
+			if (last)
+				queue_work(wq_unbound_, &last->work);
+			last = w;
+		}
+		for (j = 0; j < n_pb && p != biow_list; j++)
+			p = p->next;
+	}
+	if (last)
+		task_calc_checksum_for_redo(&last->work);
+
+	for (i = 0; i < logh->n_records; i++) {
+		struct redo_csum_work *w = &works[i];
+		if (!w->biow)
+			continue;
+		wait_for_completion(&w->done);
+		read_rd->n_csum_record++;
+		read_rd->csum_cpu_ns += w->cpu_ns;
+	}
+	read_rd->csum_wait_ns += ktime_get_ns() - t0;
+	return works;
+}
+
+/**
+ * Checksum calculation task for redo.
+ */
+static void task_calc_checksum_for_redo(struct work_struct *work)
+{
+	struct redo_csum_work *w =
+		container_of(work, struct redo_csum_work, work);
+	const u64 t0 = ktime_get_ns();
+
+	w->csum = calc_checksum_for_redo(
+		w->n_lb, w->pbs, w->type, w->salt, w->biow);
+	w->cpu_ns = ktime_get_ns() - t0;
+	complete(&w->done);
 }
 
 /**
@@ -1040,7 +1595,6 @@ static void submit_data_bio_for_redo(
 {
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
-	bool is_overlapped_insert_succeeded;
 	int n_overlapped;
 #endif
 
@@ -1048,23 +1602,15 @@ static void submit_data_bio_for_redo(
 
 #ifdef WALB_OVERLAPPED_SERIALIZE
 	/* check and insert to overlapped detection data. */
-retry_insert_ol:
 	spin_lock(&iocored->overlapped_data_lock);
-	is_overlapped_insert_succeeded =
-		overlapped_check_and_insert(
-			iocored->overlapped_data,
-			&iocored->max_sectors_in_overlapped,
-			biow, GFP_ATOMIC
+	overlapped_check_and_insert(
+		&iocored->overlapped_data, biow
 #ifdef WALB_DEBUG
-			, &iocored->overlapped_in_id
+		, &iocored->overlapped_in_id
 #endif
-			);
+		);
 	n_overlapped = biow->n_overlapped;
 	spin_unlock(&iocored->overlapped_data_lock);
-	if (!is_overlapped_insert_succeeded) {
-		schedule();
-		goto retry_insert_ol;
-	}
 	if (bio_wrapper_state_is_delayed(biow)) {
 		LOG_("n_overlapped %d\n", n_overlapped);
 		ASSERT(n_overlapped > 0);
@@ -1077,42 +1623,805 @@ retry_insert_ol:
 #endif /* WALB_OVERLAPPED_SERIALIZE */
 }
 
-/*******************************************************************************
- * Global functions definition.
- *******************************************************************************/
-
 /**
- * Execute redo.
- *
- * Start: wdev->written_lsid
- * End: lsid with checksum invalid.
+ * Submit data bios for redo and enqueue them for gc.
  *
- * written_lsid will be updated by the new
- * written_lsid, completed_lsid, and latest_lsid.
+ * @biow_list biow list linked with biow->list. It will be empty.
  */
-bool execute_redo(struct walb_dev *wdev)
+static void submit_data_bio_list_for_redo(
+	struct walb_dev *wdev, struct redo_data *gc_rd,
+	struct list_head *biow_list)
 {
-	unsigned int minor;
-	struct worker_data *read_wd, *gc_wd;
-	struct redo_data *read_rd, *gc_rd;
-	struct list_head biow_list;
-	struct bio_wrapper *logh_biow;
-	unsigned int pbs;
-	u64 written_lsid, start_lsid;
-	bool failed = false;
-	bool should_terminate;
-	int ret;
-	struct timespec ts[2];
-	u64 n_logpack = 0;
-
-	ASSERT(wdev);
-	minor = MINOR(wdev->devt);
-	pbs = wdev->physical_bs;
+	struct bio_wrapper *biow, *biow_next;
+	struct blk_plug plug;
 
-	/* Allocate resources and prepare workers.. */
-	read_wd = alloc_worker(GFP_KERNEL);
-	if (!read_wd) { goto error0; }
-	gc_wd = alloc_worker(GFP_KERNEL);
+	blk_start_plug(&plug);
+	list_for_each_entry(biow, biow_list, list) {
+		LOG_("submit data bio pos %"PRIu64" len %u\n",
+			(u64)biow->pos, biow->len);
+		submit_data_bio_for_redo(wdev, biow);
+	}
+	blk_finish_plug(&plug);
+
+	spin_lock(&gc_rd->queue_lock);
+	list_for_each_entry_safe(biow, biow_next, biow_list, list) {
+		list_move_tail(&biow->list, &gc_rd->queue);
+		gc_rd->queue_len++;
+	}
+	spin_unlock(&gc_rd->queue_lock);
+	ASSERT(list_empty(biow_list));
+}
+
+/**
+ * Get redo window size from redo_window_mb_.
+ * The window keeps all its data in memory, so it is bounded
+ * by MAX_REDO_WINDOW_MB and the ring buffer size.
+ *
+ * RETURN:
+ *   window size [physical block]. 0 means disabled.
+ */
+static u64 get_redo_window_pb(struct walb_dev *wdev)
+{
+	unsigned int window_mb = READ_ONCE(redo_window_mb_);
+	u64 window_pb;
+
+	if (window_mb > MAX_REDO_WINDOW_MB) {
+		WLOGw(wdev, "redo_window_mb %u is too large. Use %u.\n"
+			, window_mb, MAX_REDO_WINDOW_MB);
+		window_mb = MAX_REDO_WINDOW_MB;
+	}
+	window_pb = (u64)window_mb * (1024 * 1024 / wdev->physical_bs);
+	return min_t(u64, window_pb, wdev->ring_buffer_size);
+}
+
+static void init_redo_window(struct redo_window *win)
+{
+	win->tree = RB_ROOT;
+	win->n_pb = 0;
+	win->n_lb_in = 0;
+	win->n_lb_out = 0;
+}
+
+/**
+ * Insert a data biow to a redo window.
+ *
+ * Overlapped older extents are processed as follows:
+ *   covered by the new one: dropped.
+ *   partially overlapped: trimmed.
+ *   covering the new one: the new data is copied into the older one
+ *     and the new biow is dropped.
+ *     A discard inside a write clears the range with zero.
+ *     A write inside a discard splits the discard.
+ *
+ * @biow data biow created by create_data_io_for_redo()
+ *   or create_discard_data_io_for_redo().
+ */
+static void insert_to_redo_window(
+	struct walb_dev *wdev, struct redo_window *win,
+	struct bio_wrapper *biow)
+{
+	struct bio_wrapper *old, *old_next;
+	struct list_head list;
+	const u64 bgn = biow->pos;
+	const u64 end = biow->pos + biow->len;
+	const bool is_discard = bio_wrapper_state_is_discard(biow);
+
+	ASSERT(biow->len > 0);
+	win->n_lb_in += biow->len;
+	INIT_LIST_HEAD(&list);
+
+	old = redo_tree_iter_first(&win->tree, bgn, end - 1);
+	while (old) {
+		list_add_tail(&old->list, &list);
+		old = redo_tree_iter_next(old, bgn, end - 1);
+	}
+	list_for_each_entry_safe(old, old_next, &list, list) {
+		const u64 old_bgn = old->pos;
+		const u64 old_end = old->pos + old->len;
+		struct bio_wrapper *tail;
+
+		list_del(&old->list);
+		if (bgn <= old_bgn && old_end <= end) {
+			redo_tree_remove(old, &win->tree);
+			destroy_bio_wrapper_for_redo(wdev, old);
+			continue;
+		}
+		if (old_bgn < bgn && end < old_end) {
+			/* The only overlapped one. */
+			ASSERT(list_empty(&list));
+			if (!bio_wrapper_state_is_discard(old)) {
+				copy_data_bio_for_redo(old, biow);
+				destroy_bio_wrapper_for_redo(wdev, biow);
+				return;
+			}
+			if (is_discard) {
+				destroy_bio_wrapper_for_redo(wdev, biow);
+				return;
+			}
+		retry:
+			tail = create_discard_bio_wrapper_for_redo(
+				wdev, end, old_end - end);
+			if (!tail) {
+				schedule();
+				goto retry;
+			}
+			redo_tree_remove(old, &win->tree);
+			trim_data_bio_for_redo(old, old_bgn, bgn - old_bgn);
+			redo_tree_insert(old, &win->tree);
+			redo_tree_insert(tail, &win->tree);
+			break;
+		}
+		redo_tree_remove(old, &win->tree);
+		if (old_bgn < bgn)
+			trim_data_bio_for_redo(old, old_bgn, bgn - old_bgn);
+		else
+			trim_data_bio_for_redo(old, end, old_end - end);
+		redo_tree_insert(old, &win->tree);
+	}
+	redo_tree_insert(biow, &win->tree);
+}
+
+/**
+ * Trim a data bio of a biow not submitted yet.
+ *
+ * @pos new position [logical block].
+ * @len new size [logical block].
+ *   [pos, pos + len) must be inside the current range.
+ */
+static void trim_data_bio_for_redo(
+	struct bio_wrapper *biow, u64 pos, unsigned int len)
+{
+	struct bio *bio = biow->bio;
+
+	ASSERT(bio);
+	ASSERT(len > 0);
+	ASSERT(biow->pos <= pos);
+	ASSERT(pos + len <= biow->pos + biow->len);
+
+	if (biow->pos < pos)
+		bio_advance(bio, (pos - biow->pos) << 9);
+	bio->bi_iter.bi_size = len << 9;
+	biow->pos = pos;
+	biow->len = len;
+	ASSERT(bio_begin_sector(bio) == pos);
+	ASSERT(bio_sectors(bio) == len);
+}
+
+/**
+ * Overwrite the data of a write biow by a newer biow inside it.
+ * If src is a discard, the range will be zero-cleared.
+ *
+ * Data bios for redo have a single segment.
+ */
+static void copy_data_bio_for_redo(
+	struct bio_wrapper *dst, const struct bio_wrapper *src)
+{
+	u8 *dst_p;
+
+	ASSERT(!bio_wrapper_state_is_discard(dst));
+	ASSERT(dst->pos <= src->pos);
+	ASSERT(src->pos + src->len <= dst->pos + dst->len);
+
+	dst_p = (u8 *)page_address(bio_page(dst->bio)) + bio_offset(dst->bio)
+		+ ((src->pos - dst->pos) << 9);
+	if (bio_wrapper_state_is_discard(src)) {
+		memset(dst_p, 0, src->len << 9);
+	} else {
+		const u8 *src_p = (const u8 *)page_address(bio_page(src->bio))
+			+ bio_offset(src->bio);
+		memcpy(dst_p, src_p, src->len << 9);
+	}
+}
+
+/**
+ * Submit all the data IOs in a redo window in address order.
+ */
+static void flush_redo_window(
+	struct walb_dev *wdev, struct redo_window *win,
+	struct redo_data *gc_rd)
+{
+	struct rb_node *node;
+	struct list_head biow_list;
+
+	INIT_LIST_HEAD(&biow_list);
+	while ((node = rb_first(&win->tree))) {
+		struct bio_wrapper *biow =
+			rb_entry(node, struct bio_wrapper, pending_node);
+		redo_tree_remove(biow, &win->tree);
+		RB_CLEAR_NODE(&biow->pending_node);
+		win->n_lb_out += biow->len;
+		list_add_tail(&biow->list, &biow_list);
+	}
+	submit_data_bio_list_for_redo(wdev, gc_rd, &biow_list);
+	win->n_pb = 0;
+}
+
+/**
+ * Create lazy redo data.
+ */
+static struct lazy_redo* create_lazy_redo(struct walb_dev *wdev)
+{
+	struct lazy_redo *lazy;
+	int ret;
+
+	lazy = kzalloc(sizeof(*lazy), GFP_KERNEL);
+	if (!lazy)
+		goto error0;
+	lazy->wd = alloc_worker(GFP_KERNEL);
+	if (!lazy->wd)
+		goto error1;
+	ret = snprintf(lazy->wd->name, WORKER_NAME_MAX_LEN,
+		"%s/%u", "lazy_redo", wdev_minor(wdev) / 2);
+	ASSERT(ret < WORKER_NAME_MAX_LEN);
+
+	/* Do not share a bio_set with other users
+	   to avoid a deadlock of nested allocations in make_request. */
+	lazy->bio_set = bioset_create(BIO_POOL_SIZE, 0, BIOSET_NEED_RESCUER);
+	if (!lazy->bio_set)
+		goto error2;
+
+	lazy->wdev = wdev;
+	spin_lock_init(&lazy->lock);
+	lazy->extents = RB_ROOT;
+	lazy->applying = RB_ROOT;
+	INIT_LIST_HEAD(&lazy->overwritten);
+	init_waitqueue_head(&lazy->wait_q);
+	return lazy;
+
+error2:
+	free_worker(lazy->wd);
+error1:
+	kfree(lazy);
+error0:
+	return NULL;
+}
+
+/**
+ * Destroy lazy redo data.
+ * The worker must not be running.
+ */
+static void destroy_lazy_redo(struct lazy_redo *lazy)
+{
+	struct rb_node *node;
+
+	ASSERT(RB_EMPTY_ROOT(&lazy->applying));
+	ASSERT(list_empty(&lazy->overwritten));
+	while ((node = rb_first(&lazy->extents))) {
+		struct lazy_redo_extent *ext =
+			rb_entry(node, struct lazy_redo_extent, node);
+		lazy_tree_remove(ext, &lazy->extents);
+		kfree(ext);
+	}
+	bioset_free(lazy->bio_set);
+	free_worker(lazy->wd);
+	kfree(lazy);
+}
+
+static struct lazy_redo_extent* alloc_lazy_redo_extent_never_giveup(void)
+{
+	struct lazy_redo_extent *ext;
+
+	for (;;) {
+		ext = kmalloc(sizeof(*ext), GFP_NOIO);
+		if (ext)
+			return ext;
+		schedule();
+	}
+}
+
+/**
+ * Remove the range from the extents not written yet.
+ *
+ * @pos position [logical block].
+ * @len size [logical block].
+ * @spare an extent used if an extent is split. It will be NULL if used.
+ *
+ * CONTEXT:
+ *   lazy->lock must be held.
+ */
+static void overwrite_lazy_redo_extents(
+	struct lazy_redo *lazy, u64 pos, unsigned int len,
+	struct lazy_redo_extent **spare)
+{
+	struct lazy_redo_extent *ext, *ext_next, *tail;
+	struct list_head list;
+	const u64 bgn = pos;
+	const u64 end = pos + len;
+
+	ASSERT(len > 0);
+	INIT_LIST_HEAD(&list);
+
+	ext = lazy_tree_iter_first(&lazy->extents, bgn, end - 1);
+	while (ext) {
+		list_add_tail(&ext->list, &list);
+		ext = lazy_tree_iter_next(ext, bgn, end - 1);
+	}
+	list_for_each_entry_safe(ext, ext_next, &list, list) {
+		const u64 ext_bgn = ext->pos;
+		const u64 ext_end = ext->pos + ext->len;
+
+		list_del(&ext->list);
+		lazy_tree_remove(ext, &lazy->extents);
+		if (bgn <= ext_bgn && ext_end <= end) {
+			kfree(ext);
+			continue;
+		}
+		if (ext_bgn < bgn && end < ext_end) {
+			/* Split. */
+			ASSERT(*spare);
+			tail = *spare;
+			*spare = NULL;
+			tail->pos = end;
+			tail->len = ext_end - end;
+			tail->log_pos = ext->log_pos + (end - ext_bgn);
+			tail->is_discard = ext->is_discard;
+			lazy_tree_insert(tail, &lazy->extents);
+			ext->len = bgn - ext_bgn;
+		} else if (ext_bgn < bgn) {
+			ext->len = bgn - ext_bgn;
+		} else {
+			ext->pos = end;
+			ext->len = ext_end - end;
+			ext->log_pos += end - ext_bgn;
+		}
+		lazy_tree_insert(ext, &lazy->extents);
+	}
+}
+
+/**
+ * Insert a verified log record to lazy redo.
+ *
+ * The data is split at the end of the ring buffer
+ * and by LAZY_REDO_EXTENT_MAX_LB
+ * so that each extent can be read by a bio.
+ */
+static void insert_record_to_lazy_redo(
+	struct lazy_redo *lazy, const struct walb_log_record *rec)
+{
+	struct walb_dev *wdev = lazy->wdev;
+	const unsigned int pbs = wdev->physical_bs;
+	u64 pos = rec->offset;
+	unsigned int n_lb = rec->io_size;
+	u64 lsid = rec->lsid;
+
+	if (test_bit_u32(LOG_RECORD_DISCARD, &rec->flags)) {
+		insert_extent_to_lazy_redo(lazy, pos, n_lb, 0, true);
+		return;
+	}
+	while (n_lb > 0) {
+		u64 off_in_ring;
+		unsigned int len = min_t(unsigned int, n_lb, LAZY_REDO_EXTENT_MAX_LB);
+		const u64 log_pos = addr_lb(pbs, get_offset_of_lsid(
+				lsid, wdev->ring_buffer_off, wdev->ring_buffer_size));
+
+		div64_u64_rem(lsid, wdev->ring_buffer_size, &off_in_ring);
+		if ((u64)capacity_pb(pbs, len) > wdev->ring_buffer_size - off_in_ring)
+			len = (wdev->ring_buffer_size - off_in_ring) * n_lb_in_pb(pbs);
+		insert_extent_to_lazy_redo(lazy, pos, len, log_pos, false);
+		pos += len;
+		n_lb -= len;
+		lsid += capacity_pb(pbs, len);
+	}
+}
+
+static void insert_extent_to_lazy_redo(
+	struct lazy_redo *lazy, u64 pos, unsigned int len,
+	u64 log_pos, bool is_discard)
+{
+	struct lazy_redo_extent *ext, *spare;
+
+	ext = alloc_lazy_redo_extent_never_giveup();
+	spare = alloc_lazy_redo_extent_never_giveup();
+	ext->pos = pos;
+	ext->len = len;
+	ext->log_pos = log_pos;
+	ext->is_discard = is_discard;
+
+	spin_lock(&lazy->lock);
+	overwrite_lazy_redo_extents(lazy, pos, len, &spare);
+	lazy_tree_insert(ext, &lazy->extents);
+	spin_unlock(&lazy->lock);
+	kfree(spare);
+}
+
+/**
+ * Get the first extent whose data must be read from the log device.
+ *
+ * Discard extents are skipped, which means reads of them
+ * return the data before the discard.
+ *
+ * CONTEXT:
+ *   lazy->lock must be held.
+ */
+static struct lazy_redo_extent* get_first_readable_extent(
+	struct lazy_redo *lazy, u64 first, u64 last)
+{
+	struct lazy_redo_extent *ext0, *ext1;
+
+	ext0 = lazy_tree_iter_first(&lazy->extents, first, last);
+	while (ext0 && ext0->is_discard)
+		ext0 = lazy_tree_iter_next(ext0, first, last);
+	ext1 = lazy_tree_iter_first(&lazy->applying, first, last);
+	while (ext1 && ext1->is_discard)
+		ext1 = lazy_tree_iter_next(ext1, first, last);
+
+	if (!ext0)
+		return ext1;
+	if (!ext1)
+		return ext0;
+	return ext0->pos < ext1->pos ? ext0 : ext1;
+}
+
+static bool is_applying_overlapped(
+	struct lazy_redo *lazy, u64 pos, unsigned int len)
+{
+	bool ret;
+
+	spin_lock(&lazy->lock);
+	ret = lazy_tree_iter_first(&lazy->applying, pos, pos + len - 1) != NULL;
+	spin_unlock(&lazy->lock);
+	return ret;
+}
+
+/**
+ * Lazy redo worker.
+ * It writes all the extents and then finishes lazy redo.
+ * If paused, it returns at a batch boundary
+ * and resume_lazy_redo() will wake it up again.
+ */
+static void run_lazy_redo(void *data)
+{
+	struct lazy_redo *lazy = data;
+	bool ret;
+
+	if (READ_ONCE(lazy->is_done))
+		return;
+	while (!READ_ONCE(lazy->should_stop)) {
+		if (!begin_lazy_redo_batch(lazy))
+			return;
+		ret = apply_lazy_redo_batch(lazy);
+		end_lazy_redo_batch(lazy);
+		if (!ret)
+			break;
+		cond_resched();
+	}
+	finish_lazy_redo(lazy);
+}
+
+/**
+ * RETURN:
+ *   false if lazy redo is paused.
+ */
+static bool begin_lazy_redo_batch(struct lazy_redo *lazy)
+{
+	bool ret;
+
+	spin_lock(&lazy->lock);
+	ret = !lazy->is_paused;
+	lazy->is_applying = ret;
+	spin_unlock(&lazy->lock);
+	return ret;
+}
+
+static void end_lazy_redo_batch(struct lazy_redo *lazy)
+{
+	spin_lock(&lazy->lock);
+	lazy->is_applying = false;
+	spin_unlock(&lazy->lock);
+	wake_up_all(&lazy->wait_q);
+}
+
+static bool is_lazy_redo_batch_running(struct lazy_redo *lazy)
+{
+	bool ret;
+
+	spin_lock(&lazy->lock);
+	ret = lazy->is_applying;
+	spin_unlock(&lazy->lock);
+	return ret;
+}
+
+/**
+ * Write extents to the data device in address order.
+ *
+ * RETURN:
+ *   true if some extents have been written.
+ *   false if there is no extent or an IO error occurred.
+ */
+static bool apply_lazy_redo_batch(struct lazy_redo *lazy)
+{
+	struct walb_dev *wdev = lazy->wdev;
+	const bool support_discard = blk_queue_discard(bdev_get_queue(wdev->ddev));
+	struct lazy_redo_extent *exts[LAZY_REDO_BATCH];
+	struct lazy_redo_io *lios[LAZY_REDO_BATCH];
+	struct lazy_redo_extent *ext, *ow, *ow_next;
+	struct rb_node *node;
+	struct blk_plug plug;
+	blk_status_t status = BLK_STS_OK;
+	unsigned int i, n = 0;
+	u64 n_lb = 0;
+
+	/* Move extents to the applying tree. */
+	spin_lock(&lazy->lock);
+	while (n < LAZY_REDO_BATCH && (node = rb_first(&lazy->extents))) {
+		ext = rb_entry(node, struct lazy_redo_extent, node);
+		lazy_tree_remove(ext, &lazy->extents);
+		lazy_tree_insert(ext, &lazy->applying);
+		exts[n++] = ext;
+	}
+	spin_unlock(&lazy->lock);
+	if (n == 0)
+		return false;
+
+	for (i = 0; i < n; i++)
+		lios[i] = create_lazy_redo_io(wdev, exts[i]);
+
+	/* Read the data from the log device. */
+	blk_start_plug(&plug);
+	for (i = 0; i < n; i++) {
+		struct lazy_redo_io *lio = lios[i];
+		if (lio->ext->is_discard)
+			continue;
+		prepare_lazy_redo_io(lio, wdev->ldev, lio->ext->log_pos, REQ_OP_READ);
+		submit_bio(lio->bio);
+	}
+	blk_finish_plug(&plug);
+	for (i = 0; i < n; i++) {
+		struct lazy_redo_io *lio = lios[i];
+		if (lio->ext->is_discard)
+			continue;
+		wait_for_completion(&lio->done);
+		if (lio->status)
+			status = lio->status;
+	}
+	if (status)
+		goto fin;
+
+	/* Write the data to the data device. */
+	blk_start_plug(&plug);
+	for (i = 0; i < n; i++) {
+		struct lazy_redo_io *lio = lios[i];
+		if (lio->ext->is_discard) {
+			if (!support_discard)
+				continue;
+			prepare_lazy_redo_io(lio, wdev->ddev, lio->ext->pos, REQ_OP_DISCARD);
+		} else {
+			prepare_lazy_redo_io(lio, wdev->ddev, lio->ext->pos, REQ_OP_WRITE);
+		}
+		submit_bio(lio->bio);
+	}
+	blk_finish_plug(&plug);
+	for (i = 0; i < n; i++) {
+		struct lazy_redo_io *lio = lios[i];
+		if (lio->ext->is_discard && !support_discard)
+			continue;
+		wait_for_completion(&lio->done);
+		if (lio->status)
+			status = lio->status;
+	}
+
+fin:
+	if (status) {
+		lazy->is_failed = true;
+		if (!test_and_set_bit(WALB_STATE_READ_ONLY, &wdev->flags))
+			WLOGe(wdev, "lazy redo IO error. to be read-only mode.\n");
+	}
+	/* Extents are removed only after they have been written
+	   and they are kept in the index if failed. */
+	spin_lock(&lazy->lock);
+	for (i = 0; i < n; i++) {
+		ext = exts[i];
+		lazy_tree_remove(ext, &lazy->applying);
+		if (status) {
+			lazy_tree_insert(ext, &lazy->extents);
+		} else {
+			n_lb += ext->len;
+			kfree(ext);
+		}
+	}
+	/* The extents put back must not contain
+	   older data of ranges written during the batch.
+	   Each range is used as the spare of the split. */
+	list_for_each_entry_safe(ow, ow_next, &lazy->overwritten, list) {
+		struct lazy_redo_extent *spare = ow;
+
+		list_del(&ow->list);
+		if (status)
+			overwrite_lazy_redo_extents(lazy, ow->pos, ow->len, &spare);
+		kfree(spare);
+	}
+	lazy->n_lb_applied += n_lb;
+	spin_unlock(&lazy->lock);
+	wake_up_all(&lazy->wait_q);
+
+	for (i = 0; i < n; i++)
+		destroy_lazy_redo_io(lios[i]);
+	return !status;
+}
+
+/**
+ * Create an IO with pages to write an extent.
+ * Never giveup.
+ */
+static struct lazy_redo_io* create_lazy_redo_io(
+	struct walb_dev *wdev, struct lazy_redo_extent *ext)
+{
+	const unsigned int n_pages = ext->is_discard ? 0
+		: DIV_ROUND_UP(ext->len * LOGICAL_BLOCK_SIZE, PAGE_SIZE);
+	struct lazy_redo_io *lio;
+	unsigned int i;
+
+	ASSERT(n_pages <= BIO_MAX_PAGES);
+retry:
+	lio = kzalloc(sizeof(*lio) + sizeof(struct page *) * n_pages, GFP_NOIO);
+	if (!lio)
+		goto error0;
+	lio->ext = ext;
+	lio->n_pages = n_pages;
+	for (i = 0; i < n_pages; i++) {
+		lio->pages[i] = alloc_page(GFP_NOIO);
+		if (!lio->pages[i])
+			goto error1;
+	}
+	/* bio_alloc(GFP_NOIO, 0) will cause kernel panic. */
+	lio->bio = bio_alloc(GFP_NOIO, max(n_pages, 1U));
+	if (!lio->bio)
+		goto error1;
+	return lio;
+
+error1:
+	destroy_lazy_redo_io(lio);
+error0:
+	schedule();
+	goto retry;
+}
+
+static void destroy_lazy_redo_io(struct lazy_redo_io *lio)
+{
+	unsigned int i;
+
+	if (lio->bio)
+		bio_put(lio->bio);
+	for (i = 0; i < lio->n_pages; i++) {
+		if (lio->pages[i])
+			__free_page(lio->pages[i]);
+	}
+	kfree(lio);
+}
+
+/**
+ * (Re)initialize the bio of an IO to submit.
+ *
+ * @sector target address [logical block].
+ * @op REQ_OP_READ, REQ_OP_WRITE, or REQ_OP_DISCARD.
+ */
+static void prepare_lazy_redo_io(
+	struct lazy_redo_io *lio, struct block_device *bdev, sector_t sector,
+	unsigned int op)
+{
+	struct bio *bio = lio->bio;
+	const unsigned int size = lio->ext->len * LOGICAL_BLOCK_SIZE;
+	unsigned int i;
+	UNUSED int bytes;
+
+	bio_reset(bio);
+	bio->bi_bdev = bdev;
+	bio->bi_iter.bi_sector = sector;
+	bio_set_op_attrs(bio, op, 0);
+	bio->bi_end_io = bio_end_io_for_lazy_redo;
+	bio->bi_private = lio;
+	if (op == REQ_OP_DISCARD) {
+		bio->bi_iter.bi_size = size;
+	} else {
+		for (i = 0; i < lio->n_pages; i++) {
+			const unsigned int len =
+				min_t(unsigned int, PAGE_SIZE, size - i * PAGE_SIZE);
+			bytes = bio_add_page(bio, lio->pages[i], len, 0);
+			ASSERT(bytes == len);
+		}
+	}
+	ASSERT(bio_sectors(bio) == lio->ext->len);
+	init_completion(&lio->done);
+	lio->status = BLK_STS_OK;
+}
+
+static void bio_end_io_for_lazy_redo(struct bio *bio)
+{
+	struct lazy_redo_io *lio = bio->bi_private;
+
+	lio->status = bio->bi_status;
+	complete(&lio->done);
+}
+
+/**
+ * Finish lazy redo.
+ * written_lsid will be updated and the superblock will be synced
+ * if all the extents have been written.
+ */
+static void finish_lazy_redo(struct lazy_redo *lazy)
+{
+	struct walb_dev *wdev = lazy->wdev;
+	struct timespec ts;
+	bool is_completed;
+
+	spin_lock(&lazy->lock);
+	is_completed = !lazy->is_failed && RB_EMPTY_ROOT(&lazy->extents);
+	spin_unlock(&lazy->lock);
+
+	/* The written data must be permanent before written_lsid is updated. */
+	if (is_completed && blkdev_issue_flush(wdev->ddev, GFP_NOIO, NULL)) {
+		WLOGe(wdev, "data device flush failed after lazy redo.\n");
+		lazy->is_failed = true;
+		is_completed = false;
+	}
+
+	if (is_completed) {
+		spin_lock(&wdev->lsid_lock);
+		wdev->lsids.written = max(lazy->end_lsid, lazy->written_lsid);
+		clear_bit(WALB_STATE_LAZY_REDO, &wdev->flags);
+		spin_unlock(&wdev->lsid_lock);
+
+		if (!walb_sync_super_block(wdev))
+			WLOGe(wdev, "superblock sync failed after lazy redo.\n");
+	}
+
+	getnstimeofday(&ts);
+	ts = timespec_sub(ts, lazy->start_ts);
+	WLOGi(wdev, "Lazy redo %s: %" PRIu64 " of %" PRIu64 " logical blocks"
+		" in %ld.%09ld second.\n"
+		, is_completed ? "done" : (lazy->is_failed ? "failed" : "stopped")
+		, lazy->n_lb_applied, lazy->n_lb, ts.tv_sec, ts.tv_nsec);
+
+	WRITE_ONCE(lazy->is_done, true);
+	wake_up_all(&lazy->wait_q);
+}
+
+/*******************************************************************************
+ * Global functions definition.
+ *******************************************************************************/
+
+/**
+ * Execute redo.
+ *
+ * Start: wdev->written_lsid
+ * End: lsid with checksum invalid.
+ *
+ * written_lsid will be updated by the new
+ * written_lsid, completed_lsid, and latest_lsid.
+ *
+ * If lazy_redo_ is set, the data device is not written here.
+ * written_lsid will be kept and the lazy redo worker will write the data
+ * after the device starts.
+ */
+bool execute_redo(struct walb_dev *wdev)
+{
+	unsigned int minor;
+	struct worker_data *read_wd, *gc_wd;
+	struct redo_data *read_rd, *gc_rd;
+	struct list_head biow_list;
+	struct bio_wrapper *logh_biow;
+	unsigned int pbs;
+	u64 written_lsid, start_lsid;
+	bool failed = false;
+	bool should_terminate;
+	int ret;
+	struct timespec ts[2];
+	u64 n_logpack = 0;
+	struct redo_window win;
+	u64 window_pb, prev_lsid;
+	u64 n_read_bio, period_ns, kib_per_sec;
+	u64 n_csum_record, csum_cpu_ns, csum_wait_ns;
+	struct lazy_redo *lazy = NULL;
+	struct rb_node *node;
+
+	ASSERT(wdev);
+	minor = MINOR(wdev->devt);
+	pbs = wdev->physical_bs;
+
+	/* Allocate resources and prepare workers.. */
+	read_wd = alloc_worker(GFP_KERNEL);
+	if (!read_wd) { goto error0; }
+	gc_wd = alloc_worker(GFP_KERNEL);
 	if (!gc_wd) { goto error1; }
 
 	ret = snprintf(read_wd->name, WORKER_NAME_MAX_LEN,
@@ -1130,8 +2439,18 @@ bool execute_redo(struct walb_dev *wdev)
 	if (!read_rd) { goto error2; }
 	gc_rd = create_redo_data(wdev, written_lsid);
 	if (!gc_rd) { goto error3; }
+	if (READ_ONCE(lazy_redo_)) {
+		lazy = create_lazy_redo(wdev);
+		if (!lazy) { goto error4; }
+	}
 
 	WLOGi(wdev, "Redo will start from lsid %"PRIu64".\n", written_lsid);
+	init_redo_window(&win);
+	window_pb = lazy ? 0 : get_redo_window_pb(wdev);
+	if (window_pb > 0)
+		WLOGi(wdev, "Redo window: %" PRIu64 " physical blocks.\n", window_pb);
+	if (lazy)
+		WLOGi(wdev, "Lazy redo is enabled.\n");
 
 	/* Run workers. */
 	initialize_worker(read_wd,
@@ -1143,6 +2462,8 @@ bool execute_redo(struct walb_dev *wdev)
 	INIT_LIST_HEAD(&biow_list);
 	getnstimeofday(&ts[0]);
 	while (true) {
+		prev_lsid = written_lsid;
+
 		/* Get logpack header. */
 		logh_biow = get_logpack_header_for_redo(
 			read_wd, read_rd, written_lsid);
@@ -1161,6 +2482,7 @@ bool execute_redo(struct walb_dev *wdev)
 		/* Try to redo the logpack. */
 		LOG_("Try to redo (lsid %"PRIu64")\n", written_lsid);
 		if (!redo_logpack(read_wd, read_rd, gc_rd,
+					window_pb > 0 ? &win : NULL, lazy,
 					logh_biow, &written_lsid,
 					&should_terminate)) {
 			/* IO error occurred. */
@@ -1172,11 +2494,17 @@ bool execute_redo(struct walb_dev *wdev)
 		if (should_terminate) {
 			break;
 		}
+		if (window_pb > 0) {
+			win.n_pb += written_lsid - prev_lsid;
+			if (win.n_pb >= window_pb)
+				flush_redo_window(wdev, &win, gc_rd);
+		}
 		wakeup_worker(gc_wd);
 		wakeup_worker(read_wd);
 	}
 
 	/* Finalize. */
+	flush_redo_window(wdev, &win, gc_rd);
 	finalize_worker(read_wd);
 	wait_for_all_read_io_and_destroy(read_rd);
 	wakeup_worker(gc_wd);
@@ -1186,6 +2514,11 @@ bool execute_redo(struct walb_dev *wdev)
 
 	/* Now the redo task has done. */
 
+	n_read_bio = read_rd->n_bio;
+	n_csum_record = read_rd->n_csum_record;
+	csum_cpu_ns = read_rd->csum_cpu_ns;
+	csum_wait_ns = read_rd->csum_wait_ns;
+
 	/* Free resources. */
 	destroy_redo_data(gc_rd);
 	destroy_redo_data(read_rd);
@@ -1194,7 +2527,34 @@ bool execute_redo(struct walb_dev *wdev)
 
 	if (failed) {
 		WLOGe(wdev, "IO error occurred during redo.\n");
-		return false;
+		goto error5;
+	}
+
+	if (lazy) {
+		for (node = rb_first(&lazy->extents); node; node = rb_next(node))
+			lazy->n_lb += rb_entry(node, struct lazy_redo_extent, node)->len;
+		if (lazy->n_lb == 0) {
+			/* Nothing to write. */
+			destroy_lazy_redo(lazy);
+			lazy = NULL;
+		}
+	}
+	if (lazy) {
+		/* Logs in [start_lsid, written_lsid) are redone again
+		   if the device crashes before lazy redo finishes. */
+		spin_lock(&wdev->lsid_lock);
+		wdev->lsids.prev_written = start_lsid;
+		wdev->lsids.written = start_lsid;
+		wdev->lsids.completed = written_lsid;
+		wdev->lsids.permanent = written_lsid;
+		wdev->lsids.flush = written_lsid;
+		wdev->lsids.latest = written_lsid;
+		lazy->end_lsid = written_lsid;
+		lazy->written_lsid = start_lsid;
+		wdev->lazy_redo = lazy;
+		set_bit(WALB_STATE_LAZY_REDO, &wdev->flags);
+		spin_unlock(&wdev->lsid_lock);
+		goto log;
 	}
 
 	/* Update lsid variables. */
@@ -1211,20 +2571,45 @@ bool execute_redo(struct walb_dev *wdev)
 	if (!walb_sync_super_block(wdev))
 		return false;
 
+log:
+	trace_walb_redo(wdev, start_lsid, written_lsid, n_logpack, lazy != NULL);
+
 	/* Get end time. */
 	getnstimeofday(&ts[1]);
 	ts[0] = timespec_sub(ts[1], ts[0]);
-	WLOGi(wdev, "Redo period: %ld.%09ld second\n"
-		, ts[0].tv_sec, ts[0].tv_nsec);
+	period_ns = max_t(u64, timespec_to_ns(&ts[0]), 1);
+	kib_per_sec = div64_u64(
+		(written_lsid - start_lsid) * pbs / 1024 * NSEC_PER_SEC,
+		period_ns);
+	WLOGi(wdev, "Redo period: %ld.%09ld second %" PRIu64 " KiB/s\n"
+		, ts[0].tv_sec, ts[0].tv_nsec, kib_per_sec);
 	WLOGi(wdev, "Redo %" PRIu64 " logpack of totally "
-		"%" PRIu64 " physical blocks.\n"
-		, n_logpack, written_lsid - start_lsid);
+		"%" PRIu64 " physical blocks read by %" PRIu64 " bios.\n"
+		, n_logpack, written_lsid - start_lsid, n_read_bio);
+	WLOGi(wdev, "Redo checksum: %" PRIu64 " records "
+		"calc %" PRIu64 " usec wait %" PRIu64 " usec.\n"
+		, n_csum_record, div_u64(csum_cpu_ns, NSEC_PER_USEC)
+		, div_u64(csum_wait_ns, NSEC_PER_USEC));
+	if (window_pb > 0) {
+		WLOGi(wdev, "Redo window wrote %" PRIu64 " of %" PRIu64
+			" logical blocks.\n", win.n_lb_out, win.n_lb_in);
+	}
+	if (lazy) {
+		WLOGi(wdev, "Lazy redo will write %" PRIu64 " logical blocks.\n"
+			, lazy->n_lb);
+		lazy->start_ts = ts[1];
+		initialize_worker(lazy->wd, run_lazy_redo, (void *)lazy);
+		wakeup_worker(lazy->wd);
+	}
 
 	return true;
-#if 0
+
+error5:
+	if (lazy)
+		destroy_lazy_redo(lazy);
+	return false;
 error4:
 	destroy_redo_data(gc_rd);
-#endif
 error3:
 	destroy_redo_data(read_rd);
 error2:
@@ -1235,4 +2620,212 @@ error0:
 	return false;
 }
 
+/**
+ * Wait for lazy redo to finish.
+ * This does nothing if lazy redo is not running.
+ */
+void wait_for_lazy_redo(struct walb_dev *wdev)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+
+	if (!lazy)
+		return;
+	wait_event(lazy->wait_q, READ_ONCE(lazy->is_done));
+}
+
+/**
+ * Pause lazy redo at a batch boundary.
+ * After this returns, lazy redo does not issue IOs
+ * until resume_lazy_redo() is called.
+ * This does nothing if lazy redo is not running.
+ */
+void pause_lazy_redo(struct walb_dev *wdev)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+
+	if (!lazy)
+		return;
+	spin_lock(&lazy->lock);
+	lazy->is_paused = true;
+	spin_unlock(&lazy->lock);
+	wait_event(lazy->wait_q, !is_lazy_redo_batch_running(lazy));
+}
+
+/**
+ * Resume lazy redo paused by pause_lazy_redo().
+ */
+void resume_lazy_redo(struct walb_dev *wdev)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+
+	if (!lazy)
+		return;
+	spin_lock(&lazy->lock);
+	lazy->is_paused = false;
+	spin_unlock(&lazy->lock);
+	wakeup_worker(lazy->wd);
+}
+
+/**
+ * Stop the lazy redo worker and free resources.
+ * Logs not redone yet will be redone at the next start
+ * because written_lsid has been kept.
+ */
+void finalize_lazy_redo(struct walb_dev *wdev)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+
+	if (!lazy)
+		return;
+	WRITE_ONCE(lazy->should_stop, true);
+	/* The worker may have returned due to pause. */
+	wakeup_worker(lazy->wd);
+	wait_for_lazy_redo(wdev);
+	finalize_worker(lazy->wd);
+	wdev->lazy_redo = NULL;
+	destroy_lazy_redo(lazy);
+}
+
+/**
+ * Redirect read bios to the log device
+ * where the data has not been written to the data device yet.
+ *
+ * Bios are split at the boundaries of extents.
+ * This must be called after pending_copy_overlapped()
+ * because it uses sector addresses of the data device.
+ * The locks of the pending shards of the read range must be held
+ * so that overwrite_lazy_redo() does not run between them.
+ *
+ * @bio_list cloned bios for the data device. It may be empty.
+ *
+ * RETURN:
+ *   false if bio split failed.
+ */
+bool redirect_read_for_lazy_redo(
+	struct walb_dev *wdev, struct bio_list *bio_list, gfp_t gfp_mask)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+	struct bio_list in, out;
+	struct bio *bio, *split;
+	bool ret = true;
+
+	ASSERT(lazy);
+	bio_list_init(&in);
+	bio_list_init(&out);
+	bio_list_merge(&in, bio_list);
+	bio_list_init(bio_list);
+
+	while (ret && (bio = bio_list_pop(&in))) {
+		while (bio_sectors(bio) > 0) {
+			const u64 first = bio->bi_iter.bi_sector;
+			const u64 last = bio_end_sector(bio) - 1;
+			struct lazy_redo_extent *ext;
+			u64 pos, log_pos;
+			unsigned int len, sectors;
+
+			spin_lock(&lazy->lock);
+			ext = get_first_readable_extent(lazy, first, last);
+			if (ext) {
+				pos = ext->pos;
+				len = ext->len;
+				log_pos = ext->log_pos;
+			}
+			spin_unlock(&lazy->lock);
+			if (!ext)
+				break;
+
+			if (pos > first) {
+				/* The top half is read from the data device. */
+				sectors = pos - first;
+			} else {
+				sectors = min_t(u64, pos + len, last + 1) - first;
+				if (sectors == bio_sectors(bio)) {
+					bio->bi_bdev = wdev->ldev;
+					bio->bi_iter.bi_sector = log_pos + (first - pos);
+					break;
+				}
+			}
+			split = bio_split(bio, sectors, gfp_mask, lazy->bio_set);
+			if (!split) {
+				ret = false;
+				break;
+			}
+			bio_chain(split, bio);
+			if (pos <= first) {
+				split->bi_bdev = wdev->ldev;
+				split->bi_iter.bi_sector = log_pos + (first - pos);
+			}
+			bio_list_add(&out, split);
+		}
+		bio_list_add(&out, bio);
+	}
+	bio_list_merge(&out, &in);
+	bio_list_merge(bio_list, &out);
+	return ret;
+}
+
+/**
+ * Remove a range of a write IO from extents of lazy redo.
+ * Call this after the bio wrapper is inserted to pending data
+ * and before its data IO is submitted.
+ *
+ * @pos position [logical block].
+ * @len size [logical block].
+ */
+void overwrite_lazy_redo(struct walb_dev *wdev, u64 pos, unsigned int len)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+	struct lazy_redo_extent *spare, *ow;
+
+	ASSERT(lazy);
+	if (len == 0)
+		return;
+	spare = alloc_lazy_redo_extent_never_giveup();
+	ow = alloc_lazy_redo_extent_never_giveup();
+	spin_lock(&lazy->lock);
+	overwrite_lazy_redo_extents(lazy, pos, len, &spare);
+	if (lazy_tree_iter_first(&lazy->applying, pos, pos + len - 1)) {
+		/* See apply_lazy_redo_batch(). */
+		ow->pos = pos;
+		ow->len = len;
+		list_add_tail(&ow->list, &lazy->overwritten);
+		ow = NULL;
+	}
+	spin_unlock(&lazy->lock);
+	kfree(spare);
+	kfree(ow);
+}
+
+/**
+ * Wait for extents overlapped with a range being written by lazy redo.
+ * Call this before submitting the data IO of a write IO
+ * so that older data will not overwrite it.
+ */
+void wait_for_lazy_redo_applying(
+	struct walb_dev *wdev, u64 pos, unsigned int len)
+{
+	struct lazy_redo *lazy = wdev->lazy_redo;
+
+	ASSERT(lazy);
+	if (len == 0)
+		return;
+	wait_event(lazy->wait_q, !is_applying_overlapped(lazy, pos, len));
+}
+
+/**
+ * Keep written_lsid while lazy redo is running.
+ *
+ * RETURN:
+ *   true if written_lsid is held and must not be updated.
+ * CONTEXT:
+ *   wdev->lsid_lock must be held.
+ */
+bool hold_written_lsid_for_lazy_redo(struct walb_dev *wdev, u64 written_lsid)
+{
+	if (!test_bit(WALB_STATE_LAZY_REDO, &wdev->flags))
+		return false;
+	wdev->lazy_redo->written_lsid = written_lsid;
+	return true;
+}
+
 MODULE_LICENSE("GPL");
@@ -11,4 +11,16 @@
 
 bool execute_redo(struct walb_dev *wdev);
 
+/* Lazy redo. */
+void wait_for_lazy_redo(struct walb_dev *wdev);
+void pause_lazy_redo(struct walb_dev *wdev);
+void resume_lazy_redo(struct walb_dev *wdev);
+void finalize_lazy_redo(struct walb_dev *wdev);
+bool redirect_read_for_lazy_redo(
+	struct walb_dev *wdev, struct bio_list *bio_list, gfp_t gfp_mask);
+void overwrite_lazy_redo(struct walb_dev *wdev, u64 pos, unsigned int len);
+void wait_for_lazy_redo_applying(
+	struct walb_dev *wdev, u64 pos, unsigned int len);
+bool hold_written_lsid_for_lazy_redo(struct walb_dev *wdev, u64 written_lsid);
+
 #endif /* WALB_REDO_H_KERNEL */
@@ -165,12 +165,20 @@ bool walb_read_super_sector(
 	}
 
 	/* Validate version number. */
-	if (sect->version != WALB_LOG_VERSION) {
+	if (!is_supported_log_version(sect->version)) {
 		LOGe("walb version mismatch: superblock: %u module %u\n",
 			sect->version, WALB_LOG_VERSION);
 		goto error0;
 	}
 
+	/* Validate log checksum algorithm. */
+	if (!is_valid_log_checksum_type(
+			get_super_sector_log_checksum_type(sect))) {
+		LOGe("walb_read_super_sector: log checksum type %u is not supported.\n",
+			sect->log_checksum_type);
+		goto error0;
+	}
+
 	/* Validate name structure. */
 	if (strnlen(sect->name, DISK_NAME_LEN) >= DISK_NAME_LEN) {
 		LOGe("superblock device name is not terminated by 0.\n");
@@ -143,6 +143,126 @@ static ssize_t walb_attr_show_support_discard(struct walb_dev *wdev, char *buf)
 	return snprintf(buf, PAGE_SIZE, "%d\n", wdev->support_discard ? 1 : 0);
 }
 
+static ssize_t walb_attr_show_write_copy(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (!iocored)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE,
+		"copied_bytes     %lld\n"
+		"referenced_bytes %lld\n"
+		, (long long)atomic64_read(&iocored->copied_bytes)
+		, (long long)atomic64_read(&iocored->referenced_bytes));
+}
+
+static ssize_t walb_attr_show_absorbed_bytes(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (!iocored)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE, "%lld\n"
+			, (long long)atomic64_read(&iocored->absorbed_bytes));
+}
+
+static ssize_t walb_attr_show_data_merge(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (!iocored)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE,
+		"merged_bios  %lld\n"
+		"merged_biows %lld\n"
+		, (long long)atomic64_read(&iocored->n_merged_bios)
+		, (long long)atomic64_read(&iocored->n_merged_biows));
+}
+
+static ssize_t walb_attr_show_ldev_flush(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (!iocored)
+		return 0;
+
+	return snprintf(buf, PAGE_SIZE,
+		"requested %lld\n"
+		"issued    %lld\n"
+		, (long long)atomic64_read(&iocored->n_flush_requested)
+		, (long long)atomic64_read(&iocored->n_flush_issued));
+}
+
+static ssize_t walb_attr_show_latency(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (!iocored)
+		return 0;
+
+	return walb_latency_hist_print(&iocored->lat_hist, buf, PAGE_SIZE);
+}
+
+static ssize_t walb_attr_show_page_pool(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct walb_page_pool_stat stat;
+
+	if (!iocored)
+		return 0;
+
+	walb_page_pool_get_stat(&iocored->page_pool, &stat);
+	return snprintf(buf, PAGE_SIZE,
+		"hit      %llu\n"
+		"miss     %llu\n"
+		"nr_pages %u\n"
+		"low_wm   %u\n"
+		"high_wm  %u\n"
+		, stat.n_hit, stat.n_miss
+		, stat.nr_pages, stat.low_wm, stat.high_wm);
+}
+
+static ssize_t walb_attr_show_log_cache(struct walb_dev *wdev, char *buf)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+	struct walb_log_cache_stat stat;
+
+	if (!iocored)
+		return 0;
+
+	walb_log_cache_get_stat(&iocored->log_cache, &stat);
+	return snprintf(buf, PAGE_SIZE,
+		"hit        %llu\n"
+		"miss       %llu\n"
+		"begin_lsid %llu\n"
+		"end_lsid   %llu\n"
+		"capacity   %llu\n"
+		, stat.n_hit, stat.n_miss
+		, stat.begin_lsid, stat.end_lsid, stat.n_pb);
+}
+
+/*******************************************************************************
+ * Funtions to store attributes.
+ *******************************************************************************/
+
+/**
+ * Writing anything resets the histograms.
+ */
+static ssize_t walb_attr_store_latency(
+	struct walb_dev *wdev, const char *buf, size_t count)
+{
+	struct iocore_data *iocored = get_iocored_from_wdev(wdev);
+
+	if (!iocored)
+		return -EINVAL;
+
+	walb_latency_hist_reset(&iocored->lat_hist);
+	return count;
+}
+
 /*******************************************************************************
  * Ops and attributes definition.
  *******************************************************************************/
@@ -150,7 +270,7 @@ static ssize_t walb_attr_show_support_discard(struct walb_dev *wdev, char *buf)
 struct walb_sysfs_attr {
 	struct attribute attr;
 	ssize_t (*show)(struct walb_dev *, char *);
-	ssize_t (*store)(struct walb_dev *, char *);
+	ssize_t (*store)(struct walb_dev *, const char *, size_t);
 };
 
 static ssize_t walb_attr_show(
@@ -165,14 +285,33 @@ static ssize_t walb_attr_show(
 	return wattr->show(wdev, buf);
 }
 
+static ssize_t walb_attr_store(
+	struct kobject *kobj, struct attribute *attr,
+	const char *buf, size_t count)
+{
+	struct walb_sysfs_attr *wattr = container_of(attr, struct walb_sysfs_attr, attr);
+	struct walb_dev *wdev = get_wdev_from_kobj(kobj);
+
+	if (!wdev || !wattr->store)
+		return -EINVAL;
+
+	return wattr->store(wdev, buf, count);
+}
+
 static const struct sysfs_ops walb_sysfs_ops = {
 	.show = walb_attr_show,
+	.store = walb_attr_store,
 };
 
 #define DECLARE_WALB_SYSFS_ATTR(name)					\
 	struct walb_sysfs_attr walb_attr_##name =				\
 		__ATTR(name, S_IRUGO, walb_attr_show_##name, NULL)
 
+#define DECLARE_WALB_SYSFS_ATTR_RW(name)				\
+	struct walb_sysfs_attr walb_attr_##name =				\
+		__ATTR(name, S_IRUGO | S_IWUSR,					\
+			walb_attr_show_##name, walb_attr_store_##name)
+
 static DECLARE_WALB_SYSFS_ATTR(ldev);
 static DECLARE_WALB_SYSFS_ATTR(ddev);
 static DECLARE_WALB_SYSFS_ATTR(lsids);
@@ -184,6 +323,13 @@ static DECLARE_WALB_SYSFS_ATTR(status);
 static DECLARE_WALB_SYSFS_ATTR(support_flush);
 static DECLARE_WALB_SYSFS_ATTR(support_fua);
 static DECLARE_WALB_SYSFS_ATTR(support_discard);
+static DECLARE_WALB_SYSFS_ATTR(write_copy);
+static DECLARE_WALB_SYSFS_ATTR(page_pool);
+static DECLARE_WALB_SYSFS_ATTR(absorbed_bytes);
+static DECLARE_WALB_SYSFS_ATTR(data_merge);
+static DECLARE_WALB_SYSFS_ATTR(ldev_flush);
+static DECLARE_WALB_SYSFS_ATTR(log_cache);
+static DECLARE_WALB_SYSFS_ATTR_RW(latency);
 
 static struct attribute *walb_attrs[] = {
 	&walb_attr_ldev.attr,
@@ -197,6 +343,13 @@ static struct attribute *walb_attrs[] = {
 	&walb_attr_support_flush.attr,
 	&walb_attr_support_fua.attr,
 	&walb_attr_support_discard.attr,
+	&walb_attr_write_copy.attr,
+	&walb_attr_page_pool.attr,
+	&walb_attr_absorbed_bytes.attr,
+	&walb_attr_data_merge.attr,
+	&walb_attr_ldev_flush.attr,
+	&walb_attr_log_cache.attr,
+	&walb_attr_latency.attr,
 	NULL,
 };
 
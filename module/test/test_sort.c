@@ -11,6 +11,8 @@
 #include <linux/random.h>
 #include <linux/time.h>
 #include <linux/list.h>
+#include <linux/list_sort.h>
+#include <linux/ktime.h>
 
 #include "linux/walb/common.h"
 #include "linux/walb/logger.h"
@@ -21,6 +23,8 @@ static unsigned int n_test_ = 1000;
 module_param_named(n_test, n_test_, uint, S_IRUGO);
 static unsigned int n_items_ = 256;
 module_param_named(n_items, n_items_, uint, S_IRUGO);
+static unsigned int max_bulk_ = 65536;
+module_param_named(max_bulk, max_bulk_, uint, S_IRUGO);
 
 struct a_item
 {
@@ -354,6 +358,136 @@ fin:
 	destroy_item_list(&list1);
 }
 
+/*******************************************************************************
+ * Sort cost vs bulk size.
+ *
+ * Compare insertion sort scanning from the tail,
+ * which data IO submission used, with list_sort().
+ *******************************************************************************/
+
+static void insertion_sort_from_tail(struct list_head *dst, struct list_head *src)
+{
+	struct l_item *item, *item_next, *item_tmp;
+	bool moved;
+
+	list_for_each_entry_safe(item, item_next, src, list) {
+		moved = false;
+		list_for_each_entry_reverse(item_tmp, dst, list) {
+			if (item->key > item_tmp->key) {
+				list_move(&item->list, &item_tmp->list);
+				moved = true;
+				break;
+			}
+		}
+		if (!moved)
+			list_move(&item->list, dst);
+	}
+}
+
+static int cmp_l_item(void *priv, struct list_head *a, struct list_head *b)
+{
+	const struct l_item *x = list_entry(a, struct l_item, list);
+	const struct l_item *y = list_entry(b, struct l_item, list);
+
+	if (x->key < y->key)
+		return -1;
+	if (x->key > y->key)
+		return 1;
+	return 0;
+}
+
+static void fill_item_list_sequentially(struct list_head *list0)
+{
+	struct l_item *item;
+	u64 key = 0;
+
+	list_for_each_entry(item, list0, list) {
+		item->key = key;
+		key += 8;
+	}
+}
+
+static bool is_item_list_sorted(struct list_head *list0)
+{
+	struct l_item *item;
+	u64 key = 0;
+
+	list_for_each_entry(item, list0, list) {
+		if (item->key < key)
+			return false;
+		key = item->key;
+	}
+	return true;
+}
+
+/**
+ * @is_random true to sort random keys, false to sort sequential keys.
+ * @is_isort true to use insertion sort, false to use list_sort().
+ *
+ * RETURN:
+ *   Average sort time of a bulk [ns], or 0 in failure.
+ */
+static u64 measure_bulk_sort(
+	unsigned int n_test, unsigned int n_items, bool is_random, bool is_isort)
+{
+	unsigned int i;
+	struct list_head list0, list1;
+	u64 total = 0;
+
+	INIT_LIST_HEAD(&list0);
+	INIT_LIST_HEAD(&list1);
+	if (!create_item_list(n_items, &list0))
+		goto fin;
+
+	for (i = 0; i < n_test; i++) {
+		u64 bgn;
+		if (is_random)
+			fill_item_list_randomly(&list0);
+		else
+			fill_item_list_sequentially(&list0);
+		bgn = ktime_get_ns();
+		if (is_isort) {
+			insertion_sort_from_tail(&list1, &list0);
+		} else {
+			list_sort(NULL, &list0, cmp_l_item);
+			list_splice_init(&list0, &list1);
+		}
+		total += ktime_get_ns() - bgn;
+		if (!is_item_list_sorted(&list1)) {
+			LOGe("not sorted.\n");
+			total = 0;
+			goto fin;
+		}
+		move_item_list_all(&list0, &list1);
+	}
+	do_div(total, n_test);
+fin:
+	destroy_item_list(&list0);
+	destroy_item_list(&list1);
+	return total;
+}
+
+static void test_bulk_sort(unsigned int n_test, unsigned int max_bulk)
+{
+	unsigned int n_items;
+
+	LOGn("bulk_size isort_random_ns lsort_random_ns"
+		" isort_seq_ns lsort_seq_ns\n");
+	for (n_items = 16; n_items <= max_bulk; n_items *= 4) {
+		/* Insertion sort of large random bulks takes too long. */
+		const unsigned int n = max_t(unsigned int, 1,
+					min_t(unsigned int, n_test,
+						(1U << 24) / n_items / n_items));
+		LOGn("%u %llu %llu %llu %llu\n"
+			, n_items
+			, measure_bulk_sort(n, n_items, true, true)
+			, measure_bulk_sort(n_test, n_items, true, false)
+			, measure_bulk_sort(n_test, n_items, false, true)
+			, measure_bulk_sort(n_test, n_items, false, false));
+		cond_resched();
+	}
+}
+
 /*******************************************************************************
  * init/exit.
  *******************************************************************************/
@@ -365,6 +499,7 @@ static int __init test_init(void)
 	test_hsort(n_test_);
 	test_lsort(n_test_, n_items_);
 	test_tsort(n_test_, n_items_);
+	test_bulk_sort(n_test_, max_bulk_);
 
 	finalize_treemap_memory_manager(&mmgr_);
 	return -1;
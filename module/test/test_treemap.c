@@ -8,6 +8,10 @@
 #include <linux/moduleparam.h>
 #include <linux/init.h>
 #include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/interval_tree_generic.h>
 
 #include "linux/walb/walb.h"
 #include "linux/walb/logger.h"
@@ -698,6 +702,146 @@ error:
 
 struct treemap_memory_manager mmgr_;
 
+/*******************************************************************************
+ * Overlap query benchmark.
+ *
+ * Compare the multimap with max_sectors back-scan,
+ * which was used for pending/overlapped data,
+ * and an augmented interval tree, which is used now.
+ *******************************************************************************/
+
+struct test_interval
+{
+	struct rb_node rb;
+	u64 first;
+	u64 last; /* inclusive. */
+	u64 subtree_last;
+};
+
+#define TEST_INTERVAL_FIRST(it) ((it)->first)
+#define TEST_INTERVAL_LAST(it) ((it)->last)
+
+INTERVAL_TREE_DEFINE(struct test_interval, rb, u64, subtree_last,
+		TEST_INTERVAL_FIRST, TEST_INTERVAL_LAST, static, test_itree)
+
+/* Number of intervals and queries. */
+#define BENCH_N_ITEMS 10000
+/* Normal IO size is up to 256 logical blocks
+   and one discard-like IO is this size. */
+#define BENCH_MAX_IO_LB 256
+#define BENCH_LARGE_IO_LB (1U << 20)
+#define BENCH_ADDR_LB (1ULL << 32)
+
+static u64 bench_multimap_count(
+	struct multimap *mmap, u64 max_len, u64 first, u64 last)
+{
+	struct multimap_cursor cur;
+	const u64 start = first > max_len ? first - max_len : 0;
+	u64 n = 0;
+
+	multimap_cursor_init(mmap, &cur);
+	if (!multimap_cursor_search(&cur, start, MAP_SEARCH_GE, 0))
+		return 0;
+	while (multimap_cursor_key(&cur) <= last) {
+		struct test_interval *it =
+			(struct test_interval *)multimap_cursor_val(&cur);
+		if (it->first <= last && first <= it->last)
+			n++;
+		if (!multimap_cursor_next(&cur))
+			break;
+	}
+	return n;
+}
+
+static u64 bench_itree_count(struct rb_root *root, u64 first, u64 last)
+{
+	struct test_interval *it;
+	u64 n = 0;
+
+	for (it = test_itree_iter_first(root, first, last); it;
+	     it = test_itree_iter_next(it, first, last))
+		n++;
+	return n;
+}
+
+/**
+ * Run the benchmark for a workload.
+ *
+ * @name workload name.
+ * @is_random true for random positions, false for sequential ones.
+ *
+ * @return 0 in success, or -1.
+ */
+static int overlap_query_bench(const char *name, bool is_random)
+{
+	struct test_interval *items;
+	struct multimap *mmap;
+	struct rb_root root = RB_ROOT;
+	u64 max_len = 0, n0 = 0, n1 = 0, pos = 0;
+	u64 t0, t1, t2;
+	int i;
+
+	items = vmalloc(sizeof(*items) * BENCH_N_ITEMS);
+	if (!items)
+		return -1;
+	mmap = multimap_create(GFP_KERNEL, &mmgr_);
+	if (!mmap) {
+		vfree(items);
+		return -1;
+	}
+
+	for (i = 0; i < BENCH_N_ITEMS; i++) {
+		struct test_interval *it = &items[i];
+		u32 len;
+
+		if (i == BENCH_N_ITEMS / 2)
+			len = BENCH_LARGE_IO_LB;
+		else
+			len = 1 + get_random_int() % BENCH_MAX_IO_LB;
+		if (is_random) {
+			it->first = ((u64)get_random_int() << 32 | get_random_int())
+				% (BENCH_ADDR_LB - len);
+		} else {
+			it->first = pos;
+			pos += len;
+		}
+		it->last = it->first + len - 1;
+		max_len = max_t(u64, max_len, len);
+		if (multimap_add(mmap, it->first, (unsigned long)it, GFP_KERNEL))
+			goto error;
+		test_itree_insert(it, &root);
+	}
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < BENCH_N_ITEMS; i++)
+		n0 += bench_multimap_count(
+			mmap, max_len, items[i].first, items[i].last);
+	t1 = ktime_get_ns();
+	for (i = 0; i < BENCH_N_ITEMS; i++)
+		n1 += bench_itree_count(&root, items[i].first, items[i].last);
+	t2 = ktime_get_ns();
+
+	LOGn("overlap query %s: n_items %d n_overlap %llu "
+		"multimap %llu ns interval_tree %llu ns\n"
+		, name, BENCH_N_ITEMS, n1, t1 - t0, t2 - t1);
+	if (n0 != n1) {
+		LOGe("overlap count mismatch: multimap %llu interval_tree %llu\n"
+			, n0, n1);
+		goto error;
+	}
+
+	for (i = 0; i < BENCH_N_ITEMS; i++)
+		test_itree_remove(&items[i], &root);
+	CHECKd(RB_EMPTY_ROOT(&root));
+	multimap_destroy(mmap);
+	vfree(items);
+	return 0;
+error:
+	multimap_destroy(mmap);
+	vfree(items);
+	return -1;
+}
+
 static bool initialize(void)
 {
 	bool ret;
@@ -740,6 +884,11 @@ static int __init test_treemap_init(void)
 		printk(KERN_ERR "multimap_cursor_test() failed.\n");
 		goto error;
 	}
+	if (overlap_query_bench("random", true) ||
+		overlap_query_bench("sequential", false)) {
+		printk(KERN_ERR "overlap_query_bench() failed.\n");
+		goto error;
+	}
 
 	finalize();
 	printk(KERN_INFO "test_treemap_init end\n");
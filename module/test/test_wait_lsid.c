@@ -0,0 +1,152 @@
+/**
+ * test_wait_lsid.c - Latency of waiting for lsid to be advanced.
+ *
+ * A producer work advances a lsid with random intervals like log IO completion,
+ * and the consumer waits for each lsid like wait_for_log_permanent().
+ * The gap from advance to wakeup is measured for
+ * msleep(1) polling and a waitqueue.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "linux/walb/common.h"
+#include "linux/walb/logger.h"
+
+/* Module parameter. */
+static unsigned int n_test_ = 1000;
+module_param_named(n_test, n_test_, uint, S_IRUGO);
+/* Max interval of lsid advances [usec]. */
+static unsigned int max_interval_us_ = 500;
+module_param_named(max_interval_us, max_interval_us_, uint, S_IRUGO);
+
+struct lsid_data
+{
+	spinlock_t lock;
+	u64 lsid;
+	u64 *advanced_ns; /* advanced_ns[lsid - 1]: when lsid was advanced. */
+	wait_queue_head_t wait_q;
+	bool uses_wait_q;
+	unsigned int n;
+	struct work_struct work;
+};
+
+static u64 get_lsid(struct lsid_data *ld)
+{
+	u64 lsid;
+
+	spin_lock(&ld->lock);
+	lsid = ld->lsid;
+	spin_unlock(&ld->lock);
+	return lsid;
+}
+
+static void task_advance_lsid(struct work_struct *work)
+{
+	struct lsid_data *ld = container_of(work, struct lsid_data, work);
+	unsigned int i;
+
+	for (i = 0; i < ld->n; i++) {
+		u32 r;
+		unsigned long us;
+
+		get_random_bytes(&r, sizeof(r));
+		us = r % max_interval_us_ + 1;
+		usleep_range(us, us + 1);
+
+		spin_lock(&ld->lock);
+		ld->advanced_ns[ld->lsid] = ktime_get_ns();
+		ld->lsid++;
+		spin_unlock(&ld->lock);
+		if (ld->uses_wait_q && wq_has_sleeper(&ld->wait_q))
+			wake_up_all(&ld->wait_q);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const u64 x = *(const u64 *)a;
+	const u64 y = *(const u64 *)b;
+
+	if (x < y)
+		return -1;
+	if (x > y)
+		return 1;
+	return 0;
+}
+
+/**
+ * Measure gaps from each lsid advance to the consumer wakeup.
+ */
+static void test_wait_lsid(unsigned int n, bool uses_wait_q)
+{
+	struct lsid_data ld;
+	u64 *gap_ns;
+	u64 lsid = 1;
+	unsigned int n_wakeup = 0;
+
+	ld.advanced_ns = vmalloc(sizeof(u64) * n);
+	gap_ns = vmalloc(sizeof(u64) * n);
+	if (!ld.advanced_ns || !gap_ns) {
+		LOGe("Memory allocation error.\n");
+		goto fin;
+	}
+	spin_lock_init(&ld.lock);
+	ld.lsid = 0;
+	init_waitqueue_head(&ld.wait_q);
+	ld.uses_wait_q = uses_wait_q;
+	ld.n = n;
+	INIT_WORK(&ld.work, task_advance_lsid);
+	queue_work(system_unbound_wq, &ld.work);
+
+	while (lsid <= n) {
+		u64 cur, now;
+		if (uses_wait_q)
+			wait_event(ld.wait_q, get_lsid(&ld) >= lsid);
+		else
+			while (get_lsid(&ld) < lsid) { msleep(1); }
+		now = ktime_get_ns();
+		n_wakeup++;
+		/* All the lsids advanced before the wakeup are done. */
+		cur = get_lsid(&ld);
+		for (; lsid <= cur; lsid++)
+			gap_ns[lsid - 1] = now - ld.advanced_ns[lsid - 1];
+	}
+	flush_work(&ld.work);
+
+	sort(gap_ns, n, sizeof(u64), cmp_u64, NULL);
+	LOGn("%s n %u wakeup %u gap_ns p50 %llu p99 %llu max %llu\n"
+		, uses_wait_q ? "waitqueue" : "msleep"
+		, n, n_wakeup
+		, gap_ns[n / 2], gap_ns[n * 99 / 100], gap_ns[n - 1]);
+fin:
+	vfree(gap_ns);
+	vfree(ld.advanced_ns);
+}
+
+static int __init test_init(void)
+{
+	if (n_test_ == 0 || max_interval_us_ == 0) {
+		LOGe("n_test and max_interval_us must not be 0.\n");
+		return -1;
+	}
+	test_wait_lsid(n_test_, false);
+	test_wait_lsid(n_test_, true);
+	return -1;
+}
+
+static void test_exit(void)
+{
+}
+
+module_init(test_init);
+module_exit(test_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Test of lsid waiting latency.");
+MODULE_ALIAS("test_wait_lsid");
@@ -38,6 +38,7 @@
 #include "wdev_ioctl.h"
 #include "wdev_util.h"
 #include "bio_set.h"
+#include "checksum_simd.h"
 #include "version.h"
 #include "build_date.h"
 
@@ -71,6 +72,73 @@ module_param_named(sync_superblock, sync_superblock_, int, S_IRUGO|S_IWUSR);
 unsigned int sort_data_io_ = 1;
 module_param_named(sort_data_io, sort_data_io_, uint, S_IRUGO|S_IWUSR);
 
+/**
+ * Set non-zero if you want to merge data IOs of adjacent write IOs
+ * into one bio after sorting them.
+ * It reduces the number of IOs for the data device in sequential writes.
+ */
+unsigned int merge_data_io_ = 1;
+module_param_named(merge_data_io, merge_data_io_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Set non-zero if you want walb devices to reference pages of write IOs
+ * instead of copying them.
+ * Walb devices created with this will require stable pages,
+ * and a write IO will complete after its data IO has completed
+ * because the upper layer must keep its pages until then.
+ * Set 0 to copy all write IOs.
+ */
+unsigned int zero_copy_write_ = 0;
+module_param_named(zero_copy_write, zero_copy_write_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Set non-zero if you want walb devices to use the blk-mq frontend.
+ * Each hardware context feeds the iocore directly
+ * so submitters on different CPUs do not share a request queue lock.
+ * Set 0 to use the bio-based make_request_fn.
+ */
+unsigned int use_blk_mq_ = 0;
+module_param_named(use_blk_mq, use_blk_mq_, uint, S_IRUGO);
+
+/**
+ * Set non-zero if you want to use SIMD instructions
+ * to calculate checksums of log data.
+ * The fastest implementation supported by the CPU is selected
+ * at module load. Set 0 to use the portable implementation.
+ */
+unsigned int simd_checksum_ = 1;
+module_param_named(simd_checksum, simd_checksum_, uint, S_IRUGO);
+
+/**
+ * Size of a redo window [MiB].
+ * Set non-zero if you want redo to write only the latest data of each block
+ * in logpacks of a window to the data device in address order.
+ * Set 0 to write all the logged data in lsid order.
+ * Its max value is MAX_REDO_WINDOW_MB and the ring buffer size.
+ */
+unsigned int redo_window_mb_ = 0;
+module_param_named(redo_window_mb, redo_window_mb_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Set non-zero if you want walb devices to be available
+ * before the logged data are written to the data device by redo.
+ * Logs are verified and indexed at start,
+ * and reads of the unredone blocks are redirected to the log device
+ * while redo proceeds in background.
+ */
+unsigned int lazy_redo_ = 0;
+module_param_named(lazy_redo, lazy_redo_, uint, S_IRUGO|S_IWUSR);
+
+/**
+ * Size of the cache of recently written logs for each walb device [MiB].
+ * Reads of walblog devices hitting the cache do not access the log device.
+ * Set 0 to disable the cache.
+ * This is used at device start.
+ * Its max value is MAX_LOG_CACHE_MB and the ring buffer size.
+ */
+unsigned int log_cache_mb_ = 0;
+module_param_named(log_cache_mb, log_cache_mb_, uint, S_IRUGO|S_IWUSR);
+
 /**
  * An executable binary for error notification.
  * When an error ocurred, the exec will be invoked with arguments.
@@ -153,6 +221,7 @@ static bool initialize_workqueues(void);
 static void finalize_workqueues(void);
 
 /* Prepare/finalize. */
+static struct request_queue* walb_alloc_mq_queue(struct walb_dev *wdev);
 static int walb_prepare_device(
 	struct walb_dev *wdev, unsigned int minor, const char *name);
 static void walb_finalize_device(struct walb_dev *wdev);
@@ -400,6 +469,44 @@ static void finalize_workqueues(void)
 	}
 }
 
+/**
+ * Allocate a blk-mq request queue for a walb device.
+ *
+ * Requests are forwarded to the iocore by walb_mq_queue_rq().
+ *
+ * RETURN:
+ *   request queue in success, or NULL.
+ */
+static struct request_queue* walb_alloc_mq_queue(struct walb_dev *wdev)
+{
+	struct blk_mq_tag_set *set = &wdev->tag_set;
+	struct request_queue *q;
+
+	memset(set, 0, sizeof(*set));
+	set->ops = &walb_mq_ops;
+	set->nr_hw_queues = num_online_cpus();
+	set->queue_depth = WALB_MQ_QUEUE_DEPTH;
+	set->numa_node = NUMA_NO_NODE;
+	set->cmd_size = sizeof(struct walb_mq_cmd);
+	/* iocore_make_request() may sleep for memory allocation. */
+	set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+	set->driver_data = wdev;
+
+	if (blk_mq_alloc_tag_set(set)) {
+		LOGe("blk_mq_alloc_tag_set failed.\n");
+		return NULL;
+	}
+	q = blk_mq_init_queue(set);
+	if (IS_ERR(q)) {
+		LOGe("blk_mq_init_queue failed.\n");
+		blk_mq_free_tag_set(set);
+		return NULL;
+	}
+	/* The iocore accounts diskstats by itself. */
+	queue_flag_clear_unlocked(QUEUE_FLAG_IO_STAT, q);
+	return q;
+}
+
 /**
  * Initialize walb block device.
  *
@@ -412,11 +519,18 @@ static int walb_prepare_device(
 {
 	struct request_queue *lq, *dq;
 
-	/* Using bio interface */
-	wdev->queue = blk_alloc_queue(GFP_KERNEL);
-	if (!wdev->queue)
-		goto out;
-	blk_queue_make_request(wdev->queue, walb_make_request);
+	if (use_blk_mq_) {
+		/* Using blk-mq interface. */
+		wdev->queue = walb_alloc_mq_queue(wdev);
+		if (!wdev->queue)
+			goto out;
+	} else {
+		/* Using bio interface */
+		wdev->queue = blk_alloc_queue(GFP_KERNEL);
+		if (!wdev->queue)
+			goto out;
+		blk_queue_make_request(wdev->queue, walb_make_request);
+	}
 	wdev->queue->queuedata = wdev;
 
 	/* Queue limits. */
@@ -468,6 +582,12 @@ static int walb_prepare_device(
 	/* Write zeroes support. */
 	walb_write_zeroes_support(wdev);
 
+	/* Page cache writeback of file systems on the device
+	   must keep pages stable to reference them.
+	   See can_reference_bio_pages(). */
+	if (zero_copy_write_)
+		wdev->queue->backing_dev_info->capabilities |= BDI_CAP_STABLE_WRITES;
+
 	return 0;
 
 #if 0
@@ -478,7 +598,10 @@ out_disk:
 #endif
 out_queue:
 	if (wdev->queue) {
+		const bool is_mq = wdev->queue->mq_ops != NULL;
 		blk_cleanup_queue(wdev->queue);
+		if (is_mq)
+			blk_mq_free_tag_set(&wdev->tag_set);
 	}
 out:
 	return -1;
@@ -494,8 +617,11 @@ static void walb_finalize_device(struct walb_dev *wdev)
 		wdev->gd = NULL;
 	}
 	if (wdev->queue) {
+		const bool is_mq = wdev->queue->mq_ops != NULL;
 		blk_cleanup_queue(wdev->queue);
 		wdev->queue = NULL;
+		if (is_mq)
+			blk_mq_free_tag_set(&wdev->tag_set);
 	}
 }
 
@@ -653,6 +779,8 @@ static void walb_register_device(struct walb_dev *wdev)
 	ASSERT(wdev->gd);
 
 	add_disk(wdev->gd);
+	wdev->bdev = bdget_disk(wdev->gd, 0);
+	ASSERT(wdev->bdev);
 }
 
 /**
@@ -665,6 +793,10 @@ static void walb_unregister_device(struct walb_dev *wdev)
 		del_gendisk(wdev->gd);
 		/* Do not assign NULL here. */
 	}
+	if (wdev->bdev) {
+		bdput(wdev->bdev);
+		wdev->bdev = NULL;
+	}
 	LOG_("walb_unregister_device end.\n");
 }
 
@@ -701,6 +833,9 @@ static int __init walb_init(void)
 	/* DISK_NAME_LEN assersion */
 	ASSERT_DISK_NAME_LEN();
 
+	checksum_simd_init(simd_checksum_ != 0);
+	LOGi("checksum implementation %s\n", checksum_simd_name());
+
 	/*
 	 * Get registered.
 	 */
@@ -897,6 +1032,8 @@ struct walb_dev* prepare_wdev(
 	wdev->ring_buffer_size = super->ring_buffer_size;
 	wdev->ring_buffer_off = get_ring_buffer_offset_2(super);
 	wdev->log_checksum_salt = super->log_checksum_salt;
+	wdev->log_checksum_type = get_super_sector_log_checksum_type(super);
+	LOGi("log checksum %s\n", get_log_checksum_type_str(wdev->log_checksum_type));
 	wdev->size = super->device_size;
 	if (wdev->size > wdev->ddev_size) {
 		LOGe("device size > underlying data device size.\n");
@@ -927,6 +1064,11 @@ struct walb_dev* prepare_wdev(
 	if (param->n_pack_bulk > 0) { wdev->n_pack_bulk = param->n_pack_bulk; }
 	wdev->n_io_bulk = 1024; /* default value. */
 	if (param->n_io_bulk > 0) { wdev->n_io_bulk = param->n_io_bulk; }
+	wdev->n_pending_shards = 1; /* default value. */
+	if (param->n_pending_shards > 0) {
+		wdev->n_pending_shards = param->n_pending_shards;
+	}
+	wdev->apply_delay_jiffies = msecs_to_jiffies(param->apply_delay_ms);
 
 	lq = bdev_get_queue(wdev->ldev);
 	dq = bdev_get_queue(wdev->ddev);
@@ -940,7 +1082,8 @@ struct walb_dev* prepare_wdev(
 		"max_pending_sectors: %u "
 		"min_pending_sectors: %u "
 		"queue_stop_timeout_jiffies: %u "
-		"n_pack_bulk: %u n_io_bulk: %u "
+		"n_pack_bulk: %u n_io_bulk: %u n_pending_shards: %u "
+		"apply_delay_jiffies: %u "
 		"chunk_sectors ldev %u ddev %u.\n",
 		wdev->max_logpack_pb,
 		wdev->log_flush_interval_jiffies,
@@ -948,7 +1091,8 @@ struct walb_dev* prepare_wdev(
 		wdev->max_pending_sectors,
 		wdev->min_pending_sectors,
 		wdev->queue_stop_timeout_jiffies,
-		wdev->n_pack_bulk, wdev->n_io_bulk,
+		wdev->n_pack_bulk, wdev->n_io_bulk, wdev->n_pending_shards,
+		wdev->apply_delay_jiffies,
 		wdev->ldev_chunk_sectors,
 		wdev->ddev_chunk_sectors);
 
@@ -1006,10 +1150,13 @@ struct walb_dev* prepare_wdev(
 #endif
 	spin_unlock(&wdev->lsid_lock);
 #ifdef WALB_DEBUG
-	ASSERT(prev_written_lsid == latest_lsid);
-	ASSERT(prev_written_lsid == completed_lsid);
-	ASSERT(prev_written_lsid == flush_lsid);
+	/* written_lsid is kept during lazy redo. */
 	ASSERT(prev_written_lsid == written_lsid);
+	if (!test_bit(WALB_STATE_LAZY_REDO, &wdev->flags)) {
+		ASSERT(prev_written_lsid == latest_lsid);
+		ASSERT(prev_written_lsid == completed_lsid);
+		ASSERT(prev_written_lsid == flush_lsid);
+	}
 #endif
 
 	/* Check the device overflows or not. */
@@ -1057,6 +1204,7 @@ void finalize_wdev(struct walb_dev *wdev)
 
 	melt_if_frozen(wdev, false);
 	iocore_flush(wdev);
+	finalize_lazy_redo(wdev);
 	walb_ldev_finalize(wdev, true);
 
 	if (wdev->ddev)
@@ -1152,4 +1300,6 @@ module_exit(walb_exit);
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Block-level WAL");
 MODULE_ALIAS(WALB_NAME);
+/* crc32c() of libcrc32c is used for WALB_LOG_CHECKSUM_CRC32C. */
+MODULE_SOFTDEP("pre: crc32c");
 /* MODULE_ALIAS_BLOCKDEV_MAJOR(WALB_MAJOR); */
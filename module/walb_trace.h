@@ -0,0 +1,281 @@
+/**
+ * walb_trace.h - Trace events of the IO pipeline.
+ *
+ * Trace points are defined in io.c with CREATE_TRACE_POINTS.
+ * They cost only a static branch when disabled.
+ * Use /sys/kernel/debug/tracing/events/walb/, perf, or bpftrace.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM walb
+
+#if !defined(WALB_TRACE_H_KERNEL) || defined(TRACE_HEADER_MULTI_READ)
+#define WALB_TRACE_H_KERNEL
+
+#include <linux/tracepoint.h>
+#include "linux/walb/log_record.h"
+#include "kern.h"
+#include "bio_wrapper.h"
+
+/**
+ * A bio arrived at the walb device.
+ * pos and len are in logical blocks.
+ */
+TRACE_EVENT(walb_make_request,
+	TP_PROTO(struct walb_dev *wdev, struct bio_wrapper *biow, bool is_write),
+	TP_ARGS(wdev, biow, is_write),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, pos)
+		__field(unsigned int, len)
+		__field(bool, is_write)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->pos = biow->pos;
+		__entry->len = biow->len;
+		__entry->is_write = is_write;
+	),
+	TP_printk("minor %u %s pos %llu len %u",
+		__entry->minor, __entry->is_write ? "write" : "read",
+		(unsigned long long)__entry->pos, __entry->len)
+);
+
+/**
+ * Logpack events.
+ * total_io_size is in physical blocks.
+ */
+DECLARE_EVENT_CLASS(walb_logpack,
+	TP_PROTO(struct walb_dev *wdev, const struct walb_logpack_header *logh),
+	TP_ARGS(wdev, logh),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, lsid)
+		__field(unsigned int, total_io_size)
+		__field(unsigned int, n_records)
+		__field(unsigned int, n_padding)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->lsid = logh->logpack_lsid;
+		__entry->total_io_size = logh->total_io_size;
+		__entry->n_records = logh->n_records;
+		__entry->n_padding = logh->n_padding;
+	),
+	TP_printk("minor %u lsid %llu total_io_size %u n_records %u n_padding %u",
+		__entry->minor, (unsigned long long)__entry->lsid,
+		__entry->total_io_size, __entry->n_records, __entry->n_padding)
+);
+
+/* A logpack has been created and its lsid has been decided. */
+DEFINE_EVENT(walb_logpack, walb_logpack_create,
+	TP_PROTO(struct walb_dev *wdev, const struct walb_logpack_header *logh),
+	TP_ARGS(wdev, logh)
+);
+
+/* A logpack is being submitted to the log device. */
+DEFINE_EVENT(walb_logpack, walb_logpack_submit,
+	TP_PROTO(struct walb_dev *wdev, const struct walb_logpack_header *logh),
+	TP_ARGS(wdev, logh)
+);
+
+/* A logpack is being redone. */
+DEFINE_EVENT(walb_logpack, walb_redo_logpack,
+	TP_PROTO(struct walb_dev *wdev, const struct walb_logpack_header *logh),
+	TP_ARGS(wdev, logh)
+);
+
+/**
+ * All the log IOs of a logpack have completed
+ * and its data IOs have been queued.
+ */
+TRACE_EVENT(walb_logpack_complete,
+	TP_PROTO(struct walb_dev *wdev, const struct walb_logpack_header *logh,
+		bool is_failed),
+	TP_ARGS(wdev, logh, is_failed),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, lsid)
+		__field(unsigned int, total_io_size)
+		__field(unsigned int, n_records)
+		__field(bool, is_failed)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->lsid = logh->logpack_lsid;
+		__entry->total_io_size = logh->total_io_size;
+		__entry->n_records = logh->n_records;
+		__entry->is_failed = is_failed;
+	),
+	TP_printk("minor %u lsid %llu total_io_size %u n_records %u failed %d",
+		__entry->minor, (unsigned long long)__entry->lsid,
+		__entry->total_io_size, __entry->n_records, __entry->is_failed)
+);
+
+/**
+ * Data IOs are being submitted to the data device.
+ * lsid is of the last bio wrapper.
+ */
+TRACE_EVENT(walb_data_submit,
+	TP_PROTO(struct walb_dev *wdev, u64 lsid, unsigned int n_io, bool is_sorted),
+	TP_ARGS(wdev, lsid, n_io, is_sorted),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, lsid)
+		__field(unsigned int, n_io)
+		__field(bool, is_sorted)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->lsid = lsid;
+		__entry->n_io = n_io;
+		__entry->is_sorted = is_sorted;
+	),
+	TP_printk("minor %u lsid %llu n_io %u sorted %d",
+		__entry->minor, (unsigned long long)__entry->lsid,
+		__entry->n_io, __entry->is_sorted)
+);
+
+/**
+ * The log device has been flushed forcibly.
+ * Logs before new_permanent_lsid are permanent if err is 0.
+ */
+TRACE_EVENT(walb_force_flush,
+	TP_PROTO(struct walb_dev *wdev, u64 new_permanent_lsid, int err),
+	TP_ARGS(wdev, new_permanent_lsid, err),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, lsid)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->lsid = new_permanent_lsid;
+		__entry->err = err;
+	),
+	TP_printk("minor %u new_permanent_lsid %llu err %d",
+		__entry->minor, (unsigned long long)__entry->lsid, __entry->err)
+);
+
+/**
+ * A coalesced log device flush is being submitted.
+ * Logs before new_permanent_lsid will be permanent after it.
+ * new_permanent_lsid 0 means nothing.
+ */
+TRACE_EVENT(walb_ldev_flush_submit,
+	TP_PROTO(struct walb_dev *wdev, u64 gen, u64 new_permanent_lsid),
+	TP_ARGS(wdev, gen, new_permanent_lsid),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, gen)
+		__field(u64, lsid)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->gen = gen;
+		__entry->lsid = new_permanent_lsid;
+	),
+	TP_printk("minor %u gen %llu new_permanent_lsid %llu",
+		__entry->minor, (unsigned long long)__entry->gen,
+		(unsigned long long)__entry->lsid)
+);
+
+/**
+ * A coalesced log device flush has completed.
+ */
+TRACE_EVENT(walb_ldev_flush_complete,
+	TP_PROTO(struct walb_dev *wdev, u64 gen, int err),
+	TP_ARGS(wdev, gen, err),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, gen)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->gen = gen;
+		__entry->err = err;
+	),
+	TP_printk("minor %u gen %llu err %d",
+		__entry->minor, (unsigned long long)__entry->gen, __entry->err)
+);
+
+/**
+ * A log device flush for REQ_FUA write IOs of a logpack is being requested.
+ * The flush is coalesced with the others.
+ */
+TRACE_EVENT(walb_fua_flush,
+	TP_PROTO(struct walb_dev *wdev, u64 new_permanent_lsid, unsigned int n_bio),
+	TP_ARGS(wdev, new_permanent_lsid, n_bio),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, lsid)
+		__field(unsigned int, n_bio)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->lsid = new_permanent_lsid;
+		__entry->n_bio = n_bio;
+	),
+	TP_printk("minor %u new_permanent_lsid %llu n_bio %u",
+		__entry->minor, (unsigned long long)__entry->lsid, __entry->n_bio)
+);
+
+/**
+ * A checkpoint is being taken.
+ * The superblock sync is skipped if written_lsid has not changed.
+ */
+TRACE_EVENT(walb_checkpoint,
+	TP_PROTO(struct walb_dev *wdev, u64 written_lsid, bool is_skipped),
+	TP_ARGS(wdev, written_lsid, is_skipped),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, lsid)
+		__field(bool, is_skipped)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->lsid = written_lsid;
+		__entry->is_skipped = is_skipped;
+	),
+	TP_printk("minor %u written_lsid %llu skipped %d",
+		__entry->minor, (unsigned long long)__entry->lsid,
+		__entry->is_skipped)
+);
+
+/**
+ * Redo has finished.
+ * Logs in [start_lsid, end_lsid) have been redone
+ * or indexed for lazy redo.
+ */
+TRACE_EVENT(walb_redo,
+	TP_PROTO(struct walb_dev *wdev, u64 start_lsid, u64 end_lsid,
+		u64 n_logpack, bool is_lazy),
+	TP_ARGS(wdev, start_lsid, end_lsid, n_logpack, is_lazy),
+	TP_STRUCT__entry(
+		__field(unsigned int, minor)
+		__field(u64, start_lsid)
+		__field(u64, end_lsid)
+		__field(u64, n_logpack)
+		__field(bool, is_lazy)
+	),
+	TP_fast_assign(
+		__entry->minor = wdev_minor(wdev);
+		__entry->start_lsid = start_lsid;
+		__entry->end_lsid = end_lsid;
+		__entry->n_logpack = n_logpack;
+		__entry->is_lazy = is_lazy;
+	),
+	TP_printk("minor %u start_lsid %llu end_lsid %llu n_logpack %llu lazy %d",
+		__entry->minor, (unsigned long long)__entry->start_lsid,
+		(unsigned long long)__entry->end_lsid,
+		(unsigned long long)__entry->n_logpack, __entry->is_lazy)
+);
+
+#endif /* WALB_TRACE_H_KERNEL */
+
+/* This part must be outside the header guard. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE walb_trace
+#include <trace/define_trace.h>
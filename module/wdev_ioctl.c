@@ -15,6 +15,7 @@
 #include "alldevs.h"
 #include "control.h"
 #include "queue_util.h"
+#include "redo.h"
 
 /*******************************************************************************
  * Static functions prototype.
@@ -27,7 +28,7 @@ static void melt_for_reset_wal(struct walb_dev *wdev);
 /* Ioctl details. */
 static int ioctl_wdev_get_oldest_lsid(struct walb_dev *wdev, struct walb_ctl *ctl);
 static int ioctl_wdev_set_oldest_lsid(struct walb_dev *wdev, struct walb_ctl *ctl);
-static int ioctl_wdev_status(struct walb_dev *wdev, struct walb_ctl *ctl); /* NYI */
+static int ioctl_wdev_status(struct walb_dev *wdev, struct walb_ctl *ctl);
 static int ioctl_wdev_take_checkpoint(struct walb_dev *wdev, struct walb_ctl *ctl);
 static int ioctl_wdev_get_checkpoint_interval(struct walb_dev *wdev, struct walb_ctl *ctl);
 static int ioctl_wdev_set_checkpoint_interval(struct walb_dev *wdev, struct walb_ctl *ctl);
@@ -43,6 +44,7 @@ static int ioctl_wdev_is_log_overflow(struct walb_dev *wdev, struct walb_ctl *ct
 static int ioctl_wdev_freeze(struct walb_dev *wdev, struct walb_ctl *ctl);
 static int ioctl_wdev_is_frozen(struct walb_dev *wdev, struct walb_ctl *ctl);
 static int ioctl_wdev_melt(struct walb_dev *wdev, struct walb_ctl *ctl);
+static int ioctl_wdev_wait_for_lsid(struct walb_dev *wdev, struct walb_ctl *ctl);
 
 /*******************************************************************************
  * Static functions definition.
@@ -53,6 +55,8 @@ static bool freeze_for_reset_wal(struct walb_dev *wdev)
 	mutex_lock(&wdev->freeze_lock);
 	switch (wdev->freeze_state) {
 	case FRZ_MELTED:
+		/* Lazy redo reads the logs to be cleared. */
+		wait_for_lazy_redo(wdev);
 		iocore_freeze(wdev);
 		wdev->freeze_state = FRZ_FROZEN_DEEP;
 		break;
@@ -155,8 +159,56 @@ static int ioctl_wdev_set_oldest_lsid(struct walb_dev *wdev, struct walb_ctl *ct
  */
 static int ioctl_wdev_status(struct walb_dev *wdev, struct walb_ctl *ctl)
 {
-	LOGw("WALB_IOCTL_STATUS is not supported currently.\n");
-	return -EFAULT;
+	struct walb_status *st;
+	struct lsid_set lsids;
+	size_t size;
+
+	LOG_("WALB_IOCTL_STATUS\n");
+	ASSERT(ctl->command == WALB_IOCTL_STATUS);
+
+	if (ctl->k2u.buf_size < WALB_STATUS_MIN_SIZE) {
+		WLOGe(wdev, "Buffer size is too small: %zu.\n", ctl->k2u.buf_size);
+		return -EFAULT;
+	}
+	size = min(ctl->k2u.buf_size, sizeof(struct walb_status));
+
+	st = kzalloc(sizeof(struct walb_status), GFP_KERNEL);
+	if (!st)
+		return -EFAULT;
+
+	st->version = WALB_STATUS_VERSION;
+	st->size = size;
+	st->pbs = wdev->physical_bs;
+	if (test_bit(WALB_STATE_READ_ONLY, &wdev->flags))
+		st->flags |= WALB_STATUS_READ_ONLY;
+	if (test_bit(WALB_STATE_OVERFLOW, &wdev->flags))
+		st->flags |= WALB_STATUS_LOG_OVERFLOW;
+	if (test_bit(WALB_STATE_LAZY_REDO, &wdev->flags))
+		st->flags |= WALB_STATUS_LAZY_REDO;
+	mutex_lock(&wdev->freeze_lock);
+	if (wdev->freeze_state != FRZ_MELTED)
+		st->flags |= WALB_STATUS_FROZEN;
+	mutex_unlock(&wdev->freeze_lock);
+
+	spin_lock(&wdev->lsid_lock);
+	lsids = wdev->lsids;
+	spin_unlock(&wdev->lsid_lock);
+	st->latest_lsid = lsids.latest;
+	st->flush_lsid = lsids.flush;
+	st->completed_lsid = lsids.completed;
+	st->permanent_lsid = lsids.permanent;
+	st->written_lsid = lsids.written;
+	st->prev_written_lsid = lsids.prev_written;
+	st->oldest_lsid = lsids.oldest;
+	st->log_capacity = walb_get_log_capacity(wdev);
+	st->log_usage = lsids.latest - lsids.oldest;
+
+	iocore_get_status(wdev, st);
+
+	memcpy(ctl->k2u.kbuf, st, size);
+	kfree(st);
+	ctl->val_u32 = WALB_STATUS_VERSION;
+	return 0;
 }
 
 /**
@@ -442,6 +494,9 @@ static int ioctl_wdev_clear_log(struct walb_dev *wdev, struct walb_ctl *ctl)
 	wdev->lsids.oldest = 0;
 	spin_unlock(&wdev->lsid_lock);
 
+	/* Cached logs are not valid anymore. */
+	walb_log_cache_reset(&get_iocored_from_wdev(wdev)->log_cache);
+
 	/* Grow the walblog device. */
 	if (old_ldev_size < new_ldev_size) {
 		WLOGi(wdev, "Detect log device size change.\n");
@@ -599,6 +654,37 @@ static int ioctl_wdev_melt(struct walb_dev *wdev, struct walb_ctl *ctl)
 	return melt_if_frozen(wdev, true) ? 0 : -EFAULT;
 }
 
+/**
+ * Wait for permanent_lsid or completed_lsid to reach a target.
+ *
+ * @wdev walb dev.
+ * @ctl ioctl data.
+ * RETURN:
+ *   0 if reached or timed out, -EINTR, or -EFAULT.
+ */
+static int ioctl_wdev_wait_for_lsid(struct walb_dev *wdev, struct walb_ctl *ctl)
+{
+	u64 lsid;
+	int err;
+
+	LOG_("WALB_IOCTL_WAIT_FOR_LSID\n");
+	ASSERT(ctl->command == WALB_IOCTL_WAIT_FOR_LSID);
+
+	err = iocore_wait_for_lsid(
+		wdev, ctl->val_u64, ctl->val_int == 0, ctl->val_u32, &lsid);
+	ctl->val_u64 = lsid;
+	switch (err) {
+	case 0:
+	case -ETIMEDOUT:
+		ctl->error = err;
+		return 0;
+	case -EINTR:
+		return -EINTR;
+	default:
+		return -EFAULT;
+	}
+}
+
 /*******************************************************************************
  * Global functions.
  *******************************************************************************/
@@ -676,6 +762,9 @@ int walb_dispatch_ioctl_wdev(struct walb_dev *wdev, void __user *userctl)
 	case WALB_IOCTL_IS_FROZEN:
 		ret = ioctl_wdev_is_frozen(wdev, ctl);
 		break;
+	case WALB_IOCTL_WAIT_FOR_LSID:
+		ret = ioctl_wdev_wait_for_lsid(wdev, ctl);
+		break;
 	default:
 		WLOGw(wdev, "WALB_IOCTL_WDEV %d is not supported.\n"
 			, ctl->command);
@@ -147,6 +147,7 @@ unsigned int read_logpack_data_from_wldev(
 {
 	const int lbs = super->logical_bs;
 	const int pbs = super->physical_bs;
+	const u32 csum_type = get_super_sector_log_checksum_type(super);
 	int i;
 	int total_pb;
 
@@ -189,7 +190,7 @@ unsigned int read_logpack_data_from_wldev(
 		/* Confirm checksum */
 		u32 csum = sector_array_checksum(
 			sect_ary, total_pb * pbs,
-			log_lb * lbs, salt);
+			log_lb * lbs, csum_type, salt);
 		if (csum != logh->record[i].checksum) {
 			LOGe("log header checksum is invalid. %08x %08x\n",
 				csum, logh->record[i].checksum);
@@ -234,6 +235,7 @@ bool read_logpack_header(
  *
  * @fd file descriptor (opened, seeked)
  * @logh corresponding logpack header.
+ * @csum_type log checksum algorithm (WALB_LOG_CHECKSUM_XXX).
  * @salt checksum salt.
  * @sect_ary sector data array to be store data.
  *
@@ -242,7 +244,7 @@ bool read_logpack_header(
  */
 bool read_logpack_data(
 	int fd,
-	const struct walb_logpack_header* logh, u32 salt,
+	const struct walb_logpack_header* logh, u32 csum_type, u32 salt,
 	struct sector_data_array *sect_ary)
 {
 	unsigned int pbs;
@@ -288,7 +290,7 @@ bool read_logpack_data(
 		csum = sector_array_checksum(
 			sect_ary,
 			idx_pb * pbs,
-			log_lb * LOGICAL_BLOCK_SIZE, salt);
+			log_lb * LOGICAL_BLOCK_SIZE, csum_type, salt);
 		if (csum != rec->checksum) {
 			LOGe("log record[%d] checksum is invalid. %08x %08x\n",
 				i, csum, rec->checksum);
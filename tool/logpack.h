@@ -33,7 +33,7 @@ bool read_logpack_header(
 	struct walb_logpack_header* logh);
 bool read_logpack_data(
 	int fd,
-	const struct walb_logpack_header* logh, u32 salt,
+	const struct walb_logpack_header* logh, u32 csum_type, u32 salt,
 	struct sector_data_array *sect_ary);
 bool write_logpack_header(
 	int fd, unsigned int pbs,
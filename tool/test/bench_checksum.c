@@ -0,0 +1,93 @@
+/**
+ * Checksum benchmark code.
+ *
+ * @license 3-clause BSD, GPL version 2 or later.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <string.h>
+
+#include "linux/walb/checksum.h"
+#include "random.h"
+
+static double time_double(struct timeval *tv)
+{
+	return (double)tv->tv_sec + tv->tv_usec * 0.000001;
+}
+
+typedef u32 (*checksum_partial_fn)(u32, const void *, u32);
+
+/**
+ * Run a checksum implementation and print its throughput.
+ *
+ * @name implementation name.
+ * @fn implementation.
+ * @buf data buffer.
+ * @size buffer size [byte].
+ * @block_size size of each call [byte].
+ * @n_loop number of loops over the buffer.
+ */
+static void bench(
+	const char *name, checksum_partial_fn fn,
+	const u8 *buf, size_t size, size_t block_size, size_t n_loop)
+{
+	struct timeval tv;
+	double t0, t1;
+	size_t i, off;
+	u32 sum = 0;
+
+	gettimeofday(&tv, 0); t0 = time_double(&tv);
+	for (i = 0; i < n_loop; i++) {
+		for (off = 0; off + block_size <= size; off += block_size)
+			sum = fn(sum, buf + off, block_size);
+	}
+	gettimeofday(&tv, 0); t1 = time_double(&tv);
+
+	printf("%-9s block %7zu bytes: %8.3f GB/s (csum %08x)\n"
+		, name, block_size
+		, (double)size * n_loop / (t1 - t0) / 1e9
+		, checksum_finish(sum));
+}
+
+static u32 checksum_partial_selected(u32 sum, const void *data, u32 size)
+{
+	return checksum_partial(sum, data, size);
+}
+
+int main(int argc, char *argv[])
+{
+	const size_t size = 16 << 20;
+	const size_t block_sizes[] = {512, 4096, 65536, 1 << 20};
+	size_t n_loop = 16;
+	size_t i;
+	u8 *buf;
+
+	if (argc > 1)
+		n_loop = strtoul(argv[1], NULL, 10);
+
+	init_random();
+	buf = (u8 *)malloc(size);
+	if (!buf)
+		return 1;
+	memset_random(buf, size);
+
+	for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+		const size_t bs = block_sizes[i];
+		bench("generic", checksum_partial_generic, buf, size, bs, n_loop);
+#ifdef WALB_CHECKSUM_X86_SIMD
+		bench("sse2", checksum_partial_sse2, buf, size, bs, n_loop);
+		if (__builtin_cpu_supports("avx2"))
+			bench("avx2", checksum_partial_avx2, buf, size, bs, n_loop);
+#endif
+		bench("selected", checksum_partial_selected, buf, size, bs, n_loop);
+		bench("crc32c", crc32c_partial_generic, buf, size, bs, n_loop);
+#ifdef WALB_CHECKSUM_X86_SIMD
+		if (__builtin_cpu_supports("sse4.2"))
+			bench("crc32c-hw", crc32c_partial_sse42, buf, size, bs, n_loop);
+#endif
+	}
+
+	free(buf);
+	return 0;
+}
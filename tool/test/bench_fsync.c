@@ -0,0 +1,175 @@
+/**
+ * Fsync-heavy benchmark to see log device flushes of a walb device.
+ *
+ * @license 3-clause BSD, GPL version 2 or later.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define BLOCK_SIZE 4096
+#define MAX_THREADS 256
+
+/**
+ * Log device flush statistics of a walb device.
+ * See ldev_flush in doc/spec.creole.
+ */
+struct flush_stat
+{
+	unsigned long long n_requested;
+	unsigned long long n_issued;
+};
+
+struct worker_arg
+{
+	const char *path;
+	unsigned int id;
+	double end_time;
+	unsigned long long n_fsync;
+	int err;
+};
+
+static double time_double(struct timeval *tv)
+{
+	return (double)tv->tv_sec + tv->tv_usec * 0.000001;
+}
+
+static double now_double(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return time_double(&tv);
+}
+
+static int get_flush_stat(const char *dev_path, struct flush_stat *fs)
+{
+	struct stat st;
+	char path[256];
+	FILE *fp;
+	int ret;
+
+	if (stat(dev_path, &st) != 0 || !S_ISBLK(st.st_mode)) {
+		fprintf(stderr, "%s is not a block device.\n", dev_path);
+		return -1;
+	}
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/walb/ldev_flush"
+		, major(st.st_rdev), minor(st.st_rdev));
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "open %s failed.\n", path);
+		return -1;
+	}
+	ret = fscanf(fp, "requested %llu issued %llu"
+		, &fs->n_requested, &fs->n_issued);
+	fclose(fp);
+	return ret == 2 ? 0 : -1;
+}
+
+/**
+ * Write a block and fdatasync() repeatedly.
+ * Each thread uses its own block.
+ */
+static void* run_worker(void *data)
+{
+	struct worker_arg *arg = data;
+	void *buf;
+	int fd;
+
+	if (posix_memalign(&buf, BLOCK_SIZE, BLOCK_SIZE) != 0) {
+		arg->err = 1;
+		return NULL;
+	}
+	memset(buf, arg->id & 0xff, BLOCK_SIZE);
+	fd = open(arg->path, O_WRONLY | O_DIRECT);
+	if (fd < 0) {
+		arg->err = 1;
+		goto fin;
+	}
+	while (now_double() < arg->end_time) {
+		if (pwrite(fd, buf, BLOCK_SIZE, (off_t)arg->id * BLOCK_SIZE)
+			!= BLOCK_SIZE || fdatasync(fd) != 0) {
+			arg->err = 1;
+			break;
+		}
+		arg->n_fsync++;
+	}
+	close(fd);
+fin:
+	free(buf);
+	return NULL;
+}
+
+/**
+ * USAGE:
+ *   bench_fsync WDEV [number of threads] [period in seconds]
+ *
+ * Data on the walb device will be overwritten.
+ */
+int main(int argc, char *argv[])
+{
+	const char *wdev_path;
+	unsigned int i, n_threads = 16, period = 10;
+	struct worker_arg args[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	struct flush_stat fs0, fs1;
+	unsigned long long n_fsync = 0, n_req, n_issued;
+	double t0, t1;
+
+	if (argc < 2) {
+		printf("usage: bench_fsync [walb device]"
+			" ([number of threads] [period in seconds])\n"
+			"Data on the walb device will be overwritten.\n");
+		return 1;
+	}
+	wdev_path = argv[1];
+	if (argc > 2)
+		n_threads = atoi(argv[2]);
+	if (argc > 3)
+		period = atoi(argv[3]);
+	if (n_threads == 0 || n_threads > MAX_THREADS || period == 0) {
+		fprintf(stderr, "invalid arguments.\n");
+		return 1;
+	}
+
+	if (get_flush_stat(wdev_path, &fs0) != 0)
+		return 1;
+	t0 = now_double();
+	for (i = 0; i < n_threads; i++) {
+		args[i].path = wdev_path;
+		args[i].id = i;
+		args[i].end_time = t0 + period;
+		args[i].n_fsync = 0;
+		args[i].err = 0;
+		if (pthread_create(&threads[i], NULL, run_worker, &args[i]) != 0) {
+			fprintf(stderr, "pthread_create failed.\n");
+			return 1;
+		}
+	}
+	for (i = 0; i < n_threads; i++) {
+		pthread_join(threads[i], NULL);
+		if (args[i].err) {
+			fprintf(stderr, "thread %u failed.\n", i);
+			return 1;
+		}
+		n_fsync += args[i].n_fsync;
+	}
+	t1 = now_double();
+	if (get_flush_stat(wdev_path, &fs1) != 0)
+		return 1;
+
+	n_req = fs1.n_requested - fs0.n_requested;
+	n_issued = fs1.n_issued - fs0.n_issued;
+	printf("threads %u fsync %llu: %.3f sec %.0f fsync/s\n"
+		, n_threads, n_fsync, t1 - t0, n_fsync / (t1 - t0));
+	printf("ldev flush requested %llu issued %llu: %.3f issued/requested\n"
+		, n_req, n_issued
+		, n_req > 0 ? (double)n_issued / n_req : 0.0);
+	return 0;
+}
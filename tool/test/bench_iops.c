@@ -0,0 +1,217 @@
+/**
+ * Random IO benchmark to see IOPS scaling of a walb device
+ * with the number of submitter threads.
+ *
+ * @license 3-clause BSD, GPL version 2 or later.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define IO_SIZE 4096
+#define MAX_THREADS 256
+
+struct worker_arg
+{
+	const char *path;
+	unsigned int id;
+	int is_write;
+	unsigned long long n_blocks;
+	double end_time;
+	unsigned long long n_io;
+	int err;
+};
+
+static double time_double(struct timeval *tv)
+{
+	return (double)tv->tv_sec + tv->tv_usec * 0.000001;
+}
+
+static double now_double(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return time_double(&tv);
+}
+
+/**
+ * Xorshift random number generator.
+ * Each thread has its own state.
+ */
+static unsigned long long xorshift64(unsigned long long *state)
+{
+	unsigned long long x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static int get_n_blocks(const char *dev_path, unsigned long long *n_blocks)
+{
+	unsigned long long size;
+	int fd;
+
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "open %s failed.\n", dev_path);
+		return -1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+		fprintf(stderr, "BLKGETSIZE64 failed.\n");
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	*n_blocks = size / IO_SIZE;
+	return *n_blocks > 0 ? 0 : -1;
+}
+
+/**
+ * Issue random block IOs with O_DIRECT until the end time.
+ */
+static void* run_worker(void *data)
+{
+	struct worker_arg *arg = data;
+	unsigned long long state = 88172645463325252ULL + arg->id;
+	void *buf;
+	int fd;
+
+	if (posix_memalign(&buf, IO_SIZE, IO_SIZE) != 0) {
+		arg->err = 1;
+		return NULL;
+	}
+	memset(buf, arg->id & 0xff, IO_SIZE);
+	fd = open(arg->path, (arg->is_write ? O_WRONLY : O_RDONLY) | O_DIRECT);
+	if (fd < 0) {
+		arg->err = 1;
+		goto fin;
+	}
+	while (now_double() < arg->end_time) {
+		const off_t off = (off_t)(xorshift64(&state) % arg->n_blocks)
+			* IO_SIZE;
+		const ssize_t s = arg->is_write
+			? pwrite(fd, buf, IO_SIZE, off)
+			: pread(fd, buf, IO_SIZE, off);
+		if (s != IO_SIZE) {
+			arg->err = 1;
+			break;
+		}
+		arg->n_io++;
+	}
+	close(fd);
+fin:
+	free(buf);
+	return NULL;
+}
+
+/**
+ * Run n_threads workers for a period.
+ *
+ * RETURN:
+ *   IOPS in success, or negative value.
+ */
+static double run_bench(
+	const char *path, int is_write, unsigned long long n_blocks,
+	unsigned int n_threads, unsigned int period)
+{
+	struct worker_arg args[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	unsigned long long n_io = 0;
+	unsigned int i, n = 0;
+	double t0, t1;
+	int err = 0;
+
+	t0 = now_double();
+	for (i = 0; i < n_threads; i++) {
+		args[i].path = path;
+		args[i].id = i;
+		args[i].is_write = is_write;
+		args[i].n_blocks = n_blocks;
+		args[i].end_time = t0 + period;
+		args[i].n_io = 0;
+		args[i].err = 0;
+		if (pthread_create(&threads[i], NULL, run_worker, &args[i]) != 0) {
+			fprintf(stderr, "pthread_create failed.\n");
+			err = 1;
+			break;
+		}
+		n++;
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		if (args[i].err) {
+			fprintf(stderr, "thread %u failed.\n", i);
+			err = 1;
+		}
+		n_io += args[i].n_io;
+	}
+	t1 = now_double();
+	if (err)
+		return -1.0;
+	return n_io / (t1 - t0);
+}
+
+/**
+ * USAGE:
+ *   bench_iops WDEV [read|write] [max number of threads] [period in seconds]
+ *
+ * The number of threads is doubled from 1 to the max.
+ * Run it with use_blk_mq=0 and 1 to compare the frontends.
+ * Data on the walb device will be overwritten in write mode.
+ */
+int main(int argc, char *argv[])
+{
+	const char *wdev_path;
+	unsigned int n_threads, max_threads = 32, period = 10;
+	unsigned long long n_blocks;
+	int is_write = 1;
+	double iops, iops1 = 0.0;
+
+	if (argc < 2) {
+		printf("usage: bench_iops [walb device]"
+			" ([read|write] [max number of threads] [period in seconds])\n"
+			"Data on the walb device will be overwritten in write mode.\n");
+		return 1;
+	}
+	wdev_path = argv[1];
+	if (argc > 2) {
+		if (strcmp(argv[2], "read") == 0) {
+			is_write = 0;
+		} else if (strcmp(argv[2], "write") != 0) {
+			fprintf(stderr, "specify read or write.\n");
+			return 1;
+		}
+	}
+	if (argc > 3)
+		max_threads = atoi(argv[3]);
+	if (argc > 4)
+		period = atoi(argv[4]);
+	if (max_threads == 0 || max_threads > MAX_THREADS || period == 0) {
+		fprintf(stderr, "invalid arguments.\n");
+		return 1;
+	}
+	if (get_n_blocks(wdev_path, &n_blocks) != 0)
+		return 1;
+
+	for (n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+		iops = run_bench(wdev_path, is_write, n_blocks, n_threads, period);
+		if (iops < 0)
+			return 1;
+		if (n_threads == 1)
+			iops1 = iops;
+		printf("%s threads %u: %.0f IOPS %.2f x\n"
+			, is_write ? "write" : "read", n_threads, iops
+			, iops1 > 0 ? iops / iops1 : 0.0);
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * Sequential write benchmark to see data device IOs of a walb device.
+ *
+ * @license 3-clause BSD, GPL version 2 or later.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+/**
+ * Write statistics of a block device.
+ * See Documentation/block/stat.txt of the kernel.
+ */
+struct write_stat
+{
+	unsigned long long n_ios;
+	unsigned long long n_sectors;
+};
+
+static double time_double(struct timeval *tv)
+{
+	return (double)tv->tv_sec + tv->tv_usec * 0.000001;
+}
+
+static int get_write_stat(const char *dev_path, struct write_stat *ws)
+{
+	struct stat st;
+	char path[256];
+	FILE *fp;
+	unsigned long long v[7];
+	int ret;
+
+	if (stat(dev_path, &st) != 0 || !S_ISBLK(st.st_mode)) {
+		fprintf(stderr, "%s is not a block device.\n", dev_path);
+		return -1;
+	}
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/stat"
+		, major(st.st_rdev), minor(st.st_rdev));
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "open %s failed.\n", path);
+		return -1;
+	}
+	ret = fscanf(fp, "%llu %llu %llu %llu %llu %llu %llu"
+		, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]);
+	fclose(fp);
+	if (ret != 7)
+		return -1;
+	ws->n_ios = v[4];
+	ws->n_sectors = v[6];
+	return 0;
+}
+
+/**
+ * Data IOs are submitted after write IOs complete,
+ * so wait for the write statistics of the data device to be stable.
+ */
+static int wait_for_write_stat_stable(const char *dev_path, struct write_stat *ws)
+{
+	struct write_stat prev;
+
+	if (get_write_stat(dev_path, &prev) != 0)
+		return -1;
+	for (;;) {
+		usleep(500000);
+		if (get_write_stat(dev_path, ws) != 0)
+			return -1;
+		if (ws->n_ios == prev.n_ios && ws->n_sectors == prev.n_sectors)
+			return 0;
+		prev = *ws;
+	}
+}
+
+/**
+ * USAGE:
+ *   bench_seqwrite WDEV DDEV [total size in MiB] [block size in bytes]
+ *
+ * Data on the walb device will be overwritten.
+ */
+int main(int argc, char *argv[])
+{
+	const char *wdev_path, *ddev_path;
+	size_t total_mb = 256, block_size = 4096;
+	size_t i, n_blocks;
+	struct write_stat ws0, ws1;
+	struct timeval tv;
+	double t0, t1;
+	void *buf;
+	int fd;
+
+	if (argc < 3) {
+		printf("usage: bench_seqwrite [walb device] [its data device]"
+			" ([total size in MiB] [block size in bytes])\n"
+			"Data on the walb device will be overwritten.\n");
+		return 1;
+	}
+	wdev_path = argv[1];
+	ddev_path = argv[2];
+	if (argc > 3)
+		total_mb = atoi(argv[3]);
+	if (argc > 4)
+		block_size = atoi(argv[4]);
+	if (total_mb == 0 || block_size == 0 || block_size % 512 != 0) {
+		fprintf(stderr, "invalid size.\n");
+		return 1;
+	}
+	n_blocks = total_mb * 1024 * 1024 / block_size;
+
+	if (posix_memalign(&buf, 4096, block_size) != 0) {
+		fprintf(stderr, "memory allocation failed.\n");
+		return 1;
+	}
+	memset(buf, 0x5a, block_size);
+
+	fd = open(wdev_path, O_WRONLY | O_DIRECT);
+	if (fd < 0) {
+		fprintf(stderr, "open %s failed.\n", wdev_path);
+		return 1;
+	}
+	if (wait_for_write_stat_stable(ddev_path, &ws0) != 0)
+		return 1;
+
+	gettimeofday(&tv, 0); t0 = time_double(&tv);
+	for (i = 0; i < n_blocks; i++) {
+		if (pwrite(fd, buf, block_size, (off_t)(i * block_size))
+			!= (ssize_t)block_size) {
+			fprintf(stderr, "write failed at block %zu.\n", i);
+			return 1;
+		}
+	}
+	if (fdatasync(fd) != 0) {
+		fprintf(stderr, "fdatasync failed.\n");
+		return 1;
+	}
+	gettimeofday(&tv, 0); t1 = time_double(&tv);
+	close(fd);
+
+	if (wait_for_write_stat_stable(ddev_path, &ws1) != 0)
+		return 1;
+
+	printf("wdev  writes %zu block %zu bytes: %.3f sec %.0f IOPS %.3f MB/s\n"
+		, n_blocks, block_size, t1 - t0
+		, n_blocks / (t1 - t0)
+		, (double)n_blocks * block_size / (t1 - t0) / 1e6);
+	printf("ddev  writes %llu sectors %llu: %.1f bytes/IO %.3f IOs/wdev write\n"
+		, ws1.n_ios - ws0.n_ios, ws1.n_sectors - ws0.n_sectors
+		, ws1.n_ios > ws0.n_ios
+		? (double)(ws1.n_sectors - ws0.n_sectors) * 512 / (ws1.n_ios - ws0.n_ios)
+		: 0.0
+		, (double)(ws1.n_ios - ws0.n_ios) / n_blocks);
+	free(buf);
+	return 0;
+}
@@ -82,6 +82,65 @@ static void make_sorted_random_array_index(
 
 #define MID_SIZE 16
 
+/**
+ * Check all the checksum implementations are bit-identical
+ * for various sizes and alignments.
+ *
+ * RETURN:
+ *   true if all of them are the same.
+ */
+static bool test_checksum_variants(const u8 *buf, size_t size, u32 salt)
+{
+	size_t off, len;
+
+	for (off = 0; off < 64; off += sizeof(u32)) {
+		for (len = 0; len + off <= size; len = len * 2 + sizeof(u32)) {
+			const u32 c0 = checksum_partial_generic(salt, buf + off, len);
+			if (c0 != checksum_partial(salt, buf + off, len))
+				return false;
+#ifdef WALB_CHECKSUM_X86_SIMD
+			if (c0 != checksum_partial_sse2(salt, buf + off, len))
+				return false;
+			if (__builtin_cpu_supports("avx2") &&
+				c0 != checksum_partial_avx2(salt, buf + off, len))
+				return false;
+#endif
+		}
+	}
+	return true;
+}
+
+/**
+ * Check CRC32C implementations with the well-known check value
+ * and compare them with each other.
+ *
+ * RETURN:
+ *   true if all of them are correct.
+ */
+static bool test_crc32c(const u8 *buf, size_t size, u32 salt)
+{
+	const char *check_str = "123456789";
+	size_t off, len;
+
+	if (log_checksum(WALB_LOG_CHECKSUM_CRC32C,
+			check_str, strlen(check_str), 0xffffffff) != 0xe3069283)
+		return false;
+
+	for (off = 0; off < 64; off += sizeof(u32)) {
+		for (len = 0; len + off <= size; len = len * 2 + sizeof(u32)) {
+			const u32 c0 = crc32c_partial_generic(salt, buf + off, len);
+			if (c0 != crc32c_partial(salt, buf + off, len))
+				return false;
+#ifdef WALB_CHECKSUM_X86_SIMD
+			if (__builtin_cpu_supports("sse4.2") &&
+				c0 != crc32c_partial_sse42(salt, buf + off, len))
+				return false;
+#endif
+		}
+	}
+	return true;
+}
+
 int main()
 {
 	size_t i;
@@ -138,6 +197,20 @@ int main()
 	ASSERT(csum1 == csum2);
 	ASSERT(csum1 == csum3);
 
+	printf("checking checksum variants...\n");
+	if (!test_checksum_variants(buf, size, salt)) {
+		printf("checksum variants mismatch.\n");
+		free_buf(buf);
+		return 1;
+	}
+
+	printf("checking crc32c...\n");
+	if (!test_crc32c(buf, size, salt)) {
+		printf("crc32c check failed.\n");
+		free_buf(buf);
+		return 1;
+	}
+
 #if 0
 	printf("copying...\n");
 	u8 *buf2 = alloc_buf(size);
@@ -30,7 +30,7 @@ void test(int lbs, int pbs, u64 ddev_lb, u64 ldev_lb,
 	init_super_sector(super_sect,
 			lbs, pbs,
 			ddev_lb, ldev_lb,
-			name);
+			name, WALB_LOG_CHECKSUM_SUM);
 	ASSERT_SUPER_SECTOR(super_sect);
 	print_super_sector(super_sect);
 
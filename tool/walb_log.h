@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include "linux/walb/walb.h"
+#include "linux/walb/checksum.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -90,6 +91,11 @@ struct walblog_header
 	u64 begin_lsid;
 	u64 end_lsid; /* may be larger than lsid of
 			 the next of the end logpack. */
+
+	/* Checksum algorithm of log data. See WALB_LOG_CHECKSUM_XXX.
+	   Version 2 headers do not have this field.
+	   Use get_wlog_header_log_checksum_type() to read it. */
+	u32 log_checksum_type;
 #if 0
 	/* Flags. */
 	u32 flags;
@@ -101,6 +107,20 @@ struct walblog_header
 #endif
 } __attribute__((packed));
 
+/**
+ * Get log checksum algorithm of a walblog header.
+ *
+ * RETURN:
+ *   WALB_LOG_CHECKSUM_XXX.
+ */
+static inline u32 get_wlog_header_log_checksum_type(
+	const struct walblog_header* wh)
+{
+	if (wh->version < 3)
+		return WALB_LOG_CHECKSUM_SUM;
+	return wh->log_checksum_type;
+}
+
 /**
  * Print walblog header.
  */
@@ -117,6 +137,7 @@ static inline void print_wlog_header(const struct walblog_header* wh)
 		"checksum: %08x\n"
 		"version: %" PRIu32"\n"
 		"log_checksum_salt: %" PRIu32"\n"
+		"log_checksum_type: %s\n"
 		"logical_bs: %" PRIu32"\n"
 		"physical_bs: %" PRIu32"\n"
 		"uuid: %s\n"
@@ -125,6 +146,7 @@ static inline void print_wlog_header(const struct walblog_header* wh)
 		wh->checksum,
 		wh->version,
 		wh->log_checksum_salt,
+		get_log_checksum_type_str(get_wlog_header_log_checksum_type(wh)),
 		wh->logical_bs,
 		wh->physical_bs,
 		uuidstr,
@@ -147,10 +169,14 @@ static inline bool is_valid_wlog_header(const struct walblog_header* wh)
 		LOGx("wlog header sector type is invalid.\n");
 		return false;
 	}
-	if (wh->version != WALB_LOG_VERSION) {
+	if (!is_supported_log_version(wh->version)) {
 		LOGx("wlog header version is invalid.\n");
 		return false;
 	}
+	if (!is_valid_log_checksum_type(get_wlog_header_log_checksum_type(wh))) {
+		LOGx("wlog header log checksum type is invalid.\n");
+		return false;
+	}
 	if (wh->end_lsid <= wh->begin_lsid) {
 		LOGx("wlog header does not satisfy begin_lsid < end_lsid.\n");
 		return false;
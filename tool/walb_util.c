@@ -371,6 +371,7 @@ bool sector_array_write(
  * @ddev_lb device size [logical block].
  * @ldev_lb log device size [logical block]
  * @name name of the walb device, or NULL.
+ * @csum_type log checksum algorithm (WALB_LOG_CHECKSUM_XXX).
  *
  * RETURN:
  *   true in success.
@@ -379,7 +380,7 @@ bool init_super_sector_raw(
 	struct walb_super_sector* super_sect,
 	unsigned int lbs, unsigned int pbs,
 	u64 ddev_lb, u64 ldev_lb,
-	const char *name)
+	const char *name, u32 csum_type)
 {
 	u32 salt;
 	char *rname;
@@ -390,6 +391,7 @@ bool init_super_sector_raw(
 	ASSERT(0 < pbs);
 	ASSERT(0 < ddev_lb);
 	ASSERT(0 < ldev_lb);
+	ASSERT(is_valid_log_checksum_type(csum_type));
 
 	ASSERT(sizeof(struct walb_super_sector) <= (size_t)pbs);
 
@@ -407,6 +409,7 @@ bool init_super_sector_raw(
 	memset_random((u8 *)&salt, sizeof(salt));
 	LOGn("salt: %"PRIu32"\n", salt);
 	super_sect->log_checksum_salt = salt;
+	super_sect->log_checksum_type = csum_type;
 	super_sect->ring_buffer_size =
 		ldev_lb / (pbs / lbs)
 		- get_ring_buffer_offset(pbs);
@@ -429,13 +432,13 @@ bool init_super_sector(
 	struct sector_data *sect,
 	unsigned int lbs, unsigned int pbs,
 	u64 ddev_lb, u64 ldev_lb,
-	const char *name)
+	const char *name, u32 csum_type)
 {
 	ASSERT_SECTOR_DATA(sect);
 	ASSERT(pbs == sect->size);
 
 	return init_super_sector_raw(
-		sect->data, lbs, pbs, ddev_lb, ldev_lb, name);
+		sect->data, lbs, pbs, ddev_lb, ldev_lb, name, csum_type);
 }
 
 /**
@@ -449,12 +452,15 @@ void print_super_sector_raw(const struct walb_super_sector* super_sect)
 		"logical_bs: %u\n"
 		"physical_bs: %u\n"
 		"metadata_size: %u\n"
-		"log_checksum_salt: %"PRIu32"\n",
+		"log_checksum_salt: %"PRIu32"\n"
+		"log_checksum_type: %s\n",
 		super_sect->checksum,
 		super_sect->logical_bs,
 		super_sect->physical_bs,
 		super_sect->metadata_size,
-		super_sect->log_checksum_salt);
+		super_sect->log_checksum_salt,
+		get_log_checksum_type_str(
+			get_super_sector_log_checksum_type(super_sect)));
 	printf("uuid: ");
 	print_uuid(super_sect->uuid);
 	printf("\n"
@@ -58,7 +58,7 @@ bool init_super_sector_raw(
 	struct walb_super_sector* super_sect,
 	unsigned int pbs, unsigned int lbs,
 	u64 ddev_lb, u64 ldev_lb,
-	const char *name);
+	const char *name, u32 csum_type);
 void print_super_sector_raw(const struct walb_super_sector* super_sect);
 bool write_super_sector_raw(
 	int fd, const struct walb_super_sector* super_sect);
@@ -68,7 +68,7 @@ bool init_super_sector(
 	struct sector_data *sect,
 	unsigned int pbs, unsigned int lbs,
 	u64 ddev_lb, u64 ldev_lb,
-	const char *name);
+	const char *name, u32 csum_type);
 void print_super_sector(const struct sector_data *sect);
 bool read_super_sector(int fd, struct sector_data *sect);
 bool write_super_sector(int fd, const struct sector_data *sect);
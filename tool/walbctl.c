@@ -70,6 +70,8 @@ struct config
 
 	char *name; /* name of stuff */
 
+	u32 csum_type; /* log checksum algorithm. WALB_LOG_CHECKSUM_XXX. */
+
 	size_t size; /* (size_t)(-1) means undefined. */
 
 	/**
@@ -107,6 +109,7 @@ static const char *helpstr_options_ =
 	"  WDEV:   --wdev [walb device path]\n"
 	"  WLDEV:  --wldev [walblog device path]\n"
 	"  NAME:   --name [name of stuff]\n"
+	"  CHECKSUM: --checksum [sum or crc32c]\n"
 	"  WLOG:   walb log data as stream\n"
 	"  MAX_LOGPACK_KB: --max_logpack_kb [size]\n"
 	"  MAX_PENDING_MB: --max_pending_mb [size] \n"
@@ -115,7 +118,9 @@ static const char *helpstr_options_ =
 	"  FLUSH_INTERVAL_MB: --flush_interval_mb [size]\n"
 	"  FLUSH_INTERVAL_MS: --flush_interval_ms [timeout]\n"
 	"  N_PACK_BULK: --n_pack_bulk [size]\n"
-	"  N_IO_BULK: --n_io_bulk [size]\n";
+	"  N_IO_BULK: --n_io_bulk [size]\n"
+	"  N_PENDING_SHARDS: --n_pending_shards [number]\n"
+	"  APPLY_DELAY_MS: --apply_delay_ms [delay]\n";
 
 /**
  * Helper data structure for help command.
@@ -130,14 +135,16 @@ struct cmdhelp
  * Help string.
  */
 static struct cmdhelp cmdhelps_[] = {
-	{ "format_ldev LDEV DDEV (NAME) (DISCARD)",
+	{ "format_ldev LDEV DDEV (NAME) (DISCARD) (CHECKSUM)",
 	  "Format log device." },
 	{ "create_wdev LDEV DDEV (NAME)"
 	  " (MAX_LOGPACK_KB) (MAX_PENDING_MB) (MIN_PENDING_MB)\n"
 	  "             "
 	  " (QUEUE_STOP_TIMEOUT_MS) (FLUSH_INTERVAL_MB) (FLUSH_INTERVAL_MB)\n"
 	  "             "
-	  " (N_PACK_BULK) (N_IO_BULK)",
+	  " (N_PACK_BULK) (N_IO_BULK) (N_PENDING_SHARDS)\n"
+	  "             "
+	  " (APPLY_DELAY_MS)",
 	  "Make walb/walblog device." },
 	{ "delete_wdev WDEV",
 	  "Delete walb/walblog device." },
@@ -165,6 +172,12 @@ static struct cmdhelp cmdhelps_[] = {
 	  "Get permanent_lsid in the device." },
 	{ "get_completed_lsid WDEV",
 	  "Get completed_lsid in the device." },
+	{ "wait_for_permanent_lsid WDEV LSID (SIZE)",
+	  "Wait for permanent_lsid to reach LSID."
+	  " Specify SIZE for timeout [ms]." },
+	{ "wait_for_completed_lsid WDEV LSID (SIZE)",
+	  "Wait for completed_lsid to reach LSID."
+	  " Specify SIZE for timeout [ms]." },
 	{ "search_valid_lsid WLDEV LSID SIZE",
 	  "Search valid lsid which indicates a logpack header block." },
 	{ "get_log_usage WDEV",
@@ -186,6 +199,8 @@ static struct cmdhelp cmdhelps_[] = {
 	  "Melt a frozen device." },
 	{ "is_frozen WDEV",
 	  "Check the device is frozen or not." },
+	{ "status WDEV",
+	  "Show lsids, pending data, IO counters, and latencies of the device." },
 	{ "get_version",
 	  "Get walb driver version."},
 	{ "version",
@@ -206,6 +221,7 @@ enum
 	OPT_LSID0,
 	OPT_LSID1,
 	OPT_NAME,
+	OPT_CHECKSUM,
 	OPT_SIZE,
 	OPT_MAX_LOGPACK_KB,
 	OPT_MAX_PENDING_MB,
@@ -215,6 +231,8 @@ enum
 	OPT_FLUSH_INTERVAL_MS,
 	OPT_N_PACK_BULK,
 	OPT_N_IO_BULK,
+	OPT_N_PENDING_SHARDS,
+	OPT_APPLY_DELAY_MS,
 	OPT_HELP,
 };
 
@@ -231,10 +249,11 @@ static void init_config(struct config* cfg);
 static int parse_opt(int argc, char* const argv[], struct config *cfg);
 static bool init_walb_metadata(
 	int fd, unsigned int lbs, unsigned int pbs,
-	u64 ddev_lb, u64 ldev_lb, const char *name);
+	u64 ddev_lb, u64 ldev_lb, const char *name, u32 csum_type);
 static bool invoke_ioctl(
 	const char *wdev_name, struct walb_ctl *ctl, int open_flag);
 static bool ioctl_and_print_bool(const char *wdev_name, int cmd);
+static bool wait_for_lsid(const struct config *cfg, bool is_permanent);
 static u64 get_ioctl_u64(const char* wdev_name, int command);
 static bool dispatch(const struct config *cfg);
 static struct walblog_header *create_and_read_wlog_header(int inFd);
@@ -258,6 +277,8 @@ static bool do_get_oldest_lsid(const struct config *cfg);
 static bool do_get_written_lsid(const struct config *cfg);
 static bool do_get_permanent_lsid(const struct config *cfg);
 static bool do_get_completed_lsid(const struct config *cfg);
+static bool do_wait_for_permanent_lsid(const struct config *cfg);
+static bool do_wait_for_completed_lsid(const struct config *cfg);
 static bool do_search_valid_lsid(const struct config *cfg);
 static bool do_get_log_usage(const struct config *cfg);
 static bool do_get_log_capacity(const struct config *cfg);
@@ -268,6 +289,7 @@ static bool do_is_log_overflow(const struct config *cfg);
 static bool do_freeze(const struct config *cfg);
 static bool do_melt(const struct config *cfg);
 static bool do_is_frozen(const struct config *cfg);
+static bool do_status(const struct config *cfg);
 static bool do_get_version(const struct config *cfg);
 static bool do_version(const struct config *cfg);
 static bool do_help(const struct config *cfg);
@@ -293,6 +315,8 @@ const struct map_str_to_fn cmd_map_[] = {
 	{ "get_written_lsid", do_get_written_lsid },
 	{ "get_permanent_lsid", do_get_permanent_lsid },
 	{ "get_completed_lsid", do_get_completed_lsid },
+	{ "wait_for_permanent_lsid", do_wait_for_permanent_lsid },
+	{ "wait_for_completed_lsid", do_wait_for_completed_lsid },
 	{ "search_valid_lsid", do_search_valid_lsid },
 	{ "get_log_usage", do_get_log_usage },
 	{ "get_log_capacity", do_get_log_capacity },
@@ -303,6 +327,7 @@ const struct map_str_to_fn cmd_map_[] = {
 	{ "freeze", do_freeze },
 	{ "melt", do_melt },
 	{ "is_frozen", do_is_frozen },
+	{ "status", do_status },
 	{ "get_version", do_get_version },
 	{ "version", do_version },
 	{ "help", do_help },
@@ -389,6 +414,8 @@ static void init_config(struct config* cfg)
 
 	cfg->size = (size_t)(-1);
 
+	cfg->csum_type = WALB_LOG_CHECKSUM_SUM;
+
 	cfg->param.max_logpack_kb = 0;
 	cfg->param.max_pending_mb = 32;
 	cfg->param.min_pending_mb = 16;
@@ -397,6 +424,8 @@ static void init_config(struct config* cfg)
 	cfg->param.log_flush_interval_ms = 100;
 	cfg->param.n_pack_bulk = 128;
 	cfg->param.n_io_bulk = 1024;
+	cfg->param.n_pending_shards = 1;
+	cfg->param.apply_delay_ms = 0;
 }
 
 /**
@@ -416,6 +445,7 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
 			{"lsid0", 1, 0, OPT_LSID0}, /* begin */
 			{"lsid1", 1, 0, OPT_LSID1}, /* end */
 			{"name", 1, 0, OPT_NAME},
+			{"checksum", 1, 0, OPT_CHECKSUM},
 			{"size", 1, 0, OPT_SIZE},
 			{"max_logpack_kb", 1, 0, OPT_MAX_LOGPACK_KB},
 			{"max_pending_mb", 1, 0, OPT_MAX_PENDING_MB},
@@ -425,6 +455,8 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
 			{"flush_interval_ms", 1, 0, OPT_FLUSH_INTERVAL_MS},
 			{"n_pack_bulk", 1, 0, OPT_N_PACK_BULK},
 			{"n_io_bulk", 1, 0, OPT_N_IO_BULK},
+			{"n_pending_shards", 1, 0, OPT_N_PENDING_SHARDS},
+			{"apply_delay_ms", 1, 0, OPT_APPLY_DELAY_MS},
 			{"help", 0, 0, OPT_HELP},
 			{0, 0, 0, 0}
 		};
@@ -463,6 +495,16 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
 		case OPT_NAME:
 			cfg->name = optarg;
 			break;
+		case OPT_CHECKSUM:
+			if (strcmp(optarg, "sum") == 0) {
+				cfg->csum_type = WALB_LOG_CHECKSUM_SUM;
+			} else if (strcmp(optarg, "crc32c") == 0) {
+				cfg->csum_type = WALB_LOG_CHECKSUM_CRC32C;
+			} else {
+				LOGe("unknown checksum algorithm: %s\n", optarg);
+				return -1;
+			}
+			break;
 		case OPT_SIZE:
 			cfg->size = atoll(optarg);
 			break;
@@ -490,6 +532,12 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
 		case OPT_N_IO_BULK:
 			cfg->param.n_io_bulk = atoi(optarg);
 			break;
+		case OPT_N_PENDING_SHARDS:
+			cfg->param.n_pending_shards = atoi(optarg);
+			break;
+		case OPT_APPLY_DELAY_MS:
+			cfg->param.apply_delay_ms = atoi(optarg);
+			break;
 		case OPT_HELP:
 			cfg->cmd_str = "help";
 			return 0;
@@ -536,13 +584,14 @@ static int parse_opt(int argc, char* const argv[], struct config *cfg)
  * @ddev_lb device size [logical block].
  * @ldev_lb log device size [logical block]
  * @name name of the walb device, or NULL.
+ * @csum_type log checksum algorithm (WALB_LOG_CHECKSUM_XXX).
  *
  * RETURN:
  *   true in success, or false.
  */
 static bool init_walb_metadata(
 	int fd, unsigned int lbs, unsigned int pbs,
-	u64 ddev_lb, u64 ldev_lb, const char *name)
+	u64 ddev_lb, u64 ldev_lb, const char *name, u32 csum_type)
 {
 	struct sector_data *super_sect;
 
@@ -563,7 +612,7 @@ static bool init_walb_metadata(
 	/* Initialize super sector. */
 	if (!init_super_sector(
 			super_sect, lbs, pbs,
-			ddev_lb, ldev_lb, name)) {
+			ddev_lb, ldev_lb, name, csum_type)) {
 		LOGe("init super sector faield.\n");
 		goto error1;
 	}
@@ -675,6 +724,42 @@ static u64 get_ioctl_u64(const char* wdev_name, int command)
 	}
 }
 
+/**
+ * Wait for permanent_lsid or completed_lsid to reach cfg->lsid
+ * and print the lsid.
+ *
+ * RETURN:
+ *   true if the lsid has reached, or false (including timeout).
+ */
+static bool wait_for_lsid(const struct config *cfg, bool is_permanent)
+{
+	struct walb_ctl ctl = {
+		.command = WALB_IOCTL_WAIT_FOR_LSID,
+		.val_u64 = cfg->lsid,
+		.val_int = is_permanent ? 0 : 1,
+		.u2k = { .buf_size = 0 },
+		.k2u = { .buf_size = 0 },
+	};
+
+	if (cfg->lsid == (u64)(-1)) {
+		LOGe("Specify lsid.\n");
+		return false;
+	}
+	if (cfg->size > UINT32_MAX) {
+		ctl.val_u32 = 0;
+	} else {
+		ctl.val_u32 = (u32)cfg->size;
+	}
+	if (!invoke_ioctl(cfg->wdev_name, &ctl, O_RDONLY))
+		return false;
+	printf("%" PRIu64 "\n", ctl.val_u64);
+	if (ctl.error != 0) {
+		LOGe("Timeout.\n");
+		return false;
+	}
+	return true;
+}
+
 /**
  * Dispatch command.
  */
@@ -830,7 +915,7 @@ static bool do_format_ldev(const struct config *cfg)
 		fd, lbs, pbs,
 		ddev_info.size / lbs,
 		ldev_info.size / lbs,
-		cfg->name);
+		cfg->name, cfg->csum_type);
 	if (!retb) {
 		LOGe("initialize walb log device failed.\n");
 		goto error1;
@@ -1116,6 +1201,7 @@ static bool do_cat_wldev(const struct config *cfg)
 	wh->checksum = 0;
 	wh->version = WALB_LOG_VERSION;
 	wh->log_checksum_salt = salt;
+	wh->log_checksum_type = get_super_sector_log_checksum_type(super);
 	wh->logical_bs = wldev_info.lbs;
 	wh->physical_bs = pbs;
 	copy_uuid(wh->uuid, super->uuid);
@@ -1211,7 +1297,7 @@ static bool do_redo_wlog(const struct config *cfg)
 {
 	int fd;
 	struct walblog_header *wh;
-	u32 salt;
+	u32 salt, csum_type;
 	struct bdev_info ddev_info;
 	unsigned int lbs, pbs;
 	u64 lsid, begin_lsid, end_lsid;
@@ -1234,6 +1320,7 @@ static bool do_redo_wlog(const struct config *cfg)
 		goto error1;
 	}
 	salt = wh->log_checksum_salt;
+	csum_type = get_wlog_header_log_checksum_type(wh);
 	print_wlog_header(wh); /* debug */
 
 	/* Check block sizes of the device. */
@@ -1279,7 +1366,7 @@ static bool do_redo_wlog(const struct config *cfg)
 			goto error3;
 		}
 		if (!read_logpack_data(
-				0, logh, salt, pack->sectd_ary)) {
+				0, logh, csum_type, salt, pack->sectd_ary)) {
 			LOGe("read logpack data failed.\n");
 			goto error3;
 		}
@@ -1432,7 +1519,7 @@ error1:
 static bool do_show_wlog(const struct config *cfg)
 {
 	struct walblog_header *wh;
-	u32 salt;
+	u32 salt, csum_type;
 	unsigned int pbs;
 	struct logpack *pack;
 	struct walb_logpack_header *logh;
@@ -1447,6 +1534,7 @@ static bool do_show_wlog(const struct config *cfg)
 	if (!wh) { return false; }
 	pbs = wh->physical_bs;
 	salt = wh->log_checksum_salt;
+	csum_type = get_wlog_header_log_checksum_type(wh);
 	print_wlog_header(wh);
 
 	pack = alloc_logpack(pbs, bufsize / pbs);
@@ -1485,7 +1573,8 @@ static bool do_show_wlog(const struct config *cfg)
 		}
 
 		/* Read logpack data. */
-		if (!read_logpack_data(0, logh, salt, pack->sectd_ary)) {
+		if (!read_logpack_data(
+				0, logh, csum_type, salt, pack->sectd_ary)) {
 			LOGe("read logpack data failed.\n");
 			goto error2;
 		}
@@ -1686,6 +1775,24 @@ static bool do_get_completed_lsid(const struct config *cfg)
 	return true;
 }
 
+/**
+ * Wait for permanent_lsid.
+ */
+static bool do_wait_for_permanent_lsid(const struct config *cfg)
+{
+	ASSERT(strcmp(cfg->cmd_str, "wait_for_permanent_lsid") == 0);
+	return wait_for_lsid(cfg, true);
+}
+
+/**
+ * Wait for completed_lsid.
+ */
+static bool do_wait_for_completed_lsid(const struct config *cfg)
+{
+	ASSERT(strcmp(cfg->cmd_str, "wait_for_completed_lsid") == 0);
+	return wait_for_lsid(cfg, false);
+}
+
 /**
  * Search valid lsid which indicates a logpack header block.
  */
@@ -1903,6 +2010,99 @@ static bool do_is_frozen(const struct config *cfg)
 		cfg->wdev_name, WALB_IOCTL_IS_FROZEN);
 }
 
+/**
+ * Show status of the device.
+ */
+static bool do_status(const struct config *cfg)
+{
+	struct walb_status st;
+	unsigned int i;
+	static const char *lat_names[WALB_STATUS_LAT_MAX] = {
+		"queue", "log_write", "log_flush", "data_write", "write", "read",
+	};
+	struct walb_ctl ctl = {
+		.command = WALB_IOCTL_STATUS,
+		.u2k = { .buf_size = 0 },
+		.k2u = { .buf_size = sizeof(struct walb_status),
+			 .buf = (void *)&st, },
+	};
+
+	ASSERT(strcmp(cfg->cmd_str, "status") == 0);
+
+	memset(&st, 0, sizeof(st));
+	if (!invoke_ioctl(cfg->wdev_name, &ctl, O_RDONLY)) {
+		LOGe("Getting status failed.\n");
+		return false;
+	}
+	if (st.version != WALB_STATUS_VERSION) {
+		/* Members of the older or newer version are compatible
+		   within the filled size. */
+		LOGw("status version mismatch: driver %u walbctl %u.\n"
+			, st.version, WALB_STATUS_VERSION);
+	}
+
+	printf("version %u\n"
+		"read_only %u\n"
+		"log_overflow %u\n"
+		"frozen %u\n"
+		"queue_stopped %u\n"
+		"lazy_redo %u\n"
+		"pbs %u\n"
+		"latest_lsid %" PRIu64 "\n"
+		"flush_lsid %" PRIu64 "\n"
+		"completed_lsid %" PRIu64 "\n"
+		"permanent_lsid %" PRIu64 "\n"
+		"written_lsid %" PRIu64 "\n"
+		"prev_written_lsid %" PRIu64 "\n"
+		"oldest_lsid %" PRIu64 "\n"
+		"log_capacity %" PRIu64 "\n"
+		"log_usage %" PRIu64 "\n"
+		"pending_sectors %" PRIu64 "\n"
+		"max_pending_sectors %" PRIu64 "\n"
+		"min_pending_sectors %" PRIu64 "\n"
+		"queue_stopped_ms %" PRIu64 "\n"
+		"n_logpack %" PRIu64 "\n"
+		"n_flush_requested %" PRIu64 "\n"
+		"n_flush_issued %" PRIu64 "\n"
+		"n_fua %" PRIu64 "\n"
+		"n_discard %" PRIu64 "\n"
+		"logged_bytes %" PRIu64 "\n"
+		, st.version
+		, (st.flags & WALB_STATUS_READ_ONLY) != 0
+		, (st.flags & WALB_STATUS_LOG_OVERFLOW) != 0
+		, (st.flags & WALB_STATUS_FROZEN) != 0
+		, (st.flags & WALB_STATUS_QUEUE_STOPPED) != 0
+		, (st.flags & WALB_STATUS_LAZY_REDO) != 0
+		, st.pbs
+		, st.latest_lsid
+		, st.flush_lsid
+		, st.completed_lsid
+		, st.permanent_lsid
+		, st.written_lsid
+		, st.prev_written_lsid
+		, st.oldest_lsid
+		, st.log_capacity
+		, st.log_usage
+		, st.pending_sectors
+		, st.max_pending_sectors
+		, st.min_pending_sectors
+		, st.queue_stopped_ms
+		, st.n_logpack
+		, st.n_flush_requested
+		, st.n_flush_issued
+		, st.n_fua
+		, st.n_discard
+		, st.logged_bytes);
+	for (i = 0; i < WALB_STATUS_LAT_MAX; i++) {
+		const struct walb_status_latency *lat = &st.latency[i];
+		printf("latency_%s count %" PRIu64 " p50_us %" PRIu64
+			" p99_us %" PRIu64 " max_us %" PRIu64 "\n"
+			, lat_names[i], lat->count, lat->p50_us
+			, lat->p99_us, lat->max_us);
+	}
+	return true;
+}
+
 /**
  * Get walb driver version.
  */